@@ -0,0 +1,104 @@
+//===- AnalysisCache.h ----------------*- C++ -*-===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The AnalysisCache owns the CFG analyses of a single function (dominator and
+// post dominator tree, loop info, dominance frontier and control dependence
+// graph) and builds each of them on first request.
+//
+// Every transformation that changes the CFG declares the analyses it keeps
+// intact by calling invalidate(). Analyses that are not preserved are dropped
+// together with everything derived from them (the DFG is built on top of the
+// dominator tree, the CDG on top of the post dominator tree) and rebuilt on the
+// next request.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef RV_ANALYSISCACHE_H
+#define RV_ANALYSISCACHE_H
+
+#include <memory>
+
+#include "rv/pda/DFG.h"
+
+namespace llvm {
+class LoopInfo;
+class raw_ostream;
+}
+
+namespace rv {
+
+using namespace llvm;
+
+class AnalysisCache {
+public:
+    enum AnalysisKind {
+        DomTree = 0,
+        PostDomTree,
+        Loops,
+        DominanceFrontier,
+        ControlDependence,
+        NumAnalysisKinds
+    };
+
+    // The set of analyses that survive a transformation
+    class PreservedAnalyses {
+        unsigned mMask;
+        explicit PreservedAnalyses(unsigned mask) : mMask(mask) {}
+
+    public:
+        static PreservedAnalyses none() { return PreservedAnalyses(0); }
+        static PreservedAnalyses all() { return PreservedAnalyses((1u << NumAnalysisKinds) - 1); }
+
+        PreservedAnalyses& preserve(AnalysisKind kind) { mMask |= 1u << kind; return *this; }
+        bool preserves(AnalysisKind kind) const { return mMask & (1u << kind); }
+        bool preservesAll() const { return mMask == all().mMask; }
+    };
+
+    explicit AnalysisCache(Function& F);
+    ~AnalysisCache();
+
+    AnalysisCache(const AnalysisCache&) = delete;
+    AnalysisCache& operator=(const AnalysisCache&) = delete;
+
+    Function& getFunction() const { return mFunction; }
+
+    DominatorTree& getDomTree();
+    PostDominatorTree& getPostDomTree();
+    LoopInfo& getLoopInfo();
+    DFG& getDFG();
+    CDG& getCDG();
+
+    bool isValid(AnalysisKind kind) const;
+
+    // Drop all analyses that are not in @preserved (and those computed from them)
+    void invalidate(const PreservedAnalyses& preserved);
+    void invalidateAll() { invalidate(PreservedAnalyses::none()); }
+
+    // statistics
+    unsigned getNumBuilds(AnalysisKind kind) const { return mNumBuilds[kind]; }
+    double getBuildTime(AnalysisKind kind) const { return mBuildTime[kind]; } // in milliseconds
+    static const char* getName(AnalysisKind kind);
+    void print(raw_ostream& out) const;
+
+private:
+    Function& mFunction;
+
+    std::unique_ptr<DominatorTree>      mDomTree;
+    std::unique_ptr<PostDominatorTree>  mPostDomTree;
+    std::unique_ptr<LoopInfo>           mLoopInfo;
+    std::unique_ptr<DFG>                mDFG;
+    std::unique_ptr<CDG>                mCDG;
+
+    unsigned mNumBuilds[NumAnalysisKinds];
+    double   mBuildTime[NumAnalysisKinds];
+};
+
+}
+
+#endif // RV_ANALYSISCACHE_H
@@ -0,0 +1,83 @@
+//===- BlockReachability.h ----------------*- C++ -*-===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// BlockReachability answers the reachability queries of the CFG linearizer
+// (see rv::isReachable) for a function whose CFG does not change.
+// Blocks are numbered in reverse post order. The blocks reachable from a
+// source are collected once per query kind in a bit vector over these
+// numbers, so repeated queries from the same source are bit tests.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef RV_BLOCKREACHABILITY_H
+#define RV_BLOCKREACHABILITY_H
+
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/DenseMap.h>
+
+namespace llvm {
+class BasicBlock;
+class Function;
+class Loop;
+class LoopInfo;
+}
+
+namespace rv {
+
+using namespace llvm;
+
+class BlockReachability {
+public:
+    BlockReachability(const Function& func, const LoopInfo& loopInfo);
+
+    BlockReachability(const BlockReachability&) = delete;
+    BlockReachability& operator=(const BlockReachability&) = delete;
+
+    // Same as rv::isReachable(@target, @source, @doNotTraverse, @loop, @loop, @noBackEdges):
+    // @doNotTraverse is entered but not left, @loop (if any) is neither left nor is its back
+    // edge taken, @noBackEdges disallows all back edges.
+    bool isReachable(const BasicBlock& target,
+                     const BasicBlock& source,
+                     const BasicBlock* doNotTraverse,
+                     const Loop*       loop,
+                     const bool        noBackEdges);
+
+    // The blocks of the query above, indexed by getIndex()
+    const BitVector& getReachableBlocks(const BasicBlock& source,
+                                        const BasicBlock* doNotTraverse,
+                                        const Loop*       loop,
+                                        const bool        noBackEdges);
+
+    // Reverse post order number (blocks unreachable from the entry come last)
+    unsigned getIndex(const BasicBlock& block) const;
+    const BasicBlock* getBlock(unsigned index) const { return mBlocks[index]; }
+    unsigned getNumBlocks() const { return mBlocks.size(); }
+
+    unsigned getNumQueries() const { return mNumQueries; }
+    unsigned getNumCacheHits() const { return mNumCacheHits; }
+
+private:
+    typedef std::tuple<const BasicBlock*, const BasicBlock*, const Loop*, bool> QueryKey;
+
+    const LoopInfo&                         mLoopInfo;
+    std::vector<const BasicBlock*>          mBlocks;
+    DenseMap<const BasicBlock*, unsigned>   mIndex;
+    std::map<QueryKey, BitVector>           mReachableBlocks;
+
+    unsigned mNumQueries;
+    unsigned mNumCacheHits;
+};
+
+}
+
+#endif // RV_BLOCKREACHABILITY_H
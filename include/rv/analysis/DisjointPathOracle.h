@@ -0,0 +1,97 @@
+//===- DisjointPathOracle.h ----------------*- C++ -*-===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The DisjointPathOracle answers the disjoint path criterion of the legacy
+// divergence analysis: a varying branch in block v makes a block b divergent
+// if there are two vertex-disjoint paths from v that end in distinct
+// predecessors of b. One of the paths may be empty if v itself is a
+// predecessor of b.
+// Paths are confined to the blocks dominated by the header of the loop of b
+// (or the function entry) and never take a back edge to that header.
+//
+// Each query is decided by pushing two units of flow through the region with
+// every block split into an in- and an out-node of capacity one. This takes
+// two breadth-first searches, that is O(|V| + |E|) per query. Regions and
+// answers are cached until clear() is called.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef RV_DISJOINTPATHORACLE_H
+#define RV_DISJOINTPATHORACLE_H
+
+#include <map>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+
+namespace llvm {
+class BasicBlock;
+class DominatorTree;
+class Loop;
+class LoopInfo;
+}
+
+namespace rv {
+
+using namespace llvm;
+
+class DisjointPathOracle {
+public:
+    DisjointPathOracle(const DominatorTree& domTree, const LoopInfo& loopInfo);
+    ~DisjointPathOracle();
+
+    DisjointPathOracle(const DisjointPathOracle&) = delete;
+    DisjointPathOracle& operator=(const DisjointPathOracle&) = delete;
+
+    // Are there two disjoint paths from @branchBlock to distinct predecessors of @block?
+    bool joinsAt(const BasicBlock& branchBlock, const BasicBlock& block);
+
+    // Are there two disjoint paths in @loop from @branchBlock, one to @exitBlock and the
+    // other to the latch of @loop? @exitBlock must have a unique (exiting) predecessor.
+    bool reachesExitAndLatch(const BasicBlock& branchBlock,
+                             const BasicBlock& exitBlock,
+                             const Loop& loop);
+
+    // Drop all cached regions and answers (required after the CFG changed)
+    void clear();
+
+    unsigned getNumQueries() const { return mNumQueries; }
+    unsigned getNumCacheHits() const { return mNumCacheHits; }
+
+private:
+    // The blocks dominated by a root block with all edges into the root removed
+    struct RegionGraph {
+        std::vector<const BasicBlock*>              blocks;
+        DenseMap<const BasicBlock*, unsigned>       index;
+        std::vector<SmallVector<unsigned, 4>>       succs;
+    };
+
+    const DominatorTree&    mDomTree;
+    const LoopInfo&         mLoopInfo;
+
+    DenseMap<const BasicBlock*, std::unique_ptr<RegionGraph>>      mRegions;
+    DenseMap<std::pair<const BasicBlock*, const BasicBlock*>, bool> mJoinCache;
+    std::map<std::tuple<const BasicBlock*, const BasicBlock*, const Loop*>, bool> mLoopExitCache;
+
+    unsigned mNumQueries;
+    unsigned mNumCacheHits;
+
+    const RegionGraph& getRegion(const BasicBlock& root);
+
+    // Max-flow test for two vertex-disjoint paths from @start that end in distinct @sinks
+    static bool hasTwoDisjointPaths(const RegionGraph& graph, unsigned start, ArrayRef<unsigned> sinks);
+};
+
+}
+
+#endif // RV_DISJOINTPATHORACLE_H
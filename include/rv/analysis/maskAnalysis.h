@@ -19,8 +19,6 @@
 #include <llvm/Pass.h>
 #include <llvm/ADT/SmallVector.h>
 
-#include <memory> // shared_ptr, weak_ptr
-
 namespace llvm {
 class Value;
 class BasicBlock;
@@ -62,6 +60,17 @@ public:
 
 	void print(raw_ostream& O, const Module* M) const;
 
+    // Mask operations (and, or, not) of the mask graph before and after simplifyMaskGraph()
+    struct Statistics
+    {
+        unsigned numOperationsBefore;
+        unsigned numOperationsAfter;
+
+        Statistics() : numOperationsBefore(0), numOperationsAfter(0) {}
+    };
+
+    const Statistics& getStatistics() const { return mStats; }
+
 	void invalidateInsertPoints();
 
     typedef DenseMap<const Value*, Value*> MaskValueMapType;
@@ -107,6 +116,8 @@ public:
     void updateEntryMask(const BasicBlock& block,
                          Value*            newMask,
                          Instruction*      insertPoint);
+    bool sinkEntryMask  (const BasicBlock& block,
+                         Instruction&      insertPoint);
     void updateExitMasks(const BasicBlock& block,
                          Value*            value0,
                          Value*            value1,
@@ -144,10 +155,8 @@ private:
     DenseMap<const BasicBlock*, BlockMaskInfo*>    mBlockMap;
     DenseMap<const Loop*,       LoopMaskInfo*>     mLoopMaskMap;
     DenseMap<const BasicBlock*, LoopExitMaskInfo*> mLoopExitMap;
-    std::vector<MaskPtr>                           mMasks;
-
-    inline MaskPtr createMask(const NodeType type,
-                              Instruction*   insertPoint);
+    MaskGraph                                      mGraph;
+    Statistics                                     mStats;
 
 	BlockMaskInfo* getOrCreateBMIFor(BasicBlock* block);
 
@@ -161,6 +170,18 @@ private:
 
     void createLoopExitMasks(Loop* loop);
 
+    // Mask expression optimization on the graph before materialization
+    typedef DenseMap<const Mask*, MaskPtr> SimplifiedMaskMap;
+    void     simplifyMaskGraph();
+    MaskPtr  simplifyMask      (MaskPtr            mask,
+                                SimplifiedMaskMap& simplified);
+    MaskPtr  createJunction    (const NodeType     type,
+                                ArrayRef<MaskPtr>  operands,
+                                Instruction*       insertPoint);
+    bool     isConstantMask    (const Mask&        mask,
+                                const bool         value) const;
+    unsigned countMaskOperations() const;
+
     void setEntryMaskPtr         (const BasicBlock& block,
                                   MaskPtr           mask);
     void setExitMaskPtr          (const BasicBlock& block,
@@ -21,6 +21,7 @@
 
 #include "rv/rvInfo.h"
 #include "rv/vectorizationInfo.h"
+#include "rv/analysis/DisjointPathOracle.h"
 
 #include "analysis/analysisCfg.h"
 #include "utils/rvTools.h"
@@ -96,6 +97,9 @@ private:
     const PostDominatorTree&    mPostDomTree;
     const DominatorTree&        mDomTree;
 
+    // disjoint path queries only depend on the CFG, answers are kept across runs
+    mutable rv::DisjointPathOracle mPathOracle;
+
     Function*                   mScalarFunction;
     const Function*             mSimdFunction;
 
@@ -153,8 +157,7 @@ private:
 
     // efficient implementation of the disjoint paths criterion
     // used for isDivergent() [works]
-    bool checkForDisjointPaths(const BasicBlock* block,
-    				           bool doNotBranchToOuterLoops) const;
+    bool checkForDisjointPaths(const BasicBlock* block) const;
 
     // used for isMandatoyExit() [work-in-progress]
     bool checkForDisjointLoopPaths(const BasicBlock*             block,
@@ -0,0 +1,96 @@
+//===- loopSelection.h ----------------*- C++ -*-===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// The LoopSelection picks the loops of a function that are vectorized in
+// loop-region mode. Every loop of a nest is checked for structural legality
+// (a "++i" induction variable, supported exits and memory dependences) and
+// its speedup is estimated from the shapes computed by the PDA. The outermost
+// profitable loop of a nest is selected unless a nested loop promises a
+// higher speedup.
+//
+
+#ifndef RV_LOOPSELECTION_H
+#define RV_LOOPSELECTION_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "rv/analysis/AnalysisCache.h"
+
+namespace llvm {
+class BasicBlock;
+class Function;
+class Loop;
+class PHINode;
+class Value;
+}
+
+using namespace llvm;
+
+namespace rv {
+
+class SyncDependenceAnalysis;
+
+// Returns the incoming value of @phi from outside of @loop, nullptr if there is none
+Value* getLoopInitValue(Loop& loop, PHINode& phi);
+
+// Returns the trip count of a "++i" loop with a constant start whose latch tests the
+// counter or its increment against a constant bound with <, <u or !=, 0 if it is not known
+uint64_t getConstantTripCount(Loop& loop, PHINode& ivPhi);
+
+// Early exits are only taken once the whole vector iteration ran up to the exiting block.
+// Lanes past the exiting lane execute the iteration up to the exit test, the lanes before it
+// skip everything behind the exit. Neither must be observable, so loops with early exits
+// must not write memory at all. Otherwise @reason names the offending instruction.
+bool canVectorizeEarlyExits(Loop& loop, ArrayRef<BasicBlock*> earlyExits, std::string& reason);
+
+struct LoopCandidate
+{
+    Loop* loop;
+    unsigned nestIdx;
+    bool legal;
+    std::string reason;
+    double speedup;
+    bool selected;
+};
+
+class LoopSelection
+{
+public:
+    LoopSelection(Function& func, unsigned vectorWidth, AnalysisCache& analyses);
+
+    // Pick the loops to vectorize in each loop nest of the function (all nests if @nestIdx
+    // is negative). Returns the headers of the selected loops, the loops are disjoint.
+    std::vector<BasicBlock*> selectLoops(int nestIdx);
+
+    // Legality, speedup and decision for every loop considered by the last selectLoops call
+    void print(raw_ostream& out) const;
+
+    const std::map<Loop*, LoopCandidate>& getCandidates() const { return mCandidates; }
+
+private:
+    Function& mFunc;
+    unsigned mVectorWidth;
+    AnalysisCache& mAnalyses;
+
+    std::vector<Loop*> mNests;
+    std::map<Loop*, LoopCandidate> mCandidates;
+
+    bool checkLegality(Loop& loop, std::string& reason) const;
+    double estimateSpeedup(Loop& loop, SyncDependenceAnalysis& sda, std::string& reason) const;
+    double getBestSpeedup(Loop& loop) const;
+    void selectFromNest(Loop& loop);
+    void printDecisions(raw_ostream& out, Loop& loop) const;
+};
+
+}
+
+#endif // RV_LOOPSELECTION_H
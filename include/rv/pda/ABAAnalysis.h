@@ -21,6 +21,7 @@
 #include "llvm/Support/GenericDomTree.h"
 #include "llvm/Support/raw_ostream.h"
 #include "DFG.h"
+#include "SyncDependenceAnalysis.h"
 
 #include "rv/vectorizationInfo.h"
 #include "rv/rvInfo.h"
@@ -50,7 +51,8 @@ public:
                 native::VectorMappingMap& funcInfo,
                 const LoopInfo& loopInfo,
                 const PostDominatorTree& postDomTree,
-                const DominatorTree& domTree);
+                const DominatorTree& domTree,
+                SyncDependenceAnalysis& SDA);
     ABAAnalysis(const ABAAnalysis&) = delete;
     ABAAnalysis& operator=(ABAAnalysis) = delete;
 
@@ -62,6 +64,7 @@ private:
     const LoopInfo&              mLoopInfo;
     const DominatorTree&         mDomTree;
     const PostDominatorTree&     mPostDomTree;
+    SyncDependenceAnalysis&      mSDA;
     const Region*                mRegion;
 
     // Always-by-all/Always-by-all-or-none analysis
@@ -70,6 +73,7 @@ private:
 
     bool isInDivergentLoop(const BasicBlock& block);
     bool isABAONSESEExit(BasicBlock& block);
+    bool isReconvergedAt(const TerminatorInst& terminator, BasicBlock& block);
 
     void checkEquivalentToOldAnalysis(Function& F);
 };
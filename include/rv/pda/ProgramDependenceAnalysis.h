@@ -17,9 +17,12 @@
 
 #include <string>
 #include <map>
+#include <queue>
+#include <set>
+#include <vector>
 
+#include "llvm/ADT/BitVector.h"
 #include "llvm/ADT/DenseMap.h"
-#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Dominators.h"
 #include "llvm/IR/Function.h"
@@ -33,6 +36,7 @@
 #include "llvm/Support/raw_ostream.h"
 
 #include "DFG.h"
+#include "SyncDependenceAnalysis.h"
 
 #include "rv/vectorizationInfo.h"
 #include "rv/vectorMapping.h"
@@ -54,7 +58,6 @@ public:
     {
         Info.addRequired<DominatorTreeWrapperPass>();
         Info.addRequired<PostDominatorTree>();
-        Info.addRequired<DFGBaseWrapper<true>>();
         Info.addRequired<DFGBaseWrapper<false>>();
         Info.addRequired<RVInfoProxyPass>();
         Info.addRequired<LoopInfoWrapperPass>();
@@ -75,12 +78,23 @@ class PDA {
 public:
 
     using ValueMap          = std::map<const Value*, VectorShape>;
-    using InstructionSet    = llvm::SmallPtrSet<const Instruction*, 32>;
+    using PriorityQueue     = std::priority_queue<unsigned, std::vector<unsigned>, std::greater<unsigned>>;
     using FuncInfo          = native::VectorMappingMap;
 
+    // Solver counters of the last analyzed function
+    struct Statistics
+    {
+        unsigned numIterations;        // instructions taken from the worklist
+        unsigned numEvaluations;       // computed transfer functions
+        unsigned numReevaluations;     // evaluations of instructions that already had a shape
+        unsigned numPrivatizedAllocas; // allocas turned from uniform into per-lane storage
+
+        Statistics() : numIterations(0), numEvaluations(0), numReevaluations(0), numPrivatizedAllocas(0) {}
+    };
+
     PDA(VectorizationInfo& VecInfo,
         const CDG& cdg,
-        const DFG& dfg,
+        SyncDependenceAnalysis& SDA,
         const FuncInfo& Funcinfo,
         const LoopInfo& LoopInfo);
 
@@ -96,6 +110,8 @@ public:
     /// Get the shape for a value
     VectorShape getShape(const Value *const V) const;
 
+    const Statistics& getStatistics() const { return mStats; }
+
     //---------------------- Iterators --------------------------//
     typename ValueMap::iterator begin();
     typename ValueMap::iterator end();
@@ -106,14 +122,27 @@ public:
 private:
     VectorizationInfo&           mVecinfo;  // This will be the output
     const CDG&                   mCDG;      // Preserves CDG
-    const DFG&                   mDFG;      // Preserves DFG
+    SyncDependenceAnalysis&      mSDA;      // Join points of divergent branches and loops
     const LoopInfo&              mLoopInfo; // Preserves LoopInfo
     const FuncInfo&              mFuncinfo;
 
     Region*                      mRegion;
 
     ValueMap                     mValue2Shape;    // Computed shapes
-    InstructionSet               mWorklist;       // Next instructions to handle
+    Statistics                   mStats;
+
+    // Priority worklist: instructions are numbered in reverse post-order with the blocks
+    // of every loop kept together, the lowest number is handled first.
+    // Inner loops thus stabilize before the instructions after them are visited.
+    std::vector<const Instruction*>         mInstructionOrder;
+    DenseMap<const Instruction*, unsigned>  mPriority;
+    PriorityQueue                           mWorklist;       // Next instructions to handle
+    BitVector                               mQueued;         // Priorities currently in mWorklist
+
+    std::set<const Value*>       mPrivateAllocas; // Allocas that got per-lane storage
+    std::set<const Value*>       mStale;          // Shapes computed from a now private alloca
+    std::set<const Loop*>        mDivergentLoops; // Loops that lanes leave in different iterations
+    DenseMap<const Value*, unsigned> mKnownAlignment; // Alignment implied by the known bits of a value
 
     // VectorShape analysis logic
 
@@ -124,6 +153,12 @@ private:
     // Run Fix-Point-Iteration after initialization
     void compute(Function& F);
 
+    // Number the instructions of F for the priority worklist
+    void computeInstructionOrder(Function& F);
+    void appendBlocksInOrder(const Loop* loop, const std::vector<const BasicBlock*>& rpo, unsigned start);
+    void pushWorklist(const Instruction* I);
+    const Instruction* popWorklist();
+
     // Returns true if this block is contained in the region we want to analyze
     bool isInRegion(const BasicBlock* BB);
     bool isInRegion(const Instruction & inst);
@@ -134,19 +169,19 @@ private:
 
     // Update a value with its new computed shape, recursing into users if it has changed
     void update(const Value* const V, VectorShape AT);
-    // Calls update on every user of this PHI that is not in its loop
-    void updateOutsideLoopUsesVarying(const PHINode* PHI, const Loop* PHILoop);
+    // Calls update on every user outside of the loop of a value defined in it
+    void markLoopLiveOutsVarying(const Loop& loop);
     // Adds all users of V to the worklist to continue iterating,
     // unless the concept of shape is not defined for the user (e.g. void return calls)
     void addRelevantUsersToWL(const Value* V);
     // Corrects the shapes for any alloca operand to continous/varying
-    // and recomputes all shapes dependent on them from scratch
     // IMPORTANT: The result is as if the respective alloca had been
-    // initialized continous/varying, the dependent values have
-    // their shapes reset to bottom before recomputation
+    // initialized continous/varying. Every alloca is corrected at most once,
+    // the shapes that were derived from it are marked stale and replaced
+    // (instead of joined) when they are recomputed.
     void updateAllocaOperands(const Instruction* I);
-    // Resets the shape of this value and every value in the user graph to bottom
-    void eraseUserInfoRecursively(const Value* V);
+    // Marks the shapes of all values in the user graph of V as stale
+    void markUsersStale(const Value* V);
 
     // VectorShape::join with adaption to bottom/no value
     VectorShape joinWithOld(const Value* const V, VectorShape AT);
@@ -155,8 +190,19 @@ private:
     VectorShape combineExitShapes(const Loop* loop);
 
     // Returns true iff all operands currently have a computed shape
-    // This is essentially a negated check for bottom
+    // This is essentially a negated check for bottom (stale shapes count as bottom)
     bool allOperandsHaveShape(const Instruction* I);
+    // Returns true iff at least one operand has a computed shape
+    bool anyOperandHasShape(const Instruction* I);
+    bool hasComputedShape(const Value* V) const;
+
+    // Divergence analysis: marks the join points of a varying branch (or of the
+    // exits of a divergent loop) divergent and their phis for recomputation
+    void propagateBranchDivergence(const BranchInst& branch);
+    void propagateLoopDivergence(const Loop& loop);
+    void markJoinDivergent(const BasicBlock& BB, const Loop* level);
+    void markLoopExitDivergent(const BasicBlock& exit, const Loop& loop);
+    void pushBlockPhis(const BasicBlock& BB);
 
     // Mandatory block analysis
     void markSuccessorsMandatory(const BasicBlock* endsVarying);
@@ -167,6 +213,20 @@ private:
     // Returns true iff the constant is aligned respective to mVectorizationFactor
     unsigned getAlignment(const Constant* c) const;
 
+    // Raises the alignment of @shape to the power of two that the known bits of @V
+    // guarantee (align attributes, alloca and global alignment, masks, shifts)
+    VectorShape refineAlignment(const Value* V, VectorShape shape);
+    unsigned getKnownAlignment(const Value* V);
+    // The known bits of @V clear the sign bit, lshr, udiv and urem see the signed lane values
+    bool hasNonNegativeLanes(const Value* V) const;
+    // Whether the lanes of @V may have wrapped around in its own integer type,
+    // widening @V with sext (@isSigned) or zext only keeps @shape if they did not
+    bool mayWrapBetweenLanes(const Value* V, const VectorShape& shape, bool isSigned, unsigned depth = 0) const;
+
+    // Marks the 64 bit values whose lanes fit into 32 bit, either by their sign bits
+    // or as induction variables bounded by the loop exit condition
+    void markNarrowValues(Function& F);
+
     // Transfers the computed VectorShapes from mvalues to the VectorizationInfo object
     // TODO just write into mVecinfo immediately?
     void fillVectorizationInfo(Function& F);
@@ -0,0 +1,91 @@
+//===- SyncDependenceAnalysis.h ----------------*- C++ -*-===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The SyncDependenceAnalysis computes the blocks where control flow that
+// diverges at a branch (or at the exits of a loop) joins again.
+// A block is a join point of a branch if two disjoint paths from different
+// successors of the branch reach it. Phis in join points of varying branches
+// are varying, everything else is not affected by the divergence.
+//
+// Loop exits are join points if they are reached on a different path than
+// the loop header, that is, if some lanes may leave the loop while others
+// stay in it.
+//
+// Join points are found by propagating the successor a block is reached
+// from in reverse post-order, starting at the branch. Nested loops are
+// treated as single nodes with their exits as successors. Every query is
+// linear in the size of the CFG and the result is cached per branch.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef RV_SYNCDEPENDENCEANALYSIS_H
+#define RV_SYNCDEPENDENCEANALYSIS_H
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/InstrTypes.h"
+
+namespace rv {
+
+using namespace llvm;
+
+class SyncDependenceAnalysis {
+public:
+    using ConstBlockSet = SmallPtrSet<const BasicBlock*, 4>;
+
+    SyncDependenceAnalysis(const DominatorTree& domTree,
+                           const PostDominatorTree& postDomTree,
+                           const LoopInfo& loopInfo);
+    ~SyncDependenceAnalysis();
+
+    SyncDependenceAnalysis(const SyncDependenceAnalysis&) = delete;
+    SyncDependenceAnalysis& operator=(SyncDependenceAnalysis) = delete;
+
+    // Blocks that are reached on disjoint paths from the successors of @term.
+    // Loop exits of the branch's loop are included if lanes may leave the loop
+    // through them while others continue with the next iteration.
+    const ConstBlockSet& join_blocks(const TerminatorInst& term);
+
+    // Blocks in the parent loop of @loop (or the function) that are reached on
+    // disjoint paths from different exits of @loop.
+    const ConstBlockSet& join_blocks(const Loop& loop);
+
+private:
+    const DominatorTree&         mDomTree;
+    const PostDominatorTree&     mPostDomTree;
+    const LoopInfo&              mLoopInfo;
+
+    // reverse post-order of the function, computed on the first query
+    std::vector<const BasicBlock*>         mRPO;
+    DenseMap<const BasicBlock*, unsigned>  mRPOIndex;
+
+    std::map<const TerminatorInst*, std::unique_ptr<ConstBlockSet>> mBranchJoins;
+    std::map<const Loop*, std::unique_ptr<ConstBlockSet>>           mLoopExitJoins;
+
+    void computeRPO();
+
+    // Propagate @roots (each reaching itself) in reverse post-order starting after @rootBlock.
+    // Propagation stops at the exits and the header of @parentLoop and after @stopBlock.
+    std::unique_ptr<ConstBlockSet> computeJoinPoints(const BasicBlock& rootBlock,
+                                                     ArrayRef<const BasicBlock*> roots,
+                                                     const Loop* parentLoop,
+                                                     const BasicBlock* stopBlock);
+};
+
+}
+
+#endif // RV_SYNCDEPENDENCEANALYSIS_H
@@ -0,0 +1,99 @@
+//===- UniformLoopAnalysis.h ----------------*- C++ -*-===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The UniformLoopAnalysis finds DIVERGENT loops whose exit conditions only
+// vary between lanes that never reach the loop together.
+// The shape of an exit condition holds for all lanes of the function, but
+// the loop is only executed by the lanes that took the branches leading to
+// it. If these branches fix the values that make the condition varying, e.g.
+//
+//   m = c ? a : b;          // varying
+//   if (c)                  // all lanes in the loop have m == a
+//     for (j = 0; j < m; ++j) ...
+//
+// all lanes in the loop leave it in the same iteration. Such loops are
+// marked non-divergent and their exit branches uniform, which removes the
+// loop mask phi, the exit masks and the live-out blends. The condition keeps
+// its shape; the MaskGenerator tests it on the active lanes only.
+// The ABA analysis, which runs afterwards, marks the blocks of these loops
+// always-by-all-or-none if the loop is entered by all or none of the lanes.
+//
+// A loop is proven uniform if
+// - it has a unique exit block and only exits from its own blocks,
+// - lanes that diverge at a branch in the loop meet again before the exit and
+// - every varying exit condition is uniform on the lanes that reach the loop:
+//   its operands are uniform, known branch conditions, or phis whose edges
+//   are either infeasible for these lanes or come from a non-divergent join.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef RV_UNIFORMLOOPANALYSIS_H
+#define RV_UNIFORMLOOPANALYSIS_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Value.h"
+#include "SyncDependenceAnalysis.h"
+
+#include "rv/vectorizationInfo.h"
+#include "rv/Region/Region.h"
+
+namespace rv {
+
+class UniformLoopAnalysis {
+public:
+    UniformLoopAnalysis(VectorizationInfo& vecInfo,
+                        const LoopInfo& loopInfo,
+                        const DominatorTree& domTree,
+                        SyncDependenceAnalysis& SDA);
+    UniformLoopAnalysis(const UniformLoopAnalysis&) = delete;
+    UniformLoopAnalysis& operator=(UniformLoopAnalysis) = delete;
+
+    // Runs after the PDA and before the ABA analysis
+    void analyze(Function& F);
+
+    unsigned getNumUniformLoops() const { return mNumUniformLoops; }
+
+private:
+    // Branch conditions with the value they have on all lanes that reach a loop
+    typedef SmallDenseMap<const Value*, bool, 8> ConditionFacts;
+
+    VectorizationInfo&           mVecinfo;
+    const LoopInfo&              mLoopInfo;
+    const DominatorTree&         mDomTree;
+    SyncDependenceAnalysis&      mSDA;
+    const Region*                mRegion;
+    unsigned                     mNumUniformLoops;
+
+    // Values of the current loop that are uniform on its lanes
+    DenseMap<const Value*, bool> mUniformValues;
+
+    void analyzeLoop(Loop& loop);
+    bool isUniformLoop(const Loop& loop);
+    void markUniformLoop(const Loop& loop);
+
+    void collectConditionFacts(const Loop& loop, ConditionFacts& facts) const;
+    bool contradicts(const BasicBlock& from, const BasicBlock& to, const ConditionFacts& facts) const;
+    bool isInfeasibleEdge(const BasicBlock& from, const BasicBlock& to, const ConditionFacts& facts) const;
+    bool leavesDivergentLoop(const BasicBlock& from, const BasicBlock& to) const;
+
+    bool isUniformOnLanes(const Value& val, const ConditionFacts& facts);
+    bool isUniformOperation(const Instruction& inst, const ConditionFacts& facts);
+    bool isUniformPhi(const PHINode& phi, const ConditionFacts& facts);
+
+    bool isInRegion(const BasicBlock& block) const;
+};
+
+}
+
+#endif // RV_UNIFORMLOOPANALYSIS_H
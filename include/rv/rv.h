@@ -11,8 +11,11 @@
 
 #include "rv/vectorizationInfo.h"
 #include "rv/pda/DFG.h"
+#include "rv/pda/ProgramDependenceAnalysis.h"
+#include "rv/analysis/AnalysisCache.h"
 #include "rv/analysis/maskAnalysis.h"
 #include "rv/analysis/loopLiveValueAnalysis.h"
+#include "rv/transforms/scheduleStatistics.h"
 #include "rv/rvInfo.h"
 
 using namespace llvm;
@@ -49,12 +52,20 @@ public:
                  const LoopInfo& loopInfo,
                  const PostDominatorTree& postDomTree,
                  const DominatorTree& domTree);
+    void analyze(VectorizationInfo& vectorizationInfo, AnalysisCache& analyses);
+
+    /*
+     * Solver counters of the PDA during the last analyze call.
+     */
+    const PDA::Statistics&
+    getAnalysisStatistics() const { return mAnalysisStats; }
 
     /*
      * Analyze mask values needed to mask certain values and preserve semantics of the function
      * after its control flow is linearized where needed.
      */
     MaskAnalysis* analyzeMasks(VectorizationInfo& vectorizationInfo, const LoopInfo& loopinfo);
+    MaskAnalysis* analyzeMasks(VectorizationInfo& vectorizationInfo, AnalysisCache& analyses);
 
     /*
      * Materialize the mask information.
@@ -62,22 +73,44 @@ public:
     bool generateMasks(VectorizationInfo& vectorizationInfo,
                        MaskAnalysis& maskAnalysis,
                        const LoopInfo& loopInfo);
+    bool generateMasks(VectorizationInfo& vectorizationInfo,
+                       MaskAnalysis& maskAnalysis,
+                       AnalysisCache& analyses);
 
     /*
      * Linearize divergent regions of the scalar function to preserve semantics for the
-     * vectorized function
+     * vectorized function.
+     * The dominator tree and the loop info are updated on the fly, the post dominator tree
+     * becomes stale.
+     * With preserveSSA, the function stays in SSA form throughout instead of being
+     * demoted to the stack and promoted back.
      */
     bool linearizeCFG(VectorizationInfo& vectorizationInfo,
                       MaskAnalysis& maskAnalysis,
                       LoopInfo& loopInfo,
                       const PostDominatorTree& postDomTree,
-                      const DominatorTree& domTree);
+                      DominatorTree& domTree,
+                      const bool preserveSSA=false);
+    bool linearizeCFG(VectorizationInfo& vectorizationInfo,
+                      MaskAnalysis& maskAnalysis,
+                      AnalysisCache& analyses,
+                      const bool preserveSSA=false);
 
     /*
-     * Produce vectorized instructions
+     * Register pressure estimates of the branch side order of the last linearizeCFG call,
+     * for the structural and the scheduled order.
+     */
+    const ScheduleStatistics&
+    getScheduleStatistics() const { return mScheduleStats; }
+
+    /*
+     * Produce vectorized instructions.
+     * The overload with an AnalysisCache invalidates it if the function is vectorized in place.
      */
     bool
     vectorize(VectorizationInfo& vecInfo, const DominatorTree& domTree);
+    bool
+    vectorize(VectorizationInfo& vecInfo, AnalysisCache& analyses);
 
     /*
      * Ends the vectorization process on this function, removes metadata and
@@ -100,6 +133,8 @@ public:
 private:
     RVInfo&                       mInfo;
     Function*                      mScalarFn;
+    PDA::Statistics                mAnalysisStats;
+    ScheduleStatistics             mScheduleStats;
 
     bool verifyVectorizedType(Type* scalarType, Type* vecType);
     bool verifyFunctionSignaturesMatch(const Function& F1, const Function& F2);
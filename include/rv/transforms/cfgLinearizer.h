@@ -20,9 +20,14 @@
 #include <llvm/ADT/SetVector.h>
 
 #include <deque>
+#include <memory>
 
 #include <llvm/IR/Dominators.h>
+#include <llvm/IR/ValueHandle.h>
 #include <rv/vectorizationInfo.h>
+#include <rv/analysis/DisjointPathOracle.h>
+#include <rv/analysis/BlockReachability.h>
+#include <rv/transforms/scheduleStatistics.h>
 
 #include "utils/rvTools.h"
 
@@ -82,7 +87,8 @@ public:
                   const LoopLiveValueAnalysis& loopLiveValueAnalysis,
                   VectorizationInfo& vecInfo,
                   const PostDominatorTree& postDomTree,
-                  const DominatorTree& domTree);
+                  DominatorTree& domTree,
+                  const bool preserveSSA=false);
 
 	~CFGLinearizer();
 
@@ -90,6 +96,41 @@ public:
 
     bool verify(const Function& f) const;
 
+    // Estimated register pressure of the order in which the sides of branches are laid out
+    const ScheduleStatistics& getScheduleStatistics() const { return mScheduleStats; }
+
+    // Branches on superword condition codes (BOSCC): after linearization, a side
+    // of a varying branch is skipped if no instance enters it and, optionally,
+    // runs a copy without blends and masked memory accesses if all instances do.
+    struct BOSCCStatistics
+    {
+        unsigned numCandidates; // sides chosen by the heuristic or RV_METADATA_VARIANT_BOSCC
+        unsigned numChecks;     // ... that are skipped for empty masks
+        unsigned numFastPaths;  // ... that have a copy for full masks
+        BOSCCStatistics();
+    };
+    const BOSCCStatistics& getBOSCCStatistics() const { return mBOSCCStats; }
+
+    // Runs the analysis part of linearize() on @F without changing its CFG: the
+    // divergence causing blocks, the rewire targets, the clusters with their
+    // rewire orders and the new edges.
+    void analyzeRewiring(Function& F);
+
+    // Answer the reachability queries of the rewiring analysis with one CFG walk
+    // each (rv::isReachable) instead of the bit vectors of BlockReachability.
+    // Kept to compare the two in benchmarks.
+    void setReachabilityWalks(const bool enable) { mReachabilityWalks = enable; }
+
+    // Result of the rewiring analysis of the last linearize() or analyzeRewiring() call
+    struct RewiringStatistics
+    {
+        unsigned numClusters;
+        unsigned numRewireTargets; // entries in the rewire lists of all clusters
+        unsigned numRewiredEdges;  // edges that are removed or get new targets
+        RewiringStatistics();
+    };
+    const RewiringStatistics& getRewiringStatistics() const { return mRewiringStats; }
+
 private:
     const RVInfo&               mInfo;
     LoopInfo&                    mLoopInfo;
@@ -97,12 +138,63 @@ private:
     const LoopLiveValueAnalysis& mLoopLiveValueAnalysis;
     VectorizationInfo&           mvecInfo;
     const PostDominatorTree&     mPostDomTree;
-    const DominatorTree&         mDomTree;
-
-    std::map<BasicBlock*, std::vector<BasicBlock*>> mDivergenceCauseMap;
-    std::map<BasicBlock*, std::vector<BasicBlock*>> mRewireTargetMap;
+    DominatorTree&               mDomTree; // kept up to date through linearization
+    mutable rv::DisjointPathOracle mPathOracle;
+
+    // Keep SSA form during linearization instead of demoting values to the stack
+    // (reg2mem/mem2reg). The demoting path is kept for differential testing.
+    const bool                   mPreserveSSA;
+
+    // Blocks whose incoming or outgoing edges were changed by the rewiring and blocks
+    // created on the way. The dominator tree is only repaired below these blocks.
+    SmallPtrSet<BasicBlock*, 16> mEditedBlocks;
+    SmallVector<BasicBlock*, 4>  mNewBlocks;
+
+    typedef DenseMap<BasicBlock*, SmallVector<BasicBlock*, 2>> BlockVecMapType;
+    BlockVecMapType mDivergenceCauseMap;
+    BlockVecMapType mRewireTargetMap;
+
+    // Reachability on the unmodified CFG, valid until the edges are rewired.
+    // For every block, the blocks with varying branches that reach it (indexed
+    // by their position in mVaryingBranches).
+    std::unique_ptr<rv::BlockReachability> mReachability;
+    std::vector<BasicBlock*>               mVaryingBranches;
+    DenseMap<const BasicBlock*, unsigned>  mBranchIndex;
+    std::vector<BitVector>                 mReachingBranches;
+    bool                                   mReachabilityWalks;
+    RewiringStatistics                     mRewiringStats;
+
+    // Per block (indexed by mReachability), the non-uniform values and masks that
+    // are live out of or die in the dominator subtree of the block and the
+    // instructions in that subtree. A side of a branch is laid out first if it
+    // ends more live ranges than it starts, relative to its size.
+    struct LiveRangeEstimate
+    {
+        int      mValuesOut;
+        int      mValuesDying;
+        int      mMasksOut;
+        int      mMasksDying;
+        unsigned mSize;
+    };
+    std::vector<LiveRangeEstimate> mLiveRangeEstimates;
+    SmallPtrSet<const BasicBlock*, 16> mOrderedBranches; // counted in mScheduleStats
+    ScheduleStatistics             mScheduleStats;
+
+    // A side of a varying branch that gets a BOSCC check: the blocks dominated by its
+    // first block before linearization and the entry mask of that block. The linearizer
+    // only adds blocks in between, so the side stays a single-entry region if it only
+    // exits to one block.
+    struct BOSCCRegion
+    {
+        BasicBlock*                 mEntry;
+        WeakVH                      mMask;
+        SmallPtrSet<BasicBlock*, 8> mBlocks;
+        bool                        mFastPath;
+    };
+    std::vector<BOSCCRegion>     mBOSCCRegions;    // outermost first
+    SmallPtrSet<BasicBlock*, 32> mOriginalBlocks;  // blocks before linearization
+    BOSCCStatistics              mBOSCCStats;
 
-    Function * requestReductionFunc(llvm::Module & mod, const std::string & name);
     Instruction * createReduction(Value & pred, const std::string & name, BasicBlock & atEnd);
 
     typedef SmallVector<BasicBlock*, 16> Schedule;
@@ -113,7 +205,18 @@ private:
 
     void collectLoopExitInfo(Function* f);
     void linearize(Function* f);
-
+    void determineRewiring(Function* f);
+    void releaseReachability();
+    void cleanup();
+    void linearizeSSA(Function* f);
+
+    void computeReachingBranches(Function& F);
+    bool mayReachBlock(const BasicBlock& branchBlock, const BasicBlock& block) const;
+    bool isReachable(const BasicBlock& target,
+                     const BasicBlock& source,
+                     const BasicBlock* doNotTraverse,
+                     const Loop*       loop,
+                     const bool        noBackEdges);
     void getDivergenceCausingBlocks(Function& F);
     void getDivergenceCausingBlocksFor(BasicBlock& block);
 
@@ -125,7 +228,6 @@ private:
     void getRewireTargetsIfMandatoryExit(BasicBlock& block, const Loop& loop);
 
     bool checkForDisjointPaths(const BasicBlock* block,
-                               bool              doNotBranchToOuterLoops,
                                ConstBlockSet&    divergenceCausingBlocks) const;
 
     enum OutgoingEdgeType
@@ -195,6 +297,8 @@ private:
     void createClusters(SetVector<BasicBlock*>& dcBlockSet);
     void determineRewireOrders();
     void determineRewireOrder(Cluster& cluster);
+    void estimateLiveRanges(Function& f);
+    void orderSuccessors(const BasicBlock* block, SmallVectorImpl<BasicBlock*>& succs);
     bool hasUnseenNonLatchPred(BasicBlock*                         block,
                                const Cluster&                      cluster,
                                const LoopInfo&                     loopInfo,
@@ -305,6 +409,12 @@ private:
                                          MaskValueMapType& maskValueMap,
                                          MaskValueMapType& maskPhiValueMap);
 
+    // Book-keeping for the dominator tree and loop info while edges are rewired
+    void recordEdgeChange(BasicBlock* source, BasicBlock* target);
+    void recordNewBlock(BasicBlock* block, BasicBlock* pred);
+    void eraseBlock(BasicBlock* block);
+    void updateDominatorTree();
+
     void repairLoopExitMasks(Function* f);
 
     void reg2mem(Function*         f,
@@ -333,6 +443,57 @@ private:
 
     const Loop* getInnermostLoopForAlloca(const LoadVecType&  reloads,
                                           const StoreVecType& stores) const;
+    typedef SmallVector<const BasicBlock*, 4> ConstBlockVecType;
+    const Loop* getInnermostLoopForDefs(const ConstBlockVecType& defBlocks,
+                                        const ConstBlockVecType& useBlocks) const;
+
+    // SSA-preserving linearization:
+    // Phis of blocks whose incoming edges may change are taken out of their
+    // blocks before rewiring. They keep their incoming values and blocks, i.e.,
+    // the definitions that reach them over the original edges. Afterwards,
+    // they are rebuilt on the linearized CFG with SSAUpdater, and all uses that
+    // are no longer dominated by their definitions are rewritten the same way.
+    struct DetachedPhi
+    {
+        DetachedPhi(PHINode* phi, BasicBlock* block, BasicBlock* latchDef)
+            : mPhi(phi), mBlock(block), mLatchDef(latchDef)
+        {}
+        PHINode*    mPhi;
+        BasicBlock* mBlock;
+        // Latch of the outermost exited loop if this is an LCSSA phi of a
+        // MANDATORY exit: the incoming value is taken from the last iteration.
+        BasicBlock* mLatchDef;
+    };
+    typedef SmallVector<DetachedPhi, 16>                          DetachedPhiVecType;
+    typedef DenseMap<BasicBlock*, SmallVector<BasicBlock*, 2> >   DefOverwriteMapType;
+
+    void detachPhis(Function& f, DetachedPhiVecType& phis);
+    void rebuildPhis(DetachedPhiVecType& phis, MaskValueMapType& phiValueMap);
+    Value* blendOverwrittenDefs(BasicBlock*                    defBB,
+                                const DetachedPhi&             dp,
+                                DenseMap<BasicBlock*, Value*>& defValues,
+                                const DefOverwriteMapType&     overwriteMap,
+                                DenseMap<BasicBlock*, Value*>& blendedValues);
+    void findOverwrittenDefs(const SmallVectorImpl<BasicBlock*>& defBlocks,
+                             const BasicBlock*                   joinBlock,
+                             DefOverwriteMapType&                overwriteMap) const;
+    void repairDominance(Function& f);
+    bool hasLoopHeaderPhiUse(const Value& value) const;
+    void finishSSAUpdaterPhis(const SmallVectorImpl<PHINode*>& insertedPhis,
+                              const Value&                     origValue);
+
+    // BOSCC
+    void collectBOSCCRegions(Function& f);
+    void insertBOSCCChecks();
+    bool insertBOSCCCheck(const BOSCCRegion& region);
+    bool canHoistBOSCCMask(Value&                              value,
+                           const BasicBlock&                   entry,
+                           const SmallPtrSetImpl<BasicBlock*>& blocks,
+                           SmallPtrSetImpl<Instruction*>&      hoistedInsts) const;
+    Value* getSkippedValue(Value&                              value,
+                           const Value&                        entryMask,
+                           const SmallPtrSetImpl<BasicBlock*>& blocks,
+                           DenseMap<const Value*, Value*>&     skippedValues);
 };
 
 }
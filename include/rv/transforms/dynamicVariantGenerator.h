@@ -0,0 +1,80 @@
+//===- dynamicVariantGenerator.h ----------------*- C++ -*-===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// The DynamicVariantGenerator creates two versions of the region of a varying
+// branch that carries variant_start metadata, once the vectorization analysis
+// has run:
+// - the varying version is the original region, it is linearized and executed
+//   with masks as usual.
+// - the uniform version is a copy of the region in which the branch tests
+//   whether any lane takes it (rv_any). The linearizer keeps its CFG.
+// The block of the branch selects the uniform version if all lanes agree on the
+// branch condition. Both versions end in their own block in front of the join
+// point of the branch (the region exit, marked with variant_end), so the blends
+// of the varying version are not executed on the uniform path.
+//
+// The test looks at all lanes, so the block of the branch must be always executed
+// by all lanes. The region must be acyclic and left through the join point only.
+//
+
+#ifndef _DYNAMICVARIANTGENERATOR_H
+#define	_DYNAMICVARIANTGENERATOR_H
+
+#include <vector>
+
+namespace llvm {
+class BasicBlock;
+class BranchInst;
+class DominatorTree;
+class Function;
+class LoopInfo;
+class PostDominatorTree;
+}
+
+namespace rv {
+class VectorizationInfo;
+}
+
+using namespace llvm;
+
+class DynamicVariantGenerator
+{
+public:
+    DynamicVariantGenerator(rv::VectorizationInfo& vecInfo,
+                            const DominatorTree& domTree,
+                            const PostDominatorTree& postDomTree,
+                            LoopInfo& loopInfo);
+    ~DynamicVariantGenerator();
+
+    // Create the variants of all supported regions in @func.
+    // Returns true if any region was cloned. The shapes and block properties of the new
+    // code are set in the vectorization info and the loop info is kept up to date.
+    // The dominator trees are invalidated.
+    bool run(Function& func);
+
+    unsigned getNumVariants() const { return mNumVariants; }
+
+private:
+    struct VariantRegion
+    {
+        BasicBlock* mEntry; // block of the varying branch
+        BasicBlock* mJoin;  // its immediate post dominator
+        std::vector<BasicBlock*> mBlocks;
+    };
+
+    rv::VectorizationInfo&      mVecInfo;
+    const DominatorTree&        mDomTree;
+    const PostDominatorTree&    mPostDomTree;
+    LoopInfo&                   mLoopInfo;
+    unsigned                    mNumVariants;
+
+    bool collectRegion(BranchInst& branch, VariantRegion& region) const;
+    void createVariants(const VariantRegion& region);
+};
+
+
+#endif	/* _DYNAMICVARIANTGENERATOR_H */
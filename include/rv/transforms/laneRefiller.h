@@ -0,0 +1,59 @@
+//===- laneRefiller.h ----------------*- C++ -*-===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// The LaneRefiller prepares an outer loop with a divergent inner loop for
+// vectorization in lane-refill mode.
+// Vectorizing the outer loop directly makes every vector iteration wait for
+// the lane with the longest inner trip count. After the transformation, one
+// trip of the loop runs a single inner iteration on every busy lane. Lanes that
+// finished their inner loop execute the rest of their outer iteration and pick
+// up the next unprocessed outer iteration on the following trip.
+//
+// The outer iterations are handed out with the lane intrinsics rv_index and
+// rv_popcount. The loop keeps running while any lane is suspended in the inner
+// loop (rv_any) or outer iterations are left.
+//
+
+#ifndef _LANEREFILLER_H
+#define	_LANEREFILLER_H
+
+#include <string>
+
+#include <llvm/IR/InstrTypes.h>
+
+namespace llvm {
+class Loop;
+class PHINode;
+class Value;
+}
+
+using namespace llvm;
+
+class LaneRefiller
+{
+public:
+    LaneRefiller();
+    ~LaneRefiller();
+
+    // Returns true if the "++i" loop @loop with induction variable @ivPhi can run in lane-refill mode.
+    // The loop must be in LoopSimplify and LCSSA form, exit at its latch only, have no other
+    // header phis or live-outs and contain exactly one inner loop that all paths through
+    // the body pass. Otherwise @reason tells why the loop is not supported.
+    bool canRefill(const Loop& loop, const PHINode& ivPhi, std::string& reason) const;
+
+    // Restructure @loop for lane-refill mode. Requires canRefill(@loop, @ivPhi).
+    // The inner loop is dissolved into the body of @loop and @ivPhi holds the outer
+    // iteration of each lane afterwards. LoopInfo and dominator trees are invalidated.
+    void refill(Loop& loop, PHINode& ivPhi);
+
+private:
+    bool matchLatchCompare(const Loop& loop, const PHINode& ivPhi,
+                           CmpInst::Predicate& pred, Value*& bound) const;
+};
+
+
+#endif	/* _LANEREFILLER_H */
@@ -0,0 +1,84 @@
+//===- loopInterleaver.h ----------------*- C++ -*-===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// The LoopInterleaver replicates the body of a loop region U times before
+// vectorization so that each trip of the vectorized loop executes U
+// independent vector iterations (vector unrolling).
+// Copy k of the body operates on the induction variable plus k * vectorWidth
+// and has its own reduction accumulators. Since every copy consists of
+// distinct blocks, mask analysis assigns independent masks to each of them.
+// The accumulators are combined in the loop exit block.
+//
+// Like the plain loop vectorizer, the transformed loop expects the trip count
+// to be a multiple of U * vectorWidth. rvTool only interleaves loops with a
+// constant trip count and lowers the factor until it divides the trip count.
+//
+// The register count and latencies the factor is based on are target
+// parameters (see InterleaveTargetInfo), by default those of x86_64 with AVX.
+//
+
+#ifndef _LOOPINTERLEAVER_H
+#define	_LOOPINTERLEAVER_H
+
+namespace llvm {
+class Loop;
+class PHINode;
+class Instruction;
+class TargetTransformInfo;
+}
+
+using namespace llvm;
+
+struct InterleaveTargetInfo
+{
+    unsigned maxInterleaveFactor;  // upper bound for the interleave factor
+    unsigned numVectorRegisters;   // available to the interleaved copies
+    unsigned longLatencyThreshold; // operations at least this slow justify interleaving without reductions
+
+    // latencies in cycles
+    unsigned fpArithLatency;       // fadd, fsub, fmul
+    unsigned intMulLatency;
+    unsigned fpDivLatency;         // fdiv, frem
+    unsigned intDivLatency;        // udiv, sdiv, urem, srem
+    unsigned loadLatency;
+    unsigned callLatency;
+
+    // x86_64 with AVX
+    InterleaveTargetInfo();
+
+    // Vector register count and interleave bound of the target, the latencies keep their defaults
+    InterleaveTargetInfo(const TargetTransformInfo& TTI, unsigned vectorWidth);
+};
+
+class LoopInterleaver
+{
+public:
+    LoopInterleaver(unsigned vectorWidth, const InterleaveTargetInfo& targetInfo = InterleaveTargetInfo());
+    ~LoopInterleaver();
+
+    // Suggest an interleave factor for @loop based on the latency of its
+    // reduction chains and long-latency operations, bounded by an estimate
+    // of the vector register pressure. Returns 1 if interleaving does not pay off.
+    unsigned computeInterleaveFactor(Loop& loop, PHINode& ivPhi) const;
+
+    // Interleave @factor vector iterations of @loop with induction variable
+    // @ivPhi (a "++i" loop). The loop must be in LoopSimplify and LCSSA form,
+    // and the latch must be its only exiting block. The accumulators of the
+    // copies are added behind the existing header phis.
+    // Returns false and leaves the loop untouched if it is not supported.
+    // LoopInfo and dominator trees of the function are invalidated on success.
+    bool interleave(Loop& loop, PHINode& ivPhi, unsigned factor);
+
+private:
+    unsigned mVectorWidth;
+    InterleaveTargetInfo mTargetInfo;
+
+    unsigned getLatency(const Instruction& inst) const;
+};
+
+
+#endif	/* _LOOPINTERLEAVER_H */
@@ -50,10 +50,11 @@ private:
     VectorizationInfo& 	mvecInfo;
     MaskAnalysis&   	mMaskAnalysis;
     const LoopInfo& 	mLoopInfo;
+    unsigned            mNumMaskOperations;
 
     void markMaskOperation(Instruction& maskOp);
     void materializeMasks(Function* f);
-    bool entryMaskIsUsed(const BasicBlock& block) const;
+    Instruction* getFirstMaskUser(BasicBlock& block) const;
     Value* materializeMask(MaskPtr maskPtr);
 
     Value* createNeg(Value* operand, Instruction* insertBefore);
@@ -71,6 +72,9 @@ private:
     void materializeLoopExitMasks(Loop* loop);
     void materializeCombinedLoopExitMasks(Loop* loop);
 
+    bool hasUniformExitOnVaryingCondition(const BasicBlock& block) const;
+    void maskUniformLoopExit(BasicBlock& block);
+
 	void fillVecInfoWithPredicates(Function& F);
 };
 
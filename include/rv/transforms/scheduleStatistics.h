@@ -0,0 +1,41 @@
+//===- scheduleStatistics.h ----------------*- C++ -*-===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Estimated register pressure of the order in which the CFGLinearizer lays out
+// the sides of branches, as live values times instructions that they are live
+// across. The structural order is the one given by the successor order.
+//
+
+#ifndef _SCHEDULESTATISTICS_H
+#define	_SCHEDULESTATISTICS_H
+
+#include <cstdint>
+
+namespace rv {
+
+struct ScheduleStatistics
+{
+    unsigned      numBranches;   // blocks with more than one side to order
+    unsigned      numReordered;  // ... that deviate from the structural order
+    std::uint64_t structuralValueCost;
+    std::uint64_t scheduledValueCost;
+    std::uint64_t structuralMaskCost;
+    std::uint64_t scheduledMaskCost;
+
+    ScheduleStatistics()
+        : numBranches(0),
+          numReordered(0),
+          structuralValueCost(0),
+          scheduledValueCost(0),
+          structuralMaskCost(0),
+          scheduledMaskCost(0)
+    {}
+};
+
+}
+
+#endif	/* _SCHEDULESTATISTICS_H */
@@ -15,6 +15,9 @@
 #include <llvm/ADT/SmallVector.h>
 #include <rv/vectorizationInfo.h>
 
+#include <map>
+#include <vector>
+
 class MaskAnalysis;
 class LoopLiveValueAnalysis;
 
@@ -25,6 +28,7 @@ class Module;
 class Function;
 class SelectInst;
 class PHINode;
+class BasicBlock;
 class Loop;
 class LoopInfo;
 }
@@ -75,8 +79,31 @@ private:
     LoopLiveValueAnalysis&      mLoopLiveValueAnalysis;
 	VectorizationInfo&          mvecInfo;
 
+    // A value that reaches a join block over one or more incoming edges.
+    struct BlendLeaf
+    {
+        Value*                mValue;
+        std::vector<unsigned> mEdges;
+    };
+    // Disjunctions of exit masks of the incoming edges of a join block,
+    // keyed by the sorted indices of the edges' source blocks.
+    // Shared by all phis of the block.
+    typedef std::map<std::vector<unsigned>, Value*> BlendMaskMap;
+
     void generatePhiSelects(Function& f);
-    Value* generateSelectFromPhi(PHINode* phi);
+    Value* generateSelectFromPhi(PHINode*                        phi,
+                                 const SmallVectorImpl<BasicBlock*>& preds,
+                                 BlendMaskMap&                   blendMasks);
+    Value* generateBlendTree(PHINode*                        phi,
+                             const SmallVectorImpl<BlendLeaf>& leaves,
+                             const unsigned                  begin,
+                             const unsigned                  end,
+                             const SmallVectorImpl<BasicBlock*>& preds,
+                             BlendMaskMap&                   blendMasks);
+    Value* getBlendMask(const std::vector<unsigned>&      edges,
+                        const SmallVectorImpl<BasicBlock*>& preds,
+                        BlendMaskMap&                     blendMasks,
+                        Instruction*                      insertBefore);
 
     void generateLoopSelects(Function& f);
 
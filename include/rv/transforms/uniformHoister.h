@@ -0,0 +1,61 @@
+//===- uniformHoister.h ----------------*- C++ -*-===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// The UniformHoister moves uniform computations out of a loop region once
+// the vectorization analysis has run:
+// - uniform instructions with loop-invariant operands are hoisted into the
+//   preheader, so their broadcasts are emitted there as well. Loads stay in
+//   the loop, stores of the loop may change the memory they read.
+// - uniform values that are only used after the loop are sunk into the exit
+//   block and computed once from the live-outs of their operands.
+// Only the placement of instructions changes, the CFG and its analyses stay valid.
+//
+
+#ifndef _UNIFORMHOISTER_H
+#define	_UNIFORMHOISTER_H
+
+namespace llvm {
+class Loop;
+class BasicBlock;
+class Instruction;
+}
+
+namespace rv {
+class VectorizationInfo;
+}
+
+using namespace llvm;
+
+class UniformHoister
+{
+public:
+    UniformHoister(const rv::VectorizationInfo& vecInfo);
+    ~UniformHoister();
+
+    // Hoist and sink uniform values of @loop, which must be in LoopSimplify and LCSSA form.
+    // Returns true if any instruction was moved.
+    bool run(Loop& loop);
+
+    unsigned getNumHoisted() const { return mNumHoisted; }
+    unsigned getNumSunk() const { return mNumSunk; }
+
+private:
+    const rv::VectorizationInfo& mVecInfo;
+    unsigned mNumHoisted;
+    unsigned mNumSunk;
+
+    bool isUniform(const Instruction& inst) const;
+    bool canHoist(const Loop& loop, const Instruction& inst) const;
+    bool canSink(const Loop& loop, const Instruction& inst, const BasicBlock& exitBlock) const;
+
+    bool hoistInvariants(Loop& loop);
+    bool sinkLiveOuts(Loop& loop);
+    void sink(Loop& loop, Instruction& inst, BasicBlock& exitBlock);
+};
+
+
+#endif	/* _UNIFORMHOISTER_H */
@@ -9,11 +9,14 @@
 #ifndef _MASKGRAPHUTILS_H
 #define _MASKGRAPHUTILS_H
 
+#include <llvm/ADT/ArrayRef.h>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/FoldingSet.h>
+#include <llvm/Support/Allocator.h>
 #include <llvm/Support/raw_ostream.h>
 
-#include <memory> // shared_ptr, weak_ptr
+#include <vector>
 
 namespace llvm {
 class Value;
@@ -44,30 +47,28 @@ enum NodeType
     REFERENCE
 };
 
-// Use shared_ptr for Mask objects that can
-// directly be deleted via MaskAnalysis::mMaskMap.
-// Use weak_ptr for operands to cope with cycles.
-// This means that when deleting the object,
-// the operands may already have been deleted,
-// but in that case the operand is set to
-// nullptr.
+// Masks are owned by their MaskGraph and live as long as it does.
+// Operands are plain pointers into the same graph, cycles through
+// loop phis need no special care.
 struct Mask;
-typedef std::shared_ptr<Mask> MaskPtr;
-typedef std::weak_ptr<Mask>   MaskWeakPtr;
+typedef Mask* MaskPtr;
 
-struct Mask
+struct Mask : public FoldingSetNode
 {
-    const unsigned              mID;
+    const unsigned              mID; // dense index in the owning graph
     const NodeType              mType;
-    SmallVector<MaskWeakPtr, 2> mOperands;
+    SmallVector<MaskPtr, 2>     mOperands;
     SmallVector<BasicBlock*, 2> mIncomingDirs;
     Value*                      mValue;
     Instruction*                mInsertPoint;
 
-    Mask(const NodeType type, Instruction* insertPoint);
-    ~Mask();
+    // Structural key of hash-consed masks, fixed at creation.
+    FoldingSetNodeIDRef         mKey;
+
+    Mask(const unsigned id, const NodeType type, Instruction* insertPoint);
     bool operator==(const Mask& other) const;
     void print(raw_ostream& o) const;
+    void Profile(FoldingSetNodeID& ID) const { ID = mKey; }
 };
 
 // Objects of this type are only referenced in the blockMap.
@@ -77,7 +78,6 @@ struct BlockMaskInfo
     MaskPtr                 mEntryMask;
     SmallVector<MaskPtr, 2> mExitMasks;
 
-    ~BlockMaskInfo();
     void print(raw_ostream& o) const;
 };
 
@@ -87,7 +87,6 @@ struct LoopMaskInfo
     MaskPtr     mMaskPhi;
     MaskPtr     mCombinedLoopExitMask;
 
-    ~LoopMaskInfo();
     void print(raw_ostream& o) const;
 };
 
@@ -117,10 +116,69 @@ struct LoopExitMaskInfo
 	// NOTE: This also includes the innermost loop.
 	LoopMaskMapType mMaskPhiMap;
 
-    ~LoopExitMaskInfo();
     void print(raw_ostream& o) const;
 };
 
+// Owns all masks and mask infos of one function in bump pointer arenas.
+// Masks that do not get operands added later (constants, values, negations,
+// conjunctions, disjunctions and selects) are hash-consed: requesting a
+// structurally identical mask returns the existing node, so each such
+// expression is materialized at most once.
+class MaskGraph
+{
+public:
+    typedef std::vector<MaskPtr>::const_iterator iterator;
+
+    MaskGraph();
+    MaskGraph(const MaskGraph&) = delete;
+    MaskGraph& operator=(const MaskGraph&) = delete;
+
+    MaskPtr getConstant   (Value* value, Instruction* insertPoint);
+    MaskPtr getValue      (Value* value, Instruction* insertPoint);
+    MaskPtr getNegate     (MaskPtr operand, Instruction* insertPoint);
+    MaskPtr getConjunction(ArrayRef<MaskPtr> operands, Instruction* insertPoint);
+    MaskPtr getDisjunction(ArrayRef<MaskPtr> operands, Instruction* insertPoint);
+    MaskPtr getSelect     (MaskPtr      condition,
+                           MaskPtr      trueMask,
+                           MaskPtr      falseMask,
+                           Instruction* insertPoint);
+
+    // A fresh node whose operands are filled in by the caller
+    // (phis, loop exit updates and references).
+    MaskPtr createNode(const NodeType type, Instruction* insertPoint);
+
+    BlockMaskInfo*    createBlockMaskInfo();
+    LoopMaskInfo*     createLoopMaskInfo();
+    LoopExitMaskInfo* createLoopExitMaskInfo();
+
+    // The keys refer to values, blocks and insert points:
+    // they are dropped when those are remapped.
+    void clearUniquingTable();
+
+    unsigned size() const { return (unsigned)mNodes.size(); }
+    MaskPtr getNode(const unsigned id) const { return mNodes[id]; }
+    iterator begin() const { return mNodes.begin(); }
+    iterator end() const { return mNodes.end(); }
+
+    unsigned getNumUniquedHits() const { return mNumUniquedHits; }
+
+private:
+    SpecificBumpPtrAllocator<Mask>             mMaskAllocator;
+    SpecificBumpPtrAllocator<BlockMaskInfo>    mBlockInfoAllocator;
+    SpecificBumpPtrAllocator<LoopMaskInfo>     mLoopInfoAllocator;
+    SpecificBumpPtrAllocator<LoopExitMaskInfo> mLoopExitInfoAllocator;
+    BumpPtrAllocator                           mKeyAllocator;
+
+    FoldingSet<Mask>     mUniqued;
+    std::vector<MaskPtr> mNodes;
+    unsigned             mNumUniquedHits;
+
+    MaskPtr getUniqued(const NodeType    type,
+                       Value*            value,
+                       ArrayRef<MaskPtr> operands,
+                       Instruction*      insertPoint);
+};
+
 } // namespace MaskGraphUtils
 } // namespace rv
 
@@ -16,4 +16,10 @@ static N gcd(N a, N b) {
   return b;
 }
 
+template<typename N>
+static N lcm(N a, N b) {
+  if (!a || !b) return 0;
+  return (a / gcd<N>(a, b)) * b;
+}
+
 #endif // RV_UTILS_MATHUTILS_H_
@@ -20,10 +20,27 @@ namespace rv {
 
 
 // describes how the contents of a vector vary with the vectorized dimension
+//
+// A strided shape may carry a lane pattern: constant offsets that repeat every
+// period lanes on top of the stride, i.e. lane i holds
+//   value(0) + stride * i + offset[i % period]
+// with offset[0] == 0. This covers periodic values (i % 4, i & 3) and, for
+// periods up to the vector width, arbitrary constant per-lane offsets.
+// Shapes with a lane pattern count as varying for all queries that only know
+// affine shapes (isVarying, hasStridedShape, hasStride).
 class VectorShape {
+public:
+	// longest representable lane pattern
+	static const unsigned MaxPeriod = 16;
+
+private:
 	int stride;
 	bool hasConstantStride;
 	unsigned alignment;
+	unsigned period; // 0 if there is no lane pattern
+	int offsets[MaxPeriod];
+
+	void normalizePattern();
 
 public:
 	// Divergent constructor
@@ -31,6 +48,8 @@ public:
 	: stride(0)
 	, hasConstantStride(false)
 	, alignment(_alignment)
+	, period(0)
+	, offsets()
 	{}
 
 	// constant stride constructor
@@ -38,13 +57,28 @@ public:
 	: stride(_stride)
 	, hasConstantStride(true)
 	, alignment(_alignment)
+	, period(0)
+	, offsets()
 	{}
 
         bool isDefined() const { return !(!hasConstantStride && (alignment == 0) && (stride == 0)); }
-        bool hasStride(int testStride) const { return hasConstantStride && stride == testStride; }
-	bool hasStridedShape() const { return hasConstantStride; }
+        bool hasStride(int testStride) const { return hasStridedShape() && stride == testStride; }
+	bool hasStridedShape() const { return hasConstantStride && period == 0; }
 	int getStride() const { return stride; }
 	unsigned getAlignment() const { return alignment; }
+	void setAlignment(unsigned _alignment) { alignment = _alignment; }
+
+	// lane pattern queries
+	bool hasLanePattern() const { return hasConstantStride && period > 0; }
+	// stride, possibly with a lane pattern
+	bool hasKnownLaneOffsets() const { return hasConstantStride; }
+	unsigned getPeriod() const { return period; }
+	// the constant difference between lane @lane and lane 0
+	int getLaneOffset(unsigned lane) const {
+		return stride * (int) lane + (period ? offsets[lane % period] : 0);
+	}
+	// the offset of every lane is a multiple of @factor
+	bool hasLaneOffsetsMultipleOf(int factor) const;
 
 	bool isUniform() const { return hasStridedShape() && getStride() == 0; }
 	bool isStrided(int ofStride) const { return hasStridedShape() && stride == ofStride; }
@@ -56,6 +90,9 @@ public:
 	static VectorShape uni(int aligned = 1) { return VectorShape(0, aligned); }
 	static VectorShape cont(int aligned = 1) { return VectorShape(1, aligned); }
 	static VectorShape undef(int aligned = 1) { return VectorShape(0); }
+	// stride plus the constant lane offsets @laneOffsets (repeating, laneOffsets[0] == 0)
+	// degrades to varying if the pattern does not fit into MaxPeriod lanes
+	static VectorShape patterned(int stride, const std::vector<int>& laneOffsets, int aligned = 1);
 
         static VectorShape join(VectorShape a, VectorShape b);
 
@@ -68,13 +105,20 @@ public:
 	friend VectorShape operator*(int strideMultiplier, const VectorShape& a);
 	friend VectorShape operator/(const VectorShape& a, int strideDivisor);
 
-	static VectorShape truncateToTypeSize(const VectorShape& a, unsigned typeSize)
-	{
-		// FIXME can this become unaligned?
-		// This selects only the last typeSize digits
-		unsigned lastDigitsMask = (1U << typeSize) - 1U;
-		return VectorShape(a.getStride() & lastDigitsMask, a.alignment);
-	}
+	// Integer operations beyond +, -, * and /.
+	// Lane values are evaluated in two's complement, a shape is computed if the
+	// lanes keep a constant distance.
+
+	// truncation to @typeSizeInBits wraps strides and offsets to the narrow type
+	static VectorShape truncateToTypeSize(const VectorShape& a, unsigned typeSizeInBits);
+	// unsigned and signed remainder by a positive constant
+	// urem only handles moduli that are not a power of two if no lane is negative
+	static VectorShape urem(const VectorShape& a, int modulus, bool nonNegativeLanes = false);
+	static VectorShape srem(const VectorShape& a, int modulus);
+	// arithmetic or logical shift right by a constant (rounds towards minus infinity)
+	static VectorShape shiftRight(const VectorShape& a, unsigned shiftAmount);
+	// a | c and a ^ c for a constant c that only covers bits that are zero on every lane
+	static VectorShape disjointAdd(const VectorShape& a, int constant);
 
 	std::string str() const;
 
@@ -13,6 +13,8 @@ namespace llvm
 {
 class BasicBlock;
 
+class Function;
+
 class Instruction;
 
 class Value;
@@ -24,8 +26,10 @@ using namespace llvm;
 
 #include "vectorShape.h"
 #include "vectorMapping.h"
-#include <map>
-#include <set>
+#include <vector>
+
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/DenseMap.h>
 
 
 namespace rv
@@ -34,21 +38,49 @@ namespace rv
 class Region;
 
 // provides vectorization information (vector shapes, block predicates) for a function
+//
+// Values and blocks are numbered when the VectorizationInfo is created, values that
+// are created later on get the next free id when they are first annotated.
+// All properties are stored in dense tables indexed by these ids.
 class VectorizationInfo
 {
     VectorMapping mapping;
-    std::map<const BasicBlock*, Value*> predicates;
-    std::map<const Value*, VectorShape> shapes;
-    std::map<const BasicBlock*, const Loop*> loopAsDivergenceLevel;
 
-    std::set<const BasicBlock*> ABABlocks;
-    std::set<const BasicBlock*> ABAONBlocks;
-    std::set<const BasicBlock*> NotABABlocks;
+    // value numbering
+    DenseMap<const Value*, unsigned> valueIds;
+    std::vector<VectorShape> shapes;
+    BitVector knownShapes;
+    BitVector MetadataMaskInsts;
+    BitVector NarrowValues;
 
-    std::set<const BasicBlock*> MandatoryBlocks;
+    // block numbering
+    DenseMap<const BasicBlock*, unsigned> blockIds;
+    std::vector<Value*> predicates;
+    std::vector<const Loop*> loopAsDivergenceLevel;
+    BitVector DivergentBlocks;
+
+    BitVector ABABlocks;
+    BitVector ABAONBlocks;
+    BitVector NotABABlocks;
+
+    BitVector MandatoryBlocks;
 
     Region* region;
-    std::set<const Instruction*> MetadataMaskInsts;
+
+    void numberFunction(const Function& F);
+
+    // returns the id of @val/@block, numbering it if it has none yet
+    unsigned getOrCreateId(const Value& val);
+    unsigned getOrCreateId(const BasicBlock& block);
+
+    // returns -1 for values/blocks that were never numbered
+    int lookupId(const Value& val) const;
+    int lookupId(const BasicBlock& block) const;
+
+    static bool testBit(const BitVector& bits, int id)
+    {
+        return id >= 0 && (unsigned) id < bits.size() && bits.test(id);
+    }
 
 public:
     Region* getRegion() const
@@ -92,6 +124,7 @@ public:
     void dumpBlockInfo(const BasicBlock & block) const;
 
     void setDivergenceLevel(const BasicBlock& block, const Loop* level);
+    void dropDivergenceLevel(const BasicBlock& block);
 
     bool isAlwaysByAll(const BasicBlock* block) const;
     bool isAlwaysByAllOrNone(const BasicBlock* block) const;
@@ -105,6 +138,10 @@ public:
     void markMandatory(const BasicBlock* block);
     void markMetadataMask(const Instruction* inst);
 
+    // 64 bit integers whose lanes all fit into a signed 32 bit integer
+    bool isNarrowValue(const Value& val) const;
+    void markNarrowValue(const Value& val);
+
 };
 
 
@@ -0,0 +1,184 @@
+//===- AnalysisCache.cpp -----------------------------===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+
+#include "rv/analysis/AnalysisCache.h"
+
+#include <cassert>
+#include <chrono>
+
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/PostDominators.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace rv {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double
+elapsedMs(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+}
+
+AnalysisCache::AnalysisCache(Function& F)
+        : mFunction(F)
+{
+    for (unsigned i = 0; i < NumAnalysisKinds; ++i)
+    {
+        mNumBuilds[i] = 0;
+        mBuildTime[i] = 0.0;
+    }
+}
+
+AnalysisCache::~AnalysisCache()
+{
+    // the graphs refer to the trees
+    mDFG.reset();
+    mCDG.reset();
+}
+
+DominatorTree&
+AnalysisCache::getDomTree()
+{
+    if (!mDomTree)
+    {
+        auto start = Clock::now();
+        mDomTree.reset(new DominatorTree(mFunction));
+        mBuildTime[DomTree] += elapsedMs(start);
+        ++mNumBuilds[DomTree];
+    }
+    return *mDomTree;
+}
+
+PostDominatorTree&
+AnalysisCache::getPostDomTree()
+{
+    if (!mPostDomTree)
+    {
+        auto start = Clock::now();
+        mPostDomTree.reset(new PostDominatorTree());
+        mPostDomTree->runOnFunction(mFunction);
+        mBuildTime[PostDomTree] += elapsedMs(start);
+        ++mNumBuilds[PostDomTree];
+    }
+    return *mPostDomTree;
+}
+
+LoopInfo&
+AnalysisCache::getLoopInfo()
+{
+    if (!mLoopInfo)
+    {
+        DominatorTree& domTree = getDomTree();
+        auto start = Clock::now();
+        mLoopInfo.reset(new LoopInfo(domTree));
+        mBuildTime[Loops] += elapsedMs(start);
+        ++mNumBuilds[Loops];
+    }
+    return *mLoopInfo;
+}
+
+DFG&
+AnalysisCache::getDFG()
+{
+    if (!mDFG)
+    {
+        DominatorTree& domTree = getDomTree();
+        auto start = Clock::now();
+        mDFG.reset(new DFG(domTree));
+        mDFG->create(mFunction);
+        mBuildTime[DominanceFrontier] += elapsedMs(start);
+        ++mNumBuilds[DominanceFrontier];
+    }
+    return *mDFG;
+}
+
+CDG&
+AnalysisCache::getCDG()
+{
+    if (!mCDG)
+    {
+        PostDominatorTree& postDomTree = getPostDomTree();
+        auto start = Clock::now();
+        mCDG.reset(new CDG(*postDomTree.DT));
+        mCDG->create(mFunction);
+        mBuildTime[ControlDependence] += elapsedMs(start);
+        ++mNumBuilds[ControlDependence];
+    }
+    return *mCDG;
+}
+
+bool
+AnalysisCache::isValid(AnalysisKind kind) const
+{
+    switch (kind)
+    {
+        case DomTree:           return (bool) mDomTree;
+        case PostDomTree:       return (bool) mPostDomTree;
+        case Loops:             return (bool) mLoopInfo;
+        case DominanceFrontier: return (bool) mDFG;
+        case ControlDependence: return (bool) mCDG;
+        default: break;
+    }
+    assert (false && "unknown analysis kind");
+    return false;
+}
+
+void
+AnalysisCache::invalidate(const PreservedAnalyses& preserved)
+{
+    // derived graphs go first, they refer to the trees
+    if (!preserved.preserves(DominanceFrontier) || !preserved.preserves(DomTree))
+    {
+        mDFG.reset();
+    }
+    if (!preserved.preserves(ControlDependence) || !preserved.preserves(PostDomTree))
+    {
+        mCDG.reset();
+    }
+
+    if (!preserved.preserves(DomTree)) mDomTree.reset();
+    if (!preserved.preserves(PostDomTree)) mPostDomTree.reset();
+    if (!preserved.preserves(Loops)) mLoopInfo.reset();
+}
+
+const char*
+AnalysisCache::getName(AnalysisKind kind)
+{
+    switch (kind)
+    {
+        case DomTree:           return "dominator tree";
+        case PostDomTree:       return "post dominator tree";
+        case Loops:             return "loop info";
+        case DominanceFrontier: return "dominance frontier graph";
+        case ControlDependence: return "control dependence graph";
+        default: break;
+    }
+    return "<unknown>";
+}
+
+void
+AnalysisCache::print(raw_ostream& out) const
+{
+    out << "Analyses of function " << mFunction.getName() << ":\n";
+    for (unsigned i = 0; i < NumAnalysisKinds; ++i)
+    {
+        AnalysisKind kind = static_cast<AnalysisKind>(i);
+        out << "  " << getName(kind) << ": " << mNumBuilds[i] << " builds, "
+            << format("%.3f", mBuildTime[i]) << " ms\n";
+    }
+}
+
+}
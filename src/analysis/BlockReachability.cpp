@@ -0,0 +1,118 @@
+//===- BlockReachability.cpp -----------------------------===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// @authors simon
+//
+
+#include "rv/analysis/BlockReachability.h"
+
+#include <cassert>
+
+#include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Function.h>
+
+namespace rv {
+
+BlockReachability::BlockReachability(const Function& func, const LoopInfo& loopInfo)
+        : mLoopInfo(loopInfo),
+          mNumQueries(0),
+          mNumCacheHits(0)
+{
+    ReversePostOrderTraversal<const Function*> rpot(&func);
+    for (const BasicBlock* block : rpot)
+    {
+        mIndex[block] = mBlocks.size();
+        mBlocks.push_back(block);
+    }
+
+    for (const BasicBlock& block : func)
+    {
+        if (mIndex.count(&block)) continue;
+        mIndex[&block] = mBlocks.size();
+        mBlocks.push_back(&block);
+    }
+}
+
+unsigned
+BlockReachability::getIndex(const BasicBlock& block) const
+{
+    auto it = mIndex.find(&block);
+    assert (it != mIndex.end() && "block of another function or added later");
+    return it->second;
+}
+
+bool
+BlockReachability::isReachable(const BasicBlock& target,
+                               const BasicBlock& source,
+                               const BasicBlock* doNotTraverse,
+                               const Loop*       loop,
+                               const bool        noBackEdges)
+{
+    return getReachableBlocks(source, doNotTraverse, loop, noBackEdges).test(getIndex(target));
+}
+
+const BitVector&
+BlockReachability::getReachableBlocks(const BasicBlock& source,
+                                      const BasicBlock* doNotTraverse,
+                                      const Loop*       loop,
+                                      const bool        noBackEdges)
+{
+    ++mNumQueries;
+    auto key = std::make_tuple(&source, doNotTraverse, loop, noBackEdges);
+    auto cached = mReachableBlocks.find(key);
+    if (cached != mReachableBlocks.end())
+    {
+        ++mNumCacheHits;
+        return cached->second;
+    }
+
+    BitVector& reached = mReachableBlocks[key];
+    reached.resize(mBlocks.size());
+
+    const BasicBlock* latchBB = loop ? loop->getLoopLatch() : nullptr;
+    const BasicBlock* headerBB = loop ? loop->getHeader() : nullptr;
+
+    SmallVector<const BasicBlock*, 16> workList;
+    workList.push_back(&source);
+    reached.set(getIndex(source));
+
+    while (!workList.empty())
+    {
+        const BasicBlock* block = workList.pop_back_val();
+        if (block == doNotTraverse) continue;
+
+        for (const BasicBlock* succBB : successors(block))
+        {
+            if (loop && !loop->contains(succBB)) continue;
+            if (headerBB == succBB && latchBB == block) continue;
+
+            if (noBackEdges)
+            {
+                const Loop* succLoop = mLoopInfo.getLoopFor(succBB);
+                if (succLoop &&
+                    succLoop->getHeader() == succBB &&
+                    succLoop->getLoopLatch() == block)
+                {
+                    continue;
+                }
+            }
+
+            unsigned succIdx = getIndex(*succBB);
+            if (reached.test(succIdx)) continue;
+            reached.set(succIdx);
+            workList.push_back(succBB);
+        }
+    }
+
+    return reached;
+}
+
+}
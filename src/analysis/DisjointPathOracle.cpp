@@ -0,0 +1,233 @@
+//===- DisjointPathOracle.cpp -----------------------------===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// @authors simon
+//
+
+#include "rv/analysis/DisjointPathOracle.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include <llvm/ADT/BitVector.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+
+#include "SketchGraph.h"
+
+namespace rv {
+
+DisjointPathOracle::DisjointPathOracle(const DominatorTree& domTree, const LoopInfo& loopInfo)
+        : mDomTree(domTree),
+          mLoopInfo(loopInfo),
+          mNumQueries(0),
+          mNumCacheHits(0)
+{
+}
+
+DisjointPathOracle::~DisjointPathOracle()
+{
+}
+
+void
+DisjointPathOracle::clear()
+{
+    mRegions.clear();
+    mJoinCache.clear();
+    mLoopExitCache.clear();
+}
+
+const DisjointPathOracle::RegionGraph&
+DisjointPathOracle::getRegion(const BasicBlock& root)
+{
+    auto& region = mRegions[&root];
+    if (region) return *region;
+
+    NodeSet exitingNodes;
+    std::unique_ptr<SketchGraph> sketch(SketchGraph::createFromDominatorNode(mDomTree, root, exitingNodes));
+
+    region.reset(new RegionGraph());
+    for (auto& it : *sketch)
+    {
+        region->index[it.second] = region->blocks.size();
+        region->blocks.push_back(it.second);
+    }
+
+    region->succs.resize(region->blocks.size());
+    for (auto& it : *sketch)
+    {
+        auto& succs = region->succs[region->index[it.second]];
+        for (SketchNode* succNode : *it.first)
+        {
+            const BasicBlock* succ = sketch->getBlock(*succNode);
+            if (succ == &root) continue; // back edge of the region loop
+            succs.push_back(region->index[succ]);
+        }
+    }
+
+    return *region;
+}
+
+bool
+DisjointPathOracle::joinsAt(const BasicBlock& branchBlock, const BasicBlock& block)
+{
+    ++mNumQueries;
+    auto key = std::make_pair(&branchBlock, &block);
+    auto cached = mJoinCache.find(key);
+    if (cached != mJoinCache.end())
+    {
+        ++mNumCacheHits;
+        return cached->second;
+    }
+
+    const Loop* loop = mLoopInfo.getLoopFor(&block);
+    const BasicBlock& root = loop ? *loop->getHeader() : block.getParent()->getEntryBlock();
+
+    bool result = false;
+    if (&block != &root) // only back edges reach the root
+    {
+        const RegionGraph& region = getRegion(root);
+        auto startIt = region.index.find(&branchBlock);
+        if (startIt != region.index.end())
+        {
+            BitVector isSink(region.blocks.size());
+            SmallVector<unsigned, 8> sinks;
+            for (const BasicBlock* pred : predecessors(&block))
+            {
+                auto predIt = region.index.find(pred);
+                if (predIt == region.index.end() || isSink[predIt->second]) continue;
+                isSink.set(predIt->second);
+                sinks.push_back(predIt->second);
+            }
+
+            result = sinks.size() >= 2 && hasTwoDisjointPaths(region, startIt->second, sinks);
+        }
+    }
+
+    mJoinCache[key] = result;
+    return result;
+}
+
+bool
+DisjointPathOracle::reachesExitAndLatch(const BasicBlock& branchBlock,
+                                        const BasicBlock& exitBlock,
+                                        const Loop& loop)
+{
+    ++mNumQueries;
+    auto key = std::make_tuple(&branchBlock, &exitBlock, &loop);
+    auto cached = mLoopExitCache.find(key);
+    if (cached != mLoopExitCache.end())
+    {
+        ++mNumCacheHits;
+        return cached->second;
+    }
+
+    assert (exitBlock.getUniquePredecessor() && "exit block without unique exiting block");
+
+    bool result = false;
+    const BasicBlock* latch = loop.getLoopLatch();
+    if (latch)
+    {
+        // The exit block is dominated by its exiting block and thus part of the header's region
+        const RegionGraph& region = getRegion(*loop.getHeader());
+        auto startIt = region.index.find(&branchBlock);
+        auto exitIt = region.index.find(&exitBlock);
+        auto latchIt = region.index.find(latch);
+
+        if (startIt != region.index.end() &&
+            exitIt != region.index.end() &&
+            latchIt != region.index.end())
+        {
+            unsigned sinks[] = { exitIt->second, latchIt->second };
+            result = hasTwoDisjointPaths(region, startIt->second, sinks);
+        }
+    }
+
+    mLoopExitCache[key] = result;
+    return result;
+}
+
+bool
+DisjointPathOracle::hasTwoDisjointPaths(const RegionGraph& graph, unsigned start, ArrayRef<unsigned> sinks)
+{
+    // Block u is split into in(u) = 2u and out(u) = 2u + 1, joined by an edge of capacity one.
+    // Paths start in out(start), so the start block is shared by both paths but never re-entered.
+    const unsigned numBlocks = graph.blocks.size();
+    const unsigned target = 2 * numBlocks;
+    const unsigned source = 2 * start + 1;
+
+    struct FlowEdge { unsigned to; int cap; };
+    std::vector<FlowEdge> edges;
+    std::vector<SmallVector<unsigned, 4>> adj(target + 1);
+
+    // edge e and its residual edge e ^ 1
+    auto addEdge = [&](unsigned from, unsigned to)
+    {
+        adj[from].push_back(edges.size());
+        edges.push_back({ to, 1 });
+        adj[to].push_back(edges.size());
+        edges.push_back({ from, 0 });
+    };
+
+    for (unsigned u = 0; u < numBlocks; ++u)
+    {
+        if (u != start) addEdge(2 * u, 2 * u + 1);
+        for (unsigned w : graph.succs[u])
+        {
+            if (w != start) addEdge(2 * u + 1, 2 * w);
+        }
+    }
+
+    // a path may end right away if the start block is a sink itself
+    for (unsigned sink : sinks)
+    {
+        addEdge(2 * sink + 1, target);
+    }
+
+    // two augmenting paths in the residual graph
+    std::vector<int> parentEdge(target + 1);
+    std::vector<unsigned> queue;
+    for (int flow = 0; flow < 2; ++flow)
+    {
+        std::fill(parentEdge.begin(), parentEdge.end(), -1);
+        queue.clear();
+        queue.push_back(source);
+
+        bool reached = false;
+        for (unsigned head = 0; head < queue.size() && !reached; ++head)
+        {
+            unsigned node = queue[head];
+            for (unsigned e : adj[node])
+            {
+                unsigned to = edges[e].to;
+                if (edges[e].cap == 0 || to == source || parentEdge[to] != -1) continue;
+                parentEdge[to] = e;
+                if (to == target)
+                {
+                    reached = true;
+                    break;
+                }
+                queue.push_back(to);
+            }
+        }
+
+        if (!reached) return false;
+
+        for (unsigned node = target; node != source; node = edges[parentEdge[node] ^ 1].to)
+        {
+            edges[parentEdge[node]].cap -= 1;
+            edges[parentEdge[node] ^ 1].cap += 1;
+        }
+    }
+
+    return true;
+}
+
+}
@@ -5,6 +5,11 @@
 // This file is distributed under the University of Illinois Open Source
 // License. See LICENSE.TXT for details.
 //
+// The disjoint path queries of the divergence analysis are answered by the
+// DisjointPathOracle, which only reads the region graph built by
+// createFromDominatorNode. The path search, dead-end elimination and
+// confluence contraction are no longer used by the analysis.
+//
 
 
 #ifndef SRC_ANALYSIS_SKETCHGRAPH_H_
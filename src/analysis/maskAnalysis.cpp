@@ -10,8 +10,10 @@
 
 #include "rv/analysis/maskAnalysis.h"
 
+#include <algorithm>
 #include <stdexcept>
 
+#include <llvm/ADT/SmallPtrSet.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/CFG.h> // pred_begin() etc.
 
@@ -54,22 +56,7 @@ MaskAnalysisWrapper::MaskAnalysisWrapper()
 
 MaskAnalysis::~MaskAnalysis()
 {
-    for (auto &it : mBlockMap) {
-        delete it.second;
-    }
-
-    for (auto & it : mLoopMaskMap) {
-        delete it.second;
-    }
-
-    for (auto &it : mLoopExitMap) {
-        LoopExitMaskInfo* li = it.second;
-        delete li;
-    }
-
-    for (auto &mask : mMasks) {
-        mask.reset();
-    }
+    // The mask graph owns all masks and mask infos.
 }
 
 void
@@ -171,8 +158,9 @@ MaskAnalysis::analyze(Function& F)
 void
 MaskAnalysis::print(raw_ostream& O, const Module* M) const
 {
-    O << "Masks:\n";
-    for (auto &it : mMasks)
+    O << "Masks (" << mGraph.size() << ", "
+      << mGraph.getNumUniquedHits() << " shared):\n";
+    for (auto &it : mGraph)
     {
         it->print(O);
         //O << " " << it->mInsertPoint->getParent()->getName();
@@ -204,21 +192,6 @@ MaskAnalysis::print(raw_ostream& O, const Module* M) const
 }
 
 
-MaskPtr
-MaskAnalysis::createMask(const NodeType type,
-                         Instruction*   insertPoint)
-{
-    assert (insertPoint);
-
-    // Create shared pointer.
-    MaskPtr mask = std::make_shared<Mask>(type, insertPoint);
-
-    // Store shared pointer to prevent early deletion.
-    mMasks.push_back(mask);
-
-    return mask;
-}
-
 BlockMaskInfo*
 MaskAnalysis::getOrCreateBMIFor(BasicBlock* block)
 {
@@ -229,7 +202,7 @@ MaskAnalysis::getOrCreateBMIFor(BasicBlock* block)
         info = itBlockInfo->second;
         info->mExitMasks.clear();
     } else {
-        info = new BlockMaskInfo();
+        info = mGraph.createBlockMaskInfo();
         mBlockMap[block] = info;
     }
 
@@ -278,6 +251,8 @@ MaskAnalysis::createMaskGraph(Function& f)
         }
 #endif
     }
+
+    simplifyMaskGraph();
 }
 
 void
@@ -380,9 +355,7 @@ MaskAnalysis::createEntryMask(BasicBlock* block)
         {
             Function::arg_iterator A = block->getParent()->arg_begin();
             std::advance(A, mInfo.mMaskPosition);
-            MaskPtr entryMask = createMask(VALUE, insertPoint);
-            entryMask->mValue = &*A;
-            return entryMask;
+            return mGraph.getValue(&*A, insertPoint);
         }
 
         // assert(rv::hasMetadata(block, rv::WFV_METADATA_ALWAYS_BY_ALL_TRUE) == mvInfo.getVectorShape(*block).isUniform());
@@ -390,8 +363,7 @@ MaskAnalysis::createEntryMask(BasicBlock* block)
         assert ((mInfo.mDisableControlFlowDivAnalysis ||
                  mvInfo.getVectorShape(*block).isUniform()) &&
                 "entry block of function without mask argument must be ALWAYS_BY_ALL_TRUE");
-        MaskPtr entryMask = createMask(CONSTANT, insertPoint);
-        entryMask->mValue = mInfo.mConstBoolTrue;
+        MaskPtr entryMask = mGraph.getConstant(mInfo.mConstBoolTrue, insertPoint);
 
         DEBUG_RV( outs() << "  entryMask (1): "; entryMask->print(outs()); outs() << "\n"; );
         return entryMask;
@@ -406,8 +378,7 @@ MaskAnalysis::createEntryMask(BasicBlock* block)
         // so the mask is always entirely true.
         assert (mInfo.mMaskPosition == -1 &&
                 "function has mask argument, must not have ALWAYS_BY_ALL blocks!");
-        MaskPtr entryMask = createMask(CONSTANT, insertPoint);
-        entryMask->mValue = mInfo.mConstBoolTrue;
+        MaskPtr entryMask = mGraph.getConstant(mInfo.mConstBoolTrue, insertPoint);
 
         DEBUG_RV( outs() << "  entryMask (2): "; entryMask->print(outs()); outs() << "\n"; );
         return entryMask;
@@ -417,7 +388,7 @@ MaskAnalysis::createEntryMask(BasicBlock* block)
     // of its predecessor block.
     if (BasicBlock* predBB = block->getUniquePredecessor())
     {
-        MaskPtr entryMask = createMask(REFERENCE, insertPoint);
+        MaskPtr entryMask = mGraph.createNode(REFERENCE, insertPoint);
         entryMask->mIncomingDirs.push_back(predBB);
         entryMask->mIncomingDirs.push_back(block);
 
@@ -439,7 +410,7 @@ MaskAnalysis::createEntryMask(BasicBlock* block)
             // This is the header of a NON_DIVERGENT loop, so we have to make sure
             // that the entry mask is the exit mask of the preheader in all
             // iterations (no loop mask phi).
-            MaskPtr entryMask = createMask(REFERENCE, insertPoint);
+            MaskPtr entryMask = mGraph.createNode(REFERENCE, insertPoint);
             entryMask->mIncomingDirs.push_back(preheaderBB);
             entryMask->mIncomingDirs.push_back(block);
 
@@ -460,7 +431,7 @@ MaskAnalysis::createEntryMask(BasicBlock* block)
             //       the preheader mask being the first operand).
             // NOTE: The update operation is created and added as operand
             //       later during recursion.
-            MaskPtr entryMask = createMask(LOOPMASKPHI, block->getFirstNonPHI());
+            MaskPtr entryMask = mGraph.createNode(LOOPMASKPHI, block->getFirstNonPHI());
             entryMask->mOperands.push_back(preheaderOp);
             entryMask->mIncomingDirs.push_back(preheaderBB);
 
@@ -470,7 +441,7 @@ MaskAnalysis::createEntryMask(BasicBlock* block)
             if (itLoopMaskInfo != mLoopMaskMap.end()) {
               loopInfo = itLoopMaskInfo->second;
             } else {
-               loopInfo = new LoopMaskInfo();
+               loopInfo = mGraph.createLoopMaskInfo();
                mLoopMaskMap[loop] = loopInfo;
             }
             loopInfo->mLoop    = loop;
@@ -502,7 +473,7 @@ MaskAnalysis::createEntryMask(BasicBlock* block)
         assert (pred_begin(block) != pred_end(block) &&
                 "optional block must have predecessors!");
 
-        MaskPtr entryMask = createMask(PHI, block->getFirstNonPHI());
+        MaskPtr entryMask = mGraph.createNode(PHI, block->getFirstNonPHI());
 
         for (BasicBlock* predBB : predecessors(block))
         {
@@ -524,14 +495,14 @@ MaskAnalysis::createEntryMask(BasicBlock* block)
     // NOTE: We might have more than two incoming edges if there
     //       are no phis in the block!
 
-    MaskPtr entryMask = createMask(DISJUNCTION, insertPoint);
-
+    SmallVector<MaskPtr, 4> predOps;
     for (const BasicBlock* predBB : predecessors(block))
     {
-        MaskPtr predOp = getExitMaskPtr(*predBB, *block);
-        entryMask->mOperands.push_back(predOp);
+        predOps.push_back(getExitMaskPtr(*predBB, *block));
     }
 
+    MaskPtr entryMask = mGraph.getDisjunction(predOps, insertPoint);
+
     DEBUG_RV( outs() << "  entryMask (7): "; entryMask->print(outs()); outs() << "\n"; );
 
     return entryMask;
@@ -584,15 +555,12 @@ MaskAnalysis::createExitMasks(BasicBlock*              block,
 
             if (const BranchInst* brInst = dyn_cast<BranchInst>(terminator))
             {
-                condition = createMask(VALUE, insertPoint);
-                condition->mValue = brInst->getCondition();
+                condition = mGraph.getValue(brInst->getCondition(), insertPoint);
             }
             else if (SwitchInst* switchInst = dyn_cast<SwitchInst>(terminator))
             {
             	// if (succBB == switchInst->getDefaultDest()) continue;
 
-                condition = createMask(VALUE, insertPoint);
-
                 ConstantInt*       caseDest = switchInst->findCaseDest(succBB);
                 SwitchInst::CaseIt caseIt   = switchInst->findCaseValue(caseDest);
 
@@ -609,7 +577,7 @@ MaskAnalysis::createExitMasks(BasicBlock*              block,
                                              caseConst,
                                              "switchcmp"+str<int>(i));
 
-                condition->mValue = cmp;
+                condition = mGraph.getValue(cmp, insertPoint);
             }
             else
             {
@@ -619,8 +587,7 @@ MaskAnalysis::createExitMasks(BasicBlock*              block,
 
             trueMask = entryMask;
 
-            falseMask = createMask(VALUE, insertPoint);
-            falseMask->mValue = mInfo.mConstBoolFalse;
+            falseMask = mGraph.getValue(mInfo.mConstBoolFalse, insertPoint);
 
             const bool flipMasks = isa<BranchInst>(terminator) && i != 0;
             if (flipMasks)
@@ -633,10 +600,7 @@ MaskAnalysis::createExitMasks(BasicBlock*              block,
             DEBUG_RV( outs() << "  true mask  (2): "; trueMask->print(outs()); outs() << "\n"; );
             DEBUG_RV( outs() << "  false mask (2): "; falseMask->print(outs()); outs() << "\n"; );
 
-            MaskPtr exitMask = createMask(SELECT, insertPoint);
-            exitMask->mOperands.push_back(condition);
-            exitMask->mOperands.push_back(trueMask);
-            exitMask->mOperands.push_back(falseMask);
+            MaskPtr exitMask = mGraph.getSelect(condition, trueMask, falseMask, insertPoint);
 
             exitMasks.push_back(exitMask);
 
@@ -659,20 +623,17 @@ MaskAnalysis::createExitMasks(BasicBlock*              block,
         {
             if (i == 0)
             {
-                condition = createMask(VALUE, insertPoint);
-                condition->mValue = brInst->getCondition();
+                condition = mGraph.getValue(brInst->getCondition(), insertPoint);
                 DEBUG_RV( outs() << "  condition (1): "; condition->print(outs()); outs() << "\n"; );
             }
             else
             {
                 assert (i == 1);
-                MaskPtr cmp = createMask(VALUE, insertPoint);
-                cmp->mValue = brInst->getCondition();
+                MaskPtr cmp = mGraph.getValue(brInst->getCondition(), insertPoint);
                 DEBUG_RV( outs() << "  cmp      : "; cmp->print(outs()); outs() << "\n"; );
 
                 // We have to negate the condition since this is the 'false' edge.
-                condition = createMask(NEGATE, insertPoint);
-                condition->mOperands.push_back(cmp);
+                condition = mGraph.getNegate(cmp, insertPoint);
                 DEBUG_RV( outs() << "  condition (2): "; condition->print(outs()); outs() << "\n"; );
             }
         }
@@ -680,8 +641,6 @@ MaskAnalysis::createExitMasks(BasicBlock*              block,
         {
         	// if (succBB == switchInst->getDefaultDest()) continue;
 
-            condition = createMask(VALUE, insertPoint);
-
             ConstantInt*       caseDest = switchInst->findCaseDest(succBB);
             SwitchInst::CaseIt caseIt   = switchInst->findCaseValue(caseDest);
 
@@ -698,7 +657,7 @@ MaskAnalysis::createExitMasks(BasicBlock*              block,
                                          caseConst,
                                          "switchcmp"+str<int>(i));
 
-            condition->mValue = cmp;
+            condition = mGraph.getValue(cmp, insertPoint);
             DEBUG_RV( outs() << "  condition (3): "; condition->print(outs()); outs() << "\n"; );
         }
         else
@@ -708,9 +667,8 @@ MaskAnalysis::createExitMasks(BasicBlock*              block,
         }
 
 
-        MaskPtr exitMask = createMask(CONJUNCTION, insertPoint);
-        exitMask->mOperands.push_back(entryMask);
-        exitMask->mOperands.push_back(condition);
+        MaskPtr operands[] = { entryMask, condition };
+        MaskPtr exitMask = mGraph.getConjunction(operands, insertPoint);
 
         exitMasks.push_back(exitMask);
 
@@ -765,12 +723,12 @@ MaskAnalysis::createLoopExitMasks(Loop* loop)
             if (mLoopExitMap.count(exitingBlock))
             {
                 setLoopExitMaskPtrPhi(*loop, *exitingBlock,
-                                      createMask(LOOPEXITPHI, insertPoint));
+                                      mGraph.createNode(LOOPEXITPHI, insertPoint));
                 continue;
             }
 
             // Otherwise, create a new entry for the map.
-            LoopExitMaskInfo* info = new LoopExitMaskInfo();
+            LoopExitMaskInfo* info = mGraph.createLoopExitMaskInfo();
 
             // Derive & store information about this exit.
             // NOTE: There can be a difference between the top level loop
@@ -788,7 +746,7 @@ MaskAnalysis::createLoopExitMasks(Loop* loop)
             info->mTarget           = exitBlock;
             info->mInnermostLoop    = innermostLoop;
             info->mTopLevelLoop     = topLevelLoop;
-            info->mMaskPhiMap[loop] = createMask(LOOPEXITPHI, insertPoint);
+            info->mMaskPhiMap[loop] = mGraph.createNode(LOOPEXITPHI, insertPoint);
 
             mLoopExitMap[exitingBlock] = info;
         }
@@ -873,8 +831,7 @@ MaskAnalysis::createLoopExitMasks(Loop* loop)
         // It is updated in the parent loop).
         // NOTE: Mask materialization (MaskGenerator.cpp) relies on
         //       the preheader mask being the first operand).
-        MaskPtr boolZeroConstMask = createMask(CONSTANT, insertPoint);
-        boolZeroConstMask->mValue = mInfo.mConstBoolFalse;
+        MaskPtr boolZeroConstMask = mGraph.getConstant(mInfo.mConstBoolFalse, insertPoint);
 
         exitMaskPhi->mOperands.push_back(boolZeroConstMask);
         exitMaskPhi->mIncomingDirs.push_back(preheaderBB);
@@ -885,7 +842,7 @@ MaskAnalysis::createLoopExitMasks(Loop* loop)
         //     ((negated) branch condition)
         // - if in non-innermost loop of multi-loop exit:
         //     new 'or' of loop's mask phi and the 'or' of the next nested loop.
-        MaskPtr maskUpdateOp = createMask(LOOPEXITUPDATE, insertPoint);
+        MaskPtr maskUpdateOp = mGraph.createNode(LOOPEXITUPDATE, insertPoint);
         maskUpdateOp->mOperands.push_back(exitMaskPhi);
 
         if (exitsMultipleLoops && !isInnermostLoopOfExit)
@@ -990,15 +947,15 @@ MaskAnalysis::createLoopExitMasks(Loop* loop)
                 outs() << "\n";
             );
             assert (loopExitMask->mType == LOOPEXITUPDATE);
-            assert (loopExitMask->mOperands[0].lock()->mType == LOOPEXITPHI);
+            assert (loopExitMask->mOperands[0]->mType == LOOPEXITPHI);
 
             // We need only those instances that left the loop in the current iteration
             // of the current loop (which may include multiple iterations of all inner
             // loops of that exit). These instances are given by the update operation
             // of the next nested loop or the exit mask if this is the innermost loop.
             assert (exitInfo->mInnermostLoop == loop ||
-                    loopExitMask->mOperands[1].lock()->mType == LOOPEXITUPDATE);
-            loopExitMask = loopExitMask->mOperands[1].lock();
+                    loopExitMask->mOperands[1]->mType == LOOPEXITUPDATE);
+            loopExitMask = loopExitMask->mOperands[1];
         }
 
         DEBUG_RV( outs() << "  input mask: "; loopExitMask->print(outs()); outs() << "\n"; );
@@ -1010,10 +967,8 @@ MaskAnalysis::createLoopExitMasks(Loop* loop)
         }
         else
         {
-            MaskPtr newCombinedMask = createMask(DISJUNCTION, insertPoint);
-            newCombinedMask->mOperands.push_back(combinedMask);
-            newCombinedMask->mOperands.push_back(loopExitMask);
-            combinedMask = newCombinedMask;
+            MaskPtr operands[] = { combinedMask, loopExitMask };
+            combinedMask = mGraph.getDisjunction(operands, insertPoint);
         }
     }
 
@@ -1027,10 +982,310 @@ MaskAnalysis::createLoopExitMasks(Loop* loop)
     return;
 }
 
+bool
+MaskAnalysis::isConstantMask(const Mask& mask,
+                             const bool  value) const
+{
+    if (mask.mType != CONSTANT && mask.mType != VALUE) return false;
+    return mask.mValue == (value ? mInfo.mConstBoolTrue : mInfo.mConstBoolFalse);
+}
+
+// Builds the conjunction or disjunction of the operands (which are simplified
+// already). Nested junctions of the same kind are flattened, then constants,
+// duplicates, complements (a & !a), absorbed operands (a | (a & b)) and common
+// factors ((a & b) | (a & c) -> a & (b | c)) are removed.
+MaskPtr
+MaskAnalysis::createJunction(const NodeType    type,
+                             ArrayRef<MaskPtr> operands,
+                             Instruction*      insertPoint)
+{
+    assert (type == CONJUNCTION || type == DISJUNCTION);
+    const bool     isAnd = type == CONJUNCTION;
+    const NodeType dual  = isAnd ? DISJUNCTION : CONJUNCTION;
+
+    MaskPtr absorbing = mGraph.getConstant(isAnd ? mInfo.mConstBoolFalse : mInfo.mConstBoolTrue,
+                                           insertPoint);
+
+    SmallVector<MaskPtr, 4> flat;
+    for (MaskPtr op : operands)
+    {
+        if (op->mType == type) flat.append(op->mOperands.begin(), op->mOperands.end());
+        else flat.push_back(op);
+    }
+
+    SmallVector<MaskPtr, 4> ops;
+    SmallPtrSet<MaskPtr, 8> seen;
+    for (MaskPtr op : flat)
+    {
+        if (isConstantMask(*op, isAnd)) continue; // neutral element
+        if (isConstantMask(*op, !isAnd)) return absorbing;
+        if (seen.insert(op).second) ops.push_back(op);
+    }
+
+    // complement elimination
+    for (MaskPtr op : ops)
+    {
+        if (op->mType == NEGATE && seen.count(op->mOperands[0])) return absorbing;
+    }
+
+    // absorption
+    auto isAbsorbed = [&](MaskPtr op)
+    {
+        if (op->mType != dual) return false;
+        for (MaskPtr dualOp : op->mOperands)
+        {
+            if (seen.count(dualOp)) return true;
+        }
+        return false;
+    };
+    ops.erase(std::remove_if(ops.begin(), ops.end(), isAbsorbed), ops.end());
+
+    if (ops.empty()) return mGraph.getConstant(isAnd ? mInfo.mConstBoolTrue : mInfo.mConstBoolFalse,
+                                               insertPoint);
+    if (ops.size() == 1) return ops[0];
+
+    // factoring: all operands are dual junctions sharing some operands
+    bool allDual = true;
+    for (MaskPtr op : ops) allDual &= op->mType == dual;
+
+    if (allDual)
+    {
+        SmallVector<MaskPtr, 4> common;
+        for (MaskPtr candidate : ops[0]->mOperands)
+        {
+            bool isCommon = true;
+            for (unsigned i = 1, e = ops.size(); i < e && isCommon; ++i)
+            {
+                isCommon = std::find(ops[i]->mOperands.begin(), ops[i]->mOperands.end(), candidate) !=
+                           ops[i]->mOperands.end();
+            }
+            if (isCommon) common.push_back(candidate);
+        }
+
+        if (!common.empty())
+        {
+            SmallVector<MaskPtr, 4> rests;
+            for (MaskPtr op : ops)
+            {
+                SmallVector<MaskPtr, 4> rest;
+                for (MaskPtr dualOp : op->mOperands)
+                {
+                    if (std::find(common.begin(), common.end(), dualOp) == common.end()) rest.push_back(dualOp);
+                }
+                rests.push_back(createJunction(dual, rest, insertPoint));
+            }
+
+            common.push_back(createJunction(type, rests, insertPoint));
+            return createJunction(dual, common, insertPoint);
+        }
+    }
+
+    return isAnd ? mGraph.getConjunction(ops, insertPoint) : mGraph.getDisjunction(ops, insertPoint);
+}
+
+MaskPtr
+MaskAnalysis::simplifyMask(MaskPtr            mask,
+                           SimplifiedMaskMap& simplified)
+{
+    assert (mask);
+
+    auto it = simplified.find(mask);
+    if (it != simplified.end()) return it->second;
+
+    MaskPtr result = mask;
+    switch (mask->mType)
+    {
+        case CONSTANT:
+        case VALUE:
+        {
+            if (isConstantMask(*mask, true) || isConstantMask(*mask, false))
+            {
+                result = mGraph.getConstant(mask->mValue, mask->mInsertPoint);
+            }
+            break;
+        }
+
+        case NEGATE:
+        {
+            MaskPtr op = simplifyMask(mask->mOperands[0], simplified);
+            if (isConstantMask(*op, true))
+                result = mGraph.getConstant(mInfo.mConstBoolFalse, mask->mInsertPoint);
+            else if (isConstantMask(*op, false))
+                result = mGraph.getConstant(mInfo.mConstBoolTrue, mask->mInsertPoint);
+            else if (op->mType == NEGATE)
+                result = op->mOperands[0];
+            else
+                result = mGraph.getNegate(op, mask->mInsertPoint);
+            break;
+        }
+
+        case CONJUNCTION:
+        case DISJUNCTION:
+        {
+            SmallVector<MaskPtr, 4> ops;
+            for (MaskPtr op : mask->mOperands) ops.push_back(simplifyMask(op, simplified));
+            result = createJunction(mask->mType, ops, mask->mInsertPoint);
+            break;
+        }
+
+        case SELECT:
+        {
+            MaskPtr condition = simplifyMask(mask->mOperands[0], simplified);
+            MaskPtr trueMask  = simplifyMask(mask->mOperands[1], simplified);
+            MaskPtr falseMask = simplifyMask(mask->mOperands[2], simplified);
+            Instruction* insertPoint = mask->mInsertPoint;
+
+            if (isConstantMask(*condition, true) || trueMask == falseMask)
+            {
+                result = trueMask;
+            }
+            else if (isConstantMask(*condition, false))
+            {
+                result = falseMask;
+            }
+            else if (isConstantMask(*falseMask, false))
+            {
+                MaskPtr ops[] = { condition, trueMask };
+                result = createJunction(CONJUNCTION, ops, insertPoint);
+            }
+            else if (isConstantMask(*trueMask, false))
+            {
+                MaskPtr ops[] = { simplifyMask(mGraph.getNegate(condition, insertPoint), simplified), falseMask };
+                result = createJunction(CONJUNCTION, ops, insertPoint);
+            }
+            else if (isConstantMask(*trueMask, true))
+            {
+                MaskPtr ops[] = { condition, falseMask };
+                result = createJunction(DISJUNCTION, ops, insertPoint);
+            }
+            else
+            {
+                result = mGraph.getSelect(condition, trueMask, falseMask, insertPoint);
+            }
+            break;
+        }
+
+        case REFERENCE:
+        {
+            // Resolve the reference, it is only a placeholder for the exit mask of the edge.
+            simplified[mask] = mask; // cut cycles
+            result = simplifyMask(getExitMaskPtr(*mask->mIncomingDirs[0], *mask->mIncomingDirs[1]),
+                                  simplified);
+            break;
+        }
+
+        default:
+        {
+            // Phis and loop exit updates are completed after creation and thus never
+            // rebuilt, only their operands are simplified.
+            simplified[mask] = mask;
+            for (auto& op : mask->mOperands) op = simplifyMask(op, simplified);
+            break;
+        }
+    }
+
+    simplified[mask] = result;
+    return result;
+}
+
+unsigned
+MaskAnalysis::countMaskOperations() const
+{
+    SmallPtrSet<const Mask*, 32> visited;
+    SmallVector<const Mask*, 32> worklist;
+
+    for (auto& it : mBlockMap)
+    {
+        if (it.second->mEntryMask) worklist.push_back(it.second->mEntryMask);
+        for (MaskPtr exitMask : it.second->mExitMasks) worklist.push_back(exitMask);
+    }
+    for (auto& it : mLoopMaskMap)
+    {
+        if (it.second->mCombinedLoopExitMask) worklist.push_back(it.second->mCombinedLoopExitMask);
+    }
+    for (auto& it : mLoopExitMap)
+    {
+        for (auto& phi : it.second->mMaskPhiMap) worklist.push_back(phi.second);
+    }
+
+    unsigned numOperations = 0;
+    while (!worklist.empty())
+    {
+        const Mask* mask = worklist.pop_back_val();
+        if (!visited.insert(mask).second) continue;
+
+        switch (mask->mType)
+        {
+            case CONSTANT:
+            case VALUE:
+                break;
+            case REFERENCE:
+                worklist.push_back(getExitMaskPtr(*mask->mIncomingDirs[0], *mask->mIncomingDirs[1]));
+                break;
+            case CONJUNCTION:
+            case DISJUNCTION:
+                numOperations += mask->mOperands.size() - 1;
+                break;
+            default:
+                ++numOperations;
+                break;
+        }
+
+        worklist.append(mask->mOperands.begin(), mask->mOperands.end());
+    }
+
+    return numOperations;
+}
+
+void
+MaskAnalysis::simplifyMaskGraph()
+{
+    mStats.numOperationsBefore = countMaskOperations();
+
+    SimplifiedMaskMap simplified;
+
+    for (auto& it : mBlockMap)
+    {
+        BlockMaskInfo* info = it.second;
+
+        // If a block is executed, all instances are active (see createEntryMask()).
+        if (mInfo.mMaskPosition == -1 &&
+            (mvInfo.isAlwaysByAll(info->mBlock) || mvInfo.isAlwaysByAllOrNone(info->mBlock)))
+        {
+            Instruction* insertPoint = &*info->mBlock->getFirstInsertionPt();
+            info->mEntryMask = mGraph.getConstant(mInfo.mConstBoolTrue, insertPoint);
+        }
+
+        info->mEntryMask = simplifyMask(info->mEntryMask, simplified);
+        for (auto& exitMask : info->mExitMasks)
+        {
+            exitMask = simplifyMask(exitMask, simplified);
+        }
+    }
+
+    for (auto& it : mLoopMaskMap)
+    {
+        LoopMaskInfo* info = it.second;
+        if (info->mMaskPhi) simplifyMask(info->mMaskPhi, simplified);
+        if (info->mCombinedLoopExitMask)
+        {
+            info->mCombinedLoopExitMask = simplifyMask(info->mCombinedLoopExitMask, simplified);
+        }
+    }
+
+    for (auto& it : mLoopExitMap)
+    {
+        for (auto& phi : it.second->mMaskPhiMap) simplifyMask(phi.second, simplified);
+        for (auto& update : it.second->mMaskUpdateOpMap) simplifyMask(update.second, simplified);
+    }
+
+    mStats.numOperationsAfter = countMaskOperations();
+}
+
 void
 MaskAnalysis::invalidateInsertPoints()
 {
-    for (auto &mask : mMasks)
+    for (auto &mask : mGraph)
     {
         assert (mask->mInsertPoint);
         mask->mInsertPoint = nullptr;
@@ -1042,12 +1297,13 @@ MaskAnalysis::invalidateInsertPoints()
 void
 MaskAnalysis::mapMaskValues(MaskValueMapType& valueMap)
 {
-    for (auto &mask : mMasks)
+    for (auto &mask : mGraph)
     {
         if (!mask->mValue) continue; // Mask not used.
         if (!valueMap.count(mask->mValue)) continue; // Mask not mapped.
         mask->mValue = valueMap[mask->mValue];
     }
+    mGraph.clearUniquingTable();
 }
 
 // This function maps the entire mask info structure including blocks.
@@ -1085,7 +1341,8 @@ MaskAnalysis::mapMaskInformation(ValueToValueMapTy& valueMap)
         li->mBlock  = cast<BasicBlock>(valueMap[li->mBlock]);
         li->mTarget = cast<BasicBlock>(valueMap[li->mTarget]);
     }
-    for (auto &mask : mMasks)
+    mGraph.clearUniquingTable();
+    for (auto &mask : mGraph)
     {
         for (unsigned long i = 0, e = mask->mIncomingDirs.size(); i < e; ++i)
         {
@@ -1302,7 +1559,7 @@ MaskAnalysis::copyMaskInfoToNewBlock(BasicBlock*       newBlock,
     assert (!mBlockMap.count(newBlock));
 
     // Store information in new graph node.
-    BlockMaskInfo* info = new BlockMaskInfo();
+    BlockMaskInfo* info = mGraph.createBlockMaskInfo();
     info->mBlock        = newBlock;
 
     // Copy entry mask.
@@ -1326,7 +1583,7 @@ MaskAnalysis::clearEntryMask(const BasicBlock& block)
 {
     assert (mBlockMap.count(&block));
     BlockMaskInfo* info = mBlockMap[&block];
-    info->mEntryMask.reset();
+    info->mEntryMask = nullptr;
 }
 
 void
@@ -1334,10 +1591,6 @@ MaskAnalysis::clearExitMasks(const BasicBlock& block)
 {
     assert (mBlockMap.count(&block));
     BlockMaskInfo* info = mBlockMap[&block];
-    for (auto &mask : info->mExitMasks)
-    {
-        mask.reset();
-    }
     info->mExitMasks.clear();
 }
 
@@ -1351,9 +1604,38 @@ MaskAnalysis::updateEntryMask(const BasicBlock& block,
 
     BlockMaskInfo* info = mBlockMap[&block];
 
-    MaskPtr mask = createMask(VALUE, insertPoint);
-    mask->mValue = newMask;
-    info->mEntryMask =mask;
+    info->mEntryMask = mGraph.getValue(newMask, insertPoint);
+}
+
+// Move the not yet materialized entry mask of @block from the top of the
+// block to @insertPoint. Only operations that were placed at the top of the
+// block itself are moved; phis and masks of dominating blocks stay put.
+// Returns true if the mask was moved.
+bool
+MaskAnalysis::sinkEntryMask(const BasicBlock& block,
+                            Instruction&      insertPoint)
+{
+    assert (insertPoint.getParent() == &block);
+    MaskPtr mask = getEntryMaskPtr(block);
+    if (mask->mValue) return false;
+
+    switch (mask->mType)
+    {
+        case NEGATE:
+        case CONJUNCTION:
+        case DISJUNCTION:
+        case SELECT:
+            break;
+        default:
+            return false;
+    }
+
+    if (mask->mInsertPoint != &*block.getFirstInsertionPt()) return false;
+
+    // The insert point is part of the uniquing key.
+    mask->mInsertPoint = &insertPoint;
+    mGraph.clearUniquingTable();
+    return true;
 }
 
 void
@@ -1367,15 +1649,11 @@ MaskAnalysis::updateExitMasks(const BasicBlock& block,
 
     BlockMaskInfo* info = mBlockMap[&block];
 
-    MaskPtr mask0 = createMask(VALUE, insertPoint);
-    mask0->mValue = newMask0;
-    info->mExitMasks.push_back(mask0);
+    info->mExitMasks.push_back(mGraph.getValue(newMask0, insertPoint));
 
     if (!newMask1) return;
 
-    MaskPtr mask1 = createMask(VALUE, insertPoint);
-    mask1->mValue = newMask1;
-    info->mExitMasks.push_back(mask1);
+    info->mExitMasks.push_back(mGraph.getValue(newMask1, insertPoint));
 }
 
 #if 0
@@ -1406,7 +1684,6 @@ MaskAnalysis::removeExitMask(const BasicBlock& block,
     assert (mBlockMap[&block]->mExitMasks.size() > index);
 
     BlockMaskInfo* info = mBlockMap[&block];
-    if (info->mExitMasks[index]) info->mExitMasks[index].reset();
     SmallVector<MaskPtr, 2>::iterator it = info->mExitMasks.begin();
     std::advance(it, index);
     info->mExitMasks.erase(it);
@@ -1443,10 +1720,6 @@ MaskAnalysis::setEntryMaskPtr(const BasicBlock& block,
     assert (mBlockMap.find(&block)->second);
 
     BlockMaskInfo* info = mBlockMap[&block];
-
-    MaskPtr oldMask = info->mEntryMask;
-    if (oldMask) oldMask.reset();
-
     info->mEntryMask = mask;
 }
 
@@ -1460,10 +1733,6 @@ MaskAnalysis::setExitMaskPtr(const BasicBlock& block,
     assert (mBlockMap.find(&block)->second->mExitMasks.size() > index);
 
     BlockMaskInfo* info = mBlockMap[&block];
-
-    MaskPtr oldMask = info->mExitMasks[index];
-    if (oldMask) oldMask.reset();
-
     info->mExitMasks[index] = mask;
 }
 
@@ -1499,13 +1768,6 @@ MaskAnalysis::setLoopExitMaskPtrPhi(const Loop&       loop,
     assert (mLoopExitMap.count(&exitingBlock));
 
     LoopExitMaskInfo* info = mLoopExitMap[&exitingBlock];
-
-    if (info->mMaskPhiMap.count(&loop))
-    {
-        MaskPtr oldMask = info->mMaskPhiMap[&loop];
-        oldMask.reset();
-    }
-
     info->mMaskPhiMap[&loop] = mask;
 }
 
@@ -1517,13 +1779,6 @@ MaskAnalysis::setLoopExitMaskPtrUpdate(const Loop&       loop,
     assert (mLoopExitMap.count(&exitingBlock));
 
     LoopExitMaskInfo* info = mLoopExitMap[&exitingBlock];
-
-    if (info->mMaskUpdateOpMap.count(&loop))
-    {
-        MaskPtr oldMask = info->mMaskUpdateOpMap[&loop];
-        oldMask.reset();
-    }
-
     info->mMaskUpdateOpMap[&loop] = mask;
 }
 
@@ -29,8 +29,6 @@
 
 #include "utils/rvTools.h"
 #include "utils/metadata.h"
-#include "SketchGraph.h"
-#include "PathFinder.h"
 
 #include "rvConfig.h"
 
@@ -60,6 +58,7 @@ IsMaskIntrinsic(CallInst * call) {
 	if (!callee) return false;
 	if (callee->getName() == "rv_any") return true;
 	if (callee->getName() == "rv_all") return true;
+	if (callee->getName() == "rv_popcount") return true;
 	return false;
 }
 
@@ -101,7 +100,8 @@ VectorizationAnalysis::VectorizationAnalysis(Function*                   scalarF
         mVectorizationFactor(vectorizationFactor),
         mLoopInfo(loopInfo),
         mPostDomTree(postDomTree),
-        mDomTree(domTree)
+        mDomTree(domTree),
+        mPathOracle(domTree, loopInfo)
 {
     // RVInterface should set disableMemAccessAnalysis and disableControlFlowDivAnalysis
     // to 'false' if disableAllAnalyses is set.
@@ -986,209 +986,57 @@ GetIDom(const DominatorTree & domTree, const BasicBlock & block) {
 
 bool
 VectorizationAnalysis::checkForDisjointLoopPaths(const BasicBlock*  exitBlock,
-				                                 const Loop*        loop,
-				                                 BlockSet*          divCauseBlocks) const {
-
-	NodeSet exitingNodes;
-	BasicBlock * entryBlock = &mScalarFunction->getEntryBlock();
-	SketchGraph * graph = nullptr;
-
-	const DomTreeNode * idom = GetIDom(mDomTree, *exitBlock);
-	BasicBlock * idomBlock = idom ? idom->getBlock() : nullptr;
-
-
-// Restrict the graph search to @loop and exiting edges from @loop to @exitBlock
-	BasicBlock * loopHeader = loop->getHeader();
-	const DomTreeNode * loopDom = mDomTree.getNode(loopHeader);
-
-	graph = SketchGraph::createFromDominatorNode(mDomTree, *loopHeader, exitingNodes);
-
-// get the node handle for the exiting node
-	const BasicBlock * exitingBlock = exitBlock->getUniquePredecessor();
-	assert(exitingBlock);
-	auto exitingNode = graph->getNode(*exitingBlock);
-
-// add the exiting node explicitly
-	SketchNode * exitNode = graph->push(exitBlock);
-	exitingNode->insert(exitNode);
-
-// only consider reachable edges
-	const BasicBlock * latchBlock = loop->getLoopLatch();
-#if 0
-	errs() << "Loop scope "; loop->print(errs());
-	llvm::errs() << "Graph "; graph->dump();
-	llvm::errs() << "Exit block: "<< exitBlock->getName() << "\n";
-	llvm::errs() << "Latch block: "<< latchBlock->getName() << "\n";
-#endif
-	SketchNode * latchNode = graph->getNode(*latchBlock);
-	if (!latchNode) {
-		return false; // FIXME
-	}
-
-	assert(latchNode && "latchNode killed during clean-up");
-	// except for the actual path enumeration, this is copied over from isMandatoryExit(..)
-	NodeSet accepting;
-	accepting.insert(exitNode);
-	accepting.insert(latchNode);
-	PathFinder finder(*graph, accepting);
-
-	const auto & loopBlocks = loop->getBlocks();
-
-	bool isMandatoryExit = false;
-    for (const auto * vBlock : loopBlocks) {
-		if (! rv::HasVaryingBranch(*vBlock, mVecInfo))
-			continue;
+                                                 const Loop*        loop,
+                                                 BlockSet*          divCauseBlocks) const {
+    const BasicBlock * latchBlock = loop->getLoopLatch();
+    if (!latchBlock) {
+        return false; // FIXME
+    }
 
-	   // this only applies to nodes, that vBlock does not post-dominate
-	   if ( mPostDomTree.dominates(exitBlock, vBlock) )
-		   continue;
+    for (const auto * vBlock : loop->getBlocks()) {
+        if (! rv::HasVaryingBranch(*vBlock, mVecInfo))
+            continue;
 
-	   if ( mPostDomTree.dominates(latchBlock, vBlock) )
-		   continue;
+        // this only applies to nodes, that vBlock does not post-dominate
+        if ( mPostDomTree.dominates(exitBlock, vBlock) )
+            continue;
 
-    // new path search algorithm starting from here
-		SketchNode * parentNode = graph->getNode(*vBlock);
-		assert(parentNode && "branch not modelled");
+        if ( mPostDomTree.dominates(latchBlock, vBlock) )
+            continue;
 
-		if (finder.findPath(parentNode)) { // validity is not checked for first node
-			DEBUG_VA( outs() << "  Block '" << exitBlock->getName() << "' is MANDATORY (4)!\n"; );
-			DEBUG_VA( outs() << "    due to exit '" << vBlock->getName() << "'.\n"; );
-			// Add both the current block as well as the latch as rewire targets for the branch parent.
-			if (divCauseBlocks) {
-				divCauseBlocks->insert(const_cast<BasicBlock*>(exitBlock));
-			}
-			isMandatoryExit =  true;
-			break;
-		}
-	}
+        if (mPathOracle.reachesExitAndLatch(*vBlock, *exitBlock, *loop)) {
+            DEBUG_VA( outs() << "  Block '" << exitBlock->getName() << "' is MANDATORY (4)!\n"; );
+            DEBUG_VA( outs() << "    due to exit '" << vBlock->getName() << "'.\n"; );
+            // Add both the current block as well as the latch as rewire targets for the branch parent.
+            if (divCauseBlocks) {
+                divCauseBlocks->insert(const_cast<BasicBlock*>(exitBlock));
+            }
+            return true;
+        }
+    }
 
-    delete graph;
-	return isMandatoryExit;
+    return false;
 }
 
 bool
-VectorizationAnalysis::checkForDisjointPaths(const BasicBlock*  block,
-					                         bool               doNotBranchToOuterLoops) const {
-	NodeSet exitingNodes;
-	BasicBlock * entryBlock = &mScalarFunction->getEntryBlock();
-	SketchGraph * graph = nullptr;
-
-	const DomTreeNode * idom = GetIDom(mDomTree, *block);
-	BasicBlock * idomBlock = idom ? idom->getBlock() : nullptr;
-
-	// Restrict the search to nodes in the idom region that reach @block
-	if (doNotBranchToOuterLoops) {
-		const Loop * loop = mLoopInfo.getLoopFor(block);
-		BasicBlock * topBlock = loop ? loop->getHeader() : entryBlock;
-		graph = SketchGraph::createFromDominatorNode(mDomTree, *topBlock, exitingNodes);
-
-	} else{
-		graph = SketchGraph::createFromDominatorNode(mDomTree, *entryBlock, exitingNodes);
-		assert(exitingNodes.empty() && "invalid dominance graph for entry block");
-	}
+VectorizationAnalysis::checkForDisjointPaths(const BasicBlock* block) const {
+    const DomTreeNode * idom = GetIDom(mDomTree, *block);
+    BasicBlock * idomBlock = idom ? idom->getBlock() : nullptr;
 
-#if 0
-	errs() << "Original graph:\n";
-	graph->dump();
-	mLoopInfo->print(errs());
-#endif
-
-// Remove all back-edges to outer loops
-	// FIXME
-	Loop * targetLoop = mLoopInfo.getLoopFor(block);
-	if (doNotBranchToOuterLoops) {
-		for (Loop * outerLoop = targetLoop;
-				outerLoop;
-				outerLoop = outerLoop->getParentLoop())
-		{
-			SketchNode * outerHeaderNode = graph->getNode(*outerLoop->getHeader());
-			NodeSet outerLoopPredSet = graph->getPredecessors(outerHeaderNode);
-			// graph->dumpSet(outerLoopPredSet);
-
-			for (SketchNode * outerHeaderPred : outerLoopPredSet) {
-				outerHeaderPred->erase(outerHeaderNode);
-			}
-		}
-		// reference
-		// original condition restated here
-		// if (loop == targetLoop || !targetLoop->contains(loop)) continue;
-	}
-// Eliminate dead-ends to accelerate path search
-	{
-		NodeSet keepSet;
-		keepSet.insert(graph->getNode(*block));
-		graph->eliminateDeadEnds(keepSet);
-	}
-
-	SketchNode * entryNode = graph->getNode(*entryBlock);
-	SketchNode * blockNode = graph->getNode(*block);
-
-
-// Run confluence contraction to merge any two nodes that will eventually pass through the same post-dominating node
-	SketchGraph * compactGraph = nullptr;
-
-	if (graph->getNumNodes() < 5) {
-		compactGraph = graph;
-		DEBUG_VA( errs() << "[VA] Graph with "<<  graph->getNumNodes() << " nodes to small for compaction\n"; );
-	} else {
-		NodeSet coreNodes = graph->getPredecessors(blockNode);
-		coreNodes.insert(blockNode);
-		compactGraph = graph->generateConfluenceGraph(coreNodes, nullptr);
-		// FIXME also make verbose
-		DEBUG_VA( errs() << "[VA] Compacted from " << graph->getNumNodes() << " to " << compactGraph->getNumNodes() << "\n"; );
-	}
-
-#ifdef VERBOSE
-	errs () << "Mapping "; confluenceMap.dump(*compactGraph, *graph);
-	errs() << "Compact "; compactGraph->dump();
-	errs() << "Source "; graph->dump();
-#endif
-
-// Check for existing path
-	SketchNode * compactBlockNode = compactGraph->getNode(*block);
-	assert(compactBlockNode);
-
-	NodeSet compactAcceptingNodes = compactGraph->getPredecessors(compactBlockNode);
-	PathFinder finder(*compactGraph, compactAcceptingNodes);
-
-    bool ret = false;
-
-	for (auto & pair  : *compactGraph) {
-		SketchNode * vCompactNode = pair.first;
-		const llvm::BasicBlock * vBlock = pair.second;
-
-		// optimization only look below the idom (if any)
-		if (! idomBlock || (vBlock == idomBlock) || mDomTree.dominates(idomBlock, vBlock)) { //  TODO Only nodes below the idom are interesting
-			if (rv::HasVaryingBranch(*vBlock, mVecInfo)) {
-				/* const BasicBlock * A;
-				const BasicBlock * B;
-				GetTwoSuccessors(vBlock, A, B);
-
-				// FIXME do look-ups in the contraction map
-				SketchNode * aStart = graph->getNode(*A);
-				SketchNode * bStart = graph->getNode(*B);
-				SketchNode * aCompactStart = confluenceMap.getRootForNode(aStart);
-				SketchNode * bCompactStart = confluenceMap.getRootForNode(bStart);
-				assert(aCompactStart && bCompactStart);
-
-				if (aCompactStart && aCompactStart == bCompactStart) { // a and b have the same post-dominating node
-					continue;
-				} */
+    for (const BasicBlock & vBlock : *mScalarFunction) {
+        // optimization only look below the idom (if any)
+        if (idomBlock && !mDomTree.dominates(idomBlock, &vBlock))
+            continue;
 
-				// the node was not represented in this graph (FIXME this could be the reason why IDom filtering does not work. Consider, that one path might stay at vBlock==block)
-				// if (vCompactNode->size() <= 2) { continue; }
+        if (! rv::HasVaryingBranch(vBlock, mVecInfo))
+            continue;
 
-				if ( finder.findPath(vCompactNode)) { // validity is not checked for first node
-					ret = true;
-                    break;
-				}
-			}
-		}
-	}
+        if (mPathOracle.joinsAt(vBlock, *block)) {
+            return true;
+        }
+    }
 
-	delete graph;
-	if (compactGraph != graph) delete compactGraph;
-	return ret;
+    return false;
 }
 
 // A block is divergent if there exist two *disjoint* paths from a block v
@@ -1214,7 +1062,7 @@ VectorizationAnalysis::isDivergent(BasicBlock* block) const
         return false;
     }
 
-    return checkForDisjointPaths(block, true);
+    return checkForDisjointPaths(block);
 }
 
 bool
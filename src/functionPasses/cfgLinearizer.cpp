@@ -19,16 +19,20 @@
 #include "rv/vectorizationInfo.h"
 #include <rv/rvInfoProxyPass.h>
 
+#include <llvm/Analysis/InstructionSimplify.h>
+#include <llvm/Analysis/ValueTracking.h> // isSafeToSpeculativelyExecute()
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Metadata.h>
 #include <llvm/Transforms/Scalar.h> // SROA
 #include <llvm/Transforms/Utils/SSAUpdater.h>
 #include <llvm/Transforms/Utils/PromoteMemToReg.h>
 #include <llvm/Transforms/Utils/Local.h> // DemoteRegToStack()
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
 
+#include <algorithm>
 #include <stdexcept>
-#include <analysis/SketchGraph.h>
-#include <analysis/PathFinder.h>
 
 // Copied from DemoteRegToStack.cpp
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
@@ -40,6 +44,7 @@
 #include "llvm/Transforms/Utils/Local.h"
 #include "llvm/Analysis/PostDominators.h"
 #include "llvm/IR/Dominators.h"
+#include "llvm/ADT/PostOrderIterator.h"
 
 #include "rvConfig.h"
 
@@ -214,8 +219,8 @@ CFGLinearizer::remapFakeUses(Function & f) {
 Value*
 CFGLinearizer::createFakeUse(Value & val, Instruction * InsertPt) {
   auto * mod = mInfo.mModule;
-  auto * func = requestReductionFunc(*mod, "rv_fake");
-  return CallInst::Create(func, &val, "fake", InsertPt);
+  auto & func = requestLaneFunction(*mod, "rv_fake");
+  return CallInst::Create(&func, &val, "fake", InsertPt);
 }
 
 
@@ -229,14 +234,18 @@ CFGLinearizer::CFGLinearizer(const RVInfo& rvInfo,
                              const LoopLiveValueAnalysis& loopLiveValueAnalysis,
                              VectorizationInfo& vecInfo,
                              const PostDominatorTree& postDomTree,
-                             const DominatorTree& domTree)
+                             DominatorTree& domTree,
+                             const bool preserveSSA)
         : mInfo(rvInfo),
           mLoopInfo(loopInfo),
           mMaskAnalysis(maskAnalysis),
           mLoopLiveValueAnalysis(loopLiveValueAnalysis),
           mvecInfo(vecInfo),
           mPostDomTree(postDomTree),
-          mDomTree(domTree)
+          mDomTree(domTree),
+          mPathOracle(domTree, loopInfo),
+          mPreserveSSA(preserveSSA),
+          mReachabilityWalks(false)
 {
 }
 
@@ -244,25 +253,10 @@ CFGLinearizer::~CFGLinearizer()
 {
 }
 
-Function *
-CFGLinearizer::requestReductionFunc(llvm::Module & mod, const std::string & name) {
-  auto * func = mod.getFunction(name);
-  if (func) return func;
-  auto & context = mod.getContext();
-  auto * boolTy = Type::getInt1Ty(context);
-  auto * funcTy = FunctionType::get(boolTy, boolTy, false);
-  auto * redFunc = Function::Create(funcTy, GlobalValue::ExternalLinkage, name, &mod);
-  redFunc->setDoesNotAccessMemory();
-  redFunc->setDoesNotThrow();
-  redFunc->setConvergent();
-  redFunc->setDoesNotRecurse();
-  return redFunc; // TODO add SIMD mapping
-}
-
 Instruction *
 CFGLinearizer::createReduction(Value & pred, const std::string & name, BasicBlock & atEnd) {
-  auto * func = requestReductionFunc(*atEnd.getParent()->getParent(), name);
-  auto * call = CallInst::Create(func, &pred, "reduce", &atEnd);
+  auto & func = requestLaneFunction(*atEnd.getParent()->getParent(), name);
+  auto * call = CallInst::Create(&func, &pred, "reduce", &atEnd);
   mvecInfo.setVectorShape(*call, VectorShape::uni());
   return call;
 }
@@ -297,32 +291,16 @@ CFGLinearizer::linearize(Function& F)
         return true;
     }
 
-#if 1
-  // cleanup
-    for (auto it : mLinearizeInfoMap) {
-      delete it.second;
-    }
-    mLinearizeInfoMap.clear();
-
-    std::set<Cluster*> freed;
-    for (auto it : mClusterMap) {
-      if (freed.insert(it.second).second) {
-        delete it.second;
-      }
-    }
-    mClusterMap.clear();
-
-   for (auto it : mLoopExitInfoMap) {
-     auto * lei = it.second;
-     for (auto itBlock : *lei) {
-       delete itBlock.second;
-     }
-     delete it.second;
-   }
-   mLoopExitInfoMap.clear();
-#endif
+    cleanup();
 
     IF_DEBUG {
+      errs() << "linearized " << F.getName() << ": ordered the sides of " << mScheduleStats.numBranches
+             << " branches (" << mScheduleStats.numReordered << " reordered), live values x insts "
+             << mScheduleStats.structuralValueCost << " -> " << mScheduleStats.scheduledValueCost
+             << ", live masks x insts " << mScheduleStats.structuralMaskCost << " -> "
+             << mScheduleStats.scheduledMaskCost << "\n";
+      errs() << "BOSCC: " << mBOSCCStats.numChecks << " of " << mBOSCCStats.numCandidates
+             << " regions skippable, " << mBOSCCStats.numFastPaths << " with a copy for full masks\n";
       errs() << "function after linearization:\n";
       F.print(errs());
     }
@@ -428,17 +406,111 @@ CFGLinearizer::verify(const Function& f) const
 
 
 void
-CFGLinearizer::linearize(Function* f)
+CFGLinearizer::analyzeRewiring(Function& F)
 {
-    assert (f);
+    determineRewiring(&F);
+    releaseReachability();
+    cleanup();
+}
+
+CFGLinearizer::RewiringStatistics::RewiringStatistics()
+        : numClusters(0),
+          numRewireTargets(0),
+          numRewiredEdges(0)
+{
+}
+
+void
+CFGLinearizer::determineRewiring(Function* f)
+{
+    mScheduleStats = ScheduleStatistics();
+    mRewiringStats = RewiringStatistics();
+    mReachability.reset(new rv::BlockReachability(*f, mLoopInfo));
+    computeReachingBranches(*f);
 
     getDivergenceCausingBlocks(*f);
     getRewireTargets(*f);
 
     determineClusters(f);
+    estimateLiveRanges(*f);
     determineRewireOrders();
     determineNewEdges(f);
 
+    std::set<const Cluster*> clusters;
+    for (auto &pair : mClusterMap)
+    {
+        if (!clusters.insert(pair.second).second) continue;
+        ++mRewiringStats.numClusters;
+        mRewiringStats.numRewireTargets += pair.second->mRewireList->size();
+    }
+    for (auto &pair : mLinearizeInfoMap)
+    {
+        for (auto * info : *pair.second)
+        {
+            if (info->mEdgeType != LEAVE_UNTOUCHED) ++mRewiringStats.numRewiredEdges;
+        }
+    }
+}
+
+// The state that is only valid as long as the edges are not rewired
+void
+CFGLinearizer::releaseReachability()
+{
+    mReachability.reset();
+    mVaryingBranches.clear();
+    mBranchIndex.clear();
+    mReachingBranches.clear();
+    mLiveRangeEstimates.clear();
+    mOrderedBranches.clear();
+}
+
+void
+CFGLinearizer::cleanup()
+{
+    for (auto it : mLinearizeInfoMap) {
+      delete it.second;
+    }
+    mLinearizeInfoMap.clear();
+
+    std::set<Cluster*> freed;
+    for (auto it : mClusterMap) {
+      if (freed.insert(it.second).second) {
+        delete it.second;
+      }
+    }
+    mClusterMap.clear();
+    mDivergenceCauseMap.clear();
+    mRewireTargetMap.clear();
+
+    for (auto it : mLoopExitInfoMap) {
+      auto * lei = it.second;
+      for (auto itBlock : *lei) {
+        delete itBlock.second;
+      }
+      delete it.second;
+    }
+    mLoopExitInfoMap.clear();
+}
+
+void
+CFGLinearizer::linearize(Function* f)
+{
+    assert (f);
+
+    mBOSCCStats = BOSCCStatistics();
+    determineRewiring(f);
+    collectBOSCCRegions(*f);
+
+    // The edges are rewired from here on.
+    releaseReachability();
+
+    if (mPreserveSSA)
+    {
+        linearizeSSA(f);
+        insertBOSCCChecks();
+        return;
+    }
+
     MemInfoMapType   memInfos;
     MaskValueMapType maskValueMap;
     MaskValueMapType maskPhiValueMap;
@@ -551,6 +623,8 @@ CFGLinearizer::linearize(Function* f)
 
     // We invalidate insert points of masks since they may have been removed.
     mMaskAnalysis.invalidateInsertPoints();
+
+    insertBOSCCChecks();
 }
 
 // Collect information about loop exits etc. that we need after linearization.
@@ -697,12 +771,10 @@ CFGLinearizer::determineClusters(Function* f)
         dcBlockSet.insert(&BB);
     }
 
-    typedef std::vector<BasicBlock*> VecType;
     DEBUG_RV_NO_VERBOSE(
         for (auto &BB : *f)
         {
-            VecType dcBlocks = mDivergenceCauseMap[&BB];
-            for (auto &dcBB : dcBlocks)
+            for (auto &dcBB : mDivergenceCauseMap.lookup(&BB))
             {
                 assert (dcBlockSet.count(cast<BasicBlock>(dcBB)));
             }
@@ -772,96 +844,121 @@ CFGLinearizer::createClusters(SetVector<BasicBlock*>& dcBlockSet)
     assert (mClusterMap.empty());
     DEBUG_RV( outs() << "\ncreateClusters()\n"; );
 
-    DominatorTreeBase<BasicBlock> PTB(true);
-    PTB.recalculate(*(*dcBlockSet.begin())->getParent());
+    // The dc blocks of each cluster, by their position in the set.
+    const unsigned numDCBlocks = dcBlockSet.size();
+    DenseMap<const BasicBlock*, unsigned> dcIndex;
+    DenseMap<const Cluster*, BitVector> clusterBlocks;
 
     // Create a cluster for each DC block and initialize.
-    for (auto BB : dcBlockSet)
+    for (unsigned i = 0; i < numDCBlocks; ++i)
     {
+        BasicBlock* BB = dcBlockSet[i];
         Cluster* cluster = new Cluster();
         cluster->mEntry = BB;
-        cluster->mPostDom = PTB.getNode(BB)->getIDom()->getBlock();
+        cluster->mPostDom = mPostDomTree.getNode(BB)->getIDom()->getBlock();
         cluster->mDCBlocks = new SmallPtrSet<BasicBlock*, 2>();
         cluster->mDCBlocks->insert(BB);
         cluster->mRewireTargets = new SmallPtrSet<BasicBlock*, 2>();
 
         // Initialize unordered rewire target set.
-        std::vector<BasicBlock*> rewireTargets = mRewireTargetMap[BB];
-
-        for (auto RT : rewireTargets)
+        auto rtIt = mRewireTargetMap.find(BB);
+        if (rtIt != mRewireTargetMap.end())
         {
-            cluster->mRewireTargets->insert(RT);
+            cluster->mRewireTargets->insert(rtIt->second.begin(), rtIt->second.end());
         }
 
         // Ordered rewire target list is filled in determineRewireOrder().
         cluster->mRewireList = new RewireList();
         mClusterMap[BB] = cluster;
+
+        dcIndex[BB] = i;
+        BitVector& blocks = clusterBlocks[cluster];
+        blocks.resize(numDCBlocks);
+        blocks.set(i);
     }
 
-    bool changed = true;
-    while (changed)
+    // The dc blocks that BB0 reaches without passing the post dominator of its
+    // cluster. Loop exits are allowed, back edges are not.
+    std::map<std::pair<const BasicBlock*, const BasicBlock*>, BitVector> reachableDCBlocks;
+    auto getReachableDCBlocks = [&](BasicBlock* BB0, BasicBlock* postDom) -> const BitVector&
     {
-        changed = false;
-        for (auto BB0 : dcBlockSet)
-        {
-            Cluster* cluster0 = mClusterMap[BB0];
-            assert (cluster0);
-            //Loop* loop = mLoopInfo->getLoopFor(BB0);
+        BitVector& dcReached = reachableDCBlocks[std::make_pair(BB0, postDom)];
+        if (dcReached.size() == numDCBlocks) return dcReached;
 
-            SmallPtrSet<BasicBlock*, 2> remapSet;
-            for (auto BB1 : dcBlockSet)
+        dcReached.resize(numDCBlocks);
+        if (mReachabilityWalks)
+        {
+            for (unsigned i = 0; i < numDCBlocks; ++i)
             {
-                if (BB0 == BB1) continue;
-
-                // If BB1 already belongs to cluster0, do not merge.
-                Cluster* cluster1 = mClusterMap[BB1];
-                assert (cluster1);
-                if (cluster0 == cluster1) continue;
-
-                // If BB1 is the post dominator of cluster0, do not merge.
-                if (cluster0->mPostDom == BB1) continue;
+                if (isReachable(*dcBlockSet[i], *BB0, postDom, nullptr, true)) dcReached.set(i);
+            }
+            return dcReached;
+        }
 
-                // If BB1 is not reachable from BB0, do not merge.
-                // Disallow passing post dominator, allow loop exits, disallow any back edges.
-                if (!rv::isReachable(BB1, BB0, cluster0->mPostDom, nullptr, nullptr, true, &mLoopInfo)) continue;
+        const BitVector& reached = mReachability->getReachableBlocks(*BB0, postDom, nullptr, true);
+        for (unsigned i = 0; i < numDCBlocks; ++i)
+        {
+            if (reached.test(mReachability->getIndex(*dcBlockSet[i]))) dcReached.set(i);
+        }
+        return dcReached;
+    };
+
+    // Merge the cluster of the first dc block BB1 that the first possible BB0
+    // reaches into the cluster of BB0 until nothing changes. A merge only
+    // changes the candidates of the blocks of the merged cluster, so the scan
+    // resumes at the first of them instead of at the start of the set.
+    unsigned idx0 = 0;
+    while (idx0 < numDCBlocks)
+    {
+        BasicBlock* BB0 = dcBlockSet[idx0];
+        Cluster* cluster0 = mClusterMap[BB0];
+        assert (cluster0);
+
+        // If BB1 already belongs to cluster0 or is the post dominator of cluster0, do not merge.
+        BitVector candidates = getReachableDCBlocks(BB0, cluster0->mPostDom);
+        candidates.reset(clusterBlocks[cluster0]);
+        auto postDomIt = dcIndex.find(cluster0->mPostDom);
+        if (postDomIt != dcIndex.end()) candidates.reset(postDomIt->second);
+
+        const int idx1 = candidates.find_first();
+        if (idx1 == -1)
+        {
+            ++idx0;
+            continue;
+        }
 
-                assert (!rv::isReachable(BB0, BB1, cluster1->mPostDom, nullptr, nullptr, true, &mLoopInfo));
-                assert (cluster0->mPostDom == cluster1->mPostDom ||
-                        rv::isReachable(cluster0->mPostDom, cluster1->mPostDom));
+        BasicBlock* BB1 = dcBlockSet[idx1];
+        Cluster* cluster1 = mClusterMap[BB1];
+        assert (cluster1 && cluster1 != cluster0);
 
-                DEBUG_RV( outs() << "  '" << BB1->getName() << "' can be reached from '"; );
-                DEBUG_RV( outs() << BB0->getName() << "', merging clusters...\n"; );
+        assert (!rv::isReachable(BB0, BB1, cluster1->mPostDom, nullptr, nullptr, true, &mLoopInfo));
+        assert (cluster0->mPostDom == cluster1->mPostDom ||
+                rv::isReachable(cluster0->mPostDom, cluster1->mPostDom));
 
-                // BB1 can be reached from BB0.
-                // -> Merge cluster1 into cluster0
-                cluster0->mDCBlocks->insert(cluster1->mDCBlocks->begin(),
-                                            cluster1->mDCBlocks->end());
-                cluster0->mRewireTargets->insert(cluster1->mRewireTargets->begin(),
-                                                 cluster1->mRewireTargets->end());
+        DEBUG_RV( outs() << "  '" << BB1->getName() << "' can be reached from '"; );
+        DEBUG_RV( outs() << BB0->getName() << "', merging clusters...\n"; );
 
-                // Remap all blocks that referenced cluster1 to cluster0.
-                for (auto pair : mClusterMap)
-                {
-                    if (pair.second != cluster1) continue;
-                    remapSet.insert(pair.first);
-                }
+        // BB1 can be reached from BB0.
+        // -> Merge cluster1 into cluster0
+        cluster0->mDCBlocks->insert(cluster1->mDCBlocks->begin(),
+                                    cluster1->mDCBlocks->end());
+        cluster0->mRewireTargets->insert(cluster1->mRewireTargets->begin(),
+                                         cluster1->mRewireTargets->end());
 
-                // Delete cluster1.
-                delete cluster1;
-                mClusterMap[BB1] = cluster0;//erase(BB1);
+        // Remap all blocks that referenced cluster1 to cluster0.
+        for (auto BB : *cluster1->mDCBlocks)
+        {
+            mClusterMap[BB] = cluster0;
+        }
 
-                changed = true;
-                break;
-            }
+        const BitVector merged = clusterBlocks[cluster1];
+        clusterBlocks[cluster0] |= merged;
+        clusterBlocks.erase(cluster1);
 
-            for (auto BB : remapSet)
-            {
-                assert (mClusterMap[BB]->mDCBlocks->count(BB));
-                mClusterMap[BB] = cluster0;
-            }
+        // Delete cluster1.
+        delete cluster1;
 
-            if (changed) break;
-        }
+        idx0 = std::min(idx0, (unsigned) merged.find_first());
     }
 }
 
@@ -955,6 +1052,14 @@ CFGLinearizer::determineRewireOrder(Cluster& cluster)
     BasicBlock* startBB = cluster.mEntry;
 #endif
 
+    // The traversal only orders the rewire targets, so it stops once all of
+    // them are in the list (headers are never added).
+    unsigned numRewireTargets = 0;
+    for (BasicBlock* target : *cluster.mRewireTargets)
+    {
+        if (!mLoopInfo.isLoopHeader(target)) ++numRewireTargets;
+    }
+
     SmallPtrSet<BasicBlock*, 16> scheduledBlocks;
     typedef SmallVector<BasicBlock*, 32> WorkList;
     WorkList workList;
@@ -982,6 +1087,7 @@ CFGLinearizer::determineRewireOrder(Cluster& cluster)
             // assert (rv::hasMetadata(block, rv::RV_METADATA_MANDATORY));
             assert (mvecInfo.isMandatory(block));
             cluster.mRewireList->push_back(block);
+            if (cluster.mRewireList->size() == numRewireTargets) break;
         }
 
         if (block == cluster.mPostDom) continue;
@@ -1008,6 +1114,7 @@ CFGLinearizer::determineRewireOrder(Cluster& cluster)
             }
         }
 
+        SmallVector<BasicBlock*, 2> readySuccs;
         TerminatorInst* TI = block->getTerminator();
         for (unsigned i=0, e=TI->getNumSuccessors(); i<e; ++i)
         {
@@ -1023,9 +1130,135 @@ CFGLinearizer::determineRewireOrder(Cluster& cluster)
             }
 
             if (hasUnseenNonLatchPred(succBB, cluster, mLoopInfo, scheduledBlocks)) continue;
-            workList.push_back(succBB);
+            readySuccs.push_back(succBB);
+        }
+
+        // Any order of the ready successors is legal, pick the one with the
+        // lowest estimated register pressure.
+        orderSuccessors(block, readySuccs);
+        workList.append(readySuccs.begin(), readySuccs.end());
+    }
+}
+
+// The values defined in a dominator subtree that are used outside of it are
+// live across everything that is laid out after the subtree. The values
+// whose uses are all in the subtree but which are defined before it die
+// with the subtree. Both are counted with a +1/-1 pair on the tree path
+// between the definition (or the common dominator of the uses) and the
+// common dominator of definition and uses, which the subtree sums resolve.
+void
+CFGLinearizer::estimateLiveRanges(Function& f)
+{
+    mLiveRangeEstimates.assign(mReachability->getNumBlocks(), LiveRangeEstimate());
+    auto getEstimate = [this](const BasicBlock* block) -> LiveRangeEstimate&
+    {
+        return mLiveRangeEstimates[mReachability->getIndex(*block)];
+    };
+
+    for (BasicBlock& BB : f)
+    {
+        LiveRangeEstimate& defEstimate = getEstimate(&BB);
+        defEstimate.mSize += BB.size();
+        if (!mDomTree.isReachableFromEntry(&BB)) continue;
+
+        for (Instruction& I : BB)
+        {
+            if (I.use_empty() || !mvecInfo.hasKnownShape(I)) continue;
+            if (mvecInfo.getVectorShape(I).isUniform()) continue;
+
+            BasicBlock* useBB = nullptr;
+            for (Use& use : I.uses())
+            {
+                Instruction* user = cast<Instruction>(use.getUser());
+                BasicBlock* userBB = isa<PHINode>(user) ?
+                    cast<PHINode>(user)->getIncomingBlock(use) :
+                    user->getParent();
+                if (!mDomTree.isReachableFromEntry(userBB)) continue;
+                useBB = useBB ? mDomTree.findNearestCommonDominator(useBB, userBB) : userBB;
+            }
+            if (!useBB) continue;
+
+            BasicBlock* commonBB = mDomTree.findNearestCommonDominator(&BB, useBB);
+            LiveRangeEstimate& useEstimate = getEstimate(useBB);
+            LiveRangeEstimate& commonEstimate = getEstimate(commonBB);
+            if (rv::hasMetadata(&I, rv::RV_METADATA_MASK))
+            {
+                ++defEstimate.mMasksOut;
+                --commonEstimate.mMasksOut;
+                ++useEstimate.mMasksDying;
+                --commonEstimate.mMasksDying;
+            }
+            else
+            {
+                ++defEstimate.mValuesOut;
+                --commonEstimate.mValuesOut;
+                ++useEstimate.mValuesDying;
+                --commonEstimate.mValuesDying;
+            }
         }
     }
+
+    for (DomTreeNode* node : post_order(mDomTree.getRootNode()))
+    {
+        if (!node->getIDom()) continue;
+        const LiveRangeEstimate& estimate = getEstimate(node->getBlock());
+        LiveRangeEstimate& idomEstimate = getEstimate(node->getIDom()->getBlock());
+        idomEstimate.mValuesOut   += estimate.mValuesOut;
+        idomEstimate.mValuesDying += estimate.mValuesDying;
+        idomEstimate.mMasksOut    += estimate.mMasksOut;
+        idomEstimate.mMasksDying  += estimate.mMasksDying;
+        idomEstimate.mSize        += estimate.mSize;
+    }
+}
+
+void
+CFGLinearizer::orderSuccessors(const BasicBlock* block, SmallVectorImpl<BasicBlock*>& succs)
+{
+    if (succs.size() < 2) return;
+
+    auto getEstimate = [this](const BasicBlock* succBB) -> const LiveRangeEstimate&
+    {
+        return mLiveRangeEstimates[mReachability->getIndex(*succBB)];
+    };
+
+    // Laying out a before b costs out(a) * size(b) + dying(b) * size(a), so the
+    // pairwise best order sorts by (out - dying) / size. The work list is a
+    // stack, hence the side to lay out first goes last. Ties keep the
+    // structural order.
+    auto laidOutLater = [&](const BasicBlock* a, const BasicBlock* b)
+    {
+        const LiveRangeEstimate& estA = getEstimate(a);
+        const LiveRangeEstimate& estB = getEstimate(b);
+        const std::int64_t balanceA = estA.mValuesOut + estA.mMasksOut - estA.mValuesDying - estA.mMasksDying;
+        const std::int64_t balanceB = estB.mValuesOut + estB.mMasksOut - estB.mValuesDying - estB.mMasksDying;
+        return balanceA * estB.mSize > balanceB * estA.mSize;
+    };
+
+    SmallVector<BasicBlock*, 4> structuralSuccs(succs.begin(), succs.end());
+    std::stable_sort(succs.begin(), succs.end(), laidOutLater);
+
+    // Every branch is counted once, although each cluster that reaches it orders it.
+    if (!mOrderedBranches.insert(block).second) return;
+
+    auto addLayoutCost = [&](ArrayRef<BasicBlock*> pushOrder, std::uint64_t& valueCost, std::uint64_t& maskCost)
+    {
+        for (unsigned i = 0; i < pushOrder.size(); ++i)
+        {
+            // pushOrder[j] with j > i is laid out before pushOrder[i]
+            const LiveRangeEstimate& later = getEstimate(pushOrder[i]);
+            for (unsigned j = i + 1; j < pushOrder.size(); ++j)
+            {
+                const LiveRangeEstimate& earlier = getEstimate(pushOrder[j]);
+                valueCost += earlier.mValuesOut * later.mSize + later.mValuesDying * earlier.mSize;
+                maskCost  += earlier.mMasksOut * later.mSize + later.mMasksDying * earlier.mSize;
+            }
+        }
+    };
+
+    ++mScheduleStats.numBranches;
+    if (!std::equal(succs.begin(), succs.end(), structuralSuccs.begin())) ++mScheduleStats.numReordered;
+    addLayoutCost(structuralSuccs, mScheduleStats.structuralValueCost, mScheduleStats.structuralMaskCost);
+    addLayoutCost(succs, mScheduleStats.scheduledValueCost, mScheduleStats.scheduledMaskCost);
 }
 
 bool
@@ -1236,7 +1469,7 @@ CFGLinearizer::getRewireTargets(BasicBlock* block,
     assert (rewireTargets.empty());
     assert (rewireCausingBlocks.empty());
 
-    std::vector<BasicBlock*> dcBlocks = mDivergenceCauseMap[succBB];
+    SmallVector<BasicBlock*, 2> dcBlocks = mDivergenceCauseMap.lookup(succBB);
 
     DEBUG_RV_NO_VERBOSE(
         for (auto &dcBB : dcBlocks)
@@ -1298,11 +1531,11 @@ CFGLinearizer::getRewireTargets(BasicBlock* block,
         {
             BasicBlock* rewireBlock = *it++;
             Loop* rewireLoop = mLoopInfo.getLoopFor(rewireBlock);
-            const bool isReachable = rv::isReachable(block,
-                                                      rewireBlock,
-                                                      cluster->mPostDom,
-                                                      rewireLoop,
-                                                      rewireLoop);
+            const bool isReachable = this->isReachable(*block,
+                                                       *rewireBlock,
+                                                       cluster->mPostDom,
+                                                       rewireLoop,
+                                                       false);
 
             if (!findNext)
             {
@@ -1335,13 +1568,11 @@ CFGLinearizer::getRewireTargets(BasicBlock* block,
     {
         Cluster* cluster = pair.second;
         if (clusterSet.count(cluster)) continue;
-        if (!rv::isReachable(succBB,
-                              cluster->mEntry,
-                              cluster->mPostDom,
-                              nullptr,
-                              nullptr,
-                              true,
-                              &mLoopInfo))
+        if (!isReachable(*succBB,
+                         *cluster->mEntry,
+                         cluster->mPostDom,
+                         nullptr,
+                         true))
         {
             continue;
         }
@@ -1402,10 +1633,26 @@ CFGLinearizer::linearize(Function*         f,
 
     // Create alloca in each "header" of divergence-causing block clusters so
     // that we can identify where we were coming from during execution.
+    // In SSA mode, the index is a value of each cluster entry that reaches
+    // the multi-rewire switches through phis.
     AllocaInst* idxAlloca = nullptr;
     LoadVecType* reloads  = nullptr;
     DenseMap<BasicBlock*, unsigned> indexMap;
-    if (!clusters.empty())
+    SmallVector<PHINode*, 4>    idxPhis;
+    SSAUpdater                  idxUpdater(&idxPhis);
+    SmallVector<SwitchInst*, 2> idxSwitches;
+    if (!clusters.empty() && mPreserveSSA)
+    {
+        idxUpdater.Initialize(Type::getInt32Ty(*mInfo.mContext), "cluster.idx");
+        unsigned clusterIdx = 0;
+        for (auto cluster : clusters)
+        {
+            ConstantInt* idxVal = ConstantInt::get(*mInfo.mContext, APInt(32, clusterIdx));
+            idxUpdater.AddAvailableValue(cluster->mEntry, idxVal);
+            indexMap[cluster->mEntry] = clusterIdx++;
+        }
+    }
+    else if (!clusters.empty())
     {
         // Create alloca
         Function* parentFn = clusters[0]->mEntry->getParent();
@@ -1437,7 +1684,6 @@ CFGLinearizer::linearize(Function*         f,
         memInfos.push_back(new MemInfo(idxAlloca, idxAlloca, reloads, stores));
     }
 
-    // TODO keep cfg valid
     // Now, linearize/modify CFG.
     for (auto &BB : *f)
     {
@@ -1507,7 +1753,6 @@ CFGLinearizer::linearize(Function*         f,
                             BasicBlock * firstSuccBlock = branch->getSuccessor(0);
                             mvecInfo.dropVectorShape(*terminator);
                             terminator->eraseFromParent();
-                            // TODO keep cfg valid
                             terminator = BranchInst::Create(firstSuccBlock, block);
                             // rv::setMetadata(terminator, rv::RV_METADATA_OP_UNIFORM);
                             mvecInfo.setVectorShape(*terminator, VectorShape::uni());
@@ -1569,7 +1814,6 @@ CFGLinearizer::linearize(Function*         f,
                             Value* condition = sw->getCondition();
                             assert (caseVal0->getType()->isIntegerTy(32));
                             assert (condition->getType()->isIntegerTy(32));
-                            // TODO keep cfg valid
                             ICmpInst* cmp = new ICmpInst(sw,
                                                          ICmpInst::ICMP_EQ,
                                                          condition,
@@ -1580,9 +1824,7 @@ CFGLinearizer::linearize(Function*         f,
 
                             mvecInfo.dropVectorShape(*sw);
                             sw->eraseFromParent();
-                            mvecInfo.dropPredicate(*defaultBB);
-                            defaultBB->eraseFromParent();
-                            // TODO keep cfg valid
+                            eraseBlock(defaultBB);
                             terminator = BranchInst::Create(target0, target1, cmp, block);
                             // rv::setMetadata(terminator, rv::RV_METADATA_OP_UNIFORM);
                             mvecInfo.setVectorShape(*terminator, VectorShape::uni());
@@ -1599,7 +1841,7 @@ CFGLinearizer::linearize(Function*         f,
                 {
                     ++numRewireMulti;
                     //assert (numRewireMulti == 1 && "not implemented!");
-                    assert (idxAlloca && reloads);
+                    assert (mPreserveSSA || (idxAlloca && reloads));
 
                     // This only works for uniform terminators:
                     // If the terminator was varying, and we break the edge, the new
@@ -1615,7 +1857,6 @@ CFGLinearizer::linearize(Function*         f,
                     // edge from which edges go out to the different rewire targets.
                     // NOTE: This is equivalent to breaking critical edges beforehand.
                     BasicBlock* oldTarget = targetInfo->mSuccessor;
-                    // TODO keep cfg valid
                     BasicBlock* ceBlock = BasicBlock::Create(*mInfo.mContext,
                                                              block->getName()+"."+oldTarget->getName()+".mrewire",
                                                              oldTarget->getParent(),
@@ -1623,7 +1864,6 @@ CFGLinearizer::linearize(Function*         f,
 
                     // rv::setMetadata(ceBlock, rv::RV_METADATA_OPTIONAL);
 
-                    // TODO keep cfg valid
                     // Change target block of current edge.
                     for (unsigned i=0, e=terminator->getNumSuccessors(); i<e; ++i)
                     {
@@ -1640,17 +1880,23 @@ CFGLinearizer::linearize(Function*         f,
                     //  - jump to rewire target that corresponds to cluster index
                     //  - if the edge did not require a rewire for a cluster index,
                     //    the old target block is jumped to (as default of the switch).
-                    LoadInst* load = new LoadInst(idxAlloca, "reload.idx", ceBlock);
-                    reloads->push_back(load);
+                    // In SSA mode, the index is filled in once all edges exist.
+                    Value* idx = UndefValue::get(Type::getInt32Ty(*mInfo.mContext));
+                    if (!mPreserveSSA)
+                    {
+                        LoadInst* load = new LoadInst(idxAlloca, "reload.idx", ceBlock);
+                        reloads->push_back(load);
+                        // rv::setMetadata(load, rv::RV_METADATA_OP_UNIFORM);
+                        mvecInfo.setVectorShape(*load, VectorShape::uni());
+                        idx = load;
+                    }
 
                     const unsigned numCases = targetInfo->mNewTargets->size();
-                    // TODO keep cfg valid
-                    SwitchInst* sw = SwitchInst::Create(load, oldTarget, numCases, ceBlock);
+                    SwitchInst* sw = SwitchInst::Create(idx, oldTarget, numCases, ceBlock);
+                    if (mPreserveSSA) idxSwitches.push_back(sw);
 
-                    // rv::setMetadata(load, rv::RV_METADATA_OP_UNIFORM);
                     // rv::setMetadata(sw,   rv::RV_METADATA_OP_UNIFORM);
                     // rv::setMetadata(terminator,   rv::RV_METADATA_OP_UNIFORM);
-                    mvecInfo.setVectorShape(*load, VectorShape::uni());
                     mvecInfo.setVectorShape(*sw,   VectorShape::uni());
                     mvecInfo.setVectorShape(*terminator,   VectorShape::uni());
 
@@ -1665,6 +1911,9 @@ CFGLinearizer::linearize(Function*         f,
                         sw->addCase(idxVal, target);
                     }
 
+                    recordEdgeChange(block, oldTarget);
+                    recordNewBlock(ceBlock, block);
+
                     //DEBUG_RV( outs() << "  new load: " << *load << "\n"; );
                     //DEBUG_RV( outs() << "  new switch: " << *sw << "\n"; );
                     //DEBUG_RV( outs() << " REWIRE_MULTI done!\n"; );
@@ -1705,7 +1954,6 @@ CFGLinearizer::linearize(Function*         f,
                 // Update mask analysis information.
                 mMaskAnalysis.removeExitMask(*block, *removeTarget);
 
-                // TODO keep cfg valid
                 BranchInst* newBranch = removeTarget == branch->getSuccessor(0) ?
                     BranchInst::Create(branch->getSuccessor(1), block) :
                     BranchInst::Create(branch->getSuccessor(0), block);
@@ -1720,7 +1968,6 @@ CFGLinearizer::linearize(Function*         f,
             {
                 if (sw->getDefaultDest() == removeTarget)
                 {
-                    // TODO keep cfg valid
                     BasicBlock* defaultBB = BasicBlock::Create(*mInfo.mContext,
                                                                "default",
                                                                removeTarget->getParent(),
@@ -1729,10 +1976,10 @@ CFGLinearizer::linearize(Function*         f,
                     // rv::setMetadata(uinst,  rv::RV_METADATA_OP_UNIFORM);
                     mvecInfo.setVectorShape(*uinst, VectorShape::uni());
                     sw->setDefaultDest(defaultBB);
+                    recordNewBlock(defaultBB, block);
                 }
                 else
                 {
-                    // TODO keep cfg valid
                     ConstantInt* caseVal = sw->findCaseDest(removeTarget);
                     SwitchInst::CaseIt it = sw->findCaseValue(caseVal);
                     sw->removeCase(it);
@@ -1742,6 +1989,8 @@ CFGLinearizer::linearize(Function*         f,
             {
                 assert (false && "unsupported terminator found!");
             }
+
+            recordEdgeChange(block, removeTarget);
         }
 
         if (numNew)
@@ -1768,6 +2017,209 @@ CFGLinearizer::linearize(Function*         f,
         delete mLinearizeInfoMap[block];
         mLinearizeInfoMap.erase(block);
     }
+
+    for (SwitchInst* sw : idxSwitches)
+    {
+        sw->setCondition(idxUpdater.GetValueInMiddleOfBlock(sw->getParent()));
+    }
+    for (PHINode* phi : idxPhis)
+    {
+        mvecInfo.setVectorShape(*phi, VectorShape::uni());
+    }
+
+    updateDominatorTree();
+}
+
+void
+CFGLinearizer::recordEdgeChange(BasicBlock* source, BasicBlock* target)
+{
+    mEditedBlocks.insert(source);
+    mEditedBlocks.insert(target);
+}
+
+void
+CFGLinearizer::recordNewBlock(BasicBlock* block, BasicBlock* pred)
+{
+    mNewBlocks.push_back(block);
+    recordEdgeChange(pred, block);
+    for (BasicBlock* succ : successors(block))
+    {
+        recordEdgeChange(block, succ);
+    }
+
+    // The block belongs to the innermost loop of its predecessor that it leads back into.
+    for (Loop* loop = mLoopInfo.getLoopFor(pred); loop; loop = loop->getParentLoop())
+    {
+        bool inLoop = false;
+        for (BasicBlock* succ : successors(block))
+        {
+            inLoop |= loop->contains(succ);
+        }
+        if (inLoop)
+        {
+            loop->addBasicBlockToLoop(block, mLoopInfo);
+            break;
+        }
+    }
+}
+
+void
+CFGLinearizer::eraseBlock(BasicBlock* block)
+{
+    // only dead ends without successors are erased, so this is a leaf of the tree
+    if (mDomTree.getNode(block)) mDomTree.eraseNode(block);
+    mLoopInfo.removeBlock(block);
+    mEditedBlocks.erase(block);
+    mvecInfo.dropPredicate(*block);
+    block->eraseFromParent();
+}
+
+// All edited edges connect blocks that are dominated by the nearest common dominator of the
+// edited blocks in the original tree. Paths from the entry only enter the subtree of that
+// root through the root itself, so only the subtree has to be recomputed on the new CFG.
+// Blocks outside the subtree keep their dominators as long as the subtree blocks stay
+// reachable, which linearization guarantees.
+void
+CFGLinearizer::updateDominatorTree()
+{
+    BasicBlock* root = nullptr;
+    for (BasicBlock* block : mEditedBlocks)
+    {
+        if (!mDomTree.getNode(block)) continue; // created by the linearizer
+        root = root ? mDomTree.findNearestCommonDominator(root, block) : block;
+    }
+
+    if (!root)
+    {
+        assert (mNewBlocks.empty());
+        return;
+    }
+
+    // The old subtree of the root in pre-order, followed by the new blocks
+    std::vector<BasicBlock*> region;
+    DenseMap<BasicBlock*, unsigned> index;
+    std::vector<DomTreeNode*> nodeStack(1, mDomTree.getNode(root));
+    while (!nodeStack.empty())
+    {
+        DomTreeNode* node = nodeStack.back();
+        nodeStack.pop_back();
+        index[node->getBlock()] = region.size();
+        region.push_back(node->getBlock());
+        for (DomTreeNode* child : *node)
+        {
+            nodeStack.push_back(child);
+        }
+    }
+    for (BasicBlock* block : mNewBlocks)
+    {
+        index[block] = region.size();
+        region.push_back(block);
+    }
+
+    // Post order of the region on the new CFG
+    std::vector<bool> visited(region.size(), false);
+    std::vector<unsigned> postOrder;
+    SmallVector<std::pair<unsigned, succ_iterator>, 16> dfsStack;
+    visited[0] = true;
+    dfsStack.push_back(std::make_pair(0u, succ_begin(root)));
+    while (!dfsStack.empty())
+    {
+        unsigned id = dfsStack.back().first;
+        succ_iterator& itSucc = dfsStack.back().second;
+        if (itSucc == succ_end(region[id]))
+        {
+            postOrder.push_back(id);
+            dfsStack.pop_back();
+            continue;
+        }
+
+        BasicBlock* succ = *itSucc;
+        ++itSucc;
+        auto itIndex = index.find(succ);
+        if (itIndex == index.end() || visited[itIndex->second]) continue;
+        visited[itIndex->second] = true;
+        dfsStack.push_back(std::make_pair(itIndex->second, succ_begin(succ)));
+    }
+
+    std::vector<unsigned> postOrderNumber(region.size(), 0);
+    for (unsigned i = 0; i < postOrder.size(); ++i)
+    {
+        postOrderNumber[postOrder[i]] = i;
+    }
+
+    // Iterative dominator computation (Cooper, Harvey, Kennedy) on the region
+    std::vector<int> idom(region.size(), -1);
+    idom[0] = 0;
+    auto intersect = [&](unsigned a, unsigned b)
+    {
+        while (a != b)
+        {
+            while (postOrderNumber[a] < postOrderNumber[b]) a = idom[a];
+            while (postOrderNumber[b] < postOrderNumber[a]) b = idom[b];
+        }
+        return a;
+    };
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (auto it = postOrder.rbegin(); it != postOrder.rend(); ++it)
+        {
+            unsigned id = *it;
+            if (id == 0) continue;
+
+            int newIdom = -1;
+            for (BasicBlock* pred : predecessors(region[id]))
+            {
+                auto itIndex = index.find(pred);
+                if (itIndex == index.end() || idom[itIndex->second] == -1) continue;
+                newIdom = newIdom == -1 ? itIndex->second : intersect(itIndex->second, newIdom);
+            }
+
+            if (idom[id] != newIdom)
+            {
+                idom[id] = newIdom;
+                changed = true;
+            }
+        }
+    }
+
+    // Apply in reverse post order: the new dominator of a block is already in place
+    for (auto it = postOrder.rbegin(); it != postOrder.rend(); ++it)
+    {
+        unsigned id = *it;
+        if (id == 0) continue;
+
+        BasicBlock* block = region[id];
+        BasicBlock* idomBlock = region[idom[id]];
+        DomTreeNode* node = mDomTree.getNode(block);
+        if (!node)
+        {
+            mDomTree.addNewBlock(block, idomBlock);
+        }
+        else if (node->getIDom()->getBlock() != idomBlock)
+        {
+            mDomTree.changeImmediateDominator(block, idomBlock);
+        }
+    }
+
+    // Blocks that became unreachable leave the tree, children first
+    for (unsigned id = region.size(); id-- > 0; )
+    {
+        if (!visited[id] && mDomTree.getNode(region[id]))
+        {
+            mDomTree.eraseNode(region[id]);
+        }
+    }
+
+    mEditedBlocks.clear();
+    mNewBlocks.clear();
+
+    IF_DEBUG {
+        DominatorTree fullTree(*root->getParent());
+        assert (!mDomTree.compare(fullTree) && "dominator tree update went wrong");
+    }
 }
 
 // This method is required to replace exactly one edge
@@ -1785,6 +2237,8 @@ CFGLinearizer::rewireEdge(TerminatorInst* terminator,
     assert (oldTarget != newTarget);
 
     BasicBlock* parentBB = terminator->getParent();
+    recordEdgeChange(parentBB, oldTarget);
+    recordEdgeChange(parentBB, newTarget);
 
     // Check if a loop shall be removed and update loopinfo if so
     Loop* L = mLoopInfo.getLoopFor(oldTarget);
@@ -1801,7 +2255,6 @@ CFGLinearizer::rewireEdge(TerminatorInst* terminator,
         {
             mvecInfo.dropVectorShape(*br);
             br->eraseFromParent();
-            // TODO keep cfg valid
             BranchInst* newBr = BranchInst::Create(newTarget, parentBB);
             // rv::setMetadata(newBr, rv::RV_METADATA_OP_UNIFORM);
             mvecInfo.setVectorShape(*newBr, VectorShape::uni());
@@ -1810,7 +2263,6 @@ CFGLinearizer::rewireEdge(TerminatorInst* terminator,
         else
         {
             const bool trueIsTarget = br->getSuccessor(0) == oldTarget;
-            // TODO keep cfg valid
             BranchInst* newBr =
                     BranchInst::Create(trueIsTarget ? newTarget : br->getSuccessor(0),
                                        trueIsTarget ? br->getSuccessor(1) : newTarget,
@@ -1833,7 +2285,6 @@ CFGLinearizer::rewireEdge(TerminatorInst* terminator,
         {
             BasicBlock* caseTarget = sw->getSuccessor(i);
             if (caseTarget != oldTarget) continue;
-            // TODO keep cfg valid
             sw->setSuccessor(i, newTarget);
             rewired = true;
         }
@@ -1899,9 +2350,9 @@ CFGLinearizer::createSingleVaryingLoopExitEdge(const Loop*       loop,
 #endif
 
     // Jump back to header on "true".
-    // TODO keep cfg valid
     // adding an exit edge should not change the loop
     BranchInst* branch = BranchInst::Create(headerBB, exitTarget, cond, block);
+    recordEdgeChange(block, exitTarget);
 
     // rv::setMetadata(branch, rv::RV_METADATA_OP_UNIFORM);
 
@@ -2515,13 +2966,23 @@ const Loop*
 CFGLinearizer::getInnermostLoopForAlloca(const LoadVecType&  reloads,
                                          const StoreVecType& stores) const
 {
-    assert (!stores.empty());
+    ConstBlockVecType defBlocks;
+    ConstBlockVecType useBlocks;
+    for (const auto &store : stores) defBlocks.push_back(store->getParent());
+    for (const auto &reload : reloads) useBlocks.push_back(reload->getParent());
+    return getInnermostLoopForDefs(defBlocks, useBlocks);
+}
+
+const Loop*
+CFGLinearizer::getInnermostLoopForDefs(const ConstBlockVecType& defBlocks,
+                                       const ConstBlockVecType& useBlocks) const
+{
+    assert (!defBlocks.empty());
 
     // Find the innermost common loop of all defs.
     const Loop* commonLoop = nullptr;
-    for (const auto &store : stores)
+    for (const BasicBlock* defBB : defBlocks)
     {
-        const BasicBlock* defBB = store->getParent();
         const Loop* loop = mLoopInfo.getLoopFor(defBB);
 
         // If the def is not in a loop, we can return immediately because this
@@ -2544,9 +3005,8 @@ CFGLinearizer::getInnermostLoopForAlloca(const LoadVecType&  reloads,
     assert (commonLoop);
 
     // Find the outermost loop of all uses.
-    for (const auto &reload : reloads)
+    for (const BasicBlock* useBB : useBlocks)
     {
-        const BasicBlock* useBB = reload->getParent();
         const Loop* loop = mLoopInfo.getLoopFor(useBB);
 
         // If the use is not in a loop, we can return immediately because this
@@ -2702,13 +3162,941 @@ CFGLinearizer::mem2reg(Function*              f,
     }
 }
 
-static inline
-const DomTreeNode*
-GetIDom(const DominatorTree & domTree, const BasicBlock & block) {
-    const DomTreeNode * domNode = domTree.getNode(const_cast<BasicBlock*>(&block));
-    return domNode->getIDom();
-}
-
+void
+CFGLinearizer::linearizeSSA(Function* f)
+{
+    DetachedPhiVecType phis;
+    detachPhis(*f, phis);
+
+    // Nothing is demoted, so the bookkeeping of the demoting path stays empty.
+    MemInfoMapType   memInfos;
+    MaskValueMapType maskValueMap;
+    MaskValueMapType maskPhiValueMap;
+
+    // Linearize function, thereby rewiring edges that target MANDATORY blocks.
+    linearize(f, memInfos, maskValueMap, maskPhiValueMap);
+    assert (memInfos.empty());
+
+    DEBUG_RV( outs() << "\nRebuilding phis after CFG linearization...\n"; );
+
+    MaskValueMapType phiValueMap;
+    rebuildPhis(phis, phiValueMap);
+    repairDominance(*f);
+
+    // Update mask analysis.
+    mMaskAnalysis.mapMaskValues(phiValueMap);
+
+    DEBUG_RV( outs() << "\nLinearization of function finished!\n"; );
+
+    // We invalidate insert points of masks since they may have been removed.
+    mMaskAnalysis.invalidateInsertPoints();
+}
+
+// Take the phis out of all blocks except loop headers (their predecessors never
+// change), so that SSAUpdater does not see incoming blocks of edges that were
+// rewired.
+void
+CFGLinearizer::detachPhis(Function& f, DetachedPhiVecType& phis)
+{
+    for (auto &BB : f)
+    {
+        if (mLoopInfo.isLoopHeader(&BB)) continue;
+        if (!isa<PHINode>(&*BB.begin())) continue;
+
+        // If this is an LCSSA phi of a MANDATORY exit, the incoming value has
+        // to be the one from the latch of the outermost exited loop (the
+        // result vec blend in the latch).
+        BasicBlock* latchDef = nullptr;
+        if (rv::isExitOfDivergentLoop(BB, mLoopInfo, mvecInfo) &&
+            mvecInfo.isMandatory(&BB))
+        {
+            BasicBlock* predBB = BB.getUniquePredecessor();
+            assert (predBB);
+            Loop* predLoop = rv::getOutermostExitedLoop(BB, mLoopInfo);
+            assert (predLoop);
+            BasicBlock* predLatch = predLoop->getLoopLatch();
+            if (predBB != predLatch) latchDef = predLatch;
+        }
+
+        while (PHINode* phi = dyn_cast<PHINode>(&*BB.begin()))
+        {
+            DEBUG_RV( outs() << "detach phi ('" << BB.getName() << "'): " << *phi << "\n"; );
+            phi->removeFromParent();
+            phis.push_back(DetachedPhi(phi, &BB, latchDef));
+        }
+    }
+}
+
+// Rebuild each detached phi from the definitions that reached it over the
+// original edges. In MANDATORY blocks, a definition may now flow through the
+// block of another definition of the same phi. There, the value is blended
+// with the exit mask of the overwriting definition's original edge.
+void
+CFGLinearizer::rebuildPhis(DetachedPhiVecType& phis, MaskValueMapType& phiValueMap)
+{
+    for (auto &dp : phis)
+    {
+        PHINode* phi = dp.mPhi;
+        BasicBlock* block = dp.mBlock;
+
+        DEBUG_RV( outs() << "\nrebuild phi ('" << block->getName() << "'): " << *phi << "\n"; );
+
+        SmallVector<BasicBlock*, 4> defBlocks;
+        DenseMap<BasicBlock*, Value*> defValues;
+        for (unsigned i = 0, e = phi->getNumIncomingValues(); i < e; ++i)
+        {
+            BasicBlock* defBB = dp.mLatchDef ? dp.mLatchDef : phi->getIncomingBlock(i);
+            if (defValues.count(defBB)) continue; // same edge, same value
+            defValues[defBB] = phi->getIncomingValue(i);
+            defBlocks.push_back(defBB);
+        }
+
+        DefOverwriteMapType overwriteMap;
+        if (mvecInfo.isMandatory(block))
+        {
+            findOverwrittenDefs(defBlocks, block, overwriteMap);
+        }
+
+        const bool isMask = rv::hasMetadata(phi, rv::RV_METADATA_MASK);
+
+        SmallVector<PHINode*, 8> insertedPhis;
+        SSAUpdater updater(&insertedPhis);
+        updater.Initialize(phi->getType(), phi->getName());
+
+        // Do not let the value of a previous iteration reach the phi.
+        ConstBlockVecType constDefBlocks(defBlocks.begin(), defBlocks.end());
+        ConstBlockVecType useBlocks(1, block);
+        if (!hasLoopHeaderPhiUse(*phi))
+        {
+            if (const Loop* loop = getInnermostLoopForDefs(constDefBlocks, useBlocks))
+            {
+                updater.AddAvailableValue(loop->getHeader(), isMask ?
+                    Constant::getNullValue(phi->getType()) :
+                    UndefValue::get(phi->getType()));
+            }
+        }
+
+        DenseMap<BasicBlock*, Value*> blendedValues;
+        for (BasicBlock* defBB : defBlocks)
+        {
+            Value* value = blendOverwrittenDefs(defBB, dp, defValues, overwriteMap, blendedValues);
+            updater.AddAvailableValue(defBB, value);
+        }
+
+        Value* newValue = updater.GetValueInMiddleOfBlock(block);
+        assert (newValue != phi);
+        finishSSAUpdaterPhis(insertedPhis, *phi);
+
+        DEBUG_RV( outs() << "  new value: " << *newValue << "\n"; );
+
+        // Predicates that refer to the phi move to the new value.
+        if (phi->getType()->isIntegerTy(1))
+        {
+            mvecInfo.remapPredicate(*newValue, *phi);
+        }
+        phiValueMap[phi] = newValue;
+
+        phi->replaceAllUsesWith(newValue);
+        mvecInfo.dropVectorShape(*phi);
+        block->getInstList().push_front(phi);
+        phi->eraseFromParent();
+    }
+}
+
+// Returns the value that the definition in @defBB contributes to the phi:
+// If it overwrites other definitions of the phi on the linearized CFG, these
+// are blended in below it.
+Value*
+CFGLinearizer::blendOverwrittenDefs(BasicBlock*                    defBB,
+                                    const DetachedPhi&             dp,
+                                    DenseMap<BasicBlock*, Value*>& defValues,
+                                    const DefOverwriteMapType&     overwriteMap,
+                                    DenseMap<BasicBlock*, Value*>& blendedValues)
+{
+    auto itBlended = blendedValues.find(defBB);
+    if (itBlended != blendedValues.end()) return itBlended->second;
+
+    Value* value = defValues[defBB];
+    auto itOvw = overwriteMap.find(defBB);
+    if (itOvw != overwriteMap.end())
+    {
+        PHINode* phi = dp.mPhi;
+
+        SmallVector<PHINode*, 4> insertedPhis;
+        SSAUpdater prevUpdater(&insertedPhis);
+        prevUpdater.Initialize(phi->getType(), "ssa.repair");
+        for (BasicBlock* prevBB : itOvw->second)
+        {
+            Value* prevValue = blendOverwrittenDefs(prevBB, dp, defValues, overwriteMap, blendedValues);
+            prevUpdater.AddAvailableValue(prevBB, prevValue);
+        }
+        Value* prevValue = prevUpdater.GetValueInMiddleOfBlock(defBB);
+        finishSSAUpdaterPhis(insertedPhis, *phi);
+
+        // Get the mask of the corresponding (now non-existant) edge.
+        Value* mask = mMaskAnalysis.getExitMask(*defBB, *dp.mBlock);
+        SelectInst* select = SelectInst::Create(mask,
+                                                value,
+                                                prevValue,
+                                                "ssa.repair.phi",
+                                                defBB->getTerminator());
+        mvecInfo.setVectorShape(*select, VectorShape::varying());
+        if (rv::hasMetadata(phi, rv::RV_METADATA_MASK))
+        {
+            rv::setMetadata(select, rv::RV_METADATA_MASK);
+        }
+
+        DEBUG_RV( outs() << "  new select   ('" << defBB->getName() << "'): " << *select << "\n"; );
+        value = select;
+    }
+
+    blendedValues[defBB] = value;
+    return value;
+}
+
+// Map each definition block to the definition blocks that it directly
+// overwrites on the linearized CFG before reaching @joinBlock
+// (cf. findOverwritingStores).
+void
+CFGLinearizer::findOverwrittenDefs(const SmallVectorImpl<BasicBlock*>& defBlocks,
+                                   const BasicBlock*                   joinBlock,
+                                   DefOverwriteMapType&                overwriteMap) const
+{
+    for (BasicBlock* defBB : defBlocks)
+    {
+        Loop* ignoreLoop = mLoopInfo.getLoopFor(defBB);
+
+        SmallVector<BasicBlock*, 4> overwritten;
+        for (BasicBlock* otherBB : defBlocks)
+        {
+            if (otherBB == defBB) continue;
+            if (!rv::isReachable(defBB, otherBB, joinBlock, ignoreLoop, ignoreLoop)) continue;
+            overwritten.push_back(otherBB);
+        }
+
+        // Exclude those that are overwritten already by a different one.
+        for (BasicBlock* bb0 : overwritten)
+        {
+            bool isOverwrittenByOther = false;
+            for (BasicBlock* bb1 : overwritten)
+            {
+                if (bb0 == bb1) continue;
+                if (!rv::isReachable(bb1, bb0, joinBlock, ignoreLoop, ignoreLoop)) continue;
+                isOverwrittenByOther = true;
+                break;
+            }
+            if (isOverwrittenByOther) continue;
+            overwriteMap[defBB].push_back(bb0);
+        }
+    }
+}
+
+// Rewrite each use that is no longer dominated by its definition to the value
+// that reaches it on the linearized CFG (undef on paths that do not pass the
+// definition).
+void
+CFGLinearizer::repairDominance(Function& f)
+{
+    std::vector<Instruction*> insts;
+    for (auto &BB : f)
+    {
+        for (auto &I : BB)
+        {
+            insts.push_back(&I);
+        }
+    }
+
+    SmallVector<Use*, 4> brokenUses;
+    for (Instruction* inst : insts)
+    {
+        BasicBlock* defBB = inst->getParent();
+
+        brokenUses.clear();
+        ConstBlockVecType useBlocks;
+        for (Use& use : inst->uses())
+        {
+            Instruction* user = cast<Instruction>(use.getUser());
+            PHINode* usePhi = dyn_cast<PHINode>(user);
+            BasicBlock* useBB = usePhi ? usePhi->getIncomingBlock(use) : user->getParent();
+            useBlocks.push_back(useBB);
+            if (mDomTree.dominates(defBB, useBB)) continue;
+            brokenUses.push_back(&use);
+        }
+        if (brokenUses.empty()) continue;
+
+        DEBUG_RV( outs() << "\nrepair uses of ('" << defBB->getName() << "'): " << *inst << "\n"; );
+
+        SmallVector<PHINode*, 8> insertedPhis;
+        SSAUpdater updater(&insertedPhis);
+        updater.Initialize(inst->getType(), inst->getName());
+
+        // Do not let the value of a previous iteration reach the uses.
+        const bool isMask = rv::hasMetadata(inst, rv::RV_METADATA_MASK);
+        if (inst->getName().startswith("loopMaskUpdate") || !hasLoopHeaderPhiUse(*inst))
+        {
+            ConstBlockVecType defBlocks(1, defBB);
+            if (const Loop* loop = getInnermostLoopForDefs(defBlocks, useBlocks))
+            {
+                updater.AddAvailableValue(loop->getHeader(), isMask ?
+                    Constant::getNullValue(inst->getType()) :
+                    UndefValue::get(inst->getType()));
+            }
+        }
+        updater.AddAvailableValue(defBB, inst);
+
+        for (Use* use : brokenUses)
+        {
+            updater.RewriteUse(*use);
+        }
+        finishSSAUpdaterPhis(insertedPhis, *inst);
+    }
+}
+
+// Whether @value is the incoming value from the latch of a loop header phi.
+bool
+CFGLinearizer::hasLoopHeaderPhiUse(const Value& value) const
+{
+    for (const User* user : value.users())
+    {
+        const PHINode* usePhi = dyn_cast<PHINode>(user);
+        if (!usePhi || !usePhi->getParent()) continue;
+        const BasicBlock* useParentBB = usePhi->getParent();
+        const Loop* useParentLoop = mLoopInfo.getLoopFor(useParentBB);
+        if (!useParentLoop || useParentLoop->getHeader() != useParentBB) continue;
+        const BasicBlock* latchBB = useParentLoop->getLoopLatch();
+        if (usePhi->getIncomingValueForBlock(latchBB) != &value) continue;
+        return true;
+    }
+    return false;
+}
+
+// Phis created by SSAUpdater take over the shape and metadata of the value
+// they were created for. Undef incoming values of mask phis become "false"
+// (see mem2reg).
+void
+CFGLinearizer::finishSSAUpdaterPhis(const SmallVectorImpl<PHINode*>& insertedPhis,
+                                    const Value&                     origValue)
+{
+    const bool isMask = rv::hasMetadata(&origValue, rv::RV_METADATA_MASK);
+    for (PHINode* phi : insertedPhis)
+    {
+        rv::copyMetadata(phi, origValue);
+        mvecInfo.setVectorShape(*phi, mvecInfo.getVectorShape(origValue));
+        DEBUG_RV( outs() << "  new phi ('" << phi->getParent()->getName() << "'): " << *phi << "\n"; );
+
+        if (!isMask) continue;
+        for (unsigned i = 0, e = phi->getNumIncomingValues(); i < e; ++i)
+        {
+            if (!isa<UndefValue>(phi->getIncomingValue(i))) continue;
+            phi->setIncomingValue(i, ConstantInt::getFalse(phi->getContext()));
+        }
+    }
+}
+
+// A side of a varying branch is skipped if it is taken with at most a tenth of
+// the branch weight or if it is large enough to pay for the check. A side that
+// is taken with at least nine tenths of the weight and accesses memory gets a
+// copy for full masks, unless that would duplicate too much code.
+static const unsigned BOSCCMinRegionSize   = 24; // instructions
+static const unsigned BOSCCMaxFastPathSize = 64;
+
+static bool
+GetBranchWeights(const BranchInst& branch, std::uint64_t weights[2])
+{
+    MDNode* prof = branch.getMetadata(LLVMContext::MD_prof);
+    if (!prof || prof->getNumOperands() != 3) return false;
+
+    MDString* kind = dyn_cast<MDString>(prof->getOperand(0));
+    if (!kind || kind->getString() != "branch_weights") return false;
+
+    for (unsigned i = 0; i < 2; ++i)
+    {
+        ConstantInt* weight = mdconst::dyn_extract<ConstantInt>(prof->getOperand(i + 1));
+        if (!weight) return false;
+        weights[i] = weight->getZExtValue();
+    }
+    return weights[0] + weights[1] > 0;
+}
+
+CFGLinearizer::BOSCCStatistics::BOSCCStatistics()
+        : numCandidates(0),
+          numChecks(0),
+          numFastPaths(0)
+{
+}
+
+// Runs on the original CFG. The branches are visited in reverse post order, so
+// enclosing regions come first.
+void
+CFGLinearizer::collectBOSCCRegions(Function& f)
+{
+    mBOSCCRegions.clear();
+    mOriginalBlocks.clear();
+
+    for (unsigned i = 0; i < mReachability->getNumBlocks(); ++i)
+    {
+        BasicBlock* block = const_cast<BasicBlock*>(mReachability->getBlock(i));
+        if (!mDomTree.isReachableFromEntry(block)) continue;
+
+        BranchInst* branch = dyn_cast<BranchInst>(block->getTerminator());
+        if (!branch || !branch->isConditional()) continue;
+        if (mvecInfo.getVectorShape(*branch).isUniform()) continue;
+
+        const bool forced = rv::hasMetadata(branch, rv::RV_METADATA_VARIANT_BOSCC);
+        std::uint64_t weights[2];
+        const bool hasWeights = GetBranchWeights(*branch, weights);
+
+        const DomTreeNode* pdNode = mPostDomTree.getNode(block);
+        const BasicBlock* joinBB = pdNode && pdNode->getIDom() ? pdNode->getIDom()->getBlock() : nullptr;
+        const Loop* loop = mLoopInfo.getLoopFor(block);
+
+        for (unsigned s = 0; s < 2; ++s)
+        {
+            BasicBlock* entry = branch->getSuccessor(s);
+            if (entry == joinBB || entry->getSinglePredecessor() != block) continue;
+            // loop exits are left by the loop exit masks
+            if (mLoopInfo.getLoopFor(entry) != loop) continue;
+
+            BOSCCRegion region;
+            region.mEntry = entry;
+
+            unsigned size = 0;
+            unsigned numMemOps = 0;
+            bool hasLoop = false;
+            bool leavesLoop = false;
+            SmallVector<DomTreeNode*, 8> nodeStack(1, mDomTree.getNode(entry));
+            while (!nodeStack.empty())
+            {
+                DomTreeNode* node = nodeStack.pop_back_val();
+                BasicBlock* regionBB = node->getBlock();
+                region.mBlocks.insert(regionBB);
+                hasLoop |= mLoopInfo.isLoopHeader(regionBB);
+                leavesLoop |= loop && !loop->contains(regionBB);
+
+                for (Instruction& I : *regionBB)
+                {
+                    if (isa<PHINode>(I) || rv::isMetadataCall(&I)) continue;
+                    ++size;
+                    if (isa<LoadInst>(I) || isa<StoreInst>(I) || isa<CallInst>(I)) ++numMemOps;
+                }
+
+                for (DomTreeNode* child : *node)
+                {
+                    nodeStack.push_back(child);
+                }
+            }
+            if (leavesLoop) continue;
+
+            // With demand-driven masks, only the edge mask may exist.
+            Value* mask = mvecInfo.getPredicate(*entry);
+            if (!mask) mask = mMaskAnalysis.getExitMaskPtr(*block, *entry)->mValue;
+            if (!mask || isa<Constant>(mask)) continue;
+
+            const std::uint64_t total = hasWeights ? weights[0] + weights[1] : 0;
+            const bool unlikely = hasWeights && weights[s] * 10 <= total;
+            const bool likely   = hasWeights && weights[s] * 10 >= total * 9;
+
+            const bool skip = forced || unlikely || size >= BOSCCMinRegionSize;
+            region.mFastPath = numMemOps > 0 && !hasLoop &&
+                               (forced || (likely && size <= BOSCCMaxFastPathSize));
+            if (!skip && !region.mFastPath) continue;
+
+            region.mMask = mask;
+            mBOSCCRegions.push_back(region);
+        }
+    }
+
+    mBOSCCStats.numCandidates = mBOSCCRegions.size();
+    if (mBOSCCRegions.empty()) return;
+
+    for (BasicBlock& BB : f)
+    {
+        mOriginalBlocks.insert(&BB);
+    }
+}
+
+void
+CFGLinearizer::insertBOSCCChecks()
+{
+    for (const BOSCCRegion& region : mBOSCCRegions)
+    {
+        if (!insertBOSCCCheck(region))
+        {
+            DEBUG_RV( outs() << "BOSCC: region at '" << region.mEntry->getName() << "' rejected\n"; );
+        }
+    }
+
+    mBOSCCRegions.clear();
+    mOriginalBlocks.clear();
+}
+
+// Turns the linearized region at @region.mEntry (R) into
+//
+//   preds -> entry.boscc:     br rv_any(mask), R (or entry.boscc.all), X
+//            entry.boscc.all: br rv_all(mask), R.all, R
+//
+// where X is the only block that R exits to and R.all is a copy of R with the
+// mask set to true. Values of R that are used behind R are undef if R is
+// skipped, masks are false. Returns false if R does not have this shape.
+bool
+CFGLinearizer::insertBOSCCCheck(const BOSCCRegion& region)
+{
+    BasicBlock* entry = region.mEntry;
+    Value* mask = mvecInfo.getPredicate(*entry);
+    if (!mask) mask = region.mMask;
+    if (!mask || isa<Constant>(mask)) return false;
+
+    // The region after linearization: the original blocks and the blocks
+    // created by the linearizer in between.
+    SmallPtrSet<BasicBlock*, 16> blocks;
+    SmallVector<BasicBlock*, 16> workList(1, entry);
+    blocks.insert(entry);
+    BasicBlock* exitBB = nullptr;
+    BasicBlock* exitingBB = nullptr;
+    while (!workList.empty())
+    {
+        BasicBlock* block = workList.pop_back_val();
+        TerminatorInst* terminator = block->getTerminator();
+        if (terminator->getNumSuccessors() == 0) return false;
+
+        for (unsigned i = 0, e = terminator->getNumSuccessors(); i < e; ++i)
+        {
+            BasicBlock* succBB = terminator->getSuccessor(i);
+            if (succBB == entry) return false;
+            if (region.mBlocks.count(succBB) || !mOriginalBlocks.count(succBB))
+            {
+                if (blocks.insert(succBB).second) workList.push_back(succBB);
+                continue;
+            }
+            if (exitBB) return false;
+            exitBB = succBB;
+            exitingBB = block;
+        }
+    }
+    if (!exitBB) return false;
+
+    for (BasicBlock* block : blocks)
+    {
+        for (BasicBlock* predBB : predecessors(block))
+        {
+            if ((block == entry) == !blocks.count(predBB)) continue;
+            return false;
+        }
+    }
+    if (pred_begin(entry) == pred_end(entry)) return false;
+
+    Loop* loop = mLoopInfo.getLoopFor(entry);
+    if (mLoopInfo.getLoopFor(exitBB) != loop || mLoopInfo.isLoopHeader(exitBB)) return false;
+
+    // The phis and the mask computations of the entry move in front of the region.
+    SmallPtrSet<Instruction*, 4> hoistedInsts;
+    if (!canHoistBOSCCMask(*mask, *entry, blocks, hoistedInsts)) return false;
+
+    bool fastPath = region.mFastPath;
+    for (BasicBlock* block : blocks)
+    {
+        fastPath &= mLoopInfo.getLoopFor(block) == loop;
+    }
+
+    // Values of the region that are used behind it. If the region is skipped,
+    // masks evaluate to false and varying values are blended away.
+    DenseMap<const Value*, Value*> skippedValues;
+    for (Instruction& I : *entry)
+    {
+        if (isa<PHINode>(I)) hoistedInsts.insert(&I);
+    }
+    for (Instruction* inst : hoistedInsts)
+    {
+        skippedValues[inst] = inst;
+    }
+
+    SmallVector<Instruction*, 16> liveOuts;
+    DenseMap<Instruction*, SmallVector<BasicBlock*, 2> > predicateUsers;
+    for (BasicBlock& BB : *entry->getParent())
+    {
+        if (blocks.count(&BB)) continue;
+        Instruction* predicate = dyn_cast_or_null<Instruction>(mvecInfo.getPredicate(BB));
+        if (predicate && blocks.count(predicate->getParent())) predicateUsers[predicate].push_back(&BB);
+    }
+
+    for (BasicBlock* block : blocks)
+    {
+        for (Instruction& I : *block)
+        {
+            if (hoistedInsts.count(&I)) continue;
+            bool isLiveOut = predicateUsers.count(&I);
+            for (User* user : I.users())
+            {
+                Instruction* userInst = cast<Instruction>(user);
+                if (blocks.count(userInst->getParent())) continue;
+                isLiveOut = true;
+
+                if (I.getType()->isIntegerTy(1)) break;
+                if (!mvecInfo.hasKnownShape(*userInst) || mvecInfo.getVectorShape(*userInst).isUniform())
+                {
+                    return false;
+                }
+            }
+            if (!isLiveOut) continue;
+
+            if (!getSkippedValue(I, *mask, blocks, skippedValues)) return false;
+            liveOuts.push_back(&I);
+        }
+    }
+
+    // Blocks in function order, so that the copies are laid out alike.
+    Function* f = entry->getParent();
+    SmallVector<BasicBlock*, 16> regionBlocks;
+    for (BasicBlock& BB : *f)
+    {
+        if (blocks.count(&BB)) regionBlocks.push_back(&BB);
+    }
+
+    SmallPtrSet<BasicBlock*, 4> predBlocks(pred_begin(entry), pred_end(entry));
+
+    BasicBlock* checkBB = BasicBlock::Create(*mInfo.mContext, entry->getName() + ".boscc", f, entry);
+    for (BasicBlock* predBB : predBlocks)
+    {
+        TerminatorInst* terminator = predBB->getTerminator();
+        for (unsigned i = 0, e = terminator->getNumSuccessors(); i < e; ++i)
+        {
+            if (terminator->getSuccessor(i) == entry) terminator->setSuccessor(i, checkBB);
+        }
+        recordEdgeChange(predBB, checkBB);
+    }
+
+    Instruction* insertPoint = BranchInst::Create(entry, checkBB);
+    for (auto it = entry->begin(); it != entry->end(); )
+    {
+        Instruction* inst = &*it++;
+        if (hoistedInsts.count(inst)) inst->moveBefore(insertPoint);
+    }
+    insertPoint->eraseFromParent();
+
+    Instruction* anyActive = createReduction(*mask, "rv_any", *checkBB);
+
+    BasicBlock* allBB = nullptr;
+    ValueToValueMapTy cloneMap;
+    if (fastPath)
+    {
+        allBB = BasicBlock::Create(*mInfo.mContext, entry->getName() + ".boscc.all", f, entry);
+        Instruction* allActive = createReduction(*mask, "rv_all", *allBB);
+
+        cloneMap[mask] = ConstantInt::getTrue(*mInfo.mContext);
+        SmallVector<BasicBlock*, 16> clonedBlocks;
+        for (BasicBlock* block : regionBlocks)
+        {
+            BasicBlock* clonedBlock = CloneBasicBlock(block, cloneMap, ".all", f);
+            cloneMap[block] = clonedBlock;
+            clonedBlocks.push_back(clonedBlock);
+            if (loop) loop->addBasicBlockToLoop(clonedBlock, mLoopInfo);
+        }
+
+        for (BasicBlock* clonedBlock : clonedBlocks)
+        {
+            for (Instruction& I : *clonedBlock)
+            {
+                RemapInstruction(&I, cloneMap, RF_NoModuleLevelChanges | RF_IgnoreMissingEntries);
+            }
+        }
+
+        for (BasicBlock* block : regionBlocks)
+        {
+            for (Instruction& I : *block)
+            {
+                if (!mvecInfo.hasKnownShape(I)) continue;
+                Value* clonedInst = cloneMap[&I];
+                mvecInfo.setVectorShape(*clonedInst, mvecInfo.getVectorShape(I));
+            }
+        }
+
+        // With a full mask, blends and masks of the copy fold away.
+        const DataLayout& layout = f->getParent()->getDataLayout();
+        SmallVector<Instruction*, 16> foldedInsts;
+        for (BasicBlock* clonedBlock : clonedBlocks)
+        {
+            for (Instruction& I : *clonedBlock)
+            {
+                if (isa<PHINode>(I) || (!I.getType()->isIntegerTy(1) && !isa<SelectInst>(I))) continue;
+                Value* simplified = SimplifyInstruction(&I, layout);
+                if (!simplified) continue;
+                I.replaceAllUsesWith(simplified);
+                foldedInsts.push_back(&I);
+            }
+        }
+        for (Instruction* inst : foldedInsts)
+        {
+            mvecInfo.dropVectorShape(*inst);
+            inst->eraseFromParent();
+        }
+
+        for (BasicBlock* block : regionBlocks)
+        {
+            Value* predicate = mvecInfo.getPredicate(*block);
+            if (!predicate) continue;
+            Value* clonedPredicate = cloneMap.lookup(predicate);
+            mvecInfo.setPredicate(*cast<BasicBlock>(cloneMap[block]), clonedPredicate ? *clonedPredicate : *predicate);
+        }
+
+        BasicBlock* clonedEntry = cast<BasicBlock>(cloneMap[entry]);
+        BranchInst* allBranch = BranchInst::Create(clonedEntry, entry, allActive, allBB);
+        mvecInfo.setVectorShape(*allBranch, VectorShape::uni());
+
+        for (BasicBlock* clonedBlock : clonedBlocks)
+        {
+            mNewBlocks.push_back(clonedBlock);
+        }
+        recordEdgeChange(cast<BasicBlock>(cloneMap[exitingBB]), exitBB);
+        ++mBOSCCStats.numFastPaths;
+    }
+
+    BranchInst* anyBranch = BranchInst::Create(allBB ? allBB : entry, exitBB, anyActive, checkBB);
+    mvecInfo.setVectorShape(*anyBranch, VectorShape::uni());
+    recordNewBlock(checkBB, *predBlocks.begin());
+    if (allBB) recordNewBlock(allBB, checkBB);
+    recordEdgeChange(checkBB, exitBB);
+
+    auto getClonedValue = [&](Value* value) -> Value*
+    {
+        Value* clonedValue = cloneMap.lookup(value);
+        return clonedValue ? clonedValue : value;
+    };
+
+    for (Instruction& I : *exitBB)
+    {
+        PHINode* phi = dyn_cast<PHINode>(&I);
+        if (!phi) break;
+        Value* incoming = phi->getIncomingValueForBlock(exitingBB);
+        phi->addIncoming(getSkippedValue(*incoming, *mask, blocks, skippedValues), checkBB);
+        if (allBB) phi->addIncoming(getClonedValue(incoming), cast<BasicBlock>(cloneMap[exitingBB]));
+    }
+
+    for (Instruction* inst : liveOuts)
+    {
+        SmallVector<PHINode*, 8> insertedPhis;
+        SSAUpdater updater(&insertedPhis);
+        updater.Initialize(inst->getType(), inst->getName());
+        updater.AddAvailableValue(inst->getParent(), inst);
+        updater.AddAvailableValue(checkBB, getSkippedValue(*inst, *mask, blocks, skippedValues));
+        if (allBB)
+        {
+            updater.AddAvailableValue(cast<BasicBlock>(cloneMap[inst->getParent()]), getClonedValue(inst));
+        }
+
+        SmallVector<Use*, 8> outsideUses;
+        for (Use& use : inst->uses())
+        {
+            Instruction* userInst = cast<Instruction>(use.getUser());
+            if (blocks.count(userInst->getParent())) continue;
+            PHINode* phi = dyn_cast<PHINode>(userInst);
+            if (phi && phi->getParent() == exitBB && phi->getIncomingBlock(use) == exitingBB) continue;
+            outsideUses.push_back(&use);
+        }
+        for (Use* use : outsideUses)
+        {
+            updater.RewriteUse(*use);
+        }
+
+        auto itPredicateUsers = predicateUsers.find(inst);
+        if (itPredicateUsers != predicateUsers.end())
+        {
+            for (BasicBlock* block : itPredicateUsers->second)
+            {
+                mvecInfo.setPredicate(*block, *updater.GetValueInMiddleOfBlock(block));
+            }
+        }
+
+        finishSSAUpdaterPhis(insertedPhis, *inst);
+    }
+
+    updateDominatorTree();
+    ++mBOSCCStats.numChecks;
+    return true;
+}
+
+// Whether @value can be computed in front of the region at @entry: it
+// dominates @entry or is a side-effect free operation of @entry on such values.
+// The operations of @entry are collected in @hoistedInsts.
+bool
+CFGLinearizer::canHoistBOSCCMask(Value&                              value,
+                                 const BasicBlock&                   entry,
+                                 const SmallPtrSetImpl<BasicBlock*>& blocks,
+                                 SmallPtrSetImpl<Instruction*>&      hoistedInsts) const
+{
+    Instruction* inst = dyn_cast<Instruction>(&value);
+    if (!inst || hoistedInsts.count(inst)) return true;
+
+    BasicBlock* parentBB = inst->getParent();
+    if (!blocks.count(parentBB))
+    {
+        return mDomTree.properlyDominates(parentBB, const_cast<BasicBlock*>(&entry));
+    }
+    if (parentBB != &entry) return false;
+    if (isa<PHINode>(inst)) return true;
+    if (!isSafeToSpeculativelyExecute(inst) || inst->mayReadFromMemory()) return false;
+
+    for (Use& op : inst->operands())
+    {
+        if (!canHoistBOSCCMask(*op, entry, blocks, hoistedInsts)) return false;
+    }
+    hoistedInsts.insert(inst);
+    return true;
+}
+
+// The value of @value behind the region @blocks if the region is skipped
+// because its entry mask @entryMask is false, or nullptr if that value is not
+// available in front of the region. Booleans of the region are masks (or data
+// that is not foldable): they are folded with @entryMask = false. Phis are
+// optimistically assumed to be false, a contradiction rejects the region.
+Value*
+CFGLinearizer::getSkippedValue(Value&                              value,
+                               const Value&                        entryMask,
+                               const SmallPtrSetImpl<BasicBlock*>& blocks,
+                               DenseMap<const Value*, Value*>&     skippedValues)
+{
+    Constant* falseConst = ConstantInt::getFalse(value.getContext());
+    if (&value == &entryMask) return falseConst;
+
+    Instruction* inst = dyn_cast<Instruction>(&value);
+    if (!inst || !blocks.count(inst->getParent())) return &value;
+
+    auto itSkipped = skippedValues.find(inst);
+    if (itSkipped != skippedValues.end()) return itSkipped->second;
+    if (!inst->getType()->isIntegerTy(1)) return UndefValue::get(inst->getType());
+
+    Value* skipped = nullptr;
+    if (PHINode* phi = dyn_cast<PHINode>(inst))
+    {
+        skippedValues[phi] = falseConst;
+        skipped = falseConst;
+        for (Value* incoming : phi->incoming_values())
+        {
+            if (getSkippedValue(*incoming, entryMask, blocks, skippedValues) == falseConst) continue;
+            skipped = nullptr;
+            break;
+        }
+    }
+    else if (BinaryOperator* binOp = dyn_cast<BinaryOperator>(inst))
+    {
+        Value* lhs = getSkippedValue(*binOp->getOperand(0), entryMask, blocks, skippedValues);
+        Value* rhs = getSkippedValue(*binOp->getOperand(1), entryMask, blocks, skippedValues);
+        Constant* lhsConst = dyn_cast_or_null<Constant>(lhs);
+        Constant* rhsConst = dyn_cast_or_null<Constant>(rhs);
+        if (!lhs || !rhs)
+        {
+            skipped = nullptr;
+        }
+        else if (lhsConst && rhsConst)
+        {
+            skipped = ConstantExpr::get(binOp->getOpcode(), lhsConst, rhsConst);
+        }
+        else
+        {
+            switch (binOp->getOpcode())
+            {
+                case Instruction::And:
+                    if (lhsConst) skipped = lhsConst->isNullValue() ? lhsConst : rhs;
+                    if (rhsConst) skipped = rhsConst->isNullValue() ? rhsConst : lhs;
+                    break;
+                case Instruction::Or:
+                    if (lhsConst) skipped = lhsConst->isNullValue() ? rhs : lhsConst;
+                    if (rhsConst) skipped = rhsConst->isNullValue() ? lhs : rhsConst;
+                    break;
+                case Instruction::Xor:
+                    if (lhsConst && lhsConst->isNullValue()) skipped = rhs;
+                    if (rhsConst && rhsConst->isNullValue()) skipped = lhs;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    else if (SelectInst* select = dyn_cast<SelectInst>(inst))
+    {
+        Value* cond = getSkippedValue(*select->getCondition(), entryMask, blocks, skippedValues);
+        if (Constant* condConst = dyn_cast_or_null<Constant>(cond))
+        {
+            Value* chosen = condConst->isNullValue() ? select->getFalseValue() : select->getTrueValue();
+            skipped = getSkippedValue(*chosen, entryMask, blocks, skippedValues);
+        }
+        else if (cond)
+        {
+            Value* trueValue = getSkippedValue(*select->getTrueValue(), entryMask, blocks, skippedValues);
+            Value* falseValue = getSkippedValue(*select->getFalseValue(), entryMask, blocks, skippedValues);
+            if (trueValue == falseValue) skipped = trueValue;
+        }
+    }
+
+    skippedValues[inst] = skipped;
+    return skipped;
+}
+
+static inline
+const DomTreeNode*
+GetIDom(const DominatorTree & domTree, const BasicBlock & block) {
+    const DomTreeNode * domNode = domTree.getNode(const_cast<BasicBlock*>(&block));
+    return domNode->getIDom();
+}
+
+// Forward data flow over the blocks in reverse post order: a block is reached
+// by the varying branches that reach its predecessors and by the predecessors
+// with a varying branch. Back edges are followed, so loops take further sweeps.
+// This over-approximates the paths that the disjoint path oracle considers and
+// only serves to skip queries that cannot succeed.
+void
+CFGLinearizer::computeReachingBranches(Function& scalarFn)
+{
+    for (BasicBlock& BB : scalarFn)
+    {
+        if (!rv::HasVaryingBranch(BB, mvecInfo)) continue;
+        mBranchIndex[&BB] = mVaryingBranches.size();
+        mVaryingBranches.push_back(&BB);
+    }
+
+    const unsigned numBlocks = mReachability->getNumBlocks();
+    mReachingBranches.assign(numBlocks, BitVector(mVaryingBranches.size()));
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (unsigned i = 0; i < numBlocks; ++i)
+        {
+            BitVector& reaching = mReachingBranches[i];
+            const unsigned oldCount = reaching.count();
+            for (const BasicBlock* predBB : predecessors(mReachability->getBlock(i)))
+            {
+                reaching |= mReachingBranches[mReachability->getIndex(*predBB)];
+                auto it = mBranchIndex.find(predBB);
+                if (it != mBranchIndex.end()) reaching.set(it->second);
+            }
+            changed |= reaching.count() != oldCount;
+        }
+    }
+}
+
+bool
+CFGLinearizer::isReachable(const BasicBlock& target,
+                           const BasicBlock& source,
+                           const BasicBlock* doNotTraverse,
+                           const Loop*       loop,
+                           const bool        noBackEdges)
+{
+    if (mReachabilityWalks)
+    {
+        return rv::isReachable(&target, &source, doNotTraverse, loop, loop, noBackEdges, &mLoopInfo);
+    }
+    return mReachability->isReachable(target, source, doNotTraverse, loop, noBackEdges);
+}
+
+bool
+CFGLinearizer::mayReachBlock(const BasicBlock& branchBlock, const BasicBlock& block) const
+{
+    auto it = mBranchIndex.find(&branchBlock);
+    if (it == mBranchIndex.end()) return false;
+    return mReachingBranches[mReachability->getIndex(block)].test(it->second);
+}
+
 void
 CFGLinearizer::getDivergenceCausingBlocks(Function& scalarFn)
 {
@@ -2728,11 +4116,12 @@ CFGLinearizer::getDivergenceCausingBlocksFor(BasicBlock& divergentBlock)
     DEBUG_VA( outs() << "\ngetDivergenceCausingBlocksFor(" << divergentBlock.getName() << ")\n"; );
 
     ConstBlockSet divCauseBlocks;
-    checkForDisjointPaths(&divergentBlock, true, divCauseBlocks); // FIXME const_cast
+    checkForDisjointPaths(&divergentBlock, divCauseBlocks);
+    auto& dcBlocks = mDivergenceCauseMap[&divergentBlock];
     for (auto it : divCauseBlocks)
-        mDivergenceCauseMap[&divergentBlock].push_back(const_cast<BasicBlock*>(it));
+        dcBlocks.push_back(const_cast<BasicBlock*>(it));
 
-    assert (!mDivergenceCauseMap[&divergentBlock].empty());
+    assert (!dcBlocks.empty());
 }
 
 void
@@ -2776,9 +4165,7 @@ CFGLinearizer::getRewireTargetsForMandatoryBlock(BasicBlock& block,
     //-----------------------------------------------------------------------//
     if (mvecInfo.getVectorShape(block).isVarying())
     {
-        std::vector<BasicBlock*> divergenceCausingBlocks = mDivergenceCauseMap[&block];
-
-        for (auto &dcBB : divergenceCausingBlocks)
+        for (auto &dcBB : mDivergenceCauseMap.lookup(&block))
         {
             mRewireTargetMap[dcBB].push_back(&block);
         }
@@ -2824,54 +4211,14 @@ void
 CFGLinearizer::updateRewireTargetsOnDisjointLoopPaths2(BasicBlock&  exitBlock,
                                                        const Loop&  loop,
                                                        BlockSet*    divCauseBlocks) {
-
-    NodeSet exitingNodes;
-    const BasicBlock* entryBlock = &mInfo.mScalarFunction->getEntryBlock();
-    SketchGraph * graph = nullptr;
-
-    const DomTreeNode * idom = GetIDom(mDomTree, exitBlock);
-    BasicBlock * idomBlock = idom ? idom->getBlock() : nullptr;
-
-
-// Restrict the graph search to @loop and exiting edges from @loop to @exitBlock
-    BasicBlock * loopHeader = loop.getHeader();
-    const DomTreeNode * loopDom = mDomTree.getNode(loopHeader);
-
-    graph = SketchGraph::createFromDominatorNode(mDomTree, *loopHeader, exitingNodes);
-
-// get the node handle for the exiting node
-    const BasicBlock * exitingBlock = exitBlock.getUniquePredecessor();
-    assert(exitingBlock);
-    auto exitingNode = graph->getNode(*exitingBlock);
-
-// add the exiting node explicitly
-    SketchNode * exitNode = graph->push(&exitBlock);
-    exitingNode->insert(exitNode);
-
-// only consider reachable edges
     BasicBlock * latchBlock = loop.getLoopLatch();
-#if 0
-    errs() << "Loop scope "; loop->print(errs());
-	llvm::errs() << "Graph "; graph->dump();
-	llvm::errs() << "Exit block: "<< exitBlock->getName() << "\n";
-	llvm::errs() << "Latch block: "<< latchBlock->getName() << "\n";
-#endif
-    SketchNode * latchNode = graph->getNode(*latchBlock);
-    if (!latchNode) {
+    if (!latchBlock) {
         return; // FIXME
     }
 
-    assert(latchNode && "latchNode killed during clean-up");
-    // except for the actual path enumeration, this is copied over from isMandatoryExit(..)
-    NodeSet accepting;
-    accepting.insert(exitNode);
-    accepting.insert(latchNode);
-    PathFinder finder(*graph, accepting);
-
-    const auto & loopBlocks = loop.getBlocks();
-
-    for (BasicBlock * vBlock : loopBlocks) {
-        if (! rv::HasVaryingBranch(*vBlock, mvecInfo))
+    for (BasicBlock * vBlock : loop.getBlocks()) {
+        // skips blocks without varying branch as well
+        if (! mayReachBlock(*vBlock, exitBlock))
             continue;
 
         // this only applies to nodes, that vBlock does not post-dominate
@@ -2881,24 +4228,19 @@ CFGLinearizer::updateRewireTargetsOnDisjointLoopPaths2(BasicBlock&  exitBlock,
         if ( mPostDomTree.dominates(latchBlock, vBlock) )
             continue;
 
-        // new path search algorithm starting from here
-        SketchNode * parentNode = graph->getNode(*vBlock);
-        assert(parentNode && "branch not modelled");
-
-        if (finder.findPath(parentNode)) { // validity is not checked for first node
+        if (mPathOracle.reachesExitAndLatch(*vBlock, exitBlock, loop)) {
             DEBUG_VA( outs() << "  Block '" << exitBlock.getName() << "' is MANDATORY (4)!\n"; );
             DEBUG_VA( outs() << "    due to exit '" << vBlock->getName() << "'.\n"; );
             // Add both the current block as well as the latch as rewire targets for the branch parent.
-            mRewireTargetMap[vBlock].push_back(&exitBlock);
-            mRewireTargetMap[vBlock].push_back(latchBlock);
+            auto& rewireTargets = mRewireTargetMap[vBlock];
+            rewireTargets.push_back(&exitBlock);
+            rewireTargets.push_back(latchBlock);
             if (divCauseBlocks) {
                 divCauseBlocks->insert(&exitBlock);
             }
             break;
         }
     }
-
-    delete graph;
 }
 
 void
@@ -2925,126 +4267,24 @@ CFGLinearizer::getRewireTargetsIfMandatoryExit(BasicBlock& block,
 
 bool
 CFGLinearizer::checkForDisjointPaths(const BasicBlock*  block,
-                                     bool               doNotBranchToOuterLoops,
                                      ConstBlockSet&     divergenceCausingBlocks) const {
-    NodeSet exitingNodes;
-    const BasicBlock* entryBlock = &block->getParent()->getEntryBlock();
-    SketchGraph * graph = nullptr;
-
     const DomTreeNode * idom = GetIDom(mDomTree, *block);
     BasicBlock * idomBlock = idom ? idom->getBlock() : nullptr;
 
-    // Restrict the search to nodes in the idom region that reach @block
-    if (doNotBranchToOuterLoops) {
-        const Loop * loop = mLoopInfo.getLoopFor(block);
-        const BasicBlock * topBlock = loop ? loop->getHeader() : entryBlock;
-        graph = SketchGraph::createFromDominatorNode(mDomTree, *topBlock, exitingNodes);
-
-    } else{
-        graph = SketchGraph::createFromDominatorNode(mDomTree, *entryBlock, exitingNodes);
-        assert(exitingNodes.empty() && "invalid dominance graph for entry block");
-    }
-
-#if 0
-    errs() << "Original graph:\n";
-	graph->dump();
-	mLoopInfo->print(errs());
-#endif
-
-// Remove all back-edges to outer loops
-    // FIXME
-    Loop * targetLoop = mLoopInfo.getLoopFor(block);
-    if (doNotBranchToOuterLoops) {
-        for (Loop * outerLoop = targetLoop;
-             outerLoop;
-             outerLoop = outerLoop->getParentLoop())
-        {
-            SketchNode * outerHeaderNode = graph->getNode(*outerLoop->getHeader());
-            NodeSet outerLoopPredSet = graph->getPredecessors(outerHeaderNode);
-            // graph->dumpSet(outerLoopPredSet);
-
-            for (SketchNode * outerHeaderPred : outerLoopPredSet) {
-                outerHeaderPred->erase(outerHeaderNode);
-            }
-        }
-        // reference
-        // original condition restated here
-        // if (loop == targetLoop || !targetLoop->contains(loop)) continue;
-    }
-// Eliminate dead-ends to accelerate path search
-    {
-        NodeSet keepSet;
-        SketchNode* blockNode = graph->getNode(*block);
-        assert(blockNode);
-        keepSet.insert(blockNode);
-        graph->eliminateDeadEnds(keepSet);
-    }
-
-    SketchNode * entryNode = graph->getNode(*entryBlock);
-    SketchNode * blockNode = graph->getNode(*block);
-
-
-// Run confluence contraction to merge any two nodes that will eventually pass through the same post-dominating node
-    SketchGraph * compactGraph = nullptr;
-
-    if (graph->getNumNodes() < 5) {
-        compactGraph = graph;
-        DEBUG_VA( errs() << "[VA] Graph with "<<  graph->getNumNodes() << " nodes to small for compaction\n"; );
-    } else {
-        NodeSet coreNodes = graph->getPredecessors(blockNode);
-        coreNodes.insert(blockNode);
-        compactGraph = graph->generateConfluenceGraph(coreNodes, nullptr);
-        // FIXME also make verbose
-        DEBUG_VA( errs() << "[VA] Compacted from " << graph->getNumNodes() << " to " << compactGraph->getNumNodes() << "\n"; );
-    }
-
-#ifdef VERBOSE
-    errs () << "Mapping "; confluenceMap.dump(*compactGraph, *graph);
-	errs() << "Compact "; compactGraph->dump();
-	errs() << "Source "; graph->dump();
-#endif
-
-// Check for existing path
-    SketchNode * compactBlockNode = compactGraph->getNode(*block);
-    assert(compactBlockNode);
-
-    NodeSet compactAcceptingNodes = compactGraph->getPredecessors(compactBlockNode);
-    PathFinder finder(*compactGraph, compactAcceptingNodes);
-
-    for (auto & pair  : *compactGraph) {
-        SketchNode * vCompactNode = pair.first;
-        const llvm::BasicBlock * vBlock = pair.second;
+    // only varying branches that reach the block can cause divergence there
+    const BitVector & reachingBranches = mReachingBranches[mReachability->getIndex(*block)];
+    for (int idx = reachingBranches.find_first(); idx != -1; idx = reachingBranches.find_next(idx)) {
+        const BasicBlock & vBlock = *mVaryingBranches[idx];
 
         // optimization only look below the idom (if any)
-        if (! idomBlock || (vBlock == idomBlock) || mDomTree.dominates(idomBlock, vBlock)) { //  TODO Only nodes below the idom are interesting
-            if (rv::HasVaryingBranch(*vBlock, mvecInfo)) {
-                /* const BasicBlock * A;
-                const BasicBlock * B;
-                GetTwoSuccessors(vBlock, A, B);
-
-                // FIXME do look-ups in the contraction map
-                SketchNode * aStart = graph->getNode(*A);
-                SketchNode * bStart = graph->getNode(*B);
-                SketchNode * aCompactStart = confluenceMap.getRootForNode(aStart);
-                SketchNode * bCompactStart = confluenceMap.getRootForNode(bStart);
-                assert(aCompactStart && bCompactStart);
-
-                if (aCompactStart && aCompactStart == bCompactStart) { // a and b have the same post-dominating node
-                    continue;
-                } */
-
-                // the node was not represented in this graph (FIXME this could be the reason why IDom filtering does not work. Consider, that one path might stay at vBlock==block)
-                // if (vCompactNode->size() <= 2) { continue; }
-
-                if ( finder.findPath(vCompactNode)) { // validity is not checked for first node
-                    divergenceCausingBlocks.insert(const_cast<BasicBlock*>(vBlock)); // FIXME const_cast
-                }
-            }
+        if (idomBlock && !mDomTree.dominates(idomBlock, &vBlock))
+            continue;
+
+        if (mPathOracle.joinsAt(vBlock, *block)) {
+            divergenceCausingBlocks.insert(const_cast<BasicBlock*>(&vBlock)); // FIXME const_cast
         }
     }
 
-    delete graph;
-    if (compactGraph != graph) delete compactGraph;
     return ! divergenceCausingBlocks.empty();
 }
 
@@ -3082,6 +4322,8 @@ CFGLinearizerWrapper::getAnalysisUsage(AnalysisUsage &AU) const
     AU.addRequired<LoopInfoWrapperPass>();
     AU.addPreserved<LoopInfoWrapperPass>();
 
+    AU.addPreserved<DominatorTreeWrapperPass>();
+
     AU.addRequired<LoopLiveValueAnalysisWrapper>();
     AU.addPreserved<LoopLiveValueAnalysisWrapper>();
 
@@ -3115,7 +4357,7 @@ CFGLinearizerWrapper::runOnFunction(Function& F)
                                                .getLLVAnalysis();
     VectorizationInfo& vecInfo              = getAnalysis<VectorizationInfoProxyPass>().getInfo();
     const PostDominatorTree& postDomTree    = getAnalysis<PostDominatorTree>();
-    const DominatorTree& domTree            = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+    DominatorTree& domTree                  = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
 
     mLinearizer = new rv::CFGLinearizer(rvInfo,
                                     loopInfo,
@@ -0,0 +1,384 @@
+//===- dynamicVariantGenerator.cpp ----------------*- C++ -*-===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// @authors simon
+//
+
+#include "rv/transforms/dynamicVariantGenerator.h"
+
+#include <algorithm>
+
+#include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/PostDominators.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+
+#include "rv/Region/Region.h"
+#include "rv/vectorizationInfo.h"
+#include "utils/metadata.h"
+#include "utils/rvTools.h"
+#include "rvConfig.h"
+
+using namespace llvm;
+
+
+namespace {
+
+// The uniform version doubles the code of the region.
+const unsigned MaxVariantRegionSize = 256;
+
+void
+addUnique(SmallVectorImpl<BasicBlock*>& blocks, BasicBlock* block)
+{
+    if (std::find(blocks.begin(), blocks.end(), block) == blocks.end())
+    {
+        blocks.push_back(block);
+    }
+}
+
+}
+
+
+DynamicVariantGenerator::DynamicVariantGenerator(rv::VectorizationInfo& vecInfo,
+                                                 const DominatorTree& domTree,
+                                                 const PostDominatorTree& postDomTree,
+                                                 LoopInfo& loopInfo)
+        : mVecInfo(vecInfo)
+        , mDomTree(domTree)
+        , mPostDomTree(postDomTree)
+        , mLoopInfo(loopInfo)
+        , mNumVariants(0)
+{
+}
+
+DynamicVariantGenerator::~DynamicVariantGenerator()
+{
+}
+
+bool
+DynamicVariantGenerator::run(Function& func)
+{
+    // nobody asked for variants
+    if (!rv::isMetadataSetUp()) return false;
+
+    std::vector<VariantRegion> regions;
+    ReversePostOrderTraversal<Function*> rpot(&func);
+    for (BasicBlock* block : rpot)
+    {
+        auto* branch = dyn_cast<BranchInst>(block->getTerminator());
+        if (!branch || !branch->isConditional()) continue;
+        if (!rv::hasMetadata(branch, rv::RV_METADATA_VARIANT_START)) continue;
+
+        VariantRegion region;
+        if (collectRegion(*branch, region))
+        {
+            regions.push_back(region);
+        }
+        else
+        {
+            DEBUG_RV( outs() << "No dynamic variants for the branch in '" << block->getName() << "'\n"; );
+        }
+    }
+
+    // Regions do not nest (their entries are always executed by all lanes) and
+    // transforming a later region leaves the blocks of the earlier ones intact.
+    for (auto it = regions.rbegin(); it != regions.rend(); ++it)
+    {
+        createVariants(*it);
+    }
+
+    mNumVariants += regions.size();
+    return !regions.empty();
+}
+
+bool
+DynamicVariantGenerator::collectRegion(BranchInst& branch, VariantRegion& region) const
+{
+    BasicBlock* entry = branch.getParent();
+    if (mVecInfo.getRegion() && !mVecInfo.getRegion()->contains(entry)) return false;
+
+    // The all-equal test is only exact if there are no inactive lanes.
+    if (mVecInfo.getVectorShape(branch).isUniform()) return false;
+    if (!mVecInfo.isAlwaysByAll(entry)) return false;
+    if (branch.getSuccessor(0) == branch.getSuccessor(1)) return false;
+
+    const DomTreeNode* pdNode = mPostDomTree.getNode(entry);
+    BasicBlock* join = pdNode && pdNode->getIDom() ? pdNode->getIDom()->getBlock() : nullptr;
+    if (!join) return false;
+
+    Loop* loop = mLoopInfo.getLoopFor(entry);
+    if (mLoopInfo.getLoopFor(join) != loop || (loop && loop->getHeader() == join)) return false;
+
+    unsigned size = 0;
+    SmallPtrSet<BasicBlock*, 16> regionBlocks;
+    SmallVector<BasicBlock*, 16> workList;
+    for (BasicBlock* succBB : successors(entry))
+    {
+        if (succBB != join) workList.push_back(succBB);
+    }
+
+    while (!workList.empty())
+    {
+        BasicBlock* block = workList.pop_back_val();
+        if (!regionBlocks.insert(block).second) continue;
+
+        // no inner loops, no loop exits and no back edges
+        if (block == entry || mLoopInfo.getLoopFor(block) != loop) return false;
+        if (!mDomTree.dominates(entry, block)) return false;
+
+        // two edges to the same block would need two phi entries per copy
+        auto* term = dyn_cast<BranchInst>(block->getTerminator());
+        if (!term || (term->isConditional() && term->getSuccessor(0) == term->getSuccessor(1))) return false;
+
+        for (Instruction& inst : *block)
+        {
+            if (!isa<PHINode>(inst)) ++size;
+        }
+        if (size > MaxVariantRegionSize) return false;
+
+        region.mBlocks.push_back(block);
+        for (BasicBlock* succBB : successors(block))
+        {
+            if (succBB != join) workList.push_back(succBB);
+        }
+    }
+
+    // Values of the region can only be used by the phis of the join point then.
+    for (BasicBlock* block : region.mBlocks)
+    {
+        for (BasicBlock* predBB : predecessors(block))
+        {
+            if (predBB != entry && !regionBlocks.count(predBB)) return false;
+        }
+    }
+    for (BasicBlock* predBB : predecessors(join))
+    {
+        if (predBB != entry && !regionBlocks.count(predBB)) return false;
+    }
+
+    region.mEntry = entry;
+    region.mJoin = join;
+    return true;
+}
+
+// Turns
+//
+//   entry: br %c, A, B   ->  R  ->  join
+//
+// into
+//
+//   entry:         br (rv_any(%c) == rv_all(%c)), entry.uniform, entry.varying
+//   entry.varying: br %c, A, B                     ->  R  ->  join.varying  -> join
+//   entry.uniform: br rv_any(%c), A.uniform, B.uniform -> R' -> join.uniform -> join
+//
+// The phis of join merge the two versions, the blends that the select generator creates
+// for the varying phis end up in join.varying.
+void
+DynamicVariantGenerator::createVariants(const VariantRegion& region)
+{
+    using rv::VectorShape;
+
+    BasicBlock* entry = region.mEntry;
+    BasicBlock* join = region.mJoin;
+    Function& func = *entry->getParent();
+    Loop* loop = mLoopInfo.getLoopFor(entry);
+
+    auto* branch = cast<BranchInst>(entry->getTerminator());
+    Value* cond = branch->getCondition();
+
+    DEBUG_RV( outs() << "Creating dynamic variants of the region '" << entry->getName()
+                     << "' -> '" << join->getName() << "' (" << region.mBlocks.size() << " blocks)\n"; );
+
+    // A varying block is divergent in the uniform version only if a varying branch
+    // of the region leads to it. All other copies are entered by all lanes or none.
+    SmallPtrSet<const BasicBlock*, 16> divergentBlocks;
+    auto hasDivergentPred = [&](const BasicBlock& block)
+    {
+        for (const BasicBlock* predBB : predecessors(&block))
+        {
+            if (predBB == entry) continue;
+            if (divergentBlocks.count(predBB) ||
+                !mVecInfo.getVectorShape(*predBB->getTerminator()).isUniform())
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (BasicBlock* block : region.mBlocks)
+        {
+            if (divergentBlocks.count(block) || !hasDivergentPred(*block)) continue;
+            divergentBlocks.insert(block);
+            changed = true;
+        }
+    }
+    const bool divergentUniformJoin = hasDivergentPred(*join);
+
+    // The varying version keeps the original branch.
+    BasicBlock* varyingEntry = SplitBlock(entry, branch, nullptr, &mLoopInfo);
+    varyingEntry->setName(entry->getName() + ".varying");
+
+    SmallVector<BasicBlock*, 4> varyingPreds;
+    for (BasicBlock* predBB : predecessors(join))
+    {
+        addUnique(varyingPreds, predBB);
+    }
+
+    BasicBlock* uniformEntry = BasicBlock::Create(func.getContext(),
+                                                  entry->getName() + ".uniform",
+                                                  &func,
+                                                  varyingEntry);
+    if (loop) loop->addBasicBlockToLoop(uniformEntry, mLoopInfo);
+
+    ValueToValueMapTy valueMap;
+    valueMap[varyingEntry] = uniformEntry;
+
+    std::vector<BasicBlock*> clonedBlocks;
+    for (BasicBlock* block : region.mBlocks)
+    {
+        BasicBlock* clonedBlock = CloneBasicBlock(block, valueMap, ".uniform", &func);
+        valueMap[block] = clonedBlock;
+        clonedBlocks.push_back(clonedBlock);
+        if (loop) loop->addBasicBlockToLoop(clonedBlock, mLoopInfo);
+    }
+
+    for (BasicBlock* clonedBlock : clonedBlocks)
+    {
+        for (Instruction& inst : *clonedBlock)
+        {
+            RemapInstruction(&inst, valueMap, RF_NoModuleLevelChanges | RF_IgnoreMissingEntries);
+        }
+    }
+
+    auto mapBlock = [&](BasicBlock* block)
+    {
+        return block == join ? join : cast<BasicBlock>(valueMap[block]);
+    };
+
+    // select the version
+    Module& mod = *func.getParent();
+    TerminatorInst* jump = entry->getTerminator();
+    auto* anyLane = CallInst::Create(&rv::requestLaneFunction(mod, "rv_any"), cond, "any.lane", jump);
+    auto* allLanes = CallInst::Create(&rv::requestLaneFunction(mod, "rv_all"), cond, "all.lanes", jump);
+    auto* allEqual = new ICmpInst(jump, ICmpInst::ICMP_EQ, anyLane, allLanes, "all.equal");
+    auto* dispatch = BranchInst::Create(uniformEntry, varyingEntry, allEqual, entry);
+    jump->eraseFromParent();
+
+    auto* uniformBranch = BranchInst::Create(mapBlock(branch->getSuccessor(0)),
+                                             mapBlock(branch->getSuccessor(1)),
+                                             anyLane,
+                                             uniformEntry);
+    uniformBranch->setMetadata(LLVMContext::MD_prof, branch->getMetadata(LLVMContext::MD_prof));
+
+    // the copies enter the join point on the same edges as the originals
+    SmallVector<BasicBlock*, 4> uniformPreds;
+    for (BasicBlock* predBB : varyingPreds)
+    {
+        uniformPreds.push_back(predBB == varyingEntry ? uniformEntry : mapBlock(predBB));
+    }
+
+    for (auto it = join->begin(); isa<PHINode>(it); ++it)
+    {
+        auto* phi = cast<PHINode>(it);
+        for (unsigned i = 0; i < varyingPreds.size(); ++i)
+        {
+            Value* incoming = phi->getIncomingValueForBlock(varyingPreds[i]);
+            auto mapped = valueMap.find(incoming);
+            if (mapped != valueMap.end()) incoming = mapped->second;
+            phi->addIncoming(incoming, uniformPreds[i]);
+        }
+    }
+
+    BasicBlock* varyingJoin = SplitBlockPredecessors(join, varyingPreds, ".varying", nullptr, &mLoopInfo);
+    BasicBlock* uniformJoin = SplitBlockPredecessors(join, uniformPreds, ".uniform", nullptr, &mLoopInfo);
+
+    // The vectorization analysis does not run again, annotate the new code.
+    mVecInfo.setVectorShape(*anyLane, VectorShape::uni());
+    mVecInfo.setVectorShape(*allLanes, VectorShape::uni());
+    mVecInfo.setVectorShape(*allEqual, VectorShape::uni());
+    mVecInfo.setVectorShape(*dispatch, VectorShape::uni());
+    mVecInfo.setVectorShape(*uniformBranch, VectorShape::uni());
+
+    for (BasicBlock* block : region.mBlocks)
+    {
+        auto* clonedBlock = cast<BasicBlock>(valueMap[block]);
+        for (Instruction& inst : *block)
+        {
+            if (!mVecInfo.hasKnownShape(inst)) continue;
+            mVecInfo.setVectorShape(*cast<Instruction>(valueMap[&inst]), mVecInfo.getVectorShape(inst));
+        }
+
+        if (divergentBlocks.count(block))
+        {
+            mVecInfo.setVectorShape(*clonedBlock, mVecInfo.getVectorShape(*block));
+            if (mVecInfo.isMandatory(block)) mVecInfo.markMandatory(clonedBlock);
+            mVecInfo.markNotAlwaysByAll(clonedBlock);
+        }
+        else
+        {
+            mVecInfo.setVectorShape(*clonedBlock, VectorShape::uni());
+            mVecInfo.markAlwaysByAllOrNone(clonedBlock);
+        }
+    }
+
+    // phis created by splitting the join point
+    for (auto it = join->begin(); isa<PHINode>(it); ++it)
+    {
+        auto* phi = cast<PHINode>(it);
+        for (BasicBlock* predBB : { varyingJoin, uniformJoin })
+        {
+            auto* splitPhi = dyn_cast<PHINode>(phi->getIncomingValueForBlock(predBB));
+            if (splitPhi && splitPhi->getParent() == predBB)
+            {
+                mVecInfo.setVectorShape(*splitPhi, mVecInfo.getVectorShape(*phi));
+            }
+        }
+    }
+
+    for (BasicBlock* block : { varyingEntry, uniformEntry })
+    {
+        mVecInfo.setVectorShape(*block, VectorShape::uni());
+        mVecInfo.markAlwaysByAllOrNone(block);
+    }
+
+    mVecInfo.setVectorShape(*varyingJoin, mVecInfo.getVectorShape(*join));
+    if (mVecInfo.isMandatory(join)) mVecInfo.markMandatory(varyingJoin);
+    mVecInfo.markAlwaysByAllOrNone(varyingJoin);
+
+    if (divergentUniformJoin)
+    {
+        mVecInfo.setVectorShape(*uniformJoin, mVecInfo.getVectorShape(*join));
+        if (mVecInfo.isMandatory(join)) mVecInfo.markMandatory(uniformJoin);
+    }
+    else
+    {
+        mVecInfo.setVectorShape(*uniformJoin, VectorShape::uni());
+    }
+    mVecInfo.markAlwaysByAllOrNone(uniformJoin);
+
+    // only the two versions meet here, on the uniform edges of the dispatch
+    mVecInfo.setVectorShape(*join, VectorShape::uni());
+
+    rv::removeMetadata(branch, rv::RV_METADATA_VARIANT_START);
+    rv::setMetadata(dispatch, rv::RV_METADATA_VARIANT_START);
+    rv::setMetadata(varyingJoin->getTerminator(), rv::RV_METADATA_VARIANT_END);
+    rv::setMetadata(uniformJoin->getTerminator(), rv::RV_METADATA_VARIANT_END);
+}
@@ -0,0 +1,348 @@
+//===- laneRefiller.cpp ----------------*- C++ -*-===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// @authors simon
+//
+
+#include "rv/transforms/laneRefiller.h"
+
+#include <set>
+#include <vector>
+
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "utils/rvTools.h"
+#include "rvConfig.h"
+
+using namespace llvm;
+
+
+namespace {
+
+typedef std::set<const BasicBlock*> PostBlockSet;
+
+// Blocks of @loop that execute after @inner (starting at its exit block @innerExit).
+PostBlockSet
+collectPostBlocks(const Loop& loop, const Loop& inner, const BasicBlock& innerExit)
+{
+    PostBlockSet postBlocks;
+    std::vector<const BasicBlock*> worklist = { &innerExit };
+    while (!worklist.empty())
+    {
+        const BasicBlock* block = worklist.back();
+        worklist.pop_back();
+        if (!postBlocks.insert(block).second) continue;
+
+        for (const BasicBlock* succ : successors(block))
+        {
+            if (succ == loop.getHeader() || !loop.contains(succ) || inner.contains(succ)) continue;
+            worklist.push_back(succ);
+        }
+    }
+    return postBlocks;
+}
+
+// Create a phi in @block that receives @value from @incoming and undef from all other predecessors
+PHINode*
+createPartialPhi(BasicBlock& block, Value& value, BasicBlock& incoming, const Twine& name)
+{
+    auto* phi = PHINode::Create(value.getType(), 3, name, block.getFirstNonPHI());
+    for (BasicBlock* pred : predecessors(&block))
+    {
+        phi->addIncoming(pred == &incoming ? &value : UndefValue::get(value.getType()), pred);
+    }
+    return phi;
+}
+
+}
+
+
+LaneRefiller::LaneRefiller()
+{
+}
+
+LaneRefiller::~LaneRefiller()
+{
+}
+
+// Match the exit condition of the latch to "continue while i.next <pred> bound".
+bool
+LaneRefiller::matchLatchCompare(const Loop& loop, const PHINode& ivPhi,
+                                CmpInst::Predicate& pred, Value*& bound) const
+{
+    const BasicBlock* latch = loop.getLoopLatch();
+    const auto* branch = dyn_cast<BranchInst>(latch->getTerminator());
+    if (!branch || !branch->isConditional()) return false;
+
+    const auto* cmp = dyn_cast<ICmpInst>(branch->getCondition());
+    if (!cmp) return false;
+
+    const Value* increment = ivPhi.getIncomingValueForBlock(latch);
+    pred = cmp->getPredicate();
+    if (cmp->getOperand(0) == increment)
+    {
+        bound = cmp->getOperand(1);
+    }
+    else if (cmp->getOperand(1) == increment)
+    {
+        bound = cmp->getOperand(0);
+        pred = CmpInst::getSwappedPredicate(pred);
+    }
+    else
+    {
+        return false;
+    }
+
+    if (branch->getSuccessor(0) != loop.getHeader())
+    {
+        pred = CmpInst::getInversePredicate(pred);
+    }
+
+    // Refilled lanes skip ahead, only a monotone bound tells whether work is left
+    if (pred != CmpInst::ICMP_SLT && pred != CmpInst::ICMP_ULT &&
+        pred != CmpInst::ICMP_SLE && pred != CmpInst::ICMP_ULE)
+    {
+        return false;
+    }
+
+    return loop.isLoopInvariant(bound);
+}
+
+bool
+LaneRefiller::canRefill(const Loop& loop, const PHINode& ivPhi, std::string& reason) const
+{
+    const BasicBlock* header = loop.getHeader();
+    const BasicBlock* latch = loop.getLoopLatch();
+    if (!loop.getLoopPreheader() || !latch || loop.getExitingBlock() != latch || !loop.getExitBlock())
+    {
+        reason = "not in simplified form";
+        return false;
+    }
+
+    if (isa<PHINode>(loop.getExitBlock()->front()))
+    {
+        reason = "live-out values";
+        return false;
+    }
+
+    if (&*header->begin() != &ivPhi || header->getFirstNonPHI() != ivPhi.getNextNode())
+    {
+        reason = "loop-carried values besides the induction variable";
+        return false;
+    }
+
+    CmpInst::Predicate pred;
+    Value* bound = nullptr;
+    if (!matchLatchCompare(loop, ivPhi, pred, bound))
+    {
+        reason = "unsupported exit condition";
+        return false;
+    }
+
+    if (loop.getSubLoops().size() != 1)
+    {
+        reason = "not exactly one inner loop";
+        return false;
+    }
+
+    const Loop& inner = *loop.getSubLoops()[0];
+    const BasicBlock* innerExit = inner.getUniqueExitBlock();
+    if (!inner.getLoopPreheader() || !inner.getLoopLatch() || !innerExit)
+    {
+        reason = "inner loop not in simplified form";
+        return false;
+    }
+
+    // Every path through the body must pass the inner loop
+    PostBlockSet postBlocks = collectPostBlocks(loop, inner, *innerExit);
+    if (!postBlocks.count(latch))
+    {
+        reason = "latch does not post-dominate the inner loop";
+        return false;
+    }
+
+    for (const BasicBlock* block : loop.blocks())
+    {
+        if (inner.contains(block) || postBlocks.count(block)) continue;
+
+        for (const BasicBlock* succ : successors(block))
+        {
+            if (postBlocks.count(succ))
+            {
+                reason = "control flow bypasses the inner loop";
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void
+LaneRefiller::refill(Loop& loop, PHINode& ivPhi)
+{
+    BasicBlock* header = loop.getHeader();
+    BasicBlock* preheader = loop.getLoopPreheader();
+    BasicBlock* latch = loop.getLoopLatch();
+    BasicBlock* exitBlock = loop.getExitBlock();
+
+    Loop& inner = *loop.getSubLoops()[0];
+    BasicBlock* innerHeader = inner.getHeader();
+    BasicBlock* innerPreheader = inner.getLoopPreheader();
+    BasicBlock* innerLatch = inner.getLoopLatch();
+
+    CmpInst::Predicate pred;
+    Value* bound = nullptr;
+    bool matched = matchLatchCompare(loop, ivPhi, pred, bound);
+    assert (matched && "loop not supported!"); (void) matched;
+
+    // blocks that run before the inner loop, they are not visited on trips that resume the inner loop
+    PostBlockSet postBlocks = collectPostBlocks(loop, inner, *inner.getUniqueExitBlock());
+    std::set<BasicBlock*> preBlocks;
+    for (BasicBlock* block : loop.blocks())
+    {
+        if (!inner.contains(block) && !postBlocks.count(block)) preBlocks.insert(block);
+    }
+
+    Function& F = *header->getParent();
+    Module& mod = *F.getParent();
+    LLVMContext& context = F.getContext();
+    Type* boolTy = Type::getInt1Ty(context);
+    Type* i32Ty = Type::getInt32Ty(context);
+    Type* indexTy = ivPhi.getType();
+    Value* initValue = ivPhi.getIncomingValueForBlock(preheader);
+
+    Function& anyFn = rv::requestLaneFunction(mod, "rv_any", boolTy);
+    Function& popcountFn = rv::requestLaneFunction(mod, "rv_popcount", i32Ty);
+    Function& indexFn = rv::requestLaneFunction(mod, "rv_index", i32Ty);
+
+    // keep the header for dispatching lanes, its body becomes the first block of the outer iteration
+    BasicBlock* bodyEntry = header->splitBasicBlock(header->getFirstNonPHI(), header->getName() + ".refill.body");
+    preBlocks.erase(header);
+    preBlocks.insert(bodyEntry);
+    if (innerPreheader == header) innerPreheader = bodyEntry;
+
+    BasicBlock* checkBlock = BasicBlock::Create(context, "refill.check", &F, bodyEntry);
+    BasicBlock* idleBlock = BasicBlock::Create(context, "refill.idle", &F, bodyEntry);
+    BasicBlock* resumeBlock = BasicBlock::Create(context, "refill.resume", &F, bodyEntry);
+    BasicBlock* suspendBlock = BasicBlock::Create(context, "refill.suspend", &F, exitBlock);
+    BasicBlock* newLatch = BasicBlock::Create(context, "refill.latch", &F, exitBlock);
+    BranchInst::Create(innerHeader, resumeBlock);
+    BranchInst::Create(newLatch, idleBlock);
+    BranchInst::Create(newLatch, suspendBlock);
+
+    // lanes that are not suspended in the inner loop grab the next outer iterations
+    std::vector<Use*> ivUses;
+    for (Use& use : ivPhi.uses()) ivUses.push_back(&use);
+
+    header->getTerminator()->eraseFromParent();
+    auto* resumePhi = PHINode::Create(boolTy, 2, "refill.resume", header);
+    auto* basePhi = PHINode::Create(indexTy, 2, "refill.base", header);
+    auto* needWork = BinaryOperator::CreateNot(resumePhi, "refill.need", header);
+    auto* rank = CallInst::Create(&indexFn, needWork, "refill.rank", header);
+    auto* count = CallInst::Create(&popcountFn, needWork, "refill.count", header);
+    auto* rankIdx = CastInst::CreateIntegerCast(rank, indexTy, false, "", header);
+    auto* countIdx = CastInst::CreateIntegerCast(count, indexTy, false, "", header);
+    auto* newIdx = BinaryOperator::CreateAdd(basePhi, rankIdx, "refill.idx", header);
+    auto* currentIdx = SelectInst::Create(needWork, newIdx, &ivPhi, "refill.iv", header);
+    auto* hasWork = new ICmpInst(*header, pred, basePhi, bound, "refill.haswork");
+    auto* bumpedBase = BinaryOperator::CreateAdd(basePhi, countIdx, "", header);
+    auto* nextBase = SelectInst::Create(hasWork, bumpedBase, basePhi, "refill.base.next", header);
+    BranchInst::Create(resumeBlock, checkBlock, resumePhi, header);
+
+    for (Use* use : ivUses) use->set(currentIdx);
+
+    // lanes with an exhausted iteration space idle until the loop ends
+    auto* valid = new ICmpInst(*checkBlock, pred, currentIdx, bound, "refill.valid");
+    BranchInst::Create(bodyEntry, idleBlock, valid, checkBlock);
+
+    // the old latch finishes an outer iteration
+    auto* oldBranch = cast<BranchInst>(latch->getTerminator());
+    auto* oldCond = dyn_cast<Instruction>(oldBranch->getCondition());
+    auto* increment = cast<Instruction>(ivPhi.getIncomingValueForBlock(latch));
+    oldBranch->eraseFromParent();
+    BranchInst::Create(newLatch, latch);
+    if (oldCond && oldCond->use_empty()) oldCond->eraseFromParent();
+
+    ivPhi.removeIncomingValue(latch, false);
+    if (increment->use_empty()) increment->eraseFromParent();
+
+    // the inner back edge suspends the lane until the next trip
+    auto* innerTerm = innerLatch->getTerminator();
+    for (uint i = 0; i < innerTerm->getNumSuccessors(); ++i)
+    {
+        if (innerTerm->getSuccessor(i) == innerHeader) innerTerm->setSuccessor(i, suspendBlock);
+    }
+
+    auto* resumeNext = PHINode::Create(boolTy, 3, "refill.resume.next", newLatch);
+    resumeNext->addIncoming(ConstantInt::getTrue(context), suspendBlock);
+    resumeNext->addIncoming(ConstantInt::getFalse(context), latch);
+    resumeNext->addIncoming(ConstantInt::getFalse(context), idleBlock);
+    auto* anyResume = CallInst::Create(&anyFn, resumeNext, "refill.any", newLatch);
+    auto* moreWork = new ICmpInst(*newLatch, pred, nextBase, bound, "refill.more");
+    auto* cont = BinaryOperator::CreateOr(anyResume, moreWork, "refill.cont", newLatch);
+    BranchInst::Create(header, exitBlock, cont, newLatch);
+
+    ivPhi.addIncoming(currentIdx, newLatch);
+    resumePhi->addIncoming(ConstantInt::getFalse(context), preheader);
+    resumePhi->addIncoming(resumeNext, newLatch);
+    basePhi->addIncoming(initValue, preheader);
+    basePhi->addIncoming(nextBase, newLatch);
+
+    // inner loop-carried values travel through the outer latch and header
+    std::vector<PHINode*> innerPhis;
+    for (auto it = innerHeader->begin(); isa<PHINode>(*it); ++it) innerPhis.push_back(cast<PHINode>(&*it));
+
+    for (PHINode* phi : innerPhis)
+    {
+        Value* update = phi->getIncomingValueForBlock(innerLatch);
+        phi->removeIncomingValue(innerLatch, false);
+
+        auto* latchPhi = createPartialPhi(*newLatch, *update, *suspendBlock, phi->getName() + ".suspended");
+        auto* headerPhi = createPartialPhi(*header, *latchPhi, *newLatch, phi->getName() + ".resumed");
+        phi->addIncoming(headerPhi, resumeBlock);
+    }
+
+    // values of the outer iteration that are live in the inner loop and after it
+    // survive suspended trips through the same chain of phis
+    for (BasicBlock* block : preBlocks)
+    {
+        for (auto& inst : *block)
+        {
+            std::vector<Use*> outsideUses;
+            for (Use& use : inst.uses())
+            {
+                auto* userInst = cast<Instruction>(use.getUser());
+                BasicBlock* useBlock = userInst->getParent();
+                if (auto* phi = dyn_cast<PHINode>(userInst))
+                {
+                    useBlock = phi->getIncomingBlock(use);
+                }
+                if (!preBlocks.count(useBlock)) outsideUses.push_back(&use);
+            }
+            if (outsideUses.empty()) continue;
+
+            auto* carryPhi = PHINode::Create(inst.getType(), 2, inst.getName() + ".carried", &*innerHeader->begin());
+            auto* latchPhi = createPartialPhi(*newLatch, *carryPhi, *suspendBlock, inst.getName() + ".suspended");
+            auto* headerPhi = createPartialPhi(*header, *latchPhi, *newLatch, inst.getName() + ".resumed");
+            carryPhi->addIncoming(&inst, innerPreheader);
+            carryPhi->addIncoming(headerPhi, resumeBlock);
+
+            for (Use* use : outsideUses) use->set(carryPhi);
+        }
+    }
+
+    IF_DEBUG {
+        outs() << "LaneRefiller: refilled loop " << header->getName() << "\n";
+        F.print(outs());
+    }
+}
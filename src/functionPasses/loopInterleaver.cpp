@@ -0,0 +1,350 @@
+//===- loopInterleaver.cpp ----------------*- C++ -*-===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// @authors simon
+//
+
+#include "rv/transforms/loopInterleaver.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "rvConfig.h"
+#include "utils/rvTools.h"
+
+using namespace llvm;
+
+
+InterleaveTargetInfo::InterleaveTargetInfo()
+        : maxInterleaveFactor(4)
+        , numVectorRegisters(16)
+        , longLatencyThreshold(10)
+        , fpArithLatency(4)
+        , intMulLatency(3)
+        , fpDivLatency(14)
+        , intDivLatency(20)
+        , loadLatency(5)
+        , callLatency(10)
+{
+}
+
+InterleaveTargetInfo::InterleaveTargetInfo(const TargetTransformInfo& TTI, unsigned vectorWidth)
+        : InterleaveTargetInfo()
+{
+    maxInterleaveFactor = std::max(1u, TTI.getMaxInterleaveFactor(vectorWidth));
+    if (unsigned numRegisters = TTI.getNumberOfRegisters(true)) numVectorRegisters = numRegisters;
+}
+
+
+LoopInterleaver::LoopInterleaver(unsigned vectorWidth, const InterleaveTargetInfo& targetInfo)
+        : mVectorWidth(vectorWidth)
+        , mTargetInfo(targetInfo)
+{
+}
+
+LoopInterleaver::~LoopInterleaver()
+{
+}
+
+unsigned
+LoopInterleaver::getLatency(const Instruction& inst) const
+{
+    switch (inst.getOpcode())
+    {
+        case Instruction::FAdd:
+        case Instruction::FSub:
+        case Instruction::FMul:
+            return mTargetInfo.fpArithLatency;
+        case Instruction::Mul:
+            return mTargetInfo.intMulLatency;
+        case Instruction::FDiv:
+        case Instruction::FRem:
+            return mTargetInfo.fpDivLatency;
+        case Instruction::UDiv:
+        case Instruction::SDiv:
+        case Instruction::URem:
+        case Instruction::SRem:
+            return mTargetInfo.intDivLatency;
+        case Instruction::Load:
+            return mTargetInfo.loadLatency;
+        case Instruction::Call:
+            return mTargetInfo.callLatency;
+        default:
+            return 1;
+    }
+}
+
+unsigned
+LoopInterleaver::computeInterleaveFactor(Loop& loop, PHINode& ivPhi) const
+{
+    BasicBlock* header = loop.getHeader();
+
+    // The copies can not be chained across data-dependent exits.
+    if (loop.getExitingBlock() != loop.getLoopLatch()) return 1;
+
+    // The latency of the slowest recurrence bounds the throughput of a single
+    // vector iteration: independent accumulators hide it.
+    unsigned chainLatency = 0;
+    for (auto& inst : *header)
+    {
+        auto* phi = dyn_cast<PHINode>(&inst);
+        if (!phi) break;
+        if (phi == &ivPhi) continue;
+
+        if (!rv::getReductionOpcode(loop, *phi)) return 1;
+        auto* update = cast<Instruction>(phi->getIncomingValueForBlock(loop.getLoopLatch()));
+        chainLatency = std::max(chainLatency, getLatency(*update));
+    }
+
+    bool hasLongLatencyOp = false;
+    unsigned numLiveValues = 0;
+    for (auto* block : loop.blocks())
+    {
+        for (auto& inst : *block)
+        {
+            if (getLatency(inst) >= mTargetInfo.longLatencyThreshold) hasLongLatencyOp = true;
+            if (!inst.getType()->isVoidTy() && inst.isUsedOutsideOfBlock(block)) ++numLiveValues;
+        }
+    }
+
+    unsigned latencyFactor = chainLatency > 1 ? chainLatency : (hasLongLatencyOp ? 2 : 1);
+    unsigned registerFactor = std::max(1u, mTargetInfo.numVectorRegisters / std::max(1u, numLiveValues));
+
+    unsigned factor = std::min(std::min(latencyFactor, registerFactor), mTargetInfo.maxInterleaveFactor);
+
+    // Round down to a power of two to keep trip count requirements simple.
+    unsigned powerOfTwo = 1;
+    while (powerOfTwo * 2 <= factor) powerOfTwo *= 2;
+
+    DEBUG_RV( outs() << "LoopInterleaver: chain latency " << chainLatency
+                     << ", live values " << numLiveValues
+                     << ", long latency ops " << hasLongLatencyOp
+                     << " -> factor " << powerOfTwo << "\n"; );
+
+    return powerOfTwo;
+}
+
+bool
+LoopInterleaver::interleave(Loop& loop, PHINode& ivPhi, unsigned factor)
+{
+    if (factor <= 1) return false;
+
+    BasicBlock* header    = loop.getHeader();
+    BasicBlock* latch     = loop.getLoopLatch();
+    BasicBlock* preheader = loop.getLoopPreheader();
+    BasicBlock* exitBlock = loop.getExitBlock();
+
+    if (!latch || !preheader || !exitBlock) return false;
+    if (loop.getExitingBlock() != latch) return false;
+    if (exitBlock->getSinglePredecessor() != latch) return false;
+
+    auto* latchBranch = dyn_cast<BranchInst>(latch->getTerminator());
+    if (!latchBranch || !latchBranch->isConditional()) return false;
+
+    auto* ivIncrement = dyn_cast<BinaryOperator>(ivPhi.getIncomingValueForBlock(latch));
+    if (!ivIncrement || ivIncrement->getOpcode() != Instruction::Add) return false;
+
+    SmallVector<PHINode*, 4> reductionPhis;
+    for (auto& inst : *header)
+    {
+        auto* phi = dyn_cast<PHINode>(&inst);
+        if (!phi) break;
+        if (phi == &ivPhi) continue;
+        if (!rv::getReductionOpcode(loop, *phi))
+        {
+            DEBUG_RV( outs() << "LoopInterleaver: unsupported recurrence " << *phi << "\n"; );
+            return false;
+        }
+        reductionPhis.push_back(phi);
+    }
+
+    Function* func = header->getParent();
+    std::vector<BasicBlock*> loopBlocks(loop.block_begin(), loop.block_end());
+
+    // Clone the loop body factor - 1 times.
+    std::vector<std::unique_ptr<ValueToValueMapTy>> copyMaps;
+    std::vector<BasicBlock*> copyHeaders;
+    std::vector<BasicBlock*> copyLatches;
+    copyHeaders.push_back(header);
+    copyLatches.push_back(latch);
+
+    for (unsigned k = 1; k < factor; ++k)
+    {
+        copyMaps.emplace_back(new ValueToValueMapTy());
+        ValueToValueMapTy& valueMap = *copyMaps.back();
+
+        std::vector<BasicBlock*> clonedBlocks;
+        for (auto* block : loopBlocks)
+        {
+            BasicBlock* clonedBlock = CloneBasicBlock(block, valueMap, ".ilv" + Twine(k), func);
+            valueMap[block] = clonedBlock;
+            clonedBlocks.push_back(clonedBlock);
+        }
+
+        for (auto* clonedBlock : clonedBlocks)
+        {
+            for (auto& inst : *clonedBlock)
+            {
+                RemapInstruction(&inst, valueMap,
+                                 RF_NoModuleLevelChanges | RF_IgnoreMissingEntries);
+            }
+        }
+
+        copyHeaders.push_back(cast<BasicBlock>(valueMap[header]));
+        copyLatches.push_back(cast<BasicBlock>(valueMap[latch]));
+    }
+
+    BasicBlock* lastLatch = copyLatches.back();
+
+    // Chain the copies: all but the last latch fall through to the next copy.
+    for (unsigned k = 0; k + 1 < factor; ++k)
+    {
+        auto* branch = cast<BranchInst>(copyLatches[k]->getTerminator());
+        auto* cond = dyn_cast<Instruction>(branch->getCondition());
+        BranchInst::Create(copyHeaders[k + 1], branch);
+        branch->eraseFromParent();
+        if (cond && cond->use_empty()) cond->eraseFromParent();
+    }
+
+    // The last copy closes the loop.
+    auto* lastBranch = cast<BranchInst>(lastLatch->getTerminator());
+    for (unsigned i = 0; i < lastBranch->getNumSuccessors(); ++i)
+    {
+        if (lastBranch->getSuccessor(i) == copyHeaders.back())
+        {
+            lastBranch->setSuccessor(i, header);
+        }
+    }
+
+    // Replace the header phis of the copies by offset induction variables
+    // and independent accumulators.
+    Instruction* headerInsertPt = &*header->getFirstInsertionPt();
+    for (unsigned k = 1; k < factor; ++k)
+    {
+        ValueToValueMapTy& valueMap = *copyMaps[k - 1];
+
+        auto* clonedIV = cast<PHINode>(valueMap[&ivPhi]);
+        auto* ivOffset = ConstantInt::get(ivPhi.getType(), k * mVectorWidth);
+        auto* offsetIV = BinaryOperator::CreateAdd(&ivPhi, ivOffset,
+                                                   ivPhi.getName() + ".ilv" + Twine(k),
+                                                   headerInsertPt);
+        clonedIV->replaceAllUsesWith(offsetIV);
+        clonedIV->eraseFromParent();
+
+        for (auto* phi : reductionPhis)
+        {
+            auto* clonedPhi = cast<PHINode>(valueMap[phi]);
+            auto* update = cast<Instruction>(phi->getIncomingValueForBlock(latch));
+
+            // behind the existing phis, the induction variable stays the first one
+            auto* accu = PHINode::Create(phi->getType(), 2,
+                                         phi->getName() + ".ilv" + Twine(k),
+                                         header->getFirstNonPHI());
+            accu->addIncoming(rv::getReductionIdentity(update->getOpcode(), phi->getType()),
+                              preheader);
+            accu->addIncoming(valueMap[update], lastLatch);
+
+            clonedPhi->replaceAllUsesWith(accu);
+            clonedPhi->eraseFromParent();
+        }
+    }
+
+    // Re-route the back edge of the original header phis.
+    for (auto& inst : *header)
+    {
+        auto* phi = dyn_cast<PHINode>(&inst);
+        if (!phi) break;
+        int latchIdx = phi->getBasicBlockIndex(latch);
+        if (latchIdx < 0) continue;
+
+        phi->setIncomingBlock(latchIdx, lastLatch);
+        if (phi == &ivPhi)
+        {
+            phi->setIncomingValue(latchIdx, copyMaps.back()->lookup(ivIncrement));
+        }
+    }
+
+    // The increments of all but the last copy only fed the dropped exit tests.
+    if (ivIncrement->use_empty()) ivIncrement->eraseFromParent();
+    for (unsigned k = 1; k + 1 < factor; ++k)
+    {
+        auto* copyIncrement = cast<Instruction>(copyMaps[k - 1]->lookup(ivIncrement));
+        if (copyIncrement->use_empty()) copyIncrement->eraseFromParent();
+    }
+
+    // Fix up the LCSSA phis: reductions combine all accumulators, any other
+    // live-out is taken from the last copy.
+    ValueToValueMapTy& lastMap = *copyMaps.back();
+    SmallVector<PHINode*, 4> exitPhis;
+    for (auto& inst : *exitBlock)
+    {
+        auto* phi = dyn_cast<PHINode>(&inst);
+        if (!phi) break;
+        exitPhis.push_back(phi);
+    }
+
+    for (auto* exitPhi : exitPhis)
+    {
+        int latchIdx = exitPhi->getBasicBlockIndex(latch);
+        assert (latchIdx >= 0);
+        exitPhi->setIncomingBlock(latchIdx, lastLatch);
+
+        Value* liveOut = exitPhi->getIncomingValue(latchIdx);
+        auto* liveOutInst = dyn_cast<Instruction>(liveOut);
+        if (!liveOutInst || !loop.contains(liveOutInst->getParent())) continue;
+
+        bool isReductionResult = false;
+        for (auto* phi : reductionPhis)
+        {
+            if (phi->getIncomingValueForBlock(lastLatch) == liveOut) isReductionResult = true;
+        }
+
+        if (!isReductionResult)
+        {
+            exitPhi->setIncomingValue(latchIdx, lastMap.lookup(liveOut));
+            continue;
+        }
+
+        SmallVector<User*, 4> users(exitPhi->user_begin(), exitPhi->user_end());
+
+        Instruction* combineInsertPt = &*exitBlock->getFirstInsertionPt();
+        Value* combined = exitPhi;
+        for (unsigned k = 1; k < factor; ++k)
+        {
+            auto* accuPhi = PHINode::Create(liveOut->getType(), 1,
+                                            liveOut->getName() + ".lcssa.ilv" + Twine(k),
+                                            exitPhis.back()->getNextNode());
+            accuPhi->addIncoming(copyMaps[k - 1]->lookup(liveOut), lastLatch);
+
+            auto* combine = BinaryOperator::Create(cast<BinaryOperator>(liveOutInst)->getOpcode(),
+                                                   combined, accuPhi,
+                                                   liveOut->getName() + ".ilv.red",
+                                                   combineInsertPt);
+            combine->copyIRFlags(liveOutInst);
+            combined = combine;
+        }
+
+        for (auto* user : users)
+        {
+            user->replaceUsesOfWith(exitPhi, combined);
+        }
+    }
+
+    DEBUG_RV( outs() << "LoopInterleaver: interleaved loop " << header->getName()
+                     << " by factor " << factor << "\n"; );
+
+    return true;
+}
@@ -16,8 +16,10 @@
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Verifier.h> // verifyFunction()
+#include <llvm/ADT/SmallPtrSet.h>
 
 #include "utils/metadata.h"
+#include "utils/rvTools.h"
 #include "rvConfig.h"
 
 using namespace llvm;
@@ -25,6 +27,7 @@ using namespace rv;
 
 void
 MaskGenerator::markMaskOperation(Instruction& maskOp) {
+    ++mNumMaskOperations;
     mvecInfo.setVectorShape(maskOp, VectorShape::varying()); //isa<PHINode>(maskOp) ? VectorShape::uni() : VectorShape::varying());
 
 
@@ -68,7 +71,8 @@ MaskGenerator::MaskGenerator(RVInfo& RVinfo,
         : mInfo(RVinfo),
           mMaskAnalysis(MaskAnalysis),
           mvecInfo(Vecinfo),
-          mLoopInfo(Loopinfo)
+          mLoopInfo(Loopinfo),
+          mNumMaskOperations(0)
 {
 }
 
@@ -160,6 +164,7 @@ MaskGenerator::generate(Function& F)
     }
 
     IF_DEBUG F.print(outs());
+    IF_DEBUG { outs() << "materialized " << mNumMaskOperations << " mask operations\n"; }
 
     fillVecInfoWithPredicates(F);
 
@@ -171,100 +176,42 @@ MaskGenerator::generate(Function& F)
     return true;
 }
 
-// Recursively materialize masks where required:
-// - OP_VARYING phis (blend operations)
-// - DIVERGENT loops
-// - OP_SEQUENTIAL_GUARDED operations and "native" calls with mask parameters
-//   - For these, create dummy uses (calls) at the operations.
-//     This ensures that dependencies are maintained during CFG linearization.
-// - MANDATORY blocks with phi(s)
-//   - Masks may be required if incoming edges change and cause live ranges to overlap.
+// Materialize only the masks that are consumed later on:
+// - entry masks of blocks with memory operations or calls, which the vector
+//   backend predicates. Each is sunk to its first consumer.
+// - exit masks of edges into blocks with blended (non-uniform) phis,
+//   into MANDATORY blocks (CFG linearization) and into DIVERGENT loop headers
+// - loop masks and loop exit masks of DIVERGENT loops
+// Other masks are only materialized as operands of these.
+// Afterwards, uniform exits of loops that are only uniform on their active
+// lanes (see UniformLoopAnalysis) are rewritten to test these lanes.
 void
 MaskGenerator::materializeMasks(Function* f)
 {
     assert (f);
-    assert (!f->getParent()->getFunction("entryMaskUseFn"));
-
-    Region * region = mvecInfo.getRegion();
 
+    // Sink all demanded entry masks before anything is materialized, so that
+    // no operation is emitted at the top of the block.
+    SmallPtrSet<const BasicBlock*, 16> usedEntryMasks;
     for (auto &BB : *f)
     {
-#if 0
-        if (region && !region->contains(&BB)) continue; // skip blocks outside of region
-#endif
+        Instruction* maskUser = getFirstMaskUser(BB);
+        if (!maskUser) continue;
+
+        usedEntryMasks.insert(&BB);
+        mMaskAnalysis.sinkEntryMask(BB, *maskUser);
+    }
 
-        if (entryMaskIsUsed(BB))
+    for (auto &BB : *f)
+    {
+        if (usedEntryMasks.count(&BB))
         {
             MaskPtr mask = mMaskAnalysis.getEntryMaskPtr(BB);
-            Value* newEntryMask = materializeMask(mask);
+            Value* newEntryMask = materializeMask(mask); RV_UNUSED(newEntryMask);
 
             IF_DEBUG {  outs() << "  entry mask of block '"
                 << BB.getName() << "': " << *newEntryMask << "\n";
             }
-
-            // If the entry mask is not an 'or' in the same block, generate
-            // dummy use for the mask at beginning of block, to be used by
-            // calls that require the mask or OP_SEQUENTIAL_GUARDED operations.
-            // If the entry mask is a constant or argument, we don't need the
-            // dummy, either.
-            if (isa<Instruction>(newEntryMask) &&
-                cast<Instruction>(newEntryMask)->getParent() != &BB)
-            {
-                Function* entryMaskUseFn = f->getParent()->getFunction("entryMaskUseFn");
-#if 0
-                if (!entryMaskUseFn)
-                {
-                    // Create function that simply returns the argument.
-                    FunctionType* fnTy = FunctionType::get(Type::getInt1Ty(*mInfo.mContext),
-                                                           Type::getInt1Ty(*mInfo.mContext),
-                                                           false);
-                    entryMaskUseFn = Function::Create(fnTy,
-                                                      Function::InternalLinkage,
-                                                      "entryMaskUseFn",
-                                                      f->getParent());
-                    entryMaskUseFn->setDoesNotAccessMemory();
-                    entryMaskUseFn->setDoesNotThrow();
-
-                    BasicBlock* entryBB = BasicBlock::Create(*mInfo.mContext,
-                                                             "entry",
-                                                             entryMaskUseFn);
-                    ReturnInst::Create(*mInfo.mContext,
-                                       &*entryMaskUseFn->arg_begin(),
-                                       entryBB);
-
-                    // Add information about this function to functionInfoMap.
-                    FunctionType* fnTySIMD = FunctionType::get(mInfo.mVectorTyBoolSIMD,
-                                                               mInfo.mVectorTyBoolSIMD,
-                                                               false);
-                    Function* simdUseFn = Function::Create(fnTySIMD,
-                                                           Function::InternalLinkage,
-                                                           "entryMaskUseFnSIMD",
-                                                           f->getParent());
-                    simdUseFn->setDoesNotAccessMemory();
-                    simdUseFn->setDoesNotThrow();
-                    SmallVector<bool, 4> uniformArgs;
-                    uniformArgs.push_back(false);
-                    mInfo.mFunctionInfoMap.add(*entryMaskUseFn,
-                                                *simdUseFn,
-                                                -1,
-                                                false,
-                                                uniformArgs);
-                }
-
-                Instruction* insertBefore = BB.getFirstNonPHI();
-                CallInst* dummyCall = CallInst::Create(entryMaskUseFn,
-                                                       ArrayRef<Value*>(newEntryMask),
-                                                       "entryMaskUse",
-                                                       insertBefore);
-                dummyCall->setDoesNotAccessMemory();
-                dummyCall->setDoesNotThrow();
-                rv::copyMetadata(dummyCall, *newEntryMask);
-
-                mMaskAnalysis.updateEntryMask(BB,
-                                               dummyCall,
-                                               insertBefore);
-#endif
-            }
         }
 
         // exit masks
@@ -292,69 +239,83 @@ MaskGenerator::materializeMasks(Function* f)
 
     for (auto &L : mLoopInfo)
     {
-#if 0
-        if (region && !region->contains(L->getHeader())) continue; // skip loops outside of region
-#endif
         materializeLoopExitMasks(L);
         materializeCombinedLoopExitMasks(L);
     }
+
+    // The exit masks above refer to the original conditions
+    for (auto &BB : *f)
+    {
+        if (!usedEntryMasks.count(&BB) || !hasUniformExitOnVaryingCondition(BB)) continue;
+        maskUniformLoopExit(BB);
+    }
 }
 
+// A uniform loop exit whose condition is only uniform on the lanes that reach
+// the loop. The backend would test the condition on all lanes.
 bool
-MaskGenerator::entryMaskIsUsed(const BasicBlock& block) const
+MaskGenerator::hasUniformExitOnVaryingCondition(const BasicBlock& block) const
 {
-    if (mvecInfo.isNotAlwaysByAll(&block)) return true; // there is divergent control at this block
-    return false;
+    const BranchInst* branch = dyn_cast<BranchInst>(block.getTerminator());
+    if (!branch || !branch->isConditional()) return false;
+    if (!mvecInfo.getVectorShape(*branch).isUniform()) return false;
 
-#if 0
-    for (const auto &I : block)
-    {
-        if (rv::hasMetadata(&I, rv::RV_METADATA_OP_SEQUENTIAL_GUARDED)) //TODO refactor
-        {
-            return true;
-        }
+    const Value* cond = branch->getCondition();
+    if (!mvecInfo.hasKnownShape(*cond) || mvecInfo.getVectorShape(*cond).isUniform()) return false;
 
-        if (!isa<CallInst>(I)) continue;
+    const Loop* loop = mLoopInfo.getLoopFor(&block);
+    return loop &&
+           loop->contains(branch->getSuccessor(0)) != loop->contains(branch->getSuccessor(1));
+}
 
-        // Ignore calls to metadata function.
-        if (rv::isMetadataCall(&I)) continue;
+// Stay in the loop if any active lane stays:
+//   br %c, %exit, %stay   ->   br rv_any(%mask & !%c), %stay, %exit
+// All active lanes agree on %c, and a block without active lanes leaves the loop.
+void
+MaskGenerator::maskUniformLoopExit(BasicBlock& block)
+{
+    Value* mask = mMaskAnalysis.getEntryMask(block);
+    if (mask == mInfo.mConstBoolTrue) return;
 
-        // OP_SEQUENTIAL calls never require a mask (otherwise they would be
-        // OP_SEQUENTIAL_GUARDED).
-        // OP_UNIFORM calls never require a mask.
-        if (rv::hasMetadata(&I, rv::RV_METADATA_OP_SEQUENTIAL) || //TODO refactor
-            rv::hasMetadata(&I, rv::RV_METADATA_OP_UNIFORM))
-        {
-            continue;
-        }
+    BranchInst* branch = cast<BranchInst>(block.getTerminator());
+    const Loop* loop = mLoopInfo.getLoopFor(&block);
+    const bool exitsOnTrue = !loop->contains(branch->getSuccessor(0));
 
-        const Function* callee = cast<CallInst>(&I)->getCalledFunction();
-        assert (callee);
+    Value* stayCond = branch->getCondition();
+    if (exitsOnTrue) stayCond = createNeg(stayCond, branch);
 
-        // Calls to functions that don't have a mapping have to be marked
-        // OP_SEQUENTIAL or OP_SEQUENTIAL_GUARDED.
-        assert (mInfo.mFunctionInfoMap.hasMapping(*callee) ||
-                mInfo.mValueInfoMap.hasMapping(I));
+    Value* activeStay = createAnd(mask, stayCond, branch);
+    Module& mod = *block.getParent()->getParent();
+    CallInst* anyStay = CallInst::Create(&requestLaneFunction(mod, "rv_any"), activeStay, "stay.any", branch);
+    mvecInfo.setVectorShape(*anyStay, VectorShape::uni());
 
-        // Calls that were marked from the outside don't require a mask
-        // (otherwise they would have a mapping in the function info map).
-        if (!mInfo.mFunctionInfoMap.hasMapping(*callee))
-        {
-            assert (mInfo.mValueInfoMap.hasMapping(I));
-            continue;
-        }
+    branch->setCondition(anyStay);
+    if (exitsOnTrue) branch->swapSuccessors();
 
-        // Calls to functions that don't have a mask index never require a mask.
-        if (mInfo.mFunctionInfoMap.getMaskIndex(*callee) == -1)
-        {
-            continue;
-        }
+    IF_DEBUG {
+        outs() << "  masked uniform loop exit of block '" << block.getName() << "': " << *anyStay << "\n";
+    }
+}
+
+// Returns the first instruction of @block that the vector backend emits under
+// the block predicate (loads, stores and calls, or else the masked exit test
+// of a uniform loop), or nullptr if the entry mask of the block is never
+// consumed. Blocks that are always executed by all instances have a constant
+// mask.
+Instruction*
+MaskGenerator::getFirstMaskUser(BasicBlock& block) const
+{
+    if (!mvecInfo.isNotAlwaysByAll(&block)) return nullptr;
 
-        return true;
+    for (auto &I : block)
+    {
+        if (isa<LoadInst>(I) || isa<StoreInst>(I)) return &I;
+        if (isa<CallInst>(I) && !rv::isMetadataCall(&I)) return &I;
     }
 
-    return false;
-#endif
+    if (hasUniformExitOnVaryingCondition(block)) return block.getTerminator();
+
+    return nullptr;
 }
 
 bool
@@ -386,7 +347,7 @@ MaskGenerator::materializeMask(MaskPtr maskPtr)
 {
     assert (maskPtr);
 
-    Mask& mask = *maskPtr.get();
+    Mask& mask = *maskPtr;
 
     // Return if the mask is materialized already.
     if (mask.mValue) return mask.mValue;
@@ -397,7 +358,7 @@ MaskGenerator::materializeMask(MaskPtr maskPtr)
     {
         // The preheader mask is always the first one.
         assert (mask.mOperands.size() == 2);
-        MaskPtr preheaderMask = mask.mOperands[0].lock();
+        MaskPtr preheaderMask = mask.mOperands[0];
 
         // If mask is not yet materialized, do it.
         if (!preheaderMask->mValue) materializeMask(preheaderMask);
@@ -406,7 +367,7 @@ MaskGenerator::materializeMask(MaskPtr maskPtr)
     {
         for (unsigned i=0, e=mask.mOperands.size(); i<e; ++i)
         {
-            MaskPtr opMask = mask.mOperands[i].lock();
+            MaskPtr opMask = mask.mOperands[i];
 
             // Check if mask is already materialized.
             if (opMask->mValue) continue;
@@ -432,7 +393,7 @@ MaskGenerator::materializeMask(MaskPtr maskPtr)
         case NEGATE:
         {
             assert (mask.mOperands.size() == 1);
-            Value* mask0 = mask.mOperands[0].lock()->mValue;
+            Value* mask0 = mask.mOperands[0]->mValue;
 
             maskValue = createNeg(mask0, mask.mInsertPoint);
             break;
@@ -441,10 +402,10 @@ MaskGenerator::materializeMask(MaskPtr maskPtr)
         case CONJUNCTION:
         {
             assert (mask.mOperands.size() >= 2);
-            maskValue = mask.mOperands[0].lock()->mValue;
+            maskValue = mask.mOperands[0]->mValue;
             for (unsigned i=1, e=mask.mOperands.size(); i<e; ++i)
             {
-                Value* mask1 = mask.mOperands[i].lock()->mValue;
+                Value* mask1 = mask.mOperands[i]->mValue;
                 maskValue = createAnd(maskValue, mask1, mask.mInsertPoint);
             }
             break;
@@ -453,10 +414,10 @@ MaskGenerator::materializeMask(MaskPtr maskPtr)
         case DISJUNCTION:
         {
             assert (mask.mOperands.size() >= 2);
-            maskValue = mask.mOperands[0].lock()->mValue;
+            maskValue = mask.mOperands[0]->mValue;
             for (unsigned i=1, e=mask.mOperands.size(); i<e; ++i)
             {
-                Value* mask1 = mask.mOperands[i].lock()->mValue;
+                Value* mask1 = mask.mOperands[i]->mValue;
                 maskValue = createOr(maskValue, mask1, mask.mInsertPoint);
             }
 
@@ -466,9 +427,9 @@ MaskGenerator::materializeMask(MaskPtr maskPtr)
         case SELECT:
         {
             assert (mask.mOperands.size() == 3);
-            Value* condition = mask.mOperands[0].lock()->mValue;
-            Value* trueMask  = mask.mOperands[1].lock()->mValue;
-            Value* falseMask = mask.mOperands[2].lock()->mValue;
+            Value* condition = mask.mOperands[0]->mValue;
+            Value* trueMask  = mask.mOperands[1]->mValue;
+            Value* falseMask = mask.mOperands[2]->mValue;
             maskValue = createSelect(condition, trueMask, falseMask, mask.mInsertPoint);
             break;
         }
@@ -483,7 +444,7 @@ MaskGenerator::materializeMask(MaskPtr maskPtr)
 
             for (unsigned i=0; i<numIncVals; ++i)
             {
-                Value*      incMask = mask.mOperands[i].lock()->mValue;
+                Value*      incMask = mask.mOperands[i]->mValue;
                 BasicBlock* incBB   = mask.mIncomingDirs[i];
                 phi->addIncoming(incMask, incBB);
             }
@@ -510,9 +471,9 @@ MaskGenerator::materializeMask(MaskPtr maskPtr)
         {
             // Disjunction with exactly 2 operands.
             assert (mask.mOperands.size() == 2);
-            assert (isa<PHINode>(mask.mOperands[0].lock()->mValue));
-            Value* mask0 = mask.mOperands[0].lock()->mValue;
-            Value* mask1 = mask.mOperands[1].lock()->mValue;
+            assert (isa<PHINode>(mask.mOperands[0]->mValue));
+            Value* mask0 = mask.mOperands[0]->mValue;
+            Value* mask1 = mask.mOperands[1]->mValue;
             maskValue = createOr(mask0, mask1, mask.mInsertPoint);
             if (Instruction* maskValI = dyn_cast<Instruction>(maskValue))
             {
@@ -725,7 +686,7 @@ MaskGenerator::createPhi(Mask& mask, const Twine& name)
                                    name,
                                    mask.mInsertPoint);
 
-    Value*      preheaderMask = mask.mOperands[0].lock()->mValue;
+    Value*      preheaderMask = mask.mOperands[0]->mValue;
     BasicBlock* preheaderBB   = mask.mIncomingDirs[0];
     phi->addIncoming(preheaderMask, preheaderBB);
 
@@ -736,7 +697,7 @@ MaskGenerator::createPhi(Mask& mask, const Twine& name)
     mask.mValue = phi;
 
     // The latch mask is always the second one.
-    MaskPtr     latchMask = mask.mOperands[1].lock();
+    MaskPtr     latchMask = mask.mOperands[1];
     BasicBlock* latchBB   = mask.mIncomingDirs[1];
 
     // If mask is not yet materialized, do it.
@@ -830,13 +791,6 @@ MaskGenerator::fillVecInfoWithPredicates(Function& F)
         if (!predicate)
             continue;
 
-        CallInst* call = dyn_cast<CallInst>(predicate);
-        if (call && call->getCalledFunction() &&
-            call->getCalledFunction()->getName() == "entryMaskUseFn")
-        {
-            predicate = call->getOperand(0);
-        }
-
         mvecInfo.setPredicate(BB, *predicate);
     }
 }
@@ -22,6 +22,7 @@
 #include <llvm/IR/Verifier.h> // verifyFunction()
 #include <llvm/Analysis/LoopInfo.h>
 
+#include <algorithm>
 #include <stdexcept>
 #include <rv/rvInfoProxyPass.h>
 
@@ -197,6 +198,16 @@ SelectGenerator::generatePhiSelects(Function& f)
 
         SmallPtrSet<PHINode*, 2> deleteSet;
 
+        // All phis of the block index their incoming edges the same way,
+        // so they can share the masks of the blend trees.
+        SmallVector<BasicBlock*, 4> preds;
+        for (BasicBlock* predBB : predecessors(&block))
+        {
+            if (std::find(preds.begin(), preds.end(), predBB) != preds.end()) continue;
+            preds.push_back(predBB);
+        }
+        BlendMaskMap blendMasks;
+
         for (auto I = block.begin(); isa<PHINode>(&*I); ++I)
         {
             PHINode* phi = cast<PHINode>(I);
@@ -209,7 +220,7 @@ SelectGenerator::generatePhiSelects(Function& f)
             assert (!mvecInfo.getVectorShape(*phi).isUniform() &&
                     "phi in DIVERGENT block must not be uniform!");
 
-            Value* blendedValue = generateSelectFromPhi(phi);
+            Value* blendedValue = generateSelectFromPhi(phi, preds, blendMasks);
 
             // Update loop live value analysis.
             if (Instruction* blendedInst = dyn_cast<Instruction>(blendedValue))
@@ -237,8 +248,14 @@ SelectGenerator::generatePhiSelects(Function& f)
     }
 }
 
+// Replace the phi by a balanced tree of selects over its incoming values.
+// Incoming values that are equal are merged into one leaf, undef incoming
+// values are dropped (the instances that arrive over these edges do not care
+// about the result).
 Value*
-SelectGenerator::generateSelectFromPhi(PHINode* phi)
+SelectGenerator::generateSelectFromPhi(PHINode*                        phi,
+                                       const SmallVectorImpl<BasicBlock*>& preds,
+                                       BlendMaskMap&                   blendMasks)
 {
     assert (phi);
     assert (phi->getNumIncomingValues() >= 2 &&
@@ -246,38 +263,42 @@ SelectGenerator::generateSelectFromPhi(PHINode* phi)
 
     DEBUG_RV( outs() << "    generating select(s) for phi: " << *phi << "\n"; );
 
-    BasicBlock* block = phi->getParent();
-    assert (block);
-
-    Value* blendedValue = phi->getIncomingValue(0);
-
-    for (unsigned i = 1, e = phi->getNumIncomingValues(); i < e; ++i)
+    SmallVector<BlendLeaf, 4> leaves;
+    for (unsigned i = 0, e = phi->getNumIncomingValues(); i < e; ++i)
     {
         Value*      incVal = phi->getIncomingValue(i);
         BasicBlock* incBB  = phi->getIncomingBlock(i);
-        Value*      mask   = mMaskAnalysis.getExitMask(*incBB, *block);
-
-        assert (incVal && incBB && mask);
-
-        SelectInst* select = SelectInst::Create(mask, incVal, blendedValue, "", phi);
-        rv::copyMetadata(select, *phi);
-        mvecInfo.setVectorShape(*select, mvecInfo.getVectorShape(*phi));
-
-        // Store where the values came from in metadata.
-        // In case we have more than two incoming edges, the
-        // "false" block of all selects after the first one is
-        // nullptr since the value being blended is already a
-        // composed one.
-        BasicBlock* incBBFalse = i == 1 ?
-                                 phi->getIncomingBlock(0) :
-                                 nullptr;
-        const bool isLast = i == e-1;
-        // rv::setMetadataForBlend(select, incBB, incBBFalse, isLast);
-
-        blendedValue = select;
-        DEBUG_RV( outs() << "      generated select: " << *select << "\n"; );
+        assert (incVal && incBB);
+
+        if (isa<UndefValue>(incVal)) continue;
+
+        auto predIt = std::find(preds.begin(), preds.end(), incBB);
+        assert (predIt != preds.end());
+        const unsigned edge = predIt - preds.begin();
+
+        auto leafIt = std::find_if(leaves.begin(), leaves.end(),
+                                   [incVal](const BlendLeaf& leaf) { return leaf.mValue == incVal; });
+        if (leafIt == leaves.end())
+        {
+            leaves.push_back(BlendLeaf{incVal, std::vector<unsigned>()});
+            leafIt = leaves.end() - 1;
+        }
+        // A block may occur multiple times with the same value.
+        if (std::find(leafIt->mEdges.begin(), leafIt->mEdges.end(), edge) == leafIt->mEdges.end())
+        {
+            leafIt->mEdges.push_back(edge);
+        }
     }
 
+    for (auto &leaf : leaves)
+    {
+        std::sort(leaf.mEdges.begin(), leaf.mEdges.end());
+    }
+
+    Value* blendedValue = leaves.empty() ?
+        UndefValue::get(phi->getType()) :
+        generateBlendTree(phi, leaves, 0, leaves.size(), preds, blendMasks);
+
     phi->replaceAllUsesWith(blendedValue);
 
     DEBUG_RV( outs() << "    select-generation for phi finished.\n"; );
@@ -285,6 +306,97 @@ SelectGenerator::generateSelectFromPhi(PHINode* phi)
     return blendedValue;
 }
 
+// Blend the leaves [begin, end) by splitting them in halves. Each select is
+// keyed on the disjunction of the exit masks of the half with fewer incoming
+// edges, so a phi with n distinct values needs a chain of only log2(n) selects.
+Value*
+SelectGenerator::generateBlendTree(PHINode*                        phi,
+                                   const SmallVectorImpl<BlendLeaf>& leaves,
+                                   const unsigned                  begin,
+                                   const unsigned                  end,
+                                   const SmallVectorImpl<BasicBlock*>& preds,
+                                   BlendMaskMap&                   blendMasks)
+{
+    assert (begin < end);
+    if (end - begin == 1) return leaves[begin].mValue;
+
+    const unsigned mid = begin + (end - begin) / 2;
+    Value* lowerValue = generateBlendTree(phi, leaves, begin, mid, preds, blendMasks);
+    Value* upperValue = generateBlendTree(phi, leaves, mid, end, preds, blendMasks);
+
+    std::vector<unsigned> lowerEdges;
+    std::vector<unsigned> upperEdges;
+    for (unsigned i = begin; i < mid; ++i)
+    {
+        lowerEdges.insert(lowerEdges.end(), leaves[i].mEdges.begin(), leaves[i].mEdges.end());
+    }
+    for (unsigned i = mid; i < end; ++i)
+    {
+        upperEdges.insert(upperEdges.end(), leaves[i].mEdges.begin(), leaves[i].mEdges.end());
+    }
+
+    const bool selectUpper = upperEdges.size() <= lowerEdges.size();
+    std::vector<unsigned>& edges = selectUpper ? upperEdges : lowerEdges;
+    std::sort(edges.begin(), edges.end());
+
+    Value* mask = getBlendMask(edges, preds, blendMasks, phi);
+    SelectInst* select = SelectInst::Create(mask,
+                                            selectUpper ? upperValue : lowerValue,
+                                            selectUpper ? lowerValue : upperValue,
+                                            "", phi);
+    rv::copyMetadata(select, *phi);
+    mvecInfo.setVectorShape(*select, mvecInfo.getVectorShape(*phi));
+
+    DEBUG_RV( outs() << "      generated select: " << *select << "\n"; );
+
+    return select;
+}
+
+// Returns the mask of the instances that enter the join block over one of the
+// given edges. The disjunctions are built as balanced trees as well, and are
+// created before the first phi they are required for, so that the later phis
+// of the block can reuse them.
+Value*
+SelectGenerator::getBlendMask(const std::vector<unsigned>&      edges,
+                              const SmallVectorImpl<BasicBlock*>& preds,
+                              BlendMaskMap&                     blendMasks,
+                              Instruction*                      insertBefore)
+{
+    assert (!edges.empty());
+
+    auto it = blendMasks.find(edges);
+    if (it != blendMasks.end()) return it->second;
+
+    Value* mask = nullptr;
+    if (edges.size() == 1)
+    {
+        BasicBlock* block = insertBefore->getParent();
+        mask = mMaskAnalysis.getExitMask(*preds[edges[0]], *block);
+    }
+    else
+    {
+        const unsigned half = edges.size() / 2;
+        std::vector<unsigned> lowerEdges(edges.begin(), edges.begin() + half);
+        std::vector<unsigned> upperEdges(edges.begin() + half, edges.end());
+
+        Value* lowerMask = getBlendMask(lowerEdges, preds, blendMasks, insertBefore);
+        Value* upperMask = getBlendMask(upperEdges, preds, blendMasks, insertBefore);
+
+        Instruction* maskOp = BinaryOperator::Create(Instruction::Or,
+                                                     lowerMask,
+                                                     upperMask,
+                                                     "blend.mask",
+                                                     insertBefore);
+        mvecInfo.setVectorShape(*maskOp, VectorShape::varying());
+        rv::setMetadata(maskOp, rv::RV_METADATA_MASK);
+        mask = maskOp;
+    }
+
+    assert (mask);
+    blendMasks[edges] = mask;
+    return mask;
+}
+
 void
 SelectGenerator::generateLoopSelects(Function& f)
 {
@@ -0,0 +1,217 @@
+//===- uniformHoister.cpp ----------------*- C++ -*-===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// @authors simon
+//
+
+#include "rv/transforms/uniformHoister.h"
+
+#include <vector>
+
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "rv/vectorizationInfo.h"
+#include "rvConfig.h"
+
+using namespace llvm;
+
+
+UniformHoister::UniformHoister(const rv::VectorizationInfo& vecInfo)
+        : mVecInfo(vecInfo)
+        , mNumHoisted(0)
+        , mNumSunk(0)
+{
+}
+
+UniformHoister::~UniformHoister()
+{
+}
+
+bool
+UniformHoister::run(Loop& loop)
+{
+    assert (loop.getLoopPreheader() && "loop not in LoopSimplify form!");
+
+    bool changed = hoistInvariants(loop);
+    changed |= sinkLiveOuts(loop);
+
+    IF_DEBUG {
+        outs() << "UniformHoister: hoisted " << mNumHoisted << ", sunk " << mNumSunk
+               << " instructions of loop " << loop.getHeader()->getName() << "\n";
+    }
+
+    return changed;
+}
+
+bool
+UniformHoister::isUniform(const Instruction& inst) const
+{
+    return mVecInfo.hasKnownShape(inst) && mVecInfo.getVectorShape(inst).isUniform();
+}
+
+bool
+UniformHoister::canHoist(const Loop& loop, const Instruction& inst) const
+{
+    if (isa<PHINode>(inst) || isa<TerminatorInst>(inst)) return false;
+    if (!isUniform(inst)) return false;
+
+    // The instruction will also execute on trips that would not have reached it
+    if (!isSafeToSpeculativelyExecute(&inst)) return false;
+
+    // Stores in the loop may change what a load reads on later trips
+    if (inst.mayReadFromMemory()) return false;
+
+    for (const Value* op : inst.operand_values())
+    {
+        if (!loop.isLoopInvariant(op)) return false;
+    }
+
+    return true;
+}
+
+// Move uniform instructions with loop-invariant operands to the preheader.
+// Chains of invariant computations are hoisted as a whole since every hoisted
+// instruction becomes loop invariant itself.
+bool
+UniformHoister::hoistInvariants(Loop& loop)
+{
+    Instruction* insertPt = loop.getLoopPreheader()->getTerminator();
+
+    bool changed = false;
+    bool hoistedAny = true;
+    while (hoistedAny)
+    {
+        hoistedAny = false;
+        for (auto* block : loop.blocks())
+        {
+            for (auto it = block->begin(); it != block->end(); )
+            {
+                Instruction* inst = &*it++;
+                if (!canHoist(loop, *inst)) continue;
+
+                inst->moveBefore(insertPt);
+                ++mNumHoisted;
+                hoistedAny = true;
+            }
+        }
+        changed |= hoistedAny;
+    }
+
+    return changed;
+}
+
+bool
+UniformHoister::canSink(const Loop& loop, const Instruction& inst, const BasicBlock& exitBlock) const
+{
+    if (isa<PHINode>(inst) || isa<TerminatorInst>(inst)) return false;
+    if (!isUniform(inst)) return false;
+
+    // Memory may have changed by the time the loop is left
+    if (inst.mayHaveSideEffects() || inst.mayReadFromMemory()) return false;
+
+    // Only LCSSA phis in the exit block may use the value
+    if (inst.use_empty()) return false;
+    for (const User* user : inst.users())
+    {
+        const auto* phi = dyn_cast<PHINode>(user);
+        if (!phi || phi->getParent() != &exitBlock) return false;
+    }
+
+    // Operands computed in the loop must be uniform so that their live-out
+    // is the value of every lane
+    for (const Value* op : inst.operand_values())
+    {
+        const auto* opInst = dyn_cast<Instruction>(op);
+        if (opInst && loop.contains(opInst) && !isUniform(*opInst)) return false;
+    }
+
+    return true;
+}
+
+void
+UniformHoister::sink(Loop& loop, Instruction& inst, BasicBlock& exitBlock)
+{
+    BasicBlock* exitingBlock = exitBlock.getSinglePredecessor();
+
+    // replace the LCSSA phis of @inst by @inst itself
+    std::vector<PHINode*> lcssaPhis;
+    for (User* user : inst.users())
+    {
+        lcssaPhis.push_back(cast<PHINode>(user));
+    }
+
+    inst.moveBefore(&*exitBlock.getFirstInsertionPt());
+
+    for (auto* phi : lcssaPhis)
+    {
+        phi->replaceAllUsesWith(&inst);
+        phi->eraseFromParent();
+    }
+
+    // operands defined in the loop now leave the loop through LCSSA phis
+    for (unsigned i = 0; i < inst.getNumOperands(); ++i)
+    {
+        auto* opInst = dyn_cast<Instruction>(inst.getOperand(i));
+        if (!opInst || !loop.contains(opInst)) continue;
+
+        PHINode* lcssaPhi = nullptr;
+        for (auto it = exitBlock.begin(); isa<PHINode>(*it); ++it)
+        {
+            auto* phi = cast<PHINode>(&*it);
+            if (phi->getIncomingValueForBlock(exitingBlock) == opInst)
+            {
+                lcssaPhi = phi;
+                break;
+            }
+        }
+
+        if (!lcssaPhi)
+        {
+            lcssaPhi = PHINode::Create(opInst->getType(), 1, opInst->getName() + ".lcssa", &exitBlock.front());
+            lcssaPhi->addIncoming(opInst, exitingBlock);
+        }
+
+        inst.setOperand(i, lcssaPhi);
+    }
+
+    ++mNumSunk;
+}
+
+// Compute uniform values that are only live after the loop once in its exit block.
+// Sinking a value may make its operands sinkable, so iterate to a fixed point.
+bool
+UniformHoister::sinkLiveOuts(Loop& loop)
+{
+    BasicBlock* exitBlock = loop.getUniqueExitBlock();
+    if (!exitBlock || !exitBlock->getSinglePredecessor()) return false;
+
+    bool changed = false;
+    bool sunkAny = true;
+    while (sunkAny)
+    {
+        sunkAny = false;
+        for (auto* block : loop.blocks())
+        {
+            for (Instruction* inst = block->getTerminator(); inst; )
+            {
+                Instruction* prev = inst->getPrevNode();
+                if (canSink(loop, *inst, *exitBlock))
+                {
+                    sink(loop, *inst, *exitBlock);
+                    sunkAny = true;
+                }
+                inst = prev;
+            }
+        }
+        changed |= sunkAny;
+    }
+
+    return changed;
+}
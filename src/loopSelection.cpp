@@ -0,0 +1,472 @@
+//===- loopSelection.cpp ----------------*- C++ -*-===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+
+#include "rv/loopSelection.h"
+
+#include <algorithm>
+
+#include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/PostDominators.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Format.h>
+
+#include "rv/rvInfo.h"
+#include "rv/vectorizationInfo.h"
+#include "rv/Region/LoopRegion.h"
+#include "rv/Region/Region.h"
+#include "rv/pda/ProgramDependenceAnalysis.h"
+#include "rv/pda/SyncDependenceAnalysis.h"
+#include "utils/rvTools.h"
+
+using namespace llvm;
+
+namespace rv {
+
+Value*
+getLoopInitValue(Loop& loop, PHINode& phi)
+{
+    for (uint i = 0; i < phi.getNumIncomingValues(); ++i)
+    {
+        if (!loop.contains(phi.getIncomingBlock(i)))
+        {
+            return phi.getIncomingValue(i);
+        }
+    }
+    return nullptr;
+}
+
+uint64_t
+getConstantTripCount(Loop& loop, PHINode& ivPhi)
+{
+    auto* latch = loop.getLoopLatch();
+    auto* init = dyn_cast_or_null<ConstantInt>(getLoopInitValue(loop, ivPhi));
+    auto* branch = dyn_cast<BranchInst>(latch->getTerminator());
+    if (!init || !branch || !branch->isConditional()) return 0;
+
+    auto* cmp = dyn_cast<ICmpInst>(branch->getCondition());
+    if (!cmp) return 0;
+
+    // normalize to "counter pred bound" holds while the loop keeps running
+    CmpInst::Predicate pred = cmp->getPredicate();
+    Value* counter = cmp->getOperand(0);
+    auto* bound = dyn_cast<ConstantInt>(cmp->getOperand(1));
+    if (!bound)
+    {
+        counter = cmp->getOperand(1);
+        bound = dyn_cast<ConstantInt>(cmp->getOperand(0));
+        pred = CmpInst::getSwappedPredicate(pred);
+    }
+    if (!loop.contains(branch->getSuccessor(0))) pred = CmpInst::getInversePredicate(pred);
+
+    Value* increment = ivPhi.getIncomingValueForBlock(latch);
+    if (!bound || (counter != &ivPhi && counter != increment)) return 0;
+    if (init->getBitWidth() > 64 || bound->getBitWidth() > 64) return 0;
+
+    // the k-th test (from 0) sees first + k, the loop runs until the first failing test
+    const bool isUnsigned = pred == CmpInst::ICMP_ULT;
+    int64_t first = isUnsigned ? (int64_t) init->getZExtValue() : init->getSExtValue();
+    int64_t last = isUnsigned ? (int64_t) bound->getZExtValue() : bound->getSExtValue();
+    if (isUnsigned && (first < 0 || last < 0)) return 0;
+    if (counter == increment) ++first;
+
+    switch (pred)
+    {
+        case CmpInst::ICMP_SLT:
+        case CmpInst::ICMP_ULT:
+            return last > first ? last - first + 1 : 1;
+        case CmpInst::ICMP_NE:
+            return last >= first ? last - first + 1 : 0;
+        default:
+            return 0;
+    }
+}
+
+bool
+canVectorizeEarlyExits(Loop& loop, ArrayRef<BasicBlock*> earlyExits, std::string& reason)
+{
+    if (earlyExits.empty()) return true;
+
+    for (auto* block : loop.blocks())
+    {
+        for (auto& inst : *block)
+        {
+            if (!inst.mayWriteToMemory()) continue;
+
+            reason.clear();
+            raw_string_ostream out(reason);
+            out << "side effect " << inst;
+            out.flush();
+            return false;
+        }
+    }
+    return true;
+}
+
+LoopSelection::LoopSelection(Function& func, unsigned vectorWidth, AnalysisCache& analyses)
+        : mFunc(func)
+        , mVectorWidth(vectorWidth)
+        , mAnalyses(analyses)
+{
+}
+
+// Structural legality of vectorizing @loop in loop-region mode
+bool
+LoopSelection::checkLegality(Loop& loop, std::string& reason) const
+{
+    auto* latch = loop.getLoopLatch();
+    if (!loop.getLoopPreheader() || !latch || !loop.isLoopExiting(latch))
+    {
+        reason = "not a simplified loop exiting at its latch";
+        return false;
+    }
+
+    // "++i" induction variable
+    auto* xPhi = dyn_cast<PHINode>(&*loop.getHeader()->begin());
+    auto* increment = xPhi ? dyn_cast<BinaryOperator>(xPhi->getIncomingValueForBlock(latch)) : nullptr;
+    auto* step = increment && increment->getOpcode() == Instruction::Add ?
+                 dyn_cast<ConstantInt>(increment->getOperand(isa<Constant>(increment->getOperand(1)) ? 1 : 0)) :
+                 nullptr;
+    if (!step || step->getLimitedValue() != 1 || !getLoopInitValue(loop, *xPhi))
+    {
+        reason = "no ++i induction variable";
+        return false;
+    }
+
+    uint64_t tripCount = getConstantTripCount(loop, *xPhi);
+    if (tripCount && tripCount % mVectorWidth)
+    {
+        reason = "trip count " + std::to_string(tripCount) + " is not a multiple of the vector width";
+        return false;
+    }
+
+    SmallVector<BasicBlock*, 4> exitingBlocks;
+    loop.getExitingBlocks(exitingBlocks);
+    SmallVector<BasicBlock*, 4> earlyExits;
+    for (auto* exiting : exitingBlocks)
+    {
+        if (exiting == latch) continue;
+        auto* branch = dyn_cast<BranchInst>(exiting->getTerminator());
+        if (!branch || !branch->isConditional())
+        {
+            reason = "unsupported exit in " + exiting->getName().str();
+            return false;
+        }
+        earlyExits.push_back(exiting);
+    }
+    std::string sideEffect;
+    if (!canVectorizeEarlyExits(loop, earlyExits, sideEffect))
+    {
+        reason = "side effects in a loop with early exits";
+        return false;
+    }
+
+    // the lanes of a reduction are only combined at the exit of the "++i" loop
+    if (!earlyExits.empty())
+    {
+        for (auto& inst : *loop.getHeader())
+        {
+            auto* phi = dyn_cast<PHINode>(&inst);
+            if (!phi) break;
+            if (phi != xPhi && getReductionOpcode(loop, *phi))
+            {
+                reason = "reduction in a loop with early exits";
+                return false;
+            }
+        }
+    }
+
+    // memory dependences: a location written in the loop may only be accessed through the same address
+    const DataLayout& layout = loop.getHeader()->getModule()->getDataLayout();
+    SmallVector<Instruction*, 8> memInsts;
+    for (auto* block : loop.blocks())
+    {
+        for (auto& inst : *block)
+        {
+            if (auto* call = dyn_cast<CallInst>(&inst))
+            {
+                auto* callee = call->getCalledFunction();
+                if (!callee)
+                {
+                    reason = "indirect call";
+                    return false;
+                }
+
+                // calls are replicated per lane, only writes through pointers can interfere
+                bool hasPointerArg = false;
+                for (auto& arg : call->arg_operands())
+                {
+                    hasPointerArg |= arg->getType()->isPointerTy();
+                }
+                if (hasPointerArg && call->mayWriteToMemory())
+                {
+                    reason = "call to " + callee->getName().str() + " may write memory";
+                    return false;
+                }
+            }
+            else if (isa<LoadInst>(inst) || isa<StoreInst>(inst))
+            {
+                memInsts.push_back(&inst);
+            }
+        }
+    }
+
+    auto getPointer = [](Instruction* inst) -> Value*
+    {
+        if (auto* load = dyn_cast<LoadInst>(inst)) return load->getPointerOperand();
+        return cast<StoreInst>(inst)->getPointerOperand();
+    };
+
+    for (auto* store : memInsts)
+    {
+        if (!isa<StoreInst>(store)) continue;
+        Value* storePtr = getPointer(store);
+        if (loop.isLoopInvariant(storePtr))
+        {
+            reason = "store to loop invariant address";
+            return false;
+        }
+
+        // different allocas, globals and noalias arguments never overlap, other bases may
+        Value* storeBase = GetUnderlyingObject(storePtr, layout);
+        for (auto* other : memInsts)
+        {
+            Value* otherPtr = getPointer(other);
+            if (otherPtr == storePtr) continue;
+
+            Value* otherBase = GetUnderlyingObject(otherPtr, layout);
+            if (otherBase != storeBase && isIdentifiedObject(storeBase) && isIdentifiedObject(otherBase)) continue;
+
+            if (otherBase == storeBase)
+                reason = "possible loop-carried dependence on " + storeBase->getName().str();
+            else
+                reason = storeBase->getName().str() + " may alias " + otherBase->getName().str();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Estimate the speedup of vectorizing @loop from the shapes computed by the PDA.
+// Scalar execution costs one unit per instruction and lane. Uniform and vector
+// instructions cost one unit, memory accesses that are not consecutive and calls
+// without a SIMD mapping are replicated per lane, divergent branches add masking.
+double
+LoopSelection::estimateSpeedup(Loop& loop, SyncDependenceAnalysis& sda, std::string& reason) const
+{
+    LoopRegion loopRegionImpl(loop);
+    Region loopRegion(loopRegionImpl);
+    VectorizationInfo vecInfo(mFunc, mVectorWidth, loopRegion);
+
+    // same configuration as the loop vectorizer of rvTool
+    auto* latch = loop.getLoopLatch();
+    PHINode* xPhi = cast<PHINode>(&*loop.getHeader()->begin());
+    vecInfo.setVectorShape(*xPhi, VectorShape::strided(1, mVectorWidth));
+    vecInfo.setVectorShape(*getLoopInitValue(loop, *xPhi), VectorShape::strided(1, mVectorWidth));
+
+    SmallVector<BasicBlock*, 4> exitingBlocks;
+    loop.getExitingBlocks(exitingBlocks);
+    for (auto* exiting : exitingBlocks)
+    {
+        vecInfo.setVectorShape(*exiting->getTerminator(), VectorShape::uni());
+    }
+    vecInfo.setVectorShape(*cast<BranchInst>(latch->getTerminator())->getCondition(),
+                           VectorShape::uni());
+
+    native::VectorMappingMap noMappings;
+    PDA pda(vecInfo, mAnalyses.getCDG(), sda, noMappings, mAnalyses.getLoopInfo());
+    pda.analyze(mFunc);
+
+    const DataLayout& layout = mFunc.getParent()->getDataLayout();
+    double scalarCost = 0.0;
+    double vectorCost = 0.0;
+    for (auto* block : loop.blocks())
+    {
+        for (auto& inst : *block)
+        {
+            if (isa<PHINode>(inst)) continue;
+            scalarCost += mVectorWidth;
+
+            VectorShape shape = vecInfo.hasKnownShape(inst) ? vecInfo.getVectorShape(inst)
+                                                            : VectorShape::uni();
+
+            Value* ptr = nullptr;
+            if (auto* load = dyn_cast<LoadInst>(&inst)) ptr = load->getPointerOperand();
+            if (auto* store = dyn_cast<StoreInst>(&inst)) ptr = store->getPointerOperand();
+
+            if (ptr)
+            {
+                VectorShape ptrShape = vecInfo.hasKnownShape(*ptr) ? vecInfo.getVectorShape(*ptr)
+                                                                   : VectorShape::uni();
+                uint elemSize = layout.getTypeStoreSize(ptr->getType()->getPointerElementType());
+                if (ptrShape.isUniform() && isa<StoreInst>(inst))
+                {
+                    reason = "all lanes store to the same address";
+                    return 0.0;
+                }
+
+                bool consecutive = ptrShape.isUniform() ||
+                                   (ptrShape.hasStridedShape() && ptrShape.getStride() == (int) elemSize);
+                vectorCost += consecutive ? 1.0 : mVectorWidth + 1.0;
+            }
+            else if (isa<CallInst>(inst) && !shape.isUniform())
+            {
+                vectorCost += mVectorWidth;
+            }
+            else if (isa<TerminatorInst>(inst) && !shape.isUniform())
+            {
+                vectorCost += 3.0;
+            }
+            else
+            {
+                vectorCost += 1.0;
+            }
+        }
+    }
+
+    return vectorCost > 0.0 ? scalarCost / vectorCost : 0.0;
+}
+
+// Prefer the outermost loop of a nest unless a nested loop promises a higher speedup
+double
+LoopSelection::getBestSpeedup(Loop& loop) const
+{
+    auto& candidate = mCandidates.at(&loop);
+    double best = candidate.legal ? candidate.speedup : 0.0;
+    for (auto* childLoop : loop)
+    {
+        best = std::max(best, getBestSpeedup(*childLoop));
+    }
+    return best;
+}
+
+void
+LoopSelection::selectFromNest(Loop& loop)
+{
+    auto& candidate = mCandidates.at(&loop);
+
+    double nestedSpeedup = 0.0;
+    for (auto* childLoop : loop)
+    {
+        nestedSpeedup = std::max(nestedSpeedup, getBestSpeedup(*childLoop));
+    }
+
+    if (candidate.legal && candidate.speedup > 1.0 && candidate.speedup >= nestedSpeedup)
+    {
+        candidate.selected = true;
+        return;
+    }
+
+    if (candidate.legal)
+    {
+        candidate.reason = candidate.speedup > 1.0 ? "a nested loop is more profitable" : "not profitable";
+    }
+
+    for (auto* childLoop : loop)
+    {
+        selectFromNest(*childLoop);
+    }
+}
+
+std::vector<BasicBlock*>
+LoopSelection::selectLoops(int nestIdx)
+{
+    LoopInfo& loopInfo = mAnalyses.getLoopInfo();
+
+    // shared by all candidates, the CFG does not change during the selection
+    SyncDependenceAnalysis sda(mAnalyses.getDomTree(), mAnalyses.getPostDomTree(), loopInfo);
+
+    // loop nests in program order
+    std::vector<Loop*> nests;
+    for (auto& block : mFunc)
+    {
+        auto* loop = loopInfo.getLoopFor(&block);
+        if (loop && !loop->getParentLoop() && loop->getHeader() == &block)
+        {
+            nests.push_back(loop);
+        }
+    }
+
+    mNests.clear();
+    mCandidates.clear();
+    std::vector<BasicBlock*> selectedHeaders;
+
+    for (uint i = 0; i < nests.size(); ++i)
+    {
+        if (nestIdx >= 0 && (uint) nestIdx != i) continue;
+
+        SmallVector<Loop*, 8> nestLoops;
+        nestLoops.push_back(nests[i]);
+        for (uint j = 0; j < nestLoops.size(); ++j)
+        {
+            Loop* loop = nestLoops[j];
+            nestLoops.append(loop->begin(), loop->end());
+
+            LoopCandidate candidate = { loop, i, false, "", 0.0, false };
+            candidate.legal = checkLegality(*loop, candidate.reason);
+            if (candidate.legal)
+            {
+                candidate.speedup = estimateSpeedup(*loop, sda, candidate.reason);
+                candidate.legal = candidate.speedup > 0.0;
+            }
+            mCandidates[loop] = candidate;
+        }
+
+        selectFromNest(*nests[i]);
+        mNests.push_back(nests[i]);
+
+        for (auto* loop : nestLoops)
+        {
+            if (mCandidates[loop].selected) selectedHeaders.push_back(loop->getHeader());
+        }
+    }
+
+    return selectedHeaders;
+}
+
+void
+LoopSelection::printDecisions(raw_ostream& out, Loop& loop) const
+{
+    auto& candidate = mCandidates.at(&loop);
+    out << "  nest " << candidate.nestIdx << ", depth " << loop.getLoopDepth()
+        << ", loop " << loop.getHeader()->getName() << ": ";
+    if (candidate.legal)
+    {
+        out << "speedup " << format("%.2f", candidate.speedup) << ", ";
+    }
+    if (candidate.selected)
+    {
+        out << "vectorize\n";
+    }
+    else
+    {
+        out << "skip (" << candidate.reason << ")\n";
+    }
+
+    for (auto* childLoop : loop)
+    {
+        printDecisions(out, *childLoop);
+    }
+}
+
+void
+LoopSelection::print(raw_ostream& out) const
+{
+    out << "Loop selection for function " << mFunc.getName() << ":\n";
+    for (auto* nest : mNests)
+    {
+        printDecisions(out, *nest);
+    }
+}
+
+}
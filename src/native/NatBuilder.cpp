@@ -7,14 +7,18 @@
 //
 // @author montada
 
+#include <algorithm>
 #include <deque>
 
 #include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/Module.h>
 
 #include "NatBuilder.h"
 #include "Utils.h"
 #include "rv/Region/Region.h"
+#include "utils/rvTools.h"
 
 
 #include "rvConfig.h"
@@ -116,7 +120,8 @@ void NatBuilder::vectorize() {
 
     if (!region) return;
 
-    // TODO what about outside uses?
+    // live-out values of the region are taken from the exiting lane
+    repairOutsideUses();
 
     // rewire branches outside the region to go to the region instead
     std::vector<BasicBlock*> oldBlocks;
@@ -162,7 +167,7 @@ void NatBuilder::vectorize(BasicBlock *const bb, BasicBlock *vecBlock) {
             vectorizeMemoryInstruction(inst);
             // calls need special treatment
         else if (call)
-            if (call->getCalledFunction()->getName() == "rv_any")
+            if (isLaneIntrinsic(call))
                 vectorizeReductionCall(call);
             else
                 vectorizeCallInstruction(call);
@@ -212,6 +217,13 @@ void NatBuilder::mapOperandsInto(Instruction *const scalInst, Instruction *inst,
 void NatBuilder::vectorizePHIInstruction(PHINode *const scalPhi) {
     assert(vectorizationInfo.hasKnownShape(*scalPhi) && "no VectorShape for PHINode available!");
     VectorShape shape = vectorizationInfo.getVectorShape(*scalPhi);
+    if (shape.isVarying() && vectorizationInfo.isNarrowValue(*scalPhi)) {
+        PHINode *phi = builder.CreatePHI(getVectorType(i32Ty, vectorWidth()), scalPhi->getNumIncomingValues(),
+                                         scalPhi->getName() + "_SIMD_narrow");
+        narrowVectorValueMap[scalPhi] = phi;
+        phiVector.push_back(scalPhi);
+        return;
+    }
     Type *type = !shape.isVarying() ? scalPhi->getType() : getVectorType(scalPhi->getType(), vectorWidth());
     auto name = !shape.isVarying() ? scalPhi->getName() : scalPhi->getName() + "_SIMD";
     PHINode *phi = builder.CreatePHI(type, scalPhi->getNumIncomingValues(), name);
@@ -265,6 +277,8 @@ void NatBuilder::copyInstruction(Instruction *const inst, unsigned laneIdx) {
 void NatBuilder::vectorize(Instruction *const inst) {
     assert(inst && "no instruction to vectorize");
     assert(builder.GetInsertBlock() && "no insertion point set");
+    if (vectorizeNarrowInstruction(inst)) return;
+
     Instruction *vecInst = inst->clone();
 
     if (!vecInst->getType()->isVoidTy())
@@ -280,6 +294,75 @@ void NatBuilder::vectorize(Instruction *const inst) {
     mapVectorValue(inst, vecInst);
 }
 
+bool NatBuilder::isNarrowOperand(Value *const value) {
+    if (ConstantInt *constInt = dyn_cast<ConstantInt>(value))
+        return constInt->getValue().isSignedIntN(32);
+    return vectorizationInfo.isNarrowValue(*value);
+}
+
+/* computes i64 values whose lanes fit into i32 on <n x i32> vectors. returns false if inst is left to the caller */
+bool NatBuilder::vectorizeNarrowInstruction(Instruction *const inst) {
+    CastInst *castInst = dyn_cast<CastInst>(inst);
+    if (castInst && (isa<SExtInst>(castInst) || isa<ZExtInst>(castInst))) {
+        if (!vectorizationInfo.isNarrowValue(*inst) || castInst->getSrcTy()->getScalarSizeInBits() > 32) return false;
+
+        // the source already holds the lane values
+        Value *narrowVal = requestVectorValue(castInst->getOperand(0));
+        Type *narrowTy = getVectorType(i32Ty, vectorWidth());
+        if (narrowVal->getType() != narrowTy)
+            narrowVal = isa<SExtInst>(castInst) ? builder.CreateSExt(narrowVal, narrowTy, inst->getName() + "_narrow")
+                                            : builder.CreateZExt(narrowVal, narrowTy, inst->getName() + "_narrow");
+        narrowVectorValueMap[inst] = narrowVal;
+        return true;
+    }
+
+    // all operands must fit and at least one must be narrow already, truncating wide vectors gains nothing
+    BinaryOperator *binOp = dyn_cast<BinaryOperator>(inst);
+    ICmpInst *cmp = dyn_cast<ICmpInst>(inst);
+    if (!binOp && !cmp) return false;
+    if (!inst->getOperand(0)->getType()->isIntegerTy(64)) return false;
+    if (binOp && !vectorizationInfo.isNarrowValue(*inst)) return false;
+
+    bool hasNarrowOperand = false;
+    for (Value *op : inst->operands()) {
+        if (!isNarrowOperand(op)) return false;
+        hasNarrowOperand |= narrowVectorValueMap.count(op) > 0;
+    }
+    if (!hasNarrowOperand) return false;
+
+    if (binOp) {
+        // the low 32 bits of the result only depend on the low 32 bits of the operands
+        switch (binOp->getOpcode()) {
+            case Instruction::Add:
+            case Instruction::Sub:
+            case Instruction::Mul:
+            case Instruction::And:
+            case Instruction::Or:
+            case Instruction::Xor:
+                break;
+            case Instruction::Shl: {
+                ConstantInt *shiftAmount = dyn_cast<ConstantInt>(binOp->getOperand(1));
+                if (!shiftAmount || shiftAmount->getZExtValue() >= 32) return false;
+                break;
+            }
+            default:
+                return false;
+        }
+
+        Value *lhs = requestNarrowVectorValue(binOp->getOperand(0));
+        Value *rhs = requestNarrowVectorValue(binOp->getOperand(1));
+        // no wrap flags, the i32 operation wraps where the i64 one does not
+        narrowVectorValueMap[inst] = builder.CreateBinOp(binOp->getOpcode(), lhs, rhs, inst->getName() + "_narrow");
+        return true;
+    }
+
+    // sign extension keeps the signed and the unsigned order
+    Value *lhs = requestNarrowVectorValue(cmp->getOperand(0));
+    Value *rhs = requestNarrowVectorValue(cmp->getOperand(1));
+    mapVectorValue(inst, builder.CreateICmp(cmp->getPredicate(), lhs, rhs, inst->getName() + "_SIMD"));
+    return true;
+}
+
 #if 0
 void NatBuilder::vectorizeGEPInstruction(GetElementPtrInst *const gep) {
     // "vectorization" of gep instruction is simply copying the instruction for each lane
@@ -297,18 +380,74 @@ void NatBuilder::vectorizeGEPInstruction(GetElementPtrInst *const gep) {
 }
 #endif
 
+bool NatBuilder::isLaneIntrinsic(CallInst *const call) {
+    Function *callee = call->getCalledFunction();
+    if (!callee) return false;
+    return callee->getName() == "rv_any" || callee->getName() == "rv_all" || callee->getName() == "rv_popcount" ||
+           callee->getName() == "rv_index";
+}
+
 void NatBuilder::vectorizeReductionCall(CallInst *rvCall) {
-    assert(rvCall->getNumArgOperands() == 1 && "expected only 1 argument for rv_any");
+    StringRef name = rvCall->getCalledFunction()->getName();
+    assert(rvCall->getNumArgOperands() == 1 && "expected only 1 argument for lane intrinsic");
 
     Value *predicate = rvCall->getArgOperand(0);
     assert(vectorizationInfo.hasKnownShape(*predicate) && "predicate has no shape");
     const VectorShape &shape = vectorizationInfo.getVectorShape(*predicate);
     assert(!shape.isContiguous() && "predicate can't be contigious");
 
+    // rv_popcount: number of lanes with a true predicate
+    if (name == "rv_popcount") {
+        Value *count;
+        if (shape.isVarying()) {
+            Value *ballot = createBallot(requestVectorValue(predicate));
+            Function *ctpop = Intrinsic::getDeclaration(rvInfo.mModule, Intrinsic::ctpop, ballot->getType());
+            count = builder.CreateZExtOrTrunc(builder.CreateCall(ctpop, ballot, "popcount"), rvCall->getType());
+        } else {
+            count = builder.CreateSelect(requestScalarValue(predicate),
+                                         ConstantInt::get(rvCall->getType(), vectorWidth()),
+                                         ConstantInt::get(rvCall->getType(), 0), "popcount");
+        }
+        mapScalarValue(rvCall, count);
+        return;
+    }
+
+    // rv_index: number of lower lanes with a true predicate
+    if (name == "rv_index") {
+        Value *index;
+        if (shape.isVarying()) {
+            Value *ballot = createBallot(requestVectorValue(predicate));
+            std::vector<Constant *> lowerLanes;
+            for (unsigned i = 0; i < vectorWidth(); ++i) {
+                lowerLanes.push_back(ConstantInt::get(ballot->getType(), APInt::getLowBitsSet(vectorWidth(), i)));
+            }
+            Value *masked = builder.CreateAnd(builder.CreateVectorSplat(vectorWidth(), ballot),
+                                              ConstantVector::get(lowerLanes), "lower_ballot");
+            Function *ctpop = Intrinsic::getDeclaration(rvInfo.mModule, Intrinsic::ctpop, masked->getType());
+            index = builder.CreateZExtOrTrunc(builder.CreateCall(ctpop, masked),
+                                              VectorType::get(rvCall->getType(), vectorWidth()), "lane_index");
+        } else {
+            // all lanes agree, the index is the lane id
+            index = createContiguousVector(vectorWidth(), rvCall->getType());
+        }
+        mapVectorValue(rvCall, index);
+        return;
+    }
+
+    // rv_any / rv_all: whether any / all lanes have a true predicate
+    // rv_any only counts the lanes that execute the call (see LowerEarlyExit in rvTool)
     Value *reduction;
-    if (shape.isVarying()) {
+    Value *blockMask = name == "rv_any" ? requestBlockMask(*rvCall->getParent()) : nullptr;
+    if (blockMask) {
+        reduction = createPTest(builder.CreateAnd(requestVectorValue(predicate), blockMask, "active_pred"));
+    } else if (shape.isVarying()) {
         Value *vecPredicate = requestVectorValue(predicate);
-        reduction = createPTest(vecPredicate);
+        if (name == "rv_all") {
+            Value *ballot = createBallot(vecPredicate);
+            reduction = builder.CreateICmpEQ(ballot, Constant::getAllOnesValue(ballot->getType()), "all_lanes");
+        } else {
+            reduction = createPTest(vecPredicate);
+        }
     } else {
         reduction = requestScalarValue(predicate);
     }
@@ -470,6 +609,15 @@ void NatBuilder::vectorizeMemoryInstruction(Instruction *const inst) {
     assert(vectorizationInfo.hasKnownShape(*accessedPtr) && "no shape for accessed pointer!");
     VectorShape addrShape = vectorizationInfo.getVectorShape(*accessedPtr);
 
+    // lanes with constant offsets into one window: wide access + shuffle instead of gather/scatter
+    if (addrShape.hasLanePattern() && !accessedType->isPointerTy()) {
+        Value *vecMem = createPatternedMemoryAccess(inst, addrShape);
+        if (vecMem) {
+            mapVectorValue(inst, vecMem);
+            return;
+        }
+    }
+
     // address: uniform -> scalar op. contiguous -> scalar from vector-width address. varying -> scatter/gather
     // exception: address is an argument that is a vector -> vector load/store.
     // exception 2: if cont. pointer of pointer, then fall back
@@ -521,6 +669,11 @@ void NatBuilder::vectorizeMemoryInstruction(Instruction *const inst) {
     assert(predicate && predicate->getType()->isIntegerTy(1) && "predicate must have i1 type!");
     if (!addrShape.isUniform() && !isa<Constant>(predicate)) needsMask = true;
 
+    // contiguous accesses may use the alignment of the first lane
+    unsigned alignment = load ? load->getAlignment() : store->getAlignment();
+    if (addrShape.hasStride(scalarBytes) && !accessedType->isPointerTy())
+        alignment = getVectorAccessAlignment(accessedType, alignment, addrShape);
+
     Value *mask = nullptr;
     Value *vecMem = nullptr;
     if (load) {
@@ -533,11 +686,11 @@ void NatBuilder::vectorizeMemoryInstruction(Instruction *const inst) {
             if (needsFallback || (addrShape.isVarying() && !isa<Argument>(vecPtr)))
                 vecMem = requestCascadeLoad(vecPtr, load->getAlignment(), mask);
             else
-                vecMem = builder.CreateMaskedLoad(vecPtr, load->getAlignment(), mask, 0, "masked_vec_load");
+                vecMem = builder.CreateMaskedLoad(vecPtr, alignment, mask, 0, "masked_vec_load");
         } else {
             std::string name = addrShape.isUniform() ? "scal_load" : "vec_load";
             vecMem = builder.CreateLoad(vecPtr, name);
-            cast<LoadInst>(vecMem)->setAlignment(load->getAlignment());
+            cast<LoadInst>(vecMem)->setAlignment(alignment);
         }
 
     } else {
@@ -552,10 +705,10 @@ void NatBuilder::vectorizeMemoryInstruction(Instruction *const inst) {
             if (needsFallback || addrShape.isVarying() && !isa<Argument>(vecPtr))
                 vecMem = requestCascadeStore(mappedStoredVal, vecPtr, store->getAlignment(), mask);
             else
-                vecMem = builder.CreateMaskedStore(mappedStoredVal, vecPtr, store->getAlignment(), mask);
+                vecMem = builder.CreateMaskedStore(mappedStoredVal, vecPtr, alignment, mask);
         } else {
             vecMem = builder.CreateStore(mappedStoredVal, vecPtr);
-            cast<StoreInst>(vecMem)->setAlignment(store->getAlignment());
+            cast<StoreInst>(vecMem)->setAlignment(alignment);
         }
     }
 
@@ -565,9 +718,112 @@ void NatBuilder::vectorizeMemoryInstruction(Instruction *const inst) {
         mapVectorValue(inst, vecMem);
 }
 
+unsigned NatBuilder::getVectorAccessAlignment(Type *accessedType, unsigned scalarAlignment,
+                                              const VectorShape &addrShape) {
+    const DataLayout &layout = *rvInfo.mDataLayout;
+    if (!scalarAlignment) scalarAlignment = layout.getABITypeAlignment(accessedType);
+
+    // largest power of two that divides the first lane, at most the size of the vector
+    unsigned shapeAlignment = addrShape.getAlignment();
+    shapeAlignment &= ~shapeAlignment + 1;
+    unsigned vectorBytes = (unsigned) layout.getTypeStoreSize(accessedType) * vectorWidth();
+    while (shapeAlignment > vectorBytes) shapeAlignment >>= 1;
+
+    return std::max(scalarAlignment, shapeAlignment);
+}
+
+Value *NatBuilder::createPatternedMemoryAccess(Instruction *const inst, const VectorShape &addrShape) {
+    LoadInst *load = dyn_cast<LoadInst>(inst);
+    StoreInst *store = dyn_cast<StoreInst>(inst);
+    Value *accessedPtr = load ? load->getPointerOperand() : store->getPointerOperand();
+    Type *accessedType = load ? load->getType() : store->getValueOperand()->getType();
+
+    // masked accesses must not touch inactive lanes
+    Value *predicate = vectorizationInfo.getPredicate(*inst->getParent());
+    if (!isa<Constant>(predicate)) return nullptr;
+
+    // element index of every lane relative to lane 0
+    uint scalarBytes = accessedType->getPrimitiveSizeInBits() / 8;
+    if (scalarBytes == 0) return nullptr;
+
+    std::vector<int> laneIndices;
+    int minIdx = 0, maxIdx = 0;
+    for (unsigned lane = 0; lane < vectorWidth(); ++lane) {
+        int offset = addrShape.getLaneOffset(lane);
+        if (offset % (int) scalarBytes != 0) return nullptr;
+        int idx = offset / (int) scalarBytes;
+        minIdx = std::min(minIdx, idx);
+        maxIdx = std::max(maxIdx, idx);
+        laneIndices.push_back(idx);
+    }
+
+    // the window has to fit into a single vector
+    unsigned windowSize = maxIdx - minIdx + 1;
+    if (windowSize > vectorWidth()) return nullptr;
+
+    // stores need every element of the window exactly once
+    std::vector<int> laneOfElement(windowSize, -1);
+    for (unsigned lane = 0; lane < vectorWidth(); ++lane) {
+        int &slot = laneOfElement[laneIndices[lane] - minIdx];
+        if (store && slot != -1) return nullptr;
+        slot = lane;
+    }
+    if (store && windowSize != vectorWidth()) return nullptr;
+
+    Value *basePtr = requestScalarValue(accessedPtr, 0);
+    if (minIdx != 0) basePtr = builder.CreateGEP(basePtr, ConstantInt::get(i32Ty, minIdx), "window_start");
+    Type *windowType = getVectorType(accessedType, windowSize);
+    Value *windowPtr = builder.CreatePointerCast(basePtr, PointerType::getUnqual(windowType), "window_cast");
+
+    // the window starts at an element, an access without alignment would assume the vector ABI alignment
+    unsigned alignment = load ? load->getAlignment() : store->getAlignment();
+    if (!alignment) alignment = rvInfo.mDataLayout->getABITypeAlignment(accessedType);
+
+    if (load) {
+        LoadInst *windowLoad = builder.CreateLoad(windowPtr, "window_load");
+        windowLoad->setAlignment(alignment);
+
+        std::vector<Constant *> mask;
+        for (unsigned lane = 0; lane < vectorWidth(); ++lane)
+            mask.push_back(ConstantInt::get(i32Ty, laneIndices[lane] - minIdx));
+        return builder.CreateShuffleVector(windowLoad, UndefValue::get(windowType), ConstantVector::get(mask),
+                                           "window_shuffle");
+    }
+
+    // put every lane at its element of the window
+    std::vector<Constant *> mask;
+    for (unsigned elem = 0; elem < windowSize; ++elem)
+        mask.push_back(ConstantInt::get(i32Ty, laneOfElement[elem]));
+    Value *vecVal = requestVectorValue(store->getValueOperand());
+    Value *windowVal = builder.CreateShuffleVector(vecVal, UndefValue::get(vecVal->getType()),
+                                                   ConstantVector::get(mask), "window_shuffle");
+    StoreInst *windowStore = builder.CreateStore(windowVal, windowPtr);
+    windowStore->setAlignment(alignment);
+    return windowStore;
+}
+
 Value *NatBuilder::requestVectorValue(Value *const value) {
     Value *vecValue = getVectorValue(value);
-    if (!vecValue) {
+    auto narrowIt = narrowVectorValueMap.find(value);
+    if (!vecValue && narrowIt != narrowVectorValueMap.end()) {
+        // widen once, right behind the narrow definition
+        Instruction *narrowInst = dyn_cast<Instruction>(narrowIt->second);
+        auto oldIP = builder.GetInsertPoint();
+        auto oldIB = builder.GetInsertBlock();
+        if (narrowInst) {
+            BasicBlock *narrowBlock = narrowInst->getParent();
+            if (narrowBlock->getTerminator())
+                builder.SetInsertPoint(narrowBlock->getTerminator());
+            else
+                builder.SetInsertPoint(narrowBlock);
+        }
+
+        vecValue = builder.CreateSExt(narrowIt->second, getVectorType(value->getType(), vectorWidth()),
+                                      value->getName() + "_SIMD");
+
+        if (narrowInst) builder.SetInsertPoint(oldIB, oldIP);
+        mapVectorValue(value, vecValue);
+    } else if (!vecValue) {
         vecValue = getScalarValue(value);
         // check shape for vecValue. if there is one and it is contiguous, cast to vector and add <0,1,2,...,n-1>
         VectorShape shape = vectorizationInfo.hasKnownShape(*vecValue) ? vectorizationInfo.getVectorShape(*vecValue)
@@ -576,21 +832,39 @@ Value *NatBuilder::requestVectorValue(Value *const value) {
         Instruction *vecInst = dyn_cast<Instruction>(vecValue);
         auto oldIP = builder.GetInsertPoint();
         auto oldIB = builder.GetInsertBlock();
+        BasicBlock *preheader = (!vecInst && !isa<Constant>(vecValue)) ? getRegionPreheader() : nullptr;
         if (vecInst) {
             if (vecInst->getParent()->getTerminator())
                 builder.SetInsertPoint(vecInst->getParent()->getTerminator());
             else
                 builder.SetInsertPoint(vecInst->getParent());
+        } else if (preheader) {
+            // broadcast arguments once before entering the region
+            builder.SetInsertPoint(preheader->getTerminator());
         }
 
         vecValue = builder.CreateVectorSplat(vectorWidth(), vecValue);
-        if (shape.isContiguous()) {
+        if (shape.isContiguous() && vecValue->getType()->getVectorElementType()->isIntegerTy()) {
             auto * laneTy = vecValue->getType()->getVectorElementType();
             Value *contVec = createContiguousVector(vectorWidth(), laneTy);
             vecValue = builder.CreateAdd(vecValue, contVec, "contiguous_add");
+        } else if (shape.hasStridedShape() && !shape.isUniform()) {
+            auto * laneTy = vecValue->getType()->getVectorElementType();
+            if (laneTy->isPointerTy()) {
+                // pointer strides count bytes
+                Type *bytePtrVecTy = getVectorType(Type::getInt8PtrTy(laneTy->getContext()), vectorWidth());
+                Value *bytePtrs = builder.CreatePointerCast(vecValue, bytePtrVecTy);
+                Value *byteOffsets = createStridedVector(vectorWidth(), i32Ty, shape.getStride());
+                vecValue = builder.CreateGEP(bytePtrs, byteOffsets, "strided_gep");
+                vecValue = builder.CreatePointerCast(vecValue, getVectorType(laneTy, vectorWidth()));
+            } else {
+                Value *strideVec = createStridedVector(vectorWidth(), laneTy, shape.getStride());
+                vecValue = laneTy->isFloatingPointTy() ? builder.CreateFAdd(vecValue, strideVec, "strided_add")
+                                                       : builder.CreateAdd(vecValue, strideVec, "strided_add");
+            }
         }
 
-        if (vecInst) builder.SetInsertPoint(oldIB, oldIP);
+        if (vecInst || preheader) builder.SetInsertPoint(oldIB, oldIP);
 
         mapVectorValue(value, vecValue);
     }
@@ -603,6 +877,7 @@ Value *NatBuilder::requestScalarValue(Value *const value, unsigned laneIdx, bool
 
     // if value has a vector mapping -> extract from vector. if not -> clone scalar op
     mappedVal = getVectorValue(value);
+    if (!mappedVal) mappedVal = narrowVectorValueMap.lookup(value);
     Value *reqVal;
     if (mappedVal) {
         Instruction *mappedInst = dyn_cast<Instruction>(mappedVal);
@@ -618,7 +893,10 @@ Value *NatBuilder::requestScalarValue(Value *const value, unsigned laneIdx, bool
         reqVal = builder.CreateExtractElement(mappedVal, ConstantInt::get(i32Ty, laneIdx), "extract");
 
         if (reqVal->getType() != value->getType()) {
-            reqVal = builder.CreateBitCast(reqVal, value->getType(), "bc");
+            if (vectorizationInfo.isNarrowValue(*value))
+                reqVal = builder.CreateSExt(reqVal, value->getType(), "sext");
+            else
+                reqVal = builder.CreateBitCast(reqVal, value->getType(), "bc");
         }
 
         if (mappedInst)
@@ -636,6 +914,18 @@ Value *NatBuilder::requestScalarValue(Value *const value, unsigned laneIdx, bool
     return reqVal;
 }
 
+/* expects that the lanes of value fit into i32 and that builder has valid insertion point set */
+Value *NatBuilder::requestNarrowVectorValue(Value *const value) {
+    auto narrowIt = narrowVectorValueMap.find(value);
+    if (narrowIt != narrowVectorValueMap.end()) return narrowIt->second;
+
+    Type *narrowTy = getVectorType(i32Ty, vectorWidth());
+    if (ConstantInt *constInt = dyn_cast<ConstantInt>(value))
+        return builder.CreateVectorSplat(vectorWidth(), ConstantInt::get(i32Ty, constInt->getSExtValue()));
+
+    return builder.CreateTrunc(requestVectorValue(value), narrowTy, value->getName() + "_narrow");
+}
+
 Value *NatBuilder::requestCascadeLoad(Value *vecPtr, unsigned alignment, Value *mask) {
     Type *elementPtrType = cast<VectorType>(vecPtr->getType())->getElementType();
     Type *accessedType = cast<PointerType>(elementPtrType)->getElementType();
@@ -841,6 +1131,134 @@ Value *NatBuilder::createPTest(Value *vector) {
     return builder.CreateICmpNE(bc, simdFalseConst, "ptest_comp");
 }
 
+Value *NatBuilder::createBallot(Value *vector) {
+    assert(vector->getType()->isVectorTy() && "given value is no vector type!");
+    assert(cast<VectorType>(vector->getType())->getElementType()->isIntegerTy(1) &&
+           "vector elements must have i1 type!");
+
+    Type *ballotType = Type::getIntNTy(vector->getContext(), vectorWidth());
+    return builder.CreateBitCast(vector, ballotType, "ballot");
+}
+
+Value *NatBuilder::requestBlockMask(const BasicBlock &block) {
+    Value *predicate = vectorizationInfo.getPredicate(block);
+    ConstantInt *constPredicate = dyn_cast_or_null<ConstantInt>(predicate);
+    if (!predicate || (constPredicate && constPredicate->isOne())) return nullptr;
+    return requestVectorValue(predicate);
+}
+
+/* expects that builder has valid insertion point set */
+Value *NatBuilder::requestExitLane(BasicBlock *const exitingBlock, BasicBlock *const exitBlock) {
+    // a data-dependent exit (rv_any) is left by the first lane that takes it
+    BranchInst *branch = dyn_cast<BranchInst>(exitingBlock->getTerminator());
+    CallInst *anyCall = branch && branch->isConditional() ? dyn_cast<CallInst>(branch->getCondition()) : nullptr;
+    if (anyCall && anyCall->getCalledFunction()->getName() == "rv_any" && branch->getSuccessor(0) == exitBlock) {
+        Value *predicate = anyCall->getArgOperand(0);
+        VectorShape shape = vectorizationInfo.hasKnownShape(*predicate) ? vectorizationInfo.getVectorShape(*predicate)
+                                                                        : VectorShape::uni();
+        Value *blockMask = requestBlockMask(*exitingBlock);
+        if (!shape.isUniform() || blockMask) {
+            Value *vecPredicate = requestVectorValue(predicate);
+            if (blockMask) vecPredicate = builder.CreateAnd(vecPredicate, blockMask, "active_pred");
+            Value *ballot = createBallot(vecPredicate);
+            Function *cttz = Intrinsic::getDeclaration(rvInfo.mModule, Intrinsic::cttz, ballot->getType());
+            Value *lane = builder.CreateCall(cttz, {ballot, builder.getTrue()}, "exit_lane");
+            return builder.CreateZExtOrTrunc(lane, i32Ty);
+        }
+    }
+
+    // all other exits are taken by all lanes together, the last lane executed the last iteration
+    return ConstantInt::get(i32Ty, vectorWidth() - 1);
+}
+
+// The live-out is the update of a reduction over the region loop whose lanes
+// all start at the identity (see PrepareReductions in rvTool), so every lane
+// holds a partial result. Returns the opcode of the update or 0.
+unsigned NatBuilder::getLaneReductionOpcode(Instruction *const liveOut) {
+    BinaryOperator *update = dyn_cast<BinaryOperator>(liveOut);
+    if (!update) return 0;
+
+    for (auto &inst : region->getRegionEntry()) {
+        PHINode *phi = dyn_cast<PHINode>(&inst);
+        if (!phi) break;
+        if (update->getOperand(0) != phi && update->getOperand(1) != phi) continue;
+
+        bool updatesPhi = false;
+        Value *init = nullptr;
+        for (unsigned i = 0; i < phi->getNumIncomingValues(); ++i) {
+            if (region->contains(phi->getIncomingBlock(i))) updatesPhi |= phi->getIncomingValue(i) == update;
+            else init = phi->getIncomingValue(i);
+        }
+
+        if (updatesPhi && init && init == getReductionIdentity(update->getOpcode(), update->getType())) {
+            return update->getOpcode();
+        }
+    }
+
+    return 0;
+}
+
+Value *NatBuilder::createLaneReduction(unsigned opcode, Value *vector) {
+    Type *i32Ty = Type::getInt32Ty(vector->getContext());
+    Value *result = builder.CreateExtractElement(vector, ConstantInt::get(i32Ty, 0), "reduce_extract");
+    for (unsigned i = 1; i < vectorWidth(); ++i) {
+        Value *lane = builder.CreateExtractElement(vector, ConstantInt::get(i32Ty, i), "reduce_extract");
+        result = builder.CreateBinOp((Instruction::BinaryOps) opcode, result, lane, "reduce");
+    }
+    return result;
+}
+
+void NatBuilder::repairOutsideUses() {
+    Function *vecFunc = vectorizationInfo.getMapping().vectorFn;
+    for (auto &BB : *vecFunc) {
+        if (region->contains(&BB)) continue;
+
+        for (auto &inst : BB) {
+            PHINode *phi = dyn_cast<PHINode>(&inst);
+            if (!phi) break;
+
+            for (unsigned i = 0; i < phi->getNumIncomingValues(); ++i) {
+                BasicBlock *exitingBlock = phi->getIncomingBlock(i);
+                if (!region->contains(exitingBlock)) continue;
+
+                BasicBlock *vecExitingBlock = cast<BasicBlock>(getVectorValue(exitingBlock));
+                builder.SetInsertPoint(vecExitingBlock->getTerminator());
+
+                Value *liveOut = phi->getIncomingValue(i);
+                Instruction *liveOutInst = dyn_cast<Instruction>(liveOut);
+                if (liveOutInst && region->contains(liveOutInst->getParent())) {
+                    VectorShape shape = vectorizationInfo.hasKnownShape(*liveOut) ? vectorizationInfo.getVectorShape(*liveOut)
+                                                                                  : VectorShape::uni();
+                    unsigned reductionOpcode = getLaneReductionOpcode(liveOutInst);
+                    if (shape.isUniform()) {
+                        liveOut = requestScalarValue(liveOut);
+                    } else if (reductionOpcode) {
+                        liveOut = createLaneReduction(reductionOpcode, requestVectorValue(liveOut));
+                    } else {
+                        Value *lane = requestExitLane(exitingBlock, &BB);
+                        liveOut = builder.CreateExtractElement(requestVectorValue(liveOut), lane, "liveout");
+                    }
+                }
+
+                phi->setIncomingValue(i, liveOut);
+                phi->setIncomingBlock(i, vecExitingBlock);
+            }
+        }
+    }
+}
+
+BasicBlock *NatBuilder::getRegionPreheader() {
+    if (!region) return nullptr;
+
+    BasicBlock *preheader = nullptr;
+    for (BasicBlock *pred : predecessors(&region->getRegionEntry())) {
+        if (region->contains(pred)) continue;
+        if (preheader && preheader != pred) return nullptr;
+        preheader = pred;
+    }
+    return preheader;
+}
+
 void NatBuilder::addValuesToPHINodes() {
     // save current insertion point before continuing
     auto IB = builder.GetInsertBlock();
@@ -849,7 +1267,10 @@ void NatBuilder::addValuesToPHINodes() {
     for (PHINode *scalPhi : phiVector) {
         assert(vectorizationInfo.hasKnownShape(*scalPhi) && "no VectorShape for PHINode available!");
         VectorShape shape = vectorizationInfo.getVectorShape(*scalPhi);
-        PHINode *phi = cast<PHINode>(!shape.isVarying() ? getScalarValue(scalPhi) : getVectorValue(scalPhi));
+        auto narrowIt = narrowVectorValueMap.find(scalPhi);
+        bool narrow = narrowIt != narrowVectorValueMap.end();
+        PHINode *phi = cast<PHINode>(narrow ? narrowIt->second :
+                                     !shape.isVarying() ? getScalarValue(scalPhi) : getVectorValue(scalPhi));
         for (unsigned i = 0; i < scalPhi->getNumIncomingValues(); ++i) {
             // set insertion point to before Terminator of incoming block
             BasicBlock *incVecBlock = cast<BasicBlock>(getVectorValue(scalPhi->getIncomingBlock(i)));
@@ -861,8 +1282,9 @@ void NatBuilder::addValuesToPHINodes() {
             }
 #endif
 
-            Value *val = !shape.isVarying() ? requestScalarValue(scalPhi->getIncomingValue(i))
-                                           : requestVectorValue(scalPhi->getIncomingValue(i));
+            Value *val = narrow ? requestNarrowVectorValue(scalPhi->getIncomingValue(i)) :
+                         !shape.isVarying() ? requestScalarValue(scalPhi->getIncomingValue(i))
+                                            : requestVectorValue(scalPhi->getIncomingValue(i));
             phi->addIncoming(val, incVecBlock);
         }
     }
@@ -63,18 +63,26 @@ namespace native {
 
         void vectorizePHIInstruction(llvm::PHINode *const scalPhi);
         void vectorizeMemoryInstruction(llvm::Instruction *const inst);
+        llvm::Value *createPatternedMemoryAccess(llvm::Instruction *const inst, const rv::VectorShape &addrShape);
+        unsigned getVectorAccessAlignment(llvm::Type *accessedType, unsigned scalarAlignment,
+                                          const rv::VectorShape &addrShape);
+        bool vectorizeNarrowInstruction(llvm::Instruction *const inst);
+        bool isNarrowOperand(llvm::Value *const value);
         void vectorizeCallInstruction(llvm::CallInst *const scalCall);
 
         void mapOperandsInto(llvm::Instruction *const scalInst, llvm::Instruction *inst, bool vectorizedInst,
                              unsigned laneIdx = 0);
 
         llvm::DenseMap<const llvm::Value *, llvm::Value *> vectorValueMap;
+        // i32 vectors of the i64 values that VectorizationInfo marked narrow
+        llvm::DenseMap<const llvm::Value *, llvm::Value *> narrowVectorValueMap;
         std::map<const llvm::Value *, LaneValueVector> scalarValueMap;
         llvm::DenseMap<unsigned, llvm::Function *> cascadeLoadMap;
         llvm::DenseMap<unsigned, llvm::Function *> cascadeStoreMap;
         std::vector<llvm::PHINode *> phiVector;
 
         llvm::Value *requestVectorValue(llvm::Value *const value);
+        llvm::Value *requestNarrowVectorValue(llvm::Value *const value);
 
         llvm::Value *requestScalarValue(llvm::Value *const value, unsigned laneIdx = 0,
                                         bool skipMappingWhenDone = false);
@@ -90,6 +98,15 @@ namespace native {
         llvm::Function *getCascadeFunction(unsigned bitWidth, bool store);
 
         llvm::Value *createPTest(llvm::Value *vector);
+        llvm::Value *createBallot(llvm::Value *vector);
+        // the vector mask of @block, nullptr if all lanes execute it
+        llvm::Value *requestBlockMask(const llvm::BasicBlock &block);
+
+        void repairOutsideUses();
+        llvm::Value *requestExitLane(llvm::BasicBlock *const exitingBlock, llvm::BasicBlock *const exitBlock);
+        unsigned getLaneReductionOpcode(llvm::Instruction *const liveOut);
+        llvm::Value *createLaneReduction(unsigned opcode, llvm::Value *vector);
+        llvm::BasicBlock *getRegionPreheader();
 
         const rv::VectorMapping * getFunctionMapping(llvm::Function *func);
 
@@ -100,6 +117,7 @@ namespace native {
 
         bool useMappingForCall(const rv::VectorMapping *mapping, llvm::CallInst *const scalCall);
 
+        bool isLaneIntrinsic(llvm::CallInst *const call);
         void vectorizeReductionCall(CallInst *wfvCall);
     };
 }
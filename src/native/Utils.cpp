@@ -28,6 +28,17 @@ Value *createContiguousVector(unsigned width, Type *type, int start) {
     return ConstantVector::get(ArrayRef<Constant *>(constants, width));
 }
 
+Value *createStridedVector(unsigned width, Type *type, int stride) {
+    Constant *constants[width];
+    for (unsigned i = 0; i < width; ++i) {
+        if (type->isFloatingPointTy())
+            constants[i] = ConstantFP::get(type, (double) ((int) i * stride));
+        else
+            constants[i] = ConstantInt::get(type, (int) i * stride, true);
+    }
+    return ConstantVector::get(ArrayRef<Constant *>(constants, width));
+}
+
 BasicBlock *createCascadeBlocks(Function *insertInto, unsigned vectorWidth,
                                 std::vector<BasicBlock *> &condBlocks,
                                 std::vector<BasicBlock *> &maskedBlocks) {
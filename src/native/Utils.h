@@ -19,6 +19,9 @@ llvm::Type *getVectorType(llvm::Type *type, unsigned width);
 
 llvm::Value *createContiguousVector(unsigned width, llvm::Type *type, int start = 0);
 
+// <0, stride, 2 * stride, ...> of integer or floating point @type
+llvm::Value *createStridedVector(unsigned width, llvm::Type *type, int stride);
+
 /***
  * Create blocks needed for an if-cascade. Condition blocks are inserted into condBlocks, the masked blocks into
  * maskedBlocks. Pointer to return block is returned.
@@ -43,11 +43,14 @@ ABAAnalysisWrapper::runOnFunction(Function& F)
     const PostDominatorTree& postDomTree = getAnalysis<PostDominatorTree>();
     const DominatorTree& domTree         = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
 
+    SyncDependenceAnalysis SDA(domTree, postDomTree, loopInfo);
+
     ABAAnalysis Analysis(vectorizationInfo,
                          funcInfo,
                          loopInfo,
                          postDomTree,
-                         domTree);
+                         domTree,
+                         SDA);
 
     Analysis.analyze(F);
 
@@ -58,12 +61,14 @@ ABAAnalysis::ABAAnalysis(VectorizationInfo& vecInfo,
                          native::VectorMappingMap& funcInfo,
                          const LoopInfo& loopInfo,
                          const PostDominatorTree& postDomTree,
-                         const DominatorTree& domTree)
+                         const DominatorTree& domTree,
+                         SyncDependenceAnalysis& SDA)
         : mVecinfo(vecInfo),
           mFuncinfo(funcInfo),
           mLoopInfo(loopInfo),
-          mPostDomTree(postDomTree),
           mDomTree(domTree),
+          mPostDomTree(postDomTree),
+          mSDA(SDA),
           mRegion(mVecinfo.getRegion())
 {
 }
@@ -216,8 +221,10 @@ ABAAnalysis::markABAONBlocks(Function& F)
                 // If only a region is analyzed, the terminator may not have a shape, or it may,
                 // depending on what assumptions the user wrote into mVecInfo.
                 // If it does not, we assume must assume it is varying, thus the block is ABA_FALSE.
+                // Lanes of a varying branch that all meet again in the block leave it ABAON.
                 if (!mVecinfo.hasKnownShape(terminator) ||
-                    !mVecinfo.getVectorShape(terminator).isUniform())
+                    (!mVecinfo.getVectorShape(terminator).isUniform() &&
+                     !isReconvergedAt(terminator, *block)))
                 {
                     mVecinfo.markNotAlwaysByAll(block);
                     marked = true;
@@ -291,6 +298,19 @@ ABAAnalysis::markABAONBlocks(Function& F)
     }
 }
 
+// Returns true if all lanes that execute the varying @terminator reach @block
+// in the same iteration, on disjoint paths that join in @block.
+bool ABAAnalysis::isReconvergedAt(const TerminatorInst& terminator, BasicBlock& block)
+{
+    BasicBlock* branchBlock = const_cast<BasicBlock*>(terminator.getParent());
+    if (!mPostDomTree.dominates(&block, branchBlock)) return false;
+
+    const Loop* branchLoop = mLoopInfo.getLoopFor(branchBlock);
+    if (branchLoop && (!branchLoop->contains(&block) || mVecinfo.isDivergentLoop(branchLoop))) return false;
+
+    return mSDA.join_blocks(terminator).count(&block);
+}
+
 bool ABAAnalysis::isABAONSESEExit(BasicBlock& block)
 {
     DomTreeNode* dtn = mDomTree.getNode(&block);
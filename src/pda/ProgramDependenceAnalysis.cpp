@@ -12,6 +12,10 @@
 
 #include "rv/pda/ProgramDependenceAnalysis.h"
 
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Support/MathExtras.h"
+
 #include "rvConfig.h"
 #include "utils/rvTools.h"
 #include "rv/utils/mathUtils.h"
@@ -27,8 +31,6 @@ namespace rv {
 using ValueMap = std::map<const Value*, VectorShape>;
 using FuncInfo = native::VectorMappingMap;
 
-#define BYTE_SIZE 8
-
 char PDAWrapperPass::ID = 0;
 
 bool
@@ -37,13 +39,16 @@ PDAWrapperPass::runOnFunction(Function& F)
     VectorizationInfo& Vecinfo = getAnalysis<VectorizationInfoProxyPass>().getInfo();
 
     const CDG& cdg = *getAnalysis<llvm::CDGWrapper>().getDFG();
-    const DFG& dfg = *getAnalysis<llvm::DFGWrapper>().getDFG();
     const FuncInfo& FuncInfo = getAnalysis<RVInfoProxyPass>().getInfo().getVectorFuncMap();
     const LoopInfo& LoopInfo = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+    const DominatorTree& domTree = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+    const PostDominatorTree& postDomTree = getAnalysis<PostDominatorTree>();
+
+    SyncDependenceAnalysis SDA(domTree, postDomTree, LoopInfo);
 
     PDA pda(Vecinfo,
             cdg,
-            dfg,
+            SDA,
             FuncInfo,
             LoopInfo);
 
@@ -62,13 +67,13 @@ PDAWrapperPass::print(llvm::raw_ostream& O, const Module*) const
 
 PDA::PDA(VectorizationInfo& VecInfo,
          const CDG& cdg,
-         const DFG& dfg,
+         SyncDependenceAnalysis& SDA,
          const FuncInfo& Funcinfo,
          const LoopInfo& LoopInfo)
 
         : layout(""),
           mCDG(cdg),
-          mDFG(dfg),
+          mSDA(SDA),
           mVecinfo(VecInfo),
           mFuncinfo(Funcinfo),
           mLoopInfo(LoopInfo),
@@ -80,13 +85,26 @@ PDA::analyze(Function& F)
 {
     assert (!F.isDeclaration());
 
-    mWorklist.clear();
+    mWorklist = PriorityQueue();
+    mStats = Statistics();
+    mPrivateAllocas.clear();
+    mStale.clear();
+    mDivergentLoops.clear();
+    mKnownAlignment.clear();
 
+    computeInstructionOrder(F);
     init(F);
     compute(F);
     fillVectorizationInfo(F);
+    markNarrowValues(F);
 
     markDivergentLoopLatchesMandatory();
+
+    IF_DEBUG_PDA {
+        outs() << "PDA solved " << F.getName() << " in " << mStats.numIterations << " iterations: "
+               << mStats.numEvaluations << " evaluations (" << mStats.numReevaluations << " repeated), "
+               << mStats.numPrivatizedAllocas << " privatized allocas\n";
+    }
     // checkEquivalentToOldAnalysis(F);
 }
 
@@ -132,6 +150,11 @@ PDA::getAlignment(const Constant* c) const
     // An undef value is never aligned.
     if (isa<UndefValue>(c)) return 1;
 
+    if (const GlobalObject* global = dyn_cast<GlobalObject>(c))
+    {
+        return std::max<unsigned>(1U, global->getAlignment());
+    }
+
     if (const ConstantInt* cint = dyn_cast<ConstantInt>(c))
     {
         return std::abs(cint->getSExtValue());
@@ -180,12 +203,12 @@ PDA::init(Function& F)
             if (arg.getType()->isPointerTy() && argShape.isVarying())
                 argShape = VectorShape::cont();
 
-            update(&arg, argShape);
+            update(&arg, refineAlignment(&arg, argShape));
             mVecinfo.dropVectorShape(arg);
         } else {
           assert(mRegion && "will only default function args if in region mode");
           // set argument shapes to uniform if not known better
-          update(&arg, VectorShape::uni());
+          update(&arg, refineAlignment(&arg, VectorShape::uni()));
         }
     }
 
@@ -219,9 +242,9 @@ PDA::init(Function& F)
 
         for (const Instruction& I : BB)
         {
-            if (isa<AllocaInst>(&I))
+            if (const AllocaInst* alloca = dyn_cast<AllocaInst>(&I))
             {
-                update(&I, VectorShape::uni(mVecinfo.getMapping().vectorWidth));
+                update(&I, refineAlignment(&I, VectorShape::uni(std::max<unsigned>(1U, alloca->getAlignment()))));
             }
             /* Need to initialize WL with calls, they may not be reached o.w. */
             else if (const CallInst* call = dyn_cast<CallInst>(&I))
@@ -229,13 +252,13 @@ PDA::init(Function& F)
                 // Only makes sense if a value is returned
                 if (call->getCalledFunction()->getReturnType()->isVoidTy()) continue;
 
-                mWorklist.insert(&I);
+                pushWorklist(&I);
                 IF_DEBUG_PDA errs() << "Inserted call in initialization: " << I.getName() << "\n";
             }
             /* Phis that depend on constants are added to the WL */
             else if (isa<PHINode>(I) && any_of(I.operands(), isa<Constant, Use>))
             {
-                mWorklist.insert(&I);
+                pushWorklist(&I);
                 IF_DEBUG_PDA outs() << "Inserted PHI in initialization: " << I.getName() << "\n";
             }
 
@@ -248,7 +271,7 @@ PDA::init(Function& F)
             // FIXME: just run constant propagation beforehand?
             if (I.getNumOperands() > 0 && all_of(I.operands(), isa<Constant, Use>))
             {
-                mWorklist.insert(&I);
+                pushWorklist(&I);
                 IF_DEBUG_PDA outs() << "Inserted all-constant instruction in initialization: " << I.getName() <<
                        "\n";
             }
@@ -260,9 +283,13 @@ PDA::init(Function& F)
 void
 PDA::update(const Value* const V, VectorShape AT)
 {
-    const VectorShape& New = joinWithOld(V, AT);
+    // A stale shape must not flow into the new one
+    const bool wasStale = mStale.erase(V);
+    const VectorShape New = wasStale ? AT : joinWithOld(V, AT);
 
-    if (mValue2Shape.count(V) && mValue2Shape[V] == New)
+    auto found = mValue2Shape.find(V);
+    const bool changed = found == mValue2Shape.end() || !(found->second == New);
+    if (!changed && !wasStale)
         return;// nothing changed
 
     IF_DEBUG_PDA {
@@ -277,6 +304,10 @@ PDA::update(const Value* const V, VectorShape AT)
     /* Add dependent elements to worklist */
     addRelevantUsersToWL(V);
 
+    // Users may still wait for this value to become fresh
+    if (!changed)
+        return;
+
     // Nothing else needs to be done for uniform values
     if (New.isUniform())
         return;
@@ -293,98 +324,126 @@ PDA::update(const Value* const V, VectorShape AT)
     if (!isa<BranchInst>(V))
         return;
 
-    // Find out which regions diverge because of this non-uniform branch
     // The branch is regarded as varying, even if its condition is only strided
-    const BranchInst* branch = cast<BranchInst>(V);
-    assert (branch->isConditional());
+    propagateBranchDivergence(*cast<BranchInst>(V));
+}
+
+void
+PDA::propagateBranchDivergence(const BranchInst& branch)
+{
+    assert (branch.isConditional());
 
-    const BasicBlock* endsVarying = branch->getParent();
+    const BasicBlock* endsVarying = branch.getParent();
     const Loop* endsVaryingLoop = mLoopInfo.getLoopFor(endsVarying);
 
     markSuccessorsMandatory(endsVarying);
     markDependentLoopExitsMandatory(endsVarying);
 
-    const CDNode* cd_node = mCDG[endsVarying];
-    // Iterate over the predeccessors in the dfg, of the successors in the cdg
-    for (const CDNode* cd_succ : cd_node->succs())
+    // Only the blocks where the paths from the branch meet again are affected
+    bool exitsDivergent = false;
+    for (const BasicBlock* BB : mSDA.join_blocks(branch))
     {
-        const DFNode* df_node = mDFG[cd_succ->getBB()];
-        for (const DFNode* df_pred : df_node->preds())
+        if (!isInRegion(BB)) continue;
+
+        IF_DEBUG errs() << "Branch " << branch << " affects " << *BB << "\n";
+
+        // Some lanes leave the loop while others continue
+        if (endsVaryingLoop && !endsVaryingLoop->contains(BB))
         {
-            // Get the block BB that is affected by the varying branch
-            const BasicBlock* const BB = df_pred->getBB();
+            markLoopExitDivergent(*BB, *endsVaryingLoop);
+            exitsDivergent = true;
+            continue;
+        }
 
-            IF_DEBUG errs() << "Branch " << *branch << " affects " << *BB << "\n";
+        markJoinDivergent(*BB, endsVaryingLoop);
+    }
 
-            assert(isInRegion(BB)); // Otherwise the region is ill-formed
+    if (exitsDivergent)
+        propagateLoopDivergence(*endsVaryingLoop);
+}
 
-            // Loop headers are not marked divergent, but can be loop divergent
-            if (mLoopInfo.isLoopHeader(BB))
-            {
-                const Loop* BBLoop = mLoopInfo.getLoopFor(BB);
-                if (!BBLoop->contains(endsVaryingLoop))
-                    continue;
+void
+PDA::propagateLoopDivergence(const Loop& loop)
+{
+    // The vectorized loop itself is left by all lanes together
+    if (!isInRegion(loop.getHeader()) || !mDivergentLoops.insert(&loop).second)
+        return;
 
-                const bool BranchExitsBBLoop = BBLoop->isLoopExiting(endsVarying);
+    IF_DEBUG_PDA outs() << "Loop " << loop.getHeader()->getName() << " is divergent\n";
 
-                // If the branch exits the loop, the loop is divergent
-                // (the header diverges in its loop)
+    // The header diverges in its loop
+    mVecinfo.setDivergenceLevel(*loop.getHeader(), &loop);
+    markLoopLiveOutsVarying(loop);
 
-                const Loop * divLevel = BranchExitsBBLoop ? BBLoop : endsVaryingLoop;
-                IF_DEBUG errs() << "Setting divlevel for " << *BB << " for branch " << *branch << " to " << *divLevel << "\n";
+    // Lanes that left through different exits meet in the parent loop
+    const Loop* parentLoop = loop.getParentLoop();
+    bool exitsDivergent = false;
+    for (const BasicBlock* BB : mSDA.join_blocks(loop))
+    {
+        if (!isInRegion(BB)) continue;
 
-                mVecinfo.setDivergenceLevel(*BB, divLevel);
+        if (parentLoop && !parentLoop->contains(BB))
+        {
+            markLoopExitDivergent(*BB, *parentLoop);
+            exitsDivergent = true;
+            continue;
+        }
 
-                if (mVecinfo.isDivergentLoop(BBLoop))
-                {
-                    for (auto it = BB->begin(); BB->getFirstNonPHI() != &*it; ++it)
-                        updateOutsideLoopUsesVarying(cast<PHINode>(&*it), BBLoop);
-                }
+        markJoinDivergent(*BB, parentLoop);
+    }
 
-                continue;
-            }
+    if (exitsDivergent)
+        propagateLoopDivergence(*parentLoop);
+}
 
-            // If the dependence exits the loop, we need to blackbox the loop
-            // If any loop exit is varying, the block is divergent since the loop might
-            // leak information before every thread is done
-            if (endsVaryingLoop && !endsVaryingLoop->contains(BB))
-            {
-                // In case of only one exit block we can optimize considering it gets
-                // linearized
-                if (endsVaryingLoop->getUniqueExitBlock())
-                {
-                    mVecinfo.setDivergenceLevel(*BB, endsVaryingLoop);
-                    continue;
-                }
+void
+PDA::markJoinDivergent(const BasicBlock& BB, const Loop* level)
+{
+    mValue2Shape[&BB] = VectorShape::varying();
+    mVecinfo.setDivergenceLevel(BB, level);
 
-                // For multiple exits, the loop shall be blackboxed
-                VectorShape CombinedExitShape = combineExitShapes(endsVaryingLoop);
-                mValue2Shape[BB] = joinWithOld(BB, CombinedExitShape);
-            }
-            else
-                mValue2Shape[BB] = VectorShape::varying();
+    IF_DEBUG_PDA {
+        outs() << "Block " << BB.getName() << " is divergent\n";
+    }
 
-            mVecinfo.setDivergenceLevel(*BB, endsVaryingLoop);
+    // MANDATORY case 2: divergent block
+    mVecinfo.markMandatory(&BB);
 
-            if (mValue2Shape[BB].isVarying())
-            {
-                IF_DEBUG_PDA {
-                        outs() << "Block " + BB->getName() +
-                                  " is divergent since the branch in " +
-                                  endsVarying->getName() + " is varying.\n\n";
-                }
+    pushBlockPhis(BB);
+}
 
-                // MANDATORY case 2: divergent block
-                mVecinfo.markMandatory(BB);
-            }
+void
+PDA::markLoopExitDivergent(const BasicBlock& exit, const Loop& loop)
+{
+    // In case of only one exit block we can optimize considering it gets
+    // linearized
+    if (loop.getUniqueExitBlock())
+    {
+        mVecinfo.setDivergenceLevel(exit, &loop);
+        return;
+    }
 
-            // add phis to worklist
-            for (auto it = BB->begin(); BB->getFirstNonPHI() != &*it; ++it)
-            {
-                mWorklist.insert(&*it);
-                IF_DEBUG_PDA outs() << "Inserted PHI: " << (&*it)->getName() << "\n";
-            }
-        }
+    // For multiple exits, the loop shall be blackboxed
+    VectorShape CombinedExitShape = combineExitShapes(&loop);
+    mValue2Shape[&exit] = joinWithOld(&exit, CombinedExitShape);
+    mVecinfo.setDivergenceLevel(exit, &loop);
+
+    if (mValue2Shape[&exit].isVarying())
+    {
+        // MANDATORY case 2: divergent block
+        mVecinfo.markMandatory(&exit);
+    }
+
+    pushBlockPhis(exit);
+}
+
+void
+PDA::pushBlockPhis(const BasicBlock& BB)
+{
+    for (auto it = BB.begin(); BB.getFirstNonPHI() != &*it; ++it)
+    {
+        pushWorklist(&*it);
+        IF_DEBUG_PDA outs() << "Inserted PHI: " << (&*it)->getName() << "\n";
     }
 }
 
@@ -397,14 +456,17 @@ PDA::updateAllocaOperands(const Instruction* I)
     {
         if (!isa<AllocaInst>(op)) continue;
 
-        // Already processed
-        if (!getShape(op).isUniform()) continue;
+        // Already processed, allocas only move from uniform to private once
+        if (!getShape(op).isUniform() || !mPrivateAllocas.insert(op).second) continue;
 
-        eraseUserInfoRecursively(op);
+        ++mStats.numPrivatizedAllocas;
+        markUsersStale(op);
 
         auto* PtrElemType = op->getType()->getPointerElementType();
         const bool Vectorizable = rv::isVectorizableNonDerivedType(*PtrElemType);
 
+        // replace the uniform shape
+        mStale.insert(op);
         update(op, Vectorizable ?
                    VectorShape::strided(layout.getTypeStoreSize(PtrElemType), alignment) :
                    VectorShape::varying(alignment));
@@ -412,16 +474,26 @@ PDA::updateAllocaOperands(const Instruction* I)
 }
 
 void
-PDA::eraseUserInfoRecursively(const Value* V)
+PDA::markUsersStale(const Value* V)
 {
-    auto found = mValue2Shape.find(V);
+    SmallVector<const Value*, 16> worklist;
+    worklist.push_back(V);
 
-    if (found == mValue2Shape.end()) return;
+    while (!worklist.empty())
+    {
+        const Value* val = worklist.pop_back_val();
+        for (const User* user : val->users())
+        {
+            const Instruction* userI = dyn_cast<Instruction>(user);
+            if (!userI || !isInRegion(*userI)) continue;
 
-    mValue2Shape.erase(found);
+            // Values without shape have nothing to reset, user shapes are final
+            if (!mValue2Shape.count(userI) || overrides.count(userI)) continue;
 
-    for (const Value* use : V->users())
-        eraseUserInfoRecursively(use);
+            if (!mStale.insert(userI).second) continue;
+            worklist.push_back(userI);
+        }
+    }
 }
 
 void
@@ -437,23 +509,29 @@ PDA::addRelevantUsersToWL(const Value* V)
             if (callI->getCalledFunction()->getReturnType()->isVoidTy())
                 continue;
 
-        mWorklist.insert(cast<Instruction>(user));
+        pushWorklist(cast<Instruction>(user));
         IF_DEBUG_PDA outs() << "Inserted " << user->getName() << " as relevant user of " << V->getName() <<
                "\n";
     }
 }
 
 void
-PDA::updateOutsideLoopUsesVarying(const PHINode* PHI, const Loop* PHILoop)
+PDA::markLoopLiveOutsVarying(const Loop& loop)
 {
-    for (auto use : PHI->users())
+    // Lanes leave the loop in different iterations, so every value that is
+    // live after the loop differs between them
+    for (const BasicBlock* BB : loop.blocks())
     {
-        const Instruction* useI = cast<Instruction>(use);
-        if (!isInRegion(*useI)) continue;
+        for (const Instruction& I : *BB)
+        {
+            for (const User* user : I.users())
+            {
+                const Instruction* userI = cast<Instruction>(user);
+                if (!isInRegion(*userI) || loop.contains(userI->getParent())) continue;
 
-        // find outside uses and update varying
-        if (!PHILoop->contains(mLoopInfo.getLoopFor(useI->getParent())))
-            update(useI, VectorShape::varying());
+                update(userI, VectorShape::varying());
+            }
+        }
     }
 }
 
@@ -520,31 +598,135 @@ PDA::markSuccessorsMandatory(const BasicBlock* endsVarying)
         mVecinfo.markMandatory(succBB);
 }
 
+bool
+PDA::hasComputedShape(const Value* V) const
+{
+    return !isa<Instruction>(V) || (mValue2Shape.count(V) && !mStale.count(V));
+}
+
 bool
 PDA::allOperandsHaveShape(const Instruction* I)
 {
     auto hasKnownShape = [this](Value* op)
     {
-        return !isa<Instruction>(op) || mValue2Shape.count(op);
+        return hasComputedShape(op);
     };
 
     return all_of(I->operands(), hasKnownShape);
 }
 
+bool
+PDA::anyOperandHasShape(const Instruction* I)
+{
+    auto hasKnownShape = [this](Value* op)
+    {
+        return hasComputedShape(op);
+    };
+
+    return any_of(I->operands(), hasKnownShape);
+}
+
+void
+PDA::computeInstructionOrder(Function& F)
+{
+    mInstructionOrder.clear();
+    mPriority.clear();
+
+    ReversePostOrderTraversal<Function*> RPOT(&F);
+    std::vector<const BasicBlock*> rpo(RPOT.begin(), RPOT.end());
+    appendBlocksInOrder(nullptr, rpo, 0);
+
+    // Unreachable blocks go last
+    for (const BasicBlock& BB : F)
+    {
+        if (mPriority.count(&BB.front())) continue;
+        for (const Instruction& I : BB)
+        {
+            mPriority[&I] = mInstructionOrder.size();
+            mInstructionOrder.push_back(&I);
+        }
+    }
+
+    mQueued.clear();
+    mQueued.resize(mInstructionOrder.size());
+}
+
+void
+PDA::appendBlocksInOrder(const Loop* loop, const std::vector<const BasicBlock*>& rpo, unsigned start)
+{
+    const unsigned numBlocks = loop ? loop->getNumBlocks() : rpo.size();
+    unsigned numPlaced = 0;
+
+    for (unsigned i = start; i < rpo.size() && numPlaced < numBlocks; ++i)
+    {
+        const BasicBlock* BB = rpo[i];
+        if (loop && !loop->contains(BB)) continue;
+
+        const Loop* BBLoop = mLoopInfo.getLoopFor(BB);
+        if (BBLoop != loop)
+        {
+            // The header comes first in RPO, it places the whole sub loop
+            const Loop* subLoop = BBLoop;
+            while (subLoop->getParentLoop() != loop)
+                subLoop = subLoop->getParentLoop();
+
+            if (subLoop->getHeader() == BB)
+            {
+                appendBlocksInOrder(subLoop, rpo, i);
+                numPlaced += subLoop->getNumBlocks();
+            }
+            continue;
+        }
+
+        for (const Instruction& I : *BB)
+        {
+            mPriority[&I] = mInstructionOrder.size();
+            mInstructionOrder.push_back(&I);
+        }
+        ++numPlaced;
+    }
+}
+
+void
+PDA::pushWorklist(const Instruction* I)
+{
+    auto found = mPriority.find(I);
+    assert (found != mPriority.end() && "instruction is not part of the analyzed function");
+
+    const unsigned priority = found->second;
+    if (mQueued.test(priority)) return;
+
+    mQueued.set(priority);
+    mWorklist.push(priority);
+}
+
+const Instruction*
+PDA::popWorklist()
+{
+    const unsigned priority = mWorklist.top();
+    mWorklist.pop();
+    mQueued.reset(priority);
+    return mInstructionOrder[priority];
+}
+
 void
 PDA::compute(Function& F)
 {
     /* Worklist algorithm to compute the least fixed-point */
     while (!mWorklist.empty())
     {
-        const Instruction* I = *mWorklist.begin();
-        mWorklist.erase(I);
+        const Instruction* I = popWorklist();
+        ++mStats.numIterations;
 
-        // Skip until all operands have a shape
-        if (!isa<PHINode>(I) && !allOperandsHaveShape(I))
+        // Skip until all operands have a shape (phis join the known ones)
+        if (isa<PHINode>(I) ? !anyOperandHasShape(I) : !allOperandsHaveShape(I))
             continue;
 
-        const VectorShape& New = computeShapeForInst(I);
+        ++mStats.numEvaluations;
+        if (mValue2Shape.count(I) && !mStale.count(I))
+            ++mStats.numReevaluations;
+
+        const VectorShape& New = refineAlignment(I, computeShapeForInst(I));
         update(I, New);
     }
 }
@@ -576,7 +758,7 @@ PDA::computeShapeForInst(const Instruction* I)
                 const int indexStride = indexShape.getStride();
                 const int indexAlignment = indexShape.getAlignment();
 
-                if (indexShape.isVarying())
+                if (!indexShape.hasKnownLaneOffsets())
                     return VectorShape::varying();
 
                 if (isa<StructType>(subT))
@@ -584,24 +766,36 @@ PDA::computeShapeForInst(const Instruction* I)
                     if (!isa<ConstantInt>(index))
                         return VectorShape::varying();
 
-                    subT = cast<StructType>(subT)->getTypeAtIndex(index);
+                    StructType* structT = cast<StructType>(subT);
+                    const unsigned fieldIdx = (unsigned) cast<ConstantInt>(index)->getZExtValue();
+                    const unsigned fieldOffset = (unsigned) layout.getStructLayout(structT)->getElementOffset(fieldIdx);
+                    subT = structT->getTypeAtIndex(index);
 
-                    if (result.isVarying())
-                        result = VectorShape::varying(1); // unaligned FIXME
+                    // the field offset is the same on all lanes
+                    if (!result.hasKnownLaneOffsets())
+                        result = VectorShape::varying(gcd<unsigned>(result.getAlignment(), fieldOffset));
                     else
-                        result = VectorShape(result.getStride() + indexStride, 1);
+                        result.setAlignment(gcd<unsigned>(result.getAlignment(), fieldOffset));
                 }
                 else
                 {
                     subT = cast<SequentialType>(subT)->getPointerElementType();
 
-                    unsigned typeSize = (unsigned)layout.getTypeStoreSize(subT) / BYTE_SIZE;
+                    unsigned typeSize = (unsigned)layout.getTypeStoreSize(subT);
+
+                    // the first lane moves by typeSize times the first index
+                    const unsigned alignment = gcd<unsigned>(result.getAlignment(), typeSize * indexAlignment);
 
-                    if (result.isVarying())
-                        result = VectorShape::varying(result.getAlignment());
+                    if (!result.hasKnownLaneOffsets())
+                        result = VectorShape::varying(alignment);
+                    else if (result.hasLanePattern() || indexShape.hasLanePattern())
+                    {
+                        // scale the lane pattern of the index to the element size
+                        result = result + (int) typeSize * indexShape;
+                        if (result.hasKnownLaneOffsets()) result.setAlignment(alignment);
+                    }
                     else
-                        result = VectorShape(result.getStride() + typeSize * indexStride,
-                                             result.getAlignment());
+                        result = VectorShape(result.getStride() + typeSize * indexStride, alignment);
                 }
             }
 
@@ -657,7 +851,7 @@ PDA::computeShapeForInst(const Instruction* I)
             // Collect defined values
             VectorShapeVec DefinedValues;
             for (auto& op : I->operands())
-                if (isa<Constant>(op) || mValue2Shape.count(op))
+                if (isa<Constant>(op) || (mValue2Shape.count(op) && !mStale.count(op)))
                     DefinedValues.push_back(getShape(op));
 
             // Join them (non-empty, at least one is defined)
@@ -704,6 +898,31 @@ PDA::computeShapeForInst(const Instruction* I)
     }
 }
 
+// Constant integer operands that fit into an int
+static bool
+getConstantIntValue(const Value* V, int& oValue)
+{
+    const ConstantInt* constant = dyn_cast<ConstantInt>(V);
+    if (!constant || constant->getValue().getMinSignedBits() > 32)
+        return false;
+
+    oValue = (int) constant->getSExtValue();
+    return true;
+}
+
+static bool
+getIntegralValue(const ConstantFP& constant, int& oValue)
+{
+    const APFloat& value = constant.getValueAPF();
+    APSInt intValue(32, false);
+    bool isExact = false;
+    if (value.convertToInteger(intValue, APFloat::rmTowardZero, &isExact) != APFloat::opOK || !isExact)
+        return false;
+
+    oValue = (int) intValue.getSExtValue();
+    return true;
+}
+
 VectorShape
 PDA::computeShapeForBinaryInst(const BinaryOperator* I)
 {
@@ -731,10 +950,12 @@ PDA::computeShapeForBinaryInst(const BinaryOperator* I)
 
             const int resAlignment = gcd(alignment1, alignment2);
 
-            if (shape1.isVarying() || shape2.isVarying())
+            if (!shape1.hasKnownLaneOffsets() || !shape2.hasKnownLaneOffsets())
                 return VectorShape::varying(resAlignment);
 
-            VectorShape res = VectorShape(stride1 + stride2, resAlignment);
+            // lane patterns add up lane by lane
+            VectorShape res = shape1 + shape2;
+            if (res.hasKnownLaneOffsets()) res.setAlignment(resAlignment);
 
             // Only allow strided results for floating point addition if
             // according fast math flags are set
@@ -758,10 +979,11 @@ PDA::computeShapeForBinaryInst(const BinaryOperator* I)
 
             const int resAlignment = gcd(alignment1, alignment2);
 
-            if (shape1.isVarying() || shape2.isVarying())
+            if (!shape1.hasKnownLaneOffsets() || !shape2.hasKnownLaneOffsets())
                 return VectorShape::varying(resAlignment);
 
-            VectorShape res = VectorShape(stride1 - stride2, resAlignment);
+            VectorShape res = shape1 - shape2;
+            if (res.hasKnownLaneOffsets()) res.setAlignment(resAlignment);
 
             // Only allow strided results for floating point substraction if
             // according fast math flags are set
@@ -782,7 +1004,7 @@ PDA::computeShapeForBinaryInst(const BinaryOperator* I)
         // Alignment constants are multiplied
         case Instruction::Mul:
         {
-            if (shape1.isVarying() || shape2.isVarying())
+            if (!shape1.hasKnownLaneOffsets() || !shape2.hasKnownLaneOffsets())
                 return VectorShape::varying();
 
             if (shape1.isUniform() && shape2.isUniform())
@@ -792,20 +1014,69 @@ PDA::computeShapeForBinaryInst(const BinaryOperator* I)
             if (const ConstantInt* constantOp = dyn_cast<ConstantInt>(op1))
             {
                 const int c = (int) constantOp->getSExtValue();
-                return VectorShape(c * stride2, c * alignment2);
+                return c * shape2;
             }
 
             // Symmetric case
             if (const ConstantInt* constantOp = dyn_cast<ConstantInt>(op2))
             {
                 const int c = (int) constantOp->getSExtValue();
-                return VectorShape(c * stride1, c * alignment1);
+                return c * shape1;
             }
 
             return VectorShape::varying();
         }
 
-        //case Instruction::FMul:
+        // Floating point products only keep strides with an integral factor if
+        // reassociation is allowed
+        case Instruction::FMul:
+        {
+            if (shape1.isUniform() && shape2.isUniform())
+                return VectorShape::uni();
+
+            if (!I->getFastMathFlags().unsafeAlgebra())
+                return VectorShape::varying();
+
+            const bool firstIsConstant = isa<ConstantFP>(op1);
+            const ConstantFP* constantOp = dyn_cast<ConstantFP>(firstIsConstant ? op1 : op2);
+            int c;
+            if (!constantOp || !getIntegralValue(*constantOp, c))
+                return VectorShape::varying();
+
+            const VectorShape& valueShape = firstIsConstant ? shape2 : shape1;
+            return c * valueShape;
+        }
+
+        // x << c == x * 2^c
+        case Instruction::Shl:
+        {
+            if (shape1.isUniform() && shape2.isUniform())
+                return VectorShape::uni();
+
+            int amount;
+            if (!getConstantIntValue(op2, amount) || amount < 0 || amount >= 31)
+                return VectorShape::varying();
+
+            return (1 << amount) * shape1;
+        }
+
+        // Both shifts round towards minus infinity
+        case Instruction::LShr:
+        case Instruction::AShr:
+        {
+            if (shape1.isUniform() && shape2.isUniform())
+                return VectorShape::uni();
+
+            int amount;
+            if (!getConstantIntValue(op2, amount) || amount < 0)
+                return VectorShape::varying();
+
+            // A logical shift moves the sign bit into the value, lanes on both sides of zero drift apart
+            if (I->getOpcode() == Instruction::LShr && !shape1.isUniform() && !hasNonNegativeLanes(op1))
+                return VectorShape::varying();
+
+            return VectorShape::shiftRight(shape1, amount);
+        }
 
         case Instruction::SDiv:
         case Instruction::UDiv:
@@ -815,25 +1086,107 @@ PDA::computeShapeForBinaryInst(const BinaryOperator* I)
                 return VectorShape::uni(alignment1 / alignment2);
             }
 
-            if (const ConstantInt* constantOp = dyn_cast<ConstantInt>(op2))
+            int c;
+            if (getConstantIntValue(op2, c) && c > 0 && shape1.hasKnownLaneOffsets())
             {
-                const int c = (int) constantOp->getSExtValue();
+                // exact if the divisor divides the offset of every lane
+                // sdiv rounds towards zero, the lanes may only cross zero at multiples of the divisor
+                // udiv reads negative lanes as huge values, they must not occur
+                const bool exact = I->getOpcode() == Instruction::UDiv ? hasNonNegativeLanes(op1)
+                                                                         : alignment1 % c == 0;
+                if (exact)
+                    return shape1 / c;
+            }
 
-                if (stride1 % c == 0)
-                {
-                    return VectorShape(stride1 / c, alignment1 / c);
-                }
+            return VectorShape::varying();
+        }
+
+        case Instruction::FDiv:
+        case Instruction::FRem:
+        {
+            if (shape1.isUniform() && shape2.isUniform())
+                return VectorShape::uni();
+
+            return VectorShape::varying();
+        }
+
+        // x % m repeats with the lanes if m divides the first lane (e.g. i % 4 for aligned i)
+        case Instruction::URem:
+        case Instruction::SRem:
+        {
+            if (shape1.isUniform() && shape2.isUniform())
+                return VectorShape::uni();
+
+            int modulus;
+            if (!getConstantIntValue(op2, modulus) || modulus <= 0)
+                return VectorShape::varying();
+
+            if (I->getOpcode() == Instruction::URem)
+                return VectorShape::urem(shape1, modulus, hasNonNegativeLanes(op1));
+            return VectorShape::srem(shape1, modulus);
+        }
+
+        // Masks that select the low bits are remainders, masks that only clear
+        // bits which are zero on every lane do not change the value
+        case Instruction::And:
+        {
+            if (shape1.isUniform() && shape2.isUniform())
+                return VectorShape::uni();
+
+            const bool firstIsConstant = isa<ConstantInt>(op1);
+            const VectorShape& valueShape = firstIsConstant ? shape2 : shape1;
+            int mask;
+            if (!getConstantIntValue(firstIsConstant ? op1 : op2, mask))
+                return VectorShape::varying();
+
+            if (mask > 0 && isPowerOf2_32((unsigned) mask + 1))
+                return VectorShape::urem(valueShape, mask + 1);
+
+            if (mask < 0 && isPowerOf2_32(~(unsigned) mask + 1))
+            {
+                const int clearedRange = (int) (~(unsigned) mask + 1);
+                if (valueShape.getAlignment() % clearedRange == 0 &&
+                    valueShape.hasLaneOffsetsMultipleOf(clearedRange))
+                    return valueShape;
             }
 
             return VectorShape::varying();
         }
 
-        //case Instruction::FDiv:
+        // With a constant whose bits are zero on every lane, or and xor are additions (e.g. (tid << 2) | k)
+        case Instruction::Or:
+        case Instruction::Xor:
+        {
+            if (shape1.isUniform() && shape2.isUniform())
+                return VectorShape::uni();
+
+            const bool firstIsConstant = isa<ConstantInt>(op1);
+            const VectorShape& valueShape = firstIsConstant ? shape2 : shape1;
+            int c;
+            if (!getConstantIntValue(firstIsConstant ? op1 : op2, c))
+                return VectorShape::varying();
+
+            // ~x == -1 - x
+            if (I->getOpcode() == Instruction::Xor && c == -1)
+                return VectorShape::uni() - valueShape;
+
+            return VectorShape::disjointAdd(valueShape, c);
+        }
 
         // If both compared values have the same stride the comparison is uniform
         // This is new and not recognized by the old analysis
         case Instruction::ICmp:
         {
+            // Lane patterns only compare alike if the lanes keep their distance
+            if (shape1.hasLanePattern() || shape2.hasLanePattern())
+            {
+                if (shape1.hasKnownLaneOffsets() && shape2.hasKnownLaneOffsets() &&
+                    (shape1 - shape2).isUniform())
+                    return VectorShape::uni();
+
+                return VectorShape::varying();
+            }
+
             if (shape1.isVarying() || shape2.isVarying())
                 return VectorShape::varying();
 
@@ -888,22 +1241,11 @@ PDA::computeShapeForBinaryInst(const BinaryOperator* I)
     }
 }
 
-static unsigned
-GetReferencedObjectSize(const DataLayout & layout, Type * ptrType) {
-  auto * elemTy = ptrType->getPointerElementType();
-  auto * arrTy = dyn_cast<ArrayType>(elemTy);
-  if (arrTy && arrTy->getArrayNumElements() == 0) {
-    elemTy = arrTy->getElementType();
-  }
-  return layout.getTypeStoreSize(elemTy);
-}
-
 VectorShape
 PDA::computeShapeForCastInst(const CastInst* castI)
 {
     const Value* castOp = castI->getOperand(0);
     const VectorShape castOpShape = getShape(castOp);
-    const int castOpStride = castOpShape.getStride();
     const int castOpAlignment = castOpShape.getAlignment();
     const DataLayout layout(castI->getModule());
 
@@ -911,32 +1253,11 @@ PDA::computeShapeForCastInst(const CastInst* castI)
 
     switch (castI->getOpcode())
     {
+        // Pointer shapes are measured in bytes, as are the integer addresses
         case Instruction::IntToPtr:
-        {
-            PointerType* DestType = cast<PointerType>(castI->getDestTy());
-            Type* DestPointsTo = DestType->getPointerElementType();
-
-            // FIXME: void pointers are char pointers (i8*), but what
-            // difference is there between a real i8* and a void pointer?
-            if (DestPointsTo->isIntegerTy(8))
-                return VectorShape::varying();
-
-            unsigned typeSize = (unsigned) layout.getTypeStoreSize(DestPointsTo);
-
-            if (castOpStride % typeSize != 0)
-                return VectorShape::varying();
-
-            return VectorShape(castOpStride / typeSize, 1);
-        }
-
         case Instruction::PtrToInt:
         {
-            PointerType* SrcType = cast<PointerType>(castI->getSrcTy());
-            Type* SrcPointsTo = SrcType->getPointerElementType();
-
-            unsigned typeSize = (unsigned) layout.getTypeStoreSize(SrcPointsTo);
-
-            return VectorShape(typeSize * castOpStride, 1);
+            return castOpShape;
         }
 
         // Truncation reinterprets the stride modulo the target type width
@@ -945,12 +1266,23 @@ PDA::computeShapeForCastInst(const CastInst* castI)
         {
             Type* destTy = castI->getDestTy();
 
-            return VectorShape::truncateToTypeSize(castOpShape,(unsigned)layout.getTypeStoreSize(destTy));
+            return VectorShape::truncateToTypeSize(castOpShape, destTy->getScalarSizeInBits());
         }
 
-        // FIXME: is this correct?
+        // Extensions keep the lane distances if the narrow lanes did not wrap around
         case Instruction::ZExt:
         case Instruction::SExt:
+        {
+            if (!castOpShape.hasKnownLaneOffsets() || castOpShape.isUniform())
+                return castOpShape;
+
+            const bool isSigned = castI->getOpcode() == Instruction::SExt;
+            if (mayWrapBetweenLanes(castOp, castOpShape, isSigned))
+                return VectorShape::varying(aligned);
+
+            return castOpShape;
+        }
+
         case Instruction::FPExt:
         // NOTE: This consciously ignores large absolute values above 2²⁴
         case Instruction::UIToFP:
@@ -979,14 +1311,8 @@ PDA::computeShapeForCastInst(const CastInst* castI)
             if (!srcType->isPointerTy() || !destType->isPointerTy())
                 return VectorShape::join(VectorShape::uni(aligned), castOpShape);
 
-            // Reassociate stride with new underlying type
-            PointerType* srcPtr = cast<PointerType>(srcType);
-            PointerType* destPtr = cast<PointerType>(destType);
-
-            unsigned long srcElementSize =  GetReferencedObjectSize(layout, srcPtr);
-            unsigned long destElementSize = GetReferencedObjectSize(layout, destPtr);
-
-            return VectorShape(srcElementSize * castOpStride / destElementSize, 1);
+            // The byte offsets of the lanes do not depend on the pointee type
+            return castOpShape;
         }
 
         default:
@@ -1007,6 +1333,241 @@ PDA::getShape(const Value* const V) const
     return found->second;
 }
 
+unsigned
+PDA::getKnownAlignment(const Value* V)
+{
+    auto found = mKnownAlignment.find(V);
+    if (found != mKnownAlignment.end()) return found->second;
+
+    unsigned alignment = 1;
+    Type* scalarTy = V->getType()->getScalarType();
+    if (scalarTy->isIntegerTy() || scalarTy->isPointerTy())
+    {
+        // The scalar facts hold for every lane, in particular for the first one
+        const unsigned bitWidth = (unsigned) layout.getTypeSizeInBits(scalarTy);
+        APInt knownZero(bitWidth, 0), knownOne(bitWidth, 0);
+        computeKnownBits(const_cast<Value*>(V), knownZero, knownOne, layout);
+
+        // bounded to keep the shape arithmetic in range
+        alignment = 1U << std::min(knownZero.countTrailingOnes(), 12U);
+    }
+
+    mKnownAlignment[V] = alignment;
+    return alignment;
+}
+
+// The sign bit is known to be clear on every lane of @V. Unsigned operations
+// then agree with the signed shape arithmetic.
+bool
+PDA::hasNonNegativeLanes(const Value* V) const
+{
+    return isKnownNonNegative(const_cast<Value*>(V), layout);
+}
+
+VectorShape
+PDA::refineAlignment(const Value* V, VectorShape shape)
+{
+    if (!shape.isDefined() || shape.getAlignment() > (1U << 16)) return shape;
+
+    const unsigned known = getKnownAlignment(V);
+    if (known <= 1 || shape.getAlignment() % known == 0) return shape;
+
+    // both divide the first lane
+    shape.setAlignment(lcm<unsigned>(shape.getAlignment(), known));
+    return shape;
+}
+
+// Matches the header phi of a "i = start; i < bound; i += step" loop with a positive constant @step
+// and returns its increment, nullptr if @phi is not one. The exit condition is normalized to
+// "counter pred bound" holds while the loop keeps running, @counter is @phi or the increment.
+static const Instruction*
+matchInductionBound(const PHINode& phi, const LoopInfo& loopInfo, CmpInst::Predicate& pred,
+                    const Value*& start, const Value*& bound, const Value*& counter, const ConstantInt*& step)
+{
+    const Loop* loop = loopInfo.getLoopFor(phi.getParent());
+    if (!loop || loop->getHeader() != phi.getParent() || phi.getNumIncomingValues() != 2) return nullptr;
+
+    const BasicBlock* latch = loop->getLoopLatch();
+    const BasicBlock* exiting = loop->getExitingBlock();
+    if (!latch || !exiting) return nullptr;
+
+    const int latchIdx = phi.getBasicBlockIndex(latch);
+    start = phi.getIncomingValue(1 - latchIdx);
+    const BinaryOperator* next = dyn_cast<BinaryOperator>(phi.getIncomingValue(latchIdx));
+    if (!next || next->getOpcode() != Instruction::Add) return nullptr;
+
+    const unsigned phiIdx = next->getOperand(0) == &phi ? 0 : 1;
+    step = dyn_cast<ConstantInt>(next->getOperand(1 - phiIdx));
+    if (next->getOperand(phiIdx) != &phi || !step || !step->getValue().isStrictlyPositive()) return nullptr;
+
+    const BranchInst* branch = dyn_cast<BranchInst>(exiting->getTerminator());
+    if (!branch || !branch->isConditional()) return nullptr;
+    const ICmpInst* cmp = dyn_cast<ICmpInst>(branch->getCondition());
+    if (!cmp) return nullptr;
+
+    pred = cmp->getPredicate();
+    counter = cmp->getOperand(0);
+    bound = cmp->getOperand(1);
+    if (bound == &phi || bound == next)
+    {
+        std::swap(counter, bound);
+        pred = CmpInst::getSwappedPredicate(pred);
+    }
+    if (counter != &phi && counter != next) return nullptr;
+    if (!loop->contains(branch->getSuccessor(0))) pred = CmpInst::getInversePredicate(pred);
+
+    return next;
+}
+
+// i = start; i < bound; ++i stays within [start, max(start, bound)] (start + 1 for the increment).
+// Returns the increment of an i64 induction variable for which both ends fit into i32.
+static const Instruction*
+getNarrowInductionIncrement(const PHINode& phi, const LoopInfo& loopInfo, const DataLayout& layout)
+{
+    CmpInst::Predicate pred;
+    const Value* start;
+    const Value* bound;
+    const Value* counter;
+    const ConstantInt* step;
+    const Instruction* next = matchInductionBound(phi, loopInfo, pred, start, bound, counter, step);
+    if (!next || !step->isOne()) return nullptr;
+
+    Value* startVal = const_cast<Value*>(start);
+    Value* boundVal = const_cast<Value*>(bound);
+    if (ComputeNumSignBits(startVal, layout) <= 33 || ComputeNumSignBits(boundVal, layout) <= 32)
+        return nullptr;
+
+    if (pred == CmpInst::ICMP_SLT) return next;
+    if (pred == CmpInst::ICMP_ULT && isKnownNonNegative(startVal, layout) && isKnownNonNegative(boundVal, layout))
+        return next;
+    return nullptr;
+}
+
+// Interval [lo, hi] that holds every value of @V as a signed or unsigned integer, by its known bits
+static void
+getKnownRange(const Value* V, bool isSigned, const DataLayout& layout, APInt& lo, APInt& hi)
+{
+    Value* val = const_cast<Value*>(V);
+    const unsigned bits = V->getType()->getScalarSizeInBits();
+    if (isSigned)
+    {
+        const unsigned rangeBits = bits - ComputeNumSignBits(val, layout) + 1;
+        lo = isKnownNonNegative(val, layout) ? APInt(bits, 0) : APInt::getSignedMinValue(rangeBits).sext(bits);
+        hi = APInt::getSignedMaxValue(rangeBits).sext(bits);
+        return;
+    }
+
+    APInt knownZero(bits, 0), knownOne(bits, 0);
+    computeKnownBits(val, knownZero, knownOne, layout);
+    lo = knownOne;
+    hi = ~knownZero;
+}
+
+// i = start; i < bound; i += step stays within [lo(start), max(hi(start), hi(bound))] in the order
+// of the compare if step is one or the loop tests the increment. This also holds for the lanes of
+// a vectorized "++i" loop, whose trip count is a multiple of the vector width. A signed range above
+// zero is also an unsigned one and vice versa.
+// Returns false if @phi is not the header phi of such a loop.
+static bool
+getInductionRange(const PHINode& phi, bool isSigned, const LoopInfo& loopInfo, const DataLayout& layout,
+                  APInt& lo, APInt& hi)
+{
+    CmpInst::Predicate pred;
+    const Value* start;
+    const Value* bound;
+    const Value* counter;
+    const ConstantInt* step;
+    if (!matchInductionBound(phi, loopInfo, pred, start, bound, counter, step)) return false;
+    if (counter == &phi && !step->isOne()) return false;
+    if (pred != CmpInst::ICMP_SLT && pred != CmpInst::ICMP_ULT) return false;
+
+    const bool signedCmp = pred == CmpInst::ICMP_SLT;
+    APInt startLo, startHi, boundLo, boundHi;
+    getKnownRange(start, signedCmp, layout, startLo, startHi);
+    getKnownRange(bound, signedCmp, layout, boundLo, boundHi);
+    lo = startLo;
+    hi = signedCmp ? (startHi.sgt(boundHi) ? startHi : boundHi) : (startHi.ugt(boundHi) ? startHi : boundHi);
+
+    if (signedCmp == isSigned) return true;
+    return !lo.isNegative() && !hi.isNegative();
+}
+
+// The lanes of @V hold scalar values that all lie in an interval [lo, hi]. Lanes that agree
+// with the shape modulo 2^bits agree with it exactly as long as hi - lo plus the largest lane
+// offset stays below 2^bits. The interval comes from the known bits of @V or, for the header
+// phi of a "++i" loop, from its start and bound. Operations with the matching no-wrap flag keep
+// exact operand lanes exact.
+bool
+PDA::mayWrapBetweenLanes(const Value* V, const VectorShape& shape, bool isSigned, unsigned depth) const
+{
+    if (shape.isUniform()) return false;
+    if (!shape.hasKnownLaneOffsets()) return true;
+
+    const OverflowingBinaryOperator* overflowingOp = dyn_cast<OverflowingBinaryOperator>(V);
+    if (overflowingOp && depth < 4 &&
+        (isSigned ? overflowingOp->hasNoSignedWrap() : overflowingOp->hasNoUnsignedWrap()))
+    {
+        bool operandsExact = true;
+        for (const Value* op : overflowingOp->operands())
+        {
+            if (isa<Constant>(op)) continue;
+            operandsExact &= hasComputedShape(op) && !mayWrapBetweenLanes(op, getShape(op), isSigned, depth + 1);
+        }
+        if (operandsExact) return false;
+    }
+
+    const unsigned bits = V->getType()->getScalarSizeInBits();
+    APInt lo, hi;
+    getKnownRange(V, isSigned, layout, lo, hi);
+
+    APInt ivLo, ivHi;
+    const PHINode* phi = dyn_cast<PHINode>(V);
+    if (phi && getInductionRange(*phi, isSigned, mLoopInfo, layout, ivLo, ivHi) && (hi - lo).ugt(ivHi - ivLo))
+    {
+        lo = ivLo;
+        hi = ivHi;
+    }
+
+    uint64_t maxOffset = 0;
+    for (unsigned lane = 0; lane < std::max(mVecinfo.getMapping().vectorWidth, 1U); ++lane)
+    {
+        const int64_t offset = shape.getLaneOffset(lane);
+        maxOffset = std::max<uint64_t>(maxOffset, offset < 0 ? -offset : offset);
+    }
+
+    if (bits < 64 && maxOffset >> bits) return true;
+    return (hi - lo).ugt(APInt::getMaxValue(bits) - maxOffset);
+}
+
+void
+PDA::markNarrowValues(Function& F)
+{
+    for (const BasicBlock& BB : F)
+    {
+        if (!isInRegion(&BB)) continue;
+
+        for (const Instruction& I : BB)
+        {
+            if (!I.getType()->isIntegerTy(64)) continue;
+
+            auto found = mValue2Shape.find(&I);
+            if (found == mValue2Shape.end() || found->second.isUniform()) continue;
+
+            if (ComputeNumSignBits(const_cast<Instruction*>(&I), layout) > 32)
+            {
+                mVecinfo.markNarrowValue(I);
+            }
+            else if (const PHINode* phi = dyn_cast<PHINode>(&I))
+            {
+                const Instruction* next = getNarrowInductionIncrement(*phi, mLoopInfo, layout);
+                if (!next) continue;
+                mVecinfo.markNarrowValue(*phi);
+                mVecinfo.markNarrowValue(*next);
+            }
+        }
+    }
+}
+
 inline std::string
 NAME(const llvm::Value* V)
 {
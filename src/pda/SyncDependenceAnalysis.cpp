@@ -0,0 +1,202 @@
+//===- SyncDependenceAnalysis.cpp -----------------------------===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// @authors simon
+//
+
+#include "rv/pda/SyncDependenceAnalysis.h"
+
+#include <algorithm>
+
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Function.h"
+
+#include "rvConfig.h"
+
+namespace rv {
+
+SyncDependenceAnalysis::SyncDependenceAnalysis(const DominatorTree& domTree,
+                                               const PostDominatorTree& postDomTree,
+                                               const LoopInfo& loopInfo)
+        : mDomTree(domTree),
+          mPostDomTree(postDomTree),
+          mLoopInfo(loopInfo)
+{
+}
+
+SyncDependenceAnalysis::~SyncDependenceAnalysis()
+{
+}
+
+void
+SyncDependenceAnalysis::computeRPO()
+{
+    const Function& F = *mDomTree.getRoot()->getParent();
+
+    ReversePostOrderTraversal<const Function*> RPOT(&F);
+    for (const BasicBlock* block : RPOT)
+    {
+        mRPOIndex[block] = mRPO.size();
+        mRPO.push_back(block);
+    }
+}
+
+const SyncDependenceAnalysis::ConstBlockSet&
+SyncDependenceAnalysis::join_blocks(const TerminatorInst& term)
+{
+    auto cached = mBranchJoins.find(&term);
+    if (cached != mBranchJoins.end()) return *cached->second;
+
+    if (mRPO.empty()) computeRPO();
+
+    const BasicBlock& block = *term.getParent();
+
+    SmallVector<const BasicBlock*, 4> succs;
+    for (unsigned i = 0; i < term.getNumSuccessors(); ++i)
+    {
+        const BasicBlock* succ = term.getSuccessor(i);
+        if (std::find(succs.begin(), succs.end(), succ) == succs.end()) succs.push_back(succ);
+    }
+
+    // All paths from the branch meet in its post dominator
+    const DomTreeNode* pdNode = mPostDomTree.getNode(const_cast<BasicBlock*>(&block));
+    const DomTreeNode* ipdNode = pdNode ? pdNode->getIDom() : nullptr;
+    const BasicBlock* stopBlock = ipdNode ? ipdNode->getBlock() : nullptr;
+
+    auto joins = computeJoinPoints(block, succs, mLoopInfo.getLoopFor(&block), stopBlock);
+
+    IF_DEBUG {
+        errs() << "SDA: branch in " << block.getName() << " joins at";
+        for (const BasicBlock* join : *joins) errs() << " " << join->getName();
+        errs() << "\n";
+    }
+
+    auto& result = mBranchJoins[&term];
+    result = std::move(joins);
+    return *result;
+}
+
+const SyncDependenceAnalysis::ConstBlockSet&
+SyncDependenceAnalysis::join_blocks(const Loop& loop)
+{
+    auto cached = mLoopExitJoins.find(&loop);
+    if (cached != mLoopExitJoins.end()) return *cached->second;
+
+    if (mRPO.empty()) computeRPO();
+
+    SmallVector<BasicBlock*, 4> exitBlocks;
+    loop.getUniqueExitBlocks(exitBlocks);
+
+    SmallVector<const BasicBlock*, 4> exits(exitBlocks.begin(), exitBlocks.end());
+    auto joins = computeJoinPoints(*loop.getHeader(), exits, loop.getParentLoop(), nullptr);
+
+    auto& result = mLoopExitJoins[&loop];
+    result = std::move(joins);
+    return *result;
+}
+
+std::unique_ptr<SyncDependenceAnalysis::ConstBlockSet>
+SyncDependenceAnalysis::computeJoinPoints(const BasicBlock& rootBlock,
+                                          ArrayRef<const BasicBlock*> roots,
+                                          const Loop* parentLoop,
+                                          const BasicBlock* stopBlock)
+{
+    std::unique_ptr<ConstBlockSet> joinBlocks(new ConstBlockSet());
+
+    auto rootIt = mRPOIndex.find(&rootBlock);
+    if (rootIt == mRPOIndex.end()) return joinBlocks; // unreachable
+
+    const BasicBlock* header = parentLoop ? parentLoop->getHeader() : nullptr;
+
+    // The root each block is reached from, join points reach themselves
+    DenseMap<const BasicBlock*, const BasicBlock*> defs;
+    SmallPtrSet<const BasicBlock*, 16> pending;
+    SmallPtrSet<const BasicBlock*, 4> reachedExits;
+    SmallPtrSet<const BasicBlock*, 4> headerDefs;
+
+    auto visit = [&](const BasicBlock* block, const BasicBlock* def)
+    {
+        // lanes take the back edge, nothing is propagated beyond the current iteration
+        if (block == header)
+        {
+            headerDefs.insert(def);
+            return;
+        }
+
+        const bool isExit = parentLoop && !parentLoop->contains(block);
+        if (isExit) reachedExits.insert(block);
+
+        auto inserted = defs.insert(std::make_pair(block, def));
+        if (!inserted.second)
+        {
+            if (inserted.first->second == def) return;
+
+            // reached from two different roots
+            if (!joinBlocks->insert(block).second) return;
+            inserted.first->second = block;
+        }
+
+        if (!isExit) pending.insert(block);
+    };
+
+    for (const BasicBlock* root : roots)
+    {
+        visit(root, root);
+    }
+
+    for (unsigned i = rootIt->second + 1; i < mRPO.size() && !pending.empty(); ++i)
+    {
+        const BasicBlock* block = mRPO[i];
+        if (!pending.erase(block)) continue;
+
+        const BasicBlock* def = defs[block];
+
+        // Beyond the post dominator of the branch all paths carry its definition
+        if (block == stopBlock && pending.empty() && headerDefs.empty())
+        {
+            if (parentLoop) headerDefs.insert(def);
+            break;
+        }
+
+        // Nested loops are passed as a whole
+        const Loop* blockLoop = mLoopInfo.getLoopFor(block);
+        if (blockLoop != parentLoop)
+        {
+            while (blockLoop->getParentLoop() != parentLoop)
+                blockLoop = blockLoop->getParentLoop();
+
+            SmallVector<BasicBlock*, 4> nestedExits;
+            blockLoop->getUniqueExitBlocks(nestedExits);
+            for (const BasicBlock* exit : nestedExits)
+                visit(exit, def);
+
+            continue;
+        }
+
+        for (const BasicBlock* succ : successors(block))
+            visit(succ, def);
+    }
+
+    // Lanes that leave the loop through an exit diverge from the lanes that
+    // continue or leave through another exit
+    if (!reachedExits.empty())
+    {
+        SmallPtrSet<const BasicBlock*, 4> arrivals(headerDefs.begin(), headerDefs.end());
+        for (const BasicBlock* exit : reachedExits)
+            arrivals.insert(defs[exit]);
+
+        if (arrivals.size() > 1)
+            joinBlocks->insert(reachedExits.begin(), reachedExits.end());
+    }
+
+    return joinBlocks;
+}
+
+}
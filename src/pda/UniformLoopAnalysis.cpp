@@ -0,0 +1,313 @@
+//===- UniformLoopAnalysis.cpp -----------------------------===//
+//
+//                     The Region Vectorizer
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+
+#include "rv/pda/UniformLoopAnalysis.h"
+
+#include <algorithm>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "rvConfig.h"
+
+namespace rv {
+
+UniformLoopAnalysis::UniformLoopAnalysis(VectorizationInfo& vecInfo,
+                                         const LoopInfo& loopInfo,
+                                         const DominatorTree& domTree,
+                                         SyncDependenceAnalysis& SDA)
+        : mVecinfo(vecInfo),
+          mLoopInfo(loopInfo),
+          mDomTree(domTree),
+          mSDA(SDA),
+          mRegion(mVecinfo.getRegion()),
+          mNumUniformLoops(0)
+{
+}
+
+void
+UniformLoopAnalysis::analyze(Function& F)
+{
+    for (Loop* loop : mLoopInfo)
+    {
+        analyzeLoop(*loop);
+    }
+
+    IF_DEBUG {
+        outs() << "UniformLoopAnalysis: " << mNumUniformLoops << " divergent loops of "
+               << F.getName() << " are uniform\n";
+    }
+}
+
+void
+UniformLoopAnalysis::analyzeLoop(Loop& loop)
+{
+    for (Loop* subLoop : loop)
+    {
+        analyzeLoop(*subLoop);
+    }
+
+    // The vectorized loop itself is never divergent
+    if (!isInRegion(*loop.getHeader()) || !mVecinfo.isDivergentLoop(&loop)) return;
+
+    mUniformValues.clear();
+    if (isUniformLoop(loop))
+    {
+        markUniformLoop(loop);
+    }
+}
+
+bool
+UniformLoopAnalysis::isUniformLoop(const Loop& loop)
+{
+    const BasicBlock* preheader = loop.getLoopPreheader();
+    const BasicBlock* exitBB = loop.getUniqueExitBlock();
+    if (!preheader || !exitBB) return false;
+
+    // The divergence of the loop spread to its parent
+    const Loop* parentLoop = loop.getParentLoop();
+    if (parentLoop && !parentLoop->contains(exitBB)) return false;
+
+    // Inner loops must be left to a block of the loop
+    SmallVector<BasicBlock*, 4> exitingBlocks;
+    loop.getExitingBlocks(exitingBlocks);
+    for (const BasicBlock* exitingBB : exitingBlocks)
+    {
+        if (mLoopInfo.getLoopFor(exitingBB) != &loop) return false;
+        if (!isa<BranchInst>(exitingBB->getTerminator())) return false;
+    }
+
+    // Lanes that take different paths in the loop have to meet again in it
+    for (const BasicBlock* block : loop.blocks())
+    {
+        const TerminatorInst& term = *block->getTerminator();
+        if (mVecinfo.getVectorShape(term).isUniform()) continue;
+        if (std::find(exitingBlocks.begin(), exitingBlocks.end(), block) != exitingBlocks.end()) continue;
+
+        for (const BasicBlock* joinBB : mSDA.join_blocks(term))
+        {
+            if (!loop.contains(joinBB)) return false;
+        }
+    }
+
+    // All lanes in the loop agree on the varying exit conditions
+    ConditionFacts facts;
+    collectConditionFacts(loop, facts);
+
+    for (const BasicBlock* exitingBB : exitingBlocks)
+    {
+        const BranchInst& branch = cast<BranchInst>(*exitingBB->getTerminator());
+        if (!branch.isConditional() || mVecinfo.getVectorShape(branch).isUniform()) continue;
+
+        if (!isUniformOnLanes(*branch.getCondition(), facts))
+        {
+            IF_DEBUG {
+                outs() << "UniformLoopAnalysis: exit condition of " << exitingBB->getName()
+                       << " is varying in loop " << loop.getHeader()->getName() << "\n";
+            }
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void
+UniformLoopAnalysis::markUniformLoop(const Loop& loop)
+{
+    IF_DEBUG {
+        outs() << "UniformLoopAnalysis: loop " << loop.getHeader()->getName() << " is uniform\n";
+    }
+
+    SmallVector<BasicBlock*, 4> exitingBlocks;
+    loop.getExitingBlocks(exitingBlocks);
+    for (const BasicBlock* exitingBB : exitingBlocks)
+    {
+        mVecinfo.setVectorShape(*exitingBB->getTerminator(), VectorShape::uni());
+    }
+
+    mVecinfo.dropDivergenceLevel(*loop.getHeader());
+    ++mNumUniformLoops;
+}
+
+// Lanes that reach @loop passed all dominators of its preheader. A dominator
+// with a single predecessor is entered over one edge of its branch, which
+// fixes the branch condition. Conditions of branches in loops that do not
+// contain @loop may have changed since.
+void
+UniformLoopAnalysis::collectConditionFacts(const Loop& loop, ConditionFacts& facts) const
+{
+    for (const DomTreeNode* node = mDomTree.getNode(loop.getLoopPreheader());
+         node;
+         node = node->getIDom())
+    {
+        const BasicBlock* block = node->getBlock();
+        const BasicBlock* predBB = block->getSinglePredecessor();
+        if (!predBB) continue;
+
+        const Loop* predLoop = mLoopInfo.getLoopFor(predBB);
+        if (predLoop && !predLoop->contains(&loop)) continue;
+
+        const BranchInst* branch = dyn_cast<BranchInst>(predBB->getTerminator());
+        if (!branch || !branch->isConditional() ||
+            branch->getSuccessor(0) == branch->getSuccessor(1))
+        {
+            continue;
+        }
+
+        facts.insert(std::make_pair(branch->getCondition(), branch->getSuccessor(0) == block));
+    }
+}
+
+// The edge @from -> @to is only taken if its branch condition contradicts the facts
+bool
+UniformLoopAnalysis::contradicts(const BasicBlock& from,
+                                 const BasicBlock& to,
+                                 const ConditionFacts& facts) const
+{
+    const BranchInst* branch = dyn_cast<BranchInst>(from.getTerminator());
+    if (!branch || !branch->isConditional() ||
+        branch->getSuccessor(0) == branch->getSuccessor(1))
+    {
+        return false;
+    }
+
+    auto fact = facts.find(branch->getCondition());
+    return fact != facts.end() && fact->second != (branch->getSuccessor(0) == &to);
+}
+
+// No lane that reaches the loop takes the edge @from -> @to: the edge itself or
+// an edge into a dominator of @from (in the same loop) contradicts the facts.
+bool
+UniformLoopAnalysis::isInfeasibleEdge(const BasicBlock& from,
+                                      const BasicBlock& to,
+                                      const ConditionFacts& facts) const
+{
+    if (contradicts(from, to, facts)) return true;
+
+    const Loop* loop = mLoopInfo.getLoopFor(&to);
+    for (const DomTreeNode* node = mDomTree.getNode(const_cast<BasicBlock*>(&from));
+         node;
+         node = node->getIDom())
+    {
+        const BasicBlock* block = node->getBlock();
+        if (mLoopInfo.getLoopFor(block) != loop) break;
+
+        const BasicBlock* predBB = block->getSinglePredecessor();
+        if (!predBB || mLoopInfo.getLoopFor(predBB) != loop) continue;
+
+        if (contradicts(*predBB, *block, facts)) return true;
+    }
+
+    return false;
+}
+
+// Lanes leave the divergent loops that contain @from but not @to in different iterations
+bool
+UniformLoopAnalysis::leavesDivergentLoop(const BasicBlock& from, const BasicBlock& to) const
+{
+    for (const Loop* loop = mLoopInfo.getLoopFor(&from);
+         loop && !loop->contains(&to);
+         loop = loop->getParentLoop())
+    {
+        if (mVecinfo.isDivergentLoop(loop)) return true;
+    }
+
+    return false;
+}
+
+// Every value that is queried is needed for the result, so a single varying
+// operand fails the loop. Cycles through phis are assumed to be uniform
+// until shown otherwise.
+bool
+UniformLoopAnalysis::isUniformOnLanes(const Value& val, const ConditionFacts& facts)
+{
+    if (isa<Constant>(val)) return true;
+    if (mVecinfo.hasKnownShape(val) && mVecinfo.getVectorShape(val).isUniform()) return true;
+    if (facts.count(&val)) return true;
+
+    const Instruction* inst = dyn_cast<Instruction>(&val);
+    if (!inst) return false;
+
+    auto cached = mUniformValues.find(inst);
+    if (cached != mUniformValues.end()) return cached->second;
+
+    mUniformValues[inst] = true;
+    const bool uniform = isUniformOperation(*inst, facts);
+    mUniformValues[inst] = uniform;
+
+    return uniform;
+}
+
+bool
+UniformLoopAnalysis::isUniformOperation(const Instruction& inst, const ConditionFacts& facts)
+{
+    if (const PHINode* phi = dyn_cast<PHINode>(&inst))
+    {
+        return isUniformPhi(*phi, facts);
+    }
+
+    // Only the selected operand reaches the loop
+    if (const SelectInst* select = dyn_cast<SelectInst>(&inst))
+    {
+        auto fact = facts.find(select->getCondition());
+        if (fact != facts.end())
+        {
+            return isUniformOnLanes(fact->second ? *select->getTrueValue() : *select->getFalseValue(), facts);
+        }
+    }
+
+    // Operations without side effects are uniform if their operands are
+    if (!isa<BinaryOperator>(inst) && !isa<CmpInst>(inst) &&
+        !isa<CastInst>(inst) && !isa<SelectInst>(inst) &&
+        !isa<GetElementPtrInst>(inst))
+    {
+        return false;
+    }
+
+    for (const Use& operand : inst.operands())
+    {
+        if (!isUniformOnLanes(*operand.get(), facts)) return false;
+    }
+
+    return true;
+}
+
+bool
+UniformLoopAnalysis::isUniformPhi(const PHINode& phi, const ConditionFacts& facts)
+{
+    const BasicBlock& block = *phi.getParent();
+    const Loop* loop = mLoopInfo.getLoopFor(&block);
+    const bool isHeader = loop && loop->getHeader() == &block;
+
+    unsigned numFeasibleEdges = 0;
+    for (unsigned i = 0, e = phi.getNumIncomingValues(); i < e; ++i)
+    {
+        const BasicBlock& incomingBB = *phi.getIncomingBlock(i);
+        if (!isHeader && isInfeasibleEdge(incomingBB, block, facts)) continue;
+
+        ++numFeasibleEdges;
+        if (leavesDivergentLoop(incomingBB, block)) return false;
+        if (!isUniformOnLanes(*phi.getIncomingValue(i), facts)) return false;
+    }
+
+    // Lanes that reach a divergent join over different edges see different values
+    if (!isHeader && numFeasibleEdges > 1 && mVecinfo.isDivergent(block, loop)) return false;
+
+    return numFeasibleEdges > 0;
+}
+
+bool
+UniformLoopAnalysis::isInRegion(const BasicBlock& block) const
+{
+    return !mRegion || mRegion->contains(&block);
+}
+
+}
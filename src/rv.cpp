@@ -16,6 +16,7 @@
 #include <rv/rv.h>
 #include <rv/pda/ProgramDependenceAnalysis.h>
 #include <rv/pda/DFG.h>
+#include <rv/pda/SyncDependenceAnalysis.h>
 #include <rv/analysis/maskAnalysis.h>
 #include <rv/analysis/MetadataMaskAnalyzer.h>
 #include <rv/transforms/maskGenerator.h>
@@ -24,6 +25,7 @@
 #include <rv/transforms/selectGenerator.h>
 #include <rv/transforms/loopExitCanonicalizer.h>
 #include <rv/pda/ABAAnalysis.h>
+#include <rv/pda/UniformLoopAnalysis.h>
 
 #include <native/nativeBackendPass.h>
 #include <native/NatBuilder.h>
@@ -34,16 +36,6 @@
 
 
 namespace {
-void removeTempFunction(Module* mod, const std::string& name)
-{
-    assert (mod);
-    if (Function* tmpFn = mod->getFunction(name))
-    {
-        assert (tmpFn->use_empty());
-        tmpFn->eraseFromParent();
-    }
-}
-
 void
 removeUnusedRVLibFunctions(Module* mod)
 {
@@ -184,6 +176,9 @@ VectorizerInterface::addPredicateInstrinsics() {
             isMaskPredicate = true;
             // Function * allSimdFunc = cast<Function>(mInfo->mModule->getOrInsertFunction("rv_all_simd", simdPredTy));
             // addSIMDMapping(func, *allSimdFunc, -1, false);
+        } else if ((func.getName() == "rv_popcount")) {
+            // lane count of a predicate, uniform like the other reductions (rv_index stays varying)
+            isMaskPredicate = true;
         }
 
         if (isMaskPredicate) {
@@ -270,21 +265,74 @@ VectorizerInterface::analyze(VectorizationInfo& vectorizationInfo,
 {
     MetadataMaskAnalyzer maskAnalyzer(vectorizationInfo);
 
+    // join points are shared by the shape and the ABA analysis
+    SyncDependenceAnalysis syncDependenceAnalysis(domTree, postDomTree, loopInfo);
+
     PDA programDependenceAnalysis(vectorizationInfo,
                                   cdg,
-                                  dfg,
+                                  syncDependenceAnalysis,
+                                  mInfo.getVectorFuncMap(),
+                                  loopInfo);
+
+    // proves divergent loops uniform on the lanes that reach them, before the ABA analysis
+    UniformLoopAnalysis uniformLoopAnalysis(vectorizationInfo,
+                                            loopInfo,
+                                            domTree,
+                                            syncDependenceAnalysis);
+
+    ABAAnalysis abaAnalysis(vectorizationInfo,
+                            mInfo.getVectorFuncMap(),
+                            loopInfo,
+                            postDomTree,
+                            domTree,
+                            syncDependenceAnalysis);
+
+    programDependenceAnalysis.analyze(*mScalarFn);
+    mAnalysisStats = programDependenceAnalysis.getStatistics();
+    uniformLoopAnalysis.analyze(*mScalarFn);
+    abaAnalysis.analyze(*mScalarFn);
+    maskAnalyzer.markMasks(*mScalarFn);
+}
+
+void
+VectorizerInterface::analyze(VectorizationInfo& vectorizationInfo, AnalysisCache& analyses)
+{
+    assert (&analyses.getFunction() == mScalarFn);
+
+    MetadataMaskAnalyzer maskAnalyzer(vectorizationInfo);
+    const DominatorTree& domTree = analyses.getDomTree();
+    const PostDominatorTree& postDomTree = analyses.getPostDomTree();
+    const LoopInfo& loopInfo = analyses.getLoopInfo();
+
+    SyncDependenceAnalysis syncDependenceAnalysis(domTree, postDomTree, loopInfo);
+
+    // the DFG is never requested here
+    PDA programDependenceAnalysis(vectorizationInfo,
+                                  analyses.getCDG(),
+                                  syncDependenceAnalysis,
                                   mInfo.getVectorFuncMap(),
                                   loopInfo);
 
+    UniformLoopAnalysis uniformLoopAnalysis(vectorizationInfo,
+                                            loopInfo,
+                                            domTree,
+                                            syncDependenceAnalysis);
+
     ABAAnalysis abaAnalysis(vectorizationInfo,
                             mInfo.getVectorFuncMap(),
                             loopInfo,
                             postDomTree,
-                            domTree);
+                            domTree,
+                            syncDependenceAnalysis);
 
     programDependenceAnalysis.analyze(*mScalarFn);
+    mAnalysisStats = programDependenceAnalysis.getStatistics();
+    uniformLoopAnalysis.analyze(*mScalarFn);
     abaAnalysis.analyze(*mScalarFn);
     maskAnalyzer.markMasks(*mScalarFn);
+
+    // analyses only annotate the function
+    analyses.invalidate(AnalysisCache::PreservedAnalyses::all());
 }
 
 MaskAnalysis*
@@ -295,6 +343,14 @@ VectorizerInterface::analyzeMasks(VectorizationInfo& vectorizationInfo, const Lo
     return maskAnalysis;
 }
 
+MaskAnalysis*
+VectorizerInterface::analyzeMasks(VectorizationInfo& vectorizationInfo, AnalysisCache& analyses)
+{
+    MaskAnalysis* maskAnalysis = analyzeMasks(vectorizationInfo, analyses.getLoopInfo());
+    analyses.invalidate(AnalysisCache::PreservedAnalyses::all());
+    return maskAnalysis;
+}
+
 bool
 VectorizerInterface::generateMasks(VectorizationInfo& vectorizationInfo,
                                    MaskAnalysis& maskAnalysis,
@@ -304,12 +360,25 @@ VectorizerInterface::generateMasks(VectorizationInfo& vectorizationInfo,
     return maskgenerator.generate(*mScalarFn);
 }
 
+bool
+VectorizerInterface::generateMasks(VectorizationInfo& vectorizationInfo,
+                                   MaskAnalysis& maskAnalysis,
+                                   AnalysisCache& analyses)
+{
+    bool generated = generateMasks(vectorizationInfo, maskAnalysis, analyses.getLoopInfo());
+
+    // mask computations are inserted into existing blocks
+    analyses.invalidate(AnalysisCache::PreservedAnalyses::all());
+    return generated;
+}
+
 bool
 VectorizerInterface::linearizeCFG(VectorizationInfo& vectorizationInfo,
                                   MaskAnalysis& maskAnalysis,
                                   LoopInfo& loopInfo,
                                   const PostDominatorTree& postDomTree,
-                                  const DominatorTree& domTree)
+                                  DominatorTree& domTree,
+                                  const bool preserveSSA)
 {
     LoopLiveValueAnalysis loopLiveValueAnalysis(mInfo,
                                                 loopInfo);
@@ -325,15 +394,37 @@ VectorizerInterface::linearizeCFG(VectorizationInfo& vectorizationInfo,
                              loopLiveValueAnalysis,
                              vectorizationInfo,
                              postDomTree,
-                             domTree);
+                             domTree,
+                             preserveSSA);
 
     loopLiveValueAnalysis.run(*mScalarFn);
     selectgenerator.generate(*mScalarFn);
     linearizer.linearize(*mScalarFn);
+    mScheduleStats = linearizer.getScheduleStatistics();
 
     return true;
 }
 
+bool
+VectorizerInterface::linearizeCFG(VectorizationInfo& vectorizationInfo,
+                                  MaskAnalysis& maskAnalysis,
+                                  AnalysisCache& analyses,
+                                  const bool preserveSSA)
+{
+    bool linearized = linearizeCFG(vectorizationInfo,
+                                   maskAnalysis,
+                                   analyses.getLoopInfo(),
+                                   analyses.getPostDomTree(),
+                                   analyses.getDomTree(),
+                                   preserveSSA);
+
+    // the linearizer updates the dominator tree and the loop info
+    analyses.invalidate(AnalysisCache::PreservedAnalyses::none()
+                        .preserve(AnalysisCache::DomTree)
+                        .preserve(AnalysisCache::Loops));
+    return linearized;
+}
+
 bool
 VectorizerInterface::vectorize(VectorizationInfo& vecInfo, const DominatorTree& domTree)
 {
@@ -359,6 +450,19 @@ VectorizerInterface::vectorize(VectorizationInfo& vecInfo, const DominatorTree&
     return true;
 }
 
+bool
+VectorizerInterface::vectorize(VectorizationInfo& vecInfo, AnalysisCache& analyses)
+{
+    bool vectorized = vectorize(vecInfo, analyses.getDomTree());
+
+    // loops are vectorized in place
+    if (vecInfo.getMapping().vectorFn == &analyses.getFunction())
+    {
+        analyses.invalidateAll();
+    }
+    return vectorized;
+}
+
 void
 VectorizerInterface::finalize()
 {
@@ -379,10 +483,6 @@ VectorizerInterface::finalize()
     //       running. We should add functions lazily.
     removeUnusedRVLibFunctions(mInfo.mModule);
 
-    // Remove temporary functions if inserted during mask generation.
-    removeTempFunction(mInfo.mModule, "entryMaskUseFn");
-    removeTempFunction(mInfo.mModule, "entryMaskUseFnSIMD");
-
     IF_DEBUG {
             outs() << "### Whole-Function Vectorization of function '" << scalarName
             << "' SUCCESSFUL!\n";
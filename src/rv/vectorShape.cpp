@@ -7,9 +7,13 @@
 //
 // @author kloessner, simon
 
+#include <algorithm>
+#include <cassert>
 #include <iostream>
 #include <sstream>
 
+#include "llvm/Support/MathExtras.h"
+
 #include "rv/utils/mathUtils.h"
 
 #include "rv/pda/ProgramDependenceAnalysis.h"
@@ -18,46 +22,296 @@
 
 namespace rv {
 
+namespace {
+
+// the pattern part of the offset of @lane (without the stride)
+int patternOffset(const VectorShape &a, unsigned lane) {
+  return a.getLaneOffset(lane) - a.getStride() * (int)lane;
+}
+
+// period of a lane-wise combination of @a and @b (1 if neither has a pattern)
+unsigned combinedPeriod(const VectorShape &a, const VectorShape &b) {
+  return lcm<unsigned>(std::max(a.getPeriod(), 1U), std::max(b.getPeriod(), 1U));
+}
+
+bool hasSamePattern(const VectorShape &a, const VectorShape &b) {
+  if (a.getPeriod() != b.getPeriod())
+    return false;
+
+  for (unsigned lane = 0; lane < a.getPeriod(); ++lane)
+    if (patternOffset(a, lane) != patternOffset(b, lane))
+      return false;
+
+  return true;
+}
+
+} // namespace
+
+VectorShape VectorShape::patterned(int stride,
+                                   const std::vector<int> &laneOffsets,
+                                   int aligned) {
+  assert(!laneOffsets.empty() && laneOffsets[0] == 0 &&
+         "lane patterns are relative to lane 0");
+
+  if (laneOffsets.size() > MaxPeriod)
+    return varying(aligned);
+
+  VectorShape shape(stride, aligned);
+  shape.period = laneOffsets.size();
+  std::copy(laneOffsets.begin(), laneOffsets.end(), shape.offsets);
+  shape.normalizePattern();
+  return shape;
+}
+
+void VectorShape::normalizePattern() {
+  // shrink the pattern to its shortest period, drop it if it is all zero
+  for (unsigned p = 1; p < period; ++p) {
+    if (period % p != 0)
+      continue;
+
+    bool repeats = true;
+    for (unsigned lane = p; lane < period && repeats; ++lane)
+      repeats = offsets[lane] == offsets[lane % p];
+
+    if (repeats) {
+      period = p;
+      break;
+    }
+  }
+
+  if (period == 1)
+    period = 0;
+  for (unsigned lane = period; lane < MaxPeriod; ++lane)
+    offsets[lane] = 0;
+}
+
 VectorShape operator+(const VectorShape &a, const VectorShape &b) {
   const int aligned = a.alignment == b.alignment ? a.alignment : 1;
 
-  if (a.isVarying() || b.isVarying())
+  if (!a.hasKnownLaneOffsets() || !b.hasKnownLaneOffsets())
     return VectorShape::varying(aligned);
 
-  return VectorShape(a.stride + b.stride, aligned);
+  if (!a.hasLanePattern() && !b.hasLanePattern())
+    return VectorShape(a.stride + b.stride, aligned);
+
+  const unsigned period = combinedPeriod(a, b);
+  if (period > VectorShape::MaxPeriod)
+    return VectorShape::varying(aligned);
+
+  std::vector<int> laneOffsets(period);
+  for (unsigned lane = 0; lane < period; ++lane)
+    laneOffsets[lane] = patternOffset(a, lane) + patternOffset(b, lane);
+
+  return VectorShape::patterned(a.stride + b.stride, laneOffsets, aligned);
 }
 
 VectorShape operator-(const VectorShape &a, const VectorShape &b) {
   const int aligned = gcd<>(a.alignment, b.alignment);
 
-  if (a.isVarying() || b.isVarying())
+  if (!a.hasKnownLaneOffsets() || !b.hasKnownLaneOffsets())
     return VectorShape::varying(aligned);
 
-  return VectorShape(a.stride - b.stride, aligned);
+  if (!a.hasLanePattern() && !b.hasLanePattern())
+    return VectorShape(a.stride - b.stride, aligned);
+
+  const unsigned period = combinedPeriod(a, b);
+  if (period > VectorShape::MaxPeriod)
+    return VectorShape::varying(aligned);
+
+  std::vector<int> laneOffsets(period);
+  for (unsigned lane = 0; lane < period; ++lane)
+    laneOffsets[lane] = patternOffset(a, lane) - patternOffset(b, lane);
+
+  return VectorShape::patterned(a.stride - b.stride, laneOffsets, aligned);
 }
 
 VectorShape operator*(int strideMultiplier, const VectorShape &a) {
   const int aligned = strideMultiplier * a.alignment;
 
-  if (a.isVarying())
+  if (!a.hasKnownLaneOffsets())
     return VectorShape::varying(aligned);
 
-  return VectorShape(a.stride * strideMultiplier, aligned);
+  if (!a.hasLanePattern())
+    return VectorShape(a.stride * strideMultiplier, aligned);
+
+  std::vector<int> laneOffsets(a.period);
+  for (unsigned lane = 0; lane < a.period; ++lane)
+    laneOffsets[lane] = a.offsets[lane] * strideMultiplier;
+
+  return VectorShape::patterned(a.stride * strideMultiplier, laneOffsets,
+                                aligned);
 }
 
 VectorShape operator/(const VectorShape &a, int strideDivisor) {
   const int aligned =
       (a.alignment % strideDivisor == 0) ? (a.alignment / strideDivisor) : 1;
 
-  if (a.isVarying() || a.stride % strideDivisor != 0)
+  if (!a.hasKnownLaneOffsets() || a.stride % strideDivisor != 0)
     return VectorShape::varying(aligned);
 
-  return VectorShape(a.stride / strideDivisor, aligned);
+  if (!a.hasLanePattern())
+    return VectorShape(a.stride / strideDivisor, aligned);
+
+  // every lane has to stay an exact multiple of the divisor
+  std::vector<int> laneOffsets(a.period);
+  for (unsigned lane = 0; lane < a.period; ++lane) {
+    if (a.offsets[lane] % strideDivisor != 0)
+      return VectorShape::varying(aligned);
+    laneOffsets[lane] = a.offsets[lane] / strideDivisor;
+  }
+
+  return VectorShape::patterned(a.stride / strideDivisor, laneOffsets,
+                                aligned);
+}
+
+bool VectorShape::hasLaneOffsetsMultipleOf(int factor) const {
+  if (!hasConstantStride || stride % factor != 0)
+    return false;
+
+  for (unsigned lane = 0; lane < period; ++lane)
+    if (offsets[lane] % factor != 0)
+      return false;
+
+  return true;
+}
+
+namespace {
+
+// the two's complement value of @value in a @bits wide integer
+int wrapToBits(int value, unsigned bits) {
+  if (bits >= 32)
+    return value;
+
+  const long long range = 1LL << bits;
+  long long wrapped = ((value % range) + range) % range;
+  if (bits > 1 && wrapped >= range / 2)
+    wrapped -= range;
+  return (int)wrapped;
+}
+
+// the largest power of two that divides @alignment
+unsigned powerOfTwoFactor(unsigned alignment) {
+  return alignment ? (alignment & (~alignment + 1U)) : 1U;
+}
+
+} // namespace
+
+VectorShape VectorShape::truncateToTypeSize(const VectorShape &a,
+                                            unsigned typeSizeInBits) {
+  // The first lane loses all multiples of 2^typeSizeInBits, so only the
+  // power-of-two part of the alignment survives
+  unsigned aligned = powerOfTwoFactor(a.alignment);
+  if (typeSizeInBits < 32)
+    aligned = std::min(aligned, 1U << typeSizeInBits);
+
+  if (!a.hasConstantStride)
+    return varying(aligned);
+
+  // lane distances are exact modulo 2^typeSizeInBits
+  const int stride = wrapToBits(a.stride, typeSizeInBits);
+  if (!a.hasLanePattern())
+    return VectorShape(stride, aligned);
+
+  std::vector<int> laneOffsets(a.period);
+  for (unsigned lane = 0; lane < a.period; ++lane)
+    laneOffsets[lane] = wrapToBits(a.offsets[lane], typeSizeInBits);
+
+  return patterned(stride, laneOffsets, aligned);
+}
+
+VectorShape VectorShape::urem(const VectorShape &a, int modulus,
+                              bool nonNegativeLanes) {
+  assert(modulus > 0);
+
+  if (!a.hasConstantStride)
+    return varying();
+
+  // A negative lane is read as lane + 2^32, which keeps its remainder only
+  // for power-of-two moduli
+  if (!nonNegativeLanes && !llvm::isPowerOf2_32((unsigned)modulus))
+    return varying();
+
+  // all lanes are congruent to the first lane
+  if (a.hasLaneOffsetsMultipleOf(modulus))
+    return uni(gcd<unsigned>(a.alignment, modulus));
+
+  // If the first lane is a multiple of the modulus, every lane holds its
+  // offset modulo the modulus
+  if (a.alignment % modulus != 0)
+    return varying();
+
+  // stride * i mod m repeats after m / gcd(stride, m) lanes
+  const unsigned strideRem = (unsigned)(((a.stride % modulus) + modulus) % modulus);
+  const unsigned stridePeriod = (unsigned)modulus / gcd<unsigned>(strideRem, modulus);
+  const unsigned period = lcm<unsigned>(stridePeriod, std::max(a.period, 1U));
+
+  if (period > MaxPeriod)
+    return varying();
+
+  std::vector<int> laneOffsets(period);
+  for (unsigned lane = 0; lane < period; ++lane)
+    laneOffsets[lane] = ((a.getLaneOffset(lane) % modulus) + modulus) % modulus;
+
+  return patterned(0, laneOffsets, modulus);
+}
+
+VectorShape VectorShape::srem(const VectorShape &a, int modulus) {
+  assert(modulus > 0);
+
+  if (!a.hasConstantStride)
+    return varying();
+
+  // The sign of the lanes may differ, only lanes that are all multiples of
+  // the modulus agree (on zero)
+  if (a.alignment % modulus == 0 && a.hasLaneOffsetsMultipleOf(modulus))
+    return uni(modulus);
+
+  return varying();
+}
+
+VectorShape VectorShape::shiftRight(const VectorShape &a,
+                                    unsigned shiftAmount) {
+  if (shiftAmount >= 31)
+    return varying();
+
+  const int divisor = 1 << shiftAmount;
+  const unsigned aligned =
+      (a.alignment % divisor == 0) ? (a.alignment / divisor) : 1;
+
+  // floor((x + k * 2^s) / 2^s) == floor(x / 2^s) + k
+  if (!a.hasLaneOffsetsMultipleOf(divisor))
+    return varying(aligned);
+
+  VectorShape res = a / divisor;
+  res.alignment = aligned;
+  return res;
+}
+
+VectorShape VectorShape::disjointAdd(const VectorShape &a, int constant) {
+  if (!a.hasConstantStride || constant < 0)
+    return varying();
+
+  if (constant == 0)
+    return a;
+
+  // the bits of the constant lie below the next power of two
+  int bitRange = 1;
+  while (bitRange <= constant && bitRange < (1 << 30))
+    bitRange <<= 1;
+  if (bitRange <= constant)
+    return varying();
+
+  if (a.alignment % bitRange != 0 || !a.hasLaneOffsetsMultipleOf(bitRange))
+    return varying();
+
+  VectorShape res = a;
+  res.alignment = gcd<unsigned>(a.alignment, constant);
+  return res;
 }
 
 bool VectorShape::operator==(const VectorShape &a) const {
   return hasConstantStride == a.hasConstantStride && stride == a.stride &&
-         alignment == a.alignment;
+         alignment == a.alignment && hasSamePattern(*this, a);
 }
 
 bool VectorShape::operator!=(const VectorShape &a) const {
@@ -65,7 +319,7 @@ bool VectorShape::operator!=(const VectorShape &a) const {
 }
 
 bool VectorShape::operator<(const VectorShape &a) const {
-  if (!isVarying() && a.isVarying())
+  if (hasConstantStride && !a.hasConstantStride)
     return true;
 
   // If both are of the same shape, decide by alignment
@@ -73,7 +327,7 @@ bool VectorShape::operator<(const VectorShape &a) const {
     return a.alignment % alignment == 0;
 
   if (hasConstantStride && a.hasConstantStride)
-    if (stride == a.stride)
+    if (stride == a.stride && hasSamePattern(*this, a))
       return a.alignment % alignment == 0;
 
   return false;
@@ -82,8 +336,10 @@ bool VectorShape::operator<(const VectorShape &a) const {
 VectorShape
 VectorShape::join(VectorShape a, VectorShape b) {
       const unsigned aligned = gcd<>(a.alignment, b.alignment);
-      if (a.hasStridedShape() && b.hasStridedShape() && a.getStride() == b.getStride()) {
-	      return VectorShape(a.stride, aligned);
+      if (a.hasKnownLaneOffsets() && b.hasKnownLaneOffsets() &&
+          a.getStride() == b.getStride() && hasSamePattern(a, b)) {
+	      a.alignment = aligned;
+	      return a;
       } else {
 	      return varying(aligned);
       }
@@ -95,8 +351,16 @@ std::string VectorShape::str() const {
   }
 
   std::stringstream ss;
-  if (isVarying()) {
+  if (!hasConstantStride) {
     ss << "varying";
+  } else if (hasLanePattern()) {
+    if (stride == 0)
+      ss << "periodic(";
+    else
+      ss << "stride(" << stride << ") + offsets(";
+    for (unsigned lane = 0; lane < period; ++lane)
+      ss << (lane ? ", " : "") << offsets[lane];
+    ss << ")";
   } else if (isUniform()) {
     ss << "uni";
   } else if (isContiguous()) {
@@ -25,15 +25,78 @@ namespace rv
 void
 VectorizationInfo::remapPredicate(Value& dest, Value& old)
 {
-    for (auto it : predicates)
+    for (auto& predicate : predicates)
     {
-        if (it.second == &old)
+        if (predicate == &old)
         {
-            predicates[it.first] = &dest;
+            predicate = &dest;
         }
     }
 }
 
+void
+VectorizationInfo::numberFunction(const Function& F)
+{
+    for (auto& arg : F.getArgumentList())
+    {
+        getOrCreateId(arg);
+    }
+
+    for (auto& block : F)
+    {
+        getOrCreateId(block);
+        for (auto& inst : block)
+        {
+            getOrCreateId(inst);
+        }
+    }
+}
+
+unsigned
+VectorizationInfo::getOrCreateId(const Value& val)
+{
+    auto inserted = valueIds.insert(std::make_pair(&val, (unsigned) shapes.size()));
+    if (inserted.second)
+    {
+        shapes.emplace_back();
+    }
+    return inserted.first->second;
+}
+
+unsigned
+VectorizationInfo::getOrCreateId(const BasicBlock& block)
+{
+    auto inserted = blockIds.insert(std::make_pair(&block, (unsigned) predicates.size()));
+    if (inserted.second)
+    {
+        predicates.push_back(nullptr);
+        loopAsDivergenceLevel.push_back(nullptr);
+    }
+    return inserted.first->second;
+}
+
+int
+VectorizationInfo::lookupId(const Value& val) const
+{
+    auto it = valueIds.find(&val);
+    return it == valueIds.end() ? -1 : (int) it->second;
+}
+
+int
+VectorizationInfo::lookupId(const BasicBlock& block) const
+{
+    auto it = blockIds.find(&block);
+    return it == blockIds.end() ? -1 : (int) it->second;
+}
+
+// set the bit @id, growing @bits to the current number of ids if necessary
+static void
+setBit(BitVector& bits, unsigned id, unsigned numIds)
+{
+    if (bits.size() <= id) bits.resize(numIds);
+    bits.set(id);
+}
+
 void
 VectorizationInfo::dump(const Value * val) const {
   llvm::raw_ostream & out = llvm::errs();
@@ -93,6 +156,8 @@ VectorizationInfo::dump() const
 VectorizationInfo::VectorizationInfo(llvm::Function& parentFn, uint vectorWidth, Region& _region)
         : mapping(&parentFn, &parentFn, vectorWidth), region(&_region)
 {
+    numberFunction(parentFn);
+
     mapping.resultShape = VectorShape::uni();
     for (auto& arg : parentFn.getArgumentList())
     {
@@ -104,6 +169,8 @@ VectorizationInfo::VectorizationInfo(llvm::Function& parentFn, uint vectorWidth,
 VectorizationInfo::VectorizationInfo(VectorMapping _mapping)
         : mapping(_mapping), region(nullptr)
 {
+    numberFunction(*mapping.scalarFn);
+
     auto& argList = mapping.scalarFn->getArgumentList();
     auto it = argList.begin();
     for (auto argShape : mapping.argShapes)
@@ -116,57 +183,52 @@ VectorizationInfo::VectorizationInfo(VectorMapping _mapping)
 bool
 VectorizationInfo::hasKnownShape(const llvm::Value& val) const
 {
-    return (bool) shapes.count(&val);
+    return testBit(knownShapes, lookupId(val));
 }
 
 VectorShape
 VectorizationInfo::getVectorShape(const llvm::Value& val) const
 {
-    auto it = shapes.find(&val);
-    assert (it != shapes.end());
-    return it->second;
+    const int id = lookupId(val);
+    assert (testBit(knownShapes, id));
+    return shapes[id];
 }
 
 void
 VectorizationInfo::dropVectorShape(const Value& val)
 {
-    auto it = shapes.find(&val);
-    if (it == shapes.end()) return;
-    shapes.erase(it);
+    const int id = lookupId(val);
+    if (!testBit(knownShapes, id)) return;
+    knownShapes.reset(id);
 }
 
 void
 VectorizationInfo::dropPredicate(const BasicBlock& block)
 {
-    auto it = predicates.find(&block);
-    if (it == predicates.end()) return;
-    predicates.erase(it);
+    const int id = lookupId(block);
+    if (id < 0) return;
+    predicates[id] = nullptr;
 }
 
 void
 VectorizationInfo::setVectorShape(const llvm::Value& val, VectorShape shape)
 {
-    shapes[&val] = shape;
+    const unsigned id = getOrCreateId(val);
+    shapes[id] = shape;
+    setBit(knownShapes, id, shapes.size());
 }
 
 llvm::Value*
 VectorizationInfo::getPredicate(const llvm::BasicBlock& block) const
 {
-    auto it = predicates.find(&block);
-    if (it == predicates.end())
-    {
-        return nullptr;
-    }
-    else
-    {
-        return it->second;
-    }
+    const int id = lookupId(block);
+    return id < 0 ? nullptr : predicates[id];
 }
 
 void
 VectorizationInfo::setPredicate(const llvm::BasicBlock& block, llvm::Value& predicate)
 {
-    predicates[&block] = &predicate;
+    predicates[getOrCreateId(block)] = &predicate;
 }
 
 void
@@ -176,36 +238,48 @@ VectorizationInfo::setDivergenceLevel(const llvm::BasicBlock& block, const llvm:
     if (level) level->dump(); else outs() << "top-level";
     outs() << "\n\n"; */
 
-    auto loopit = loopAsDivergenceLevel.find(&block);
+    const unsigned id = getOrCreateId(block);
 
-    if (loopit != loopAsDivergenceLevel.end() &&
-        loopit->second->contains(level))
+    if (testBit(DivergentBlocks, id) &&
+        loopAsDivergenceLevel[id]->contains(level))
     {
         return;
     }
 
-    loopAsDivergenceLevel[&block] = level;
+    loopAsDivergenceLevel[id] = level;
+    setBit(DivergentBlocks, id, predicates.size());
+}
+
+void
+VectorizationInfo::dropDivergenceLevel(const llvm::BasicBlock& block)
+{
+    const int id = lookupId(block);
+    if (!testBit(DivergentBlocks, id)) return;
+    DivergentBlocks.reset(id);
+    loopAsDivergenceLevel[id] = nullptr;
 }
 
 bool
 VectorizationInfo::isDivergent(const llvm::BasicBlock& block, const llvm::Loop* level) const
 {
-    auto loopit = loopAsDivergenceLevel.find(&block);
+    const int id = lookupId(block);
 
     //not divergent at all
-    if (loopit == loopAsDivergenceLevel.end())
+    if (!testBit(DivergentBlocks, id))
     {
         return false;
     }
 
+    const Loop* blockLevel = loopAsDivergenceLevel[id];
+
     //top-level-divergent
     if (!level)
     {
-        return &*loopit->second == nullptr;
+        return blockLevel == nullptr;
     }
 
     //divergent respective to level
-    return level == loopit->second || loopit->second->contains(level);
+    return level == blockLevel || blockLevel->contains(level);
 }
 
 bool
@@ -226,61 +300,73 @@ VectorizationInfo::isDivergentLoopTopLevel(const llvm::Loop* loop) const
 void
 VectorizationInfo::markAlwaysByAll(const llvm::BasicBlock* BB)
 {
-    ABABlocks.insert(BB);
+    setBit(ABABlocks, getOrCreateId(*BB), predicates.size());
 }
 
 void
 VectorizationInfo::markAlwaysByAllOrNone(const llvm::BasicBlock* BB)
 {
-    ABAONBlocks.insert(BB);
+    setBit(ABAONBlocks, getOrCreateId(*BB), predicates.size());
 }
 
 void
 VectorizationInfo::markNotAlwaysByAll(const llvm::BasicBlock* BB)
 {
-    NotABABlocks.insert(BB);
+    setBit(NotABABlocks, getOrCreateId(*BB), predicates.size());
 }
 
 bool
 VectorizationInfo::isAlwaysByAll(const llvm::BasicBlock* BB) const
 {
-    return (bool) ABABlocks.count(BB);
+    return testBit(ABABlocks, lookupId(*BB));
 }
 
 bool
 VectorizationInfo::isAlwaysByAllOrNone(const llvm::BasicBlock* BB) const
 {
-    return (bool) ABAONBlocks.count(BB);
+    return testBit(ABAONBlocks, lookupId(*BB));
 }
 
 bool
 VectorizationInfo::isNotAlwaysByAll(const llvm::BasicBlock* BB) const
 {
-    return (bool) NotABABlocks.count(BB);
+    return testBit(NotABABlocks, lookupId(*BB));
 }
 
 void
 VectorizationInfo::markMandatory(const BasicBlock* BB)
 {
-    MandatoryBlocks.insert(BB);
+    setBit(MandatoryBlocks, getOrCreateId(*BB), predicates.size());
 }
 
 bool
 VectorizationInfo::isMandatory(const BasicBlock* BB) const
 {
-    return (bool) MandatoryBlocks.count(BB);
+    return testBit(MandatoryBlocks, lookupId(*BB));
 }
 
 void
 VectorizationInfo::markMetadataMask(const Instruction* inst)
 {
-    MetadataMaskInsts.insert(inst);
+    setBit(MetadataMaskInsts, getOrCreateId(*inst), shapes.size());
 }
 
 bool
 VectorizationInfo::isMetadataMask(const Instruction* inst) const
 {
-    return (bool) MetadataMaskInsts.count(inst);
+    return testBit(MetadataMaskInsts, lookupId(*inst));
+}
+
+void
+VectorizationInfo::markNarrowValue(const Value& val)
+{
+    setBit(NarrowValues, getOrCreateId(val), shapes.size());
+}
+
+bool
+VectorizationInfo::isNarrowValue(const Value& val) const
+{
+    return testBit(NarrowValues, lookupId(val));
 }
 
 
@@ -13,6 +13,8 @@
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/Analysis/LoopInfo.h>
 
+#include <algorithm>
+
 #include "rvConfig.h"
 
 
@@ -22,22 +24,16 @@ using namespace llvm;
 namespace rv {
 namespace MaskGraphUtils {
 
-static unsigned staticMaskID = 0;
-
-Mask::Mask(const NodeType type,
+Mask::Mask(const unsigned id,
+           const NodeType type,
            Instruction*   insertPoint)
-: mID(staticMaskID++),
+: mID(id),
         mType(type),
         mValue(nullptr),
         mInsertPoint(insertPoint)
 {
 }
 
-Mask::~Mask()
-{
-    // Nothing to do due to weak pointers.
-}
-
 bool
 Mask::operator==(const Mask& other) const
 {
@@ -51,7 +47,7 @@ Mask::operator==(const Mask& other) const
 
     for (unsigned i=0, e=mOperands.size(); i<e; ++i)
     {
-        if (mOperands[i].lock() != other.mOperands[i].lock()) return false;
+        if (mOperands[i] != other.mOperands[i]) return false;
     }
     for (unsigned i=0, e=mIncomingDirs.size(); i<e; ++i)
     {
@@ -92,7 +88,7 @@ Mask::print(raw_ostream& o) const
 
     for (unsigned i=0, e=mOperands.size(); i<e; ++i)
     {
-        o << mOperands[i].lock()->mID;
+        o << mOperands[i]->mID;
         if (i+1 != e) o << ", ";
     }
 
@@ -110,17 +106,6 @@ Mask::print(raw_ostream& o) const
     o << " )";
 }
 
-BlockMaskInfo::~BlockMaskInfo()
-{
-    mEntryMask.reset();
-
-    for (auto &it : mExitMasks)
-    {
-        MaskPtr mp = it;
-        mp.reset();
-    }
-}
-
 void
 BlockMaskInfo::print(raw_ostream& o) const
 {
@@ -136,12 +121,6 @@ BlockMaskInfo::print(raw_ostream& o) const
     }
 }
 
-LoopMaskInfo::~LoopMaskInfo()
-{
-    mMaskPhi.reset();
-    mCombinedLoopExitMask.reset();
-}
-
 void
 LoopMaskInfo::print(raw_ostream& o) const
 {
@@ -150,18 +129,6 @@ LoopMaskInfo::print(raw_ostream& o) const
     o << "  combined exit mask: "; mCombinedLoopExitMask->print(o); o << "\n";
 }
 
-LoopExitMaskInfo::~LoopExitMaskInfo()
-{
-    for (auto &it : mMaskPhiMap)
-    {
-        it.second.reset();
-    }
-    for (auto &it : mMaskUpdateOpMap)
-    {
-        it.second.reset();
-    }
-}
-
 void
 LoopExitMaskInfo::print(raw_ostream& o) const
 {
@@ -181,6 +148,138 @@ LoopExitMaskInfo::print(raw_ostream& o) const
     }
 }
 
+MaskGraph::MaskGraph()
+: mNumUniquedHits(0)
+{
+}
+
+MaskPtr
+MaskGraph::createNode(const NodeType type,
+                      Instruction*   insertPoint)
+{
+    assert (insertPoint);
+
+    MaskPtr mask = new (mMaskAllocator.Allocate()) Mask((unsigned)mNodes.size(), type, insertPoint);
+    mNodes.push_back(mask);
+
+    return mask;
+}
+
+MaskPtr
+MaskGraph::getUniqued(const NodeType    type,
+                      Value*            value,
+                      ArrayRef<MaskPtr> operands,
+                      Instruction*      insertPoint)
+{
+    // Constants and values are never materialized, so their position does
+    // not matter. All other masks become instructions at their insert point.
+    const bool isLeaf = type == CONSTANT || type == VALUE;
+
+    FoldingSetNodeID ID;
+    ID.AddInteger((unsigned)type);
+    ID.AddPointer(value);
+    ID.AddPointer(isLeaf ? nullptr : insertPoint);
+    ID.AddInteger((unsigned)operands.size());
+    for (MaskPtr op : operands)
+    {
+        assert (op);
+        ID.AddInteger(op->mID);
+    }
+
+    void* insertPos = nullptr;
+    if (Mask* mask = mUniqued.FindNodeOrInsertPos(ID, insertPos))
+    {
+        ++mNumUniquedHits;
+        return mask;
+    }
+
+    MaskPtr mask = createNode(type, insertPoint);
+    mask->mValue = value;
+    mask->mOperands.append(operands.begin(), operands.end());
+    mask->mKey = ID.Intern(mKeyAllocator);
+    mUniqued.InsertNode(mask, insertPos);
+
+    return mask;
+}
+
+MaskPtr
+MaskGraph::getConstant(Value* value, Instruction* insertPoint)
+{
+    assert (value);
+    return getUniqued(CONSTANT, value, ArrayRef<MaskPtr>(), insertPoint);
+}
+
+MaskPtr
+MaskGraph::getValue(Value* value, Instruction* insertPoint)
+{
+    assert (value);
+    return getUniqued(VALUE, value, ArrayRef<MaskPtr>(), insertPoint);
+}
+
+MaskPtr
+MaskGraph::getNegate(MaskPtr operand, Instruction* insertPoint)
+{
+    return getUniqued(NEGATE, nullptr, operand, insertPoint);
+}
+
+// 'and' and 'or' are commutative: the key uses the operands ordered by id.
+static SmallVector<MaskPtr, 4>
+sortedOperands(ArrayRef<MaskPtr> operands)
+{
+    SmallVector<MaskPtr, 4> sorted(operands.begin(), operands.end());
+    std::sort(sorted.begin(), sorted.end(),
+              [](MaskPtr a, MaskPtr b) { return a->mID < b->mID; });
+    return sorted;
+}
+
+MaskPtr
+MaskGraph::getConjunction(ArrayRef<MaskPtr> operands, Instruction* insertPoint)
+{
+    assert (operands.size() >= 2);
+    return getUniqued(CONJUNCTION, nullptr, sortedOperands(operands), insertPoint);
+}
+
+MaskPtr
+MaskGraph::getDisjunction(ArrayRef<MaskPtr> operands, Instruction* insertPoint)
+{
+    assert (operands.size() >= 2);
+    return getUniqued(DISJUNCTION, nullptr, sortedOperands(operands), insertPoint);
+}
+
+MaskPtr
+MaskGraph::getSelect(MaskPtr      condition,
+                     MaskPtr      trueMask,
+                     MaskPtr      falseMask,
+                     Instruction* insertPoint)
+{
+    MaskPtr operands[] = { condition, trueMask, falseMask };
+    return getUniqued(SELECT, nullptr, operands, insertPoint);
+}
+
+BlockMaskInfo*
+MaskGraph::createBlockMaskInfo()
+{
+    return new (mBlockInfoAllocator.Allocate()) BlockMaskInfo();
+}
+
+LoopMaskInfo*
+MaskGraph::createLoopMaskInfo()
+{
+    return new (mLoopInfoAllocator.Allocate()) LoopMaskInfo();
+}
+
+LoopExitMaskInfo*
+MaskGraph::createLoopExitMaskInfo()
+{
+    return new (mLoopExitInfoAllocator.Allocate()) LoopExitMaskInfo();
+}
+
+void
+MaskGraph::clearUniquingTable()
+{
+    mUniqued.clear();
+}
+
 } // namespace rv
 
 } // namespace MaskGraphUtils
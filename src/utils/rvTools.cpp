@@ -1323,6 +1323,53 @@ rv::findNestedLoopOfInst(Loop* parentLoop, Instruction* inst)
     return nullptr;
 }
 
+Constant*
+rv::getReductionIdentity(unsigned opcode, Type* type)
+{
+    switch (opcode)
+    {
+        case Instruction::Add:
+        case Instruction::Or:
+        case Instruction::Xor:
+            return Constant::getNullValue(type);
+        case Instruction::Mul:
+            return ConstantInt::get(type, 1);
+        case Instruction::And:
+            return Constant::getAllOnesValue(type);
+        case Instruction::FAdd:
+            return ConstantFP::getNegativeZero(type);
+        case Instruction::FMul:
+            return ConstantFP::get(type, 1.0);
+        default:
+            return nullptr;
+    }
+}
+
+unsigned
+rv::getReductionOpcode(const Loop& loop, const PHINode& phi)
+{
+    BasicBlock* latch = loop.getLoopLatch();
+    if (!latch || phi.getNumIncomingValues() != 2) return 0;
+
+    auto* update = dyn_cast<BinaryOperator>(phi.getIncomingValueForBlock(latch));
+    if (!update || !phi.hasOneUse() || *phi.user_begin() != update) return 0;
+    if (!getReductionIdentity(update->getOpcode(), update->getType())) return 0;
+
+    // Splitting a floating point chain reassociates it.
+    if (update->getType()->isFloatingPointTy() && !update->hasUnsafeAlgebra()) return 0;
+
+    // The partial result must not be observed inside the loop.
+    for (auto* user : update->users())
+    {
+        auto* userInst = cast<Instruction>(user);
+        if (userInst == &phi) continue;
+        if (isa<PHINode>(userInst) && !loop.contains(userInst->getParent())) continue;
+        return 0;
+    }
+
+    return update->getOpcode();
+}
+
 Loop*
 rv::findNextNestedLoopOfExit(Loop*       loop,
                               BasicBlock* exitingBlock)
@@ -1444,6 +1491,22 @@ rv::writeFunctionToFile(const Function& f, const std::string & fileName)
     }
 }
 
+Function&
+rv::requestLaneFunction(Module& mod, const std::string& name, Type* resultTy)
+{
+    Function* func = mod.getFunction(name);
+    if (func) return *func;
+
+    Type* boolTy = Type::getInt1Ty(mod.getContext());
+    FunctionType* funcTy = FunctionType::get(resultTy ? resultTy : boolTy, boolTy, false);
+    func = Function::Create(funcTy, GlobalValue::ExternalLinkage, name, &mod);
+    func->setDoesNotAccessMemory();
+    func->setDoesNotThrow();
+    func->setConvergent();
+    func->setDoesNotRecurse();
+    return *func;
+}
+
 
 // insert print statement that prints 'value' preceeded by 'DEBUG: `message`'
 // example what can be generated:
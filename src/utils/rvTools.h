@@ -37,6 +37,7 @@ class LLVMContext;
 class CallInst;
 class Loop;
 class LoopInfo;
+class PHINode;
 }
 
 namespace rv {
@@ -238,6 +239,17 @@ collectLoopPaths(const BasicBlock*                   target,
 Loop*
 findNestedLoopOfInst(Loop* parentLoop, Instruction* inst);
 
+// Returns the identity of the reduction operation @opcode or nullptr if
+// @opcode is no supported reduction.
+Constant*
+getReductionIdentity(unsigned opcode, Type* type);
+
+// Returns the opcode of the update operation if the header phi @phi of @loop
+// is a simple reduction (phi -> binop -> phi) whose partial results are not
+// observed in the loop, or 0 otherwise.
+unsigned
+getReductionOpcode(const Loop& loop, const PHINode& phi);
+
 Loop*
 findNextNestedLoopOfExit(Loop*       loop,
                          BasicBlock* exitingBlock);
@@ -263,6 +275,12 @@ writeModuleToFile(const Module& mod, const std::string& fileName);
 void
 writeFunctionToFile(const Function& f, const std::string& fileName);
 
+// Returns the declaration of the lane function @name (rv_any, rv_all, rv_popcount, ...)
+// that maps a predicate of each lane to a uniform @resultTy value (i1 if nullptr).
+// The function is declared in @mod if it does not exist yet.
+Function&
+requestLaneFunction(Module& mod, const std::string& name, Type* resultTy = nullptr);
+
 // insert print statement that prints 'value' preceeded by 'DEBUG: `message`'
 // example what can be generated:
 // declare i32 @printf(i8* noalias nocapture, ...) nounwind
@@ -62,6 +62,24 @@ cClangLine="clang -march=native -m64 -O2 -fno-vectorize -fno-slp-vectorize"
 
 rvToolLine="./../bin/rvTool"
 
+# RV_SSA_LINEARIZE=1 runs the SSA-preserving linearizer (differential testing)
+if os.environ.get("RV_SSA_LINEARIZE"):
+  rvToolLine = rvToolLine + " --ssa"
+
+# RV_BOSCC=1 requests BOSCC checks on all varying branches
+if os.environ.get("RV_BOSCC"):
+  rvToolLine = rvToolLine + " --boscc"
+
+# RV_VARIANTS=1 creates uniform and varying versions of the regions of all varying branches
+if os.environ.get("RV_VARIANTS"):
+  rvToolLine = rvToolLine + " --variants"
+
+# RV_REFILL=1 refills idle lanes of outer loops with divergent inner loops
+if os.environ.get("RV_REFILL"):
+  rvToolLine = rvToolLine + " --refill"
+
+rvBenchLine="./../bin/rvBench"
+
 def rvClang(clangArgs):
    return shellCmd(clangLine + " -Xclang -load -Xclang " + libRV + " -O3 " + clangArgs)
 
@@ -87,6 +105,12 @@ def runOuterLoopVec(scalarLL, destFile, scalarName = "foo", loopDesc=None, logPr
 
     return shellCmd(cmd,  None, logPrefix)
 
+def runShapeCheck(logPrefix=None):
+    return shellCmd(rvBenchLine + " -b shapes", None, logPrefix) == 0
+
+def runBlendCheck(logPrefix=None):
+    return shellCmd(rvBenchLine + " -b blends", None, logPrefix) == 0
+
 def runWFV(scalarLL, destFile, scalarName = "foo", shapes=None, logPrefix=None):
     cmd = rvToolLine + " -wfv -i " + scalarLL
     if destFile:
@@ -0,0 +1,36 @@
+/*
+ * foo_launcher.cpp
+ *
+ *  Created on: Jul 22, 2015
+ *      Author: Simon Moll
+ */
+
+#include <stdio.h>
+#include <iostream>
+
+#include <cassert>
+
+#include "launcherTools.h"
+
+extern "C" void foo(int n, float * A, int * R);
+
+int main(int argc, char ** argv) {
+  srand(42);
+
+  const uint vectorWidth = 8;
+
+  const uint n = 8 * 100;
+
+  float * A = allocateRandArray<float>(n);
+  int R[1] = { -1 };
+
+  foo(n, A, R);
+
+  size_t aHash = hashArray(A, n, 0);
+  size_t hash = hashArray(R, 1, aHash);
+  delete A;
+
+  std::cerr << hash << "\n";
+
+  return 0;
+}
@@ -1,7 +1,7 @@
 #include <cmath>
 
 extern "C" void
-foo(float * A, int * B, int n)
+foo(float * __restrict__ A, int * __restrict__ B, int n)
 {
   for (int i = 0; i < n; ++i) {
     float a = A[i];
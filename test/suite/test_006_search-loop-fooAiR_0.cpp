@@ -0,0 +1,9 @@
+extern "C" void
+foo(int n, float * A, int * R)
+{
+  int i;
+  for (i = 0; i < n; ++i) {
+    if (A[i] > 2000000000.0f) break;
+  }
+  R[0] = i;
+}
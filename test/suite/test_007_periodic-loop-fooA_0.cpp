@@ -0,0 +1,8 @@
+extern "C" void
+foo(int n, float * A)
+{
+  for (int i = 0; i < n; ++i) {
+    unsigned k = (unsigned) i;
+    A[i] = (float) (k % 4u) + 0.5f * (float) (k & 7u);
+  }
+}
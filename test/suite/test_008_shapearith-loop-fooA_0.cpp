@@ -0,0 +1,10 @@
+extern "C" void
+foo(int n, float * A)
+{
+  for (int i = 0; i < n; ++i) {
+    int k = (i << 2) | 3;
+    int s = (i >> 1) + (i ^ 5) - (i % 3) + (~i & -8);
+    unsigned char t = (unsigned char) (i * 7);
+    A[i] = (float) k + 0.25f * (float) s + 0.5f * (float) t;
+  }
+}
@@ -0,0 +1,12 @@
+extern "C" void
+foo(float * __restrict__ A, int * __restrict__ B, int n)
+{
+  for (int i = 0; i < n; ++i) {
+    long m = B[i] & 15;
+    int s = 0;
+    for (long k = 0; k < m; ++k) {
+      s += B[k] & 7;
+    }
+    A[i] = (float) s;
+  }
+}
@@ -0,0 +1,14 @@
+extern "C" void
+foo(int n, float * A)
+{
+  for (int i = 0; i < n; ++i) {
+    float a = A[i];
+    // about one lane in a hundred: most vectors skip this side (BOSCC)
+    if (__builtin_expect(a < 20000000.0f, 0)) {
+      float b = a * 0.001f - 0.5f;
+      A[i] = b * b + a;
+    } else {
+      A[i] = 0.5f * a;
+    }
+  }
+}
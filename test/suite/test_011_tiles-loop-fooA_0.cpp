@@ -0,0 +1,14 @@
+extern "C" void
+foo(int n, float * A)
+{
+  for (int i = 0; i < n; ++i) {
+    float a = A[i];
+    // varying, but all lanes of a vector agree (dynamic variants)
+    if ((i / 64) & 1) {
+      float b = a * 0.25f + 1.0f;
+      A[i] = b * b;
+    } else {
+      A[i] = a - 2.0f;
+    }
+  }
+}
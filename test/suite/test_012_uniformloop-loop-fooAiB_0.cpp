@@ -0,0 +1,16 @@
+extern "C" void
+foo(float * __restrict__ A, int * __restrict__ B, int n)
+{
+  for (int i = 0; i < n; ++i) {
+    int b = B[i];
+    long m = (b & 1) ? 8 : (b & 15);
+    int s = 0;
+    // varying trip count, but uniform on the lanes that enter the loop
+    if (b & 1) {
+      for (long k = 0; k < m; ++k) {
+        s += B[k] & 7;
+      }
+    }
+    A[i] = (float) s;
+  }
+}
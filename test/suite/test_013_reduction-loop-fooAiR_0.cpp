@@ -0,0 +1,13 @@
+extern "C" void
+foo(int n, float * A, int * R)
+{
+  int s = 7;
+  int p = 3;
+  // the multiplication chain is interleaved, both results are combined across lanes
+  for (int i = 0; i < 800; ++i) {
+    int a = (int) A[i];
+    s += a & 1023;
+    p *= a | 1;
+  }
+  R[0] = s ^ p;
+}
@@ -0,0 +1,11 @@
+extern "C" void
+foo(int n, float * A, int * R)
+{
+  int i;
+  for (i = 0; i < n; ++i) {
+    if (A[i] > 2000000000.0f) break;
+    // lanes past the exiting lane must not store
+    A[i] = A[i] * 0.5f;
+  }
+  R[0] = i;
+}
@@ -0,0 +1,14 @@
+extern "C" void
+foo(int n, float * A, int * R)
+{
+  int i;
+  for (i = 0; i < n; ++i) {
+    float a = A[i];
+    // only lanes that pass the divergent test may take the exit: A[0] is small
+    // but fails it, the loop is left at i = 9 in the middle of a vector
+    if (((int) a & 256) != 0) {
+      if (a < 100000000.0f) break;
+    }
+  }
+  R[0] = i;
+}
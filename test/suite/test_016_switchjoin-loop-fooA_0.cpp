@@ -0,0 +1,25 @@
+extern "C" void
+foo(int n, float * A)
+{
+  for (int i = 0; i < n; ++i) {
+    float x = A[i] * (1.0f / 2147483648.0f);
+    float b = x * 0.5f;
+    int k = (int) (x * 64.0f) & 7;
+
+    // five edges join behind the switch: r and s share the blend masks, cases 0
+    // and 2 pass on the same values and the default leaves them undefined
+    float r, s, u;
+    switch (k) {
+      case 0: r = b; s = x; u = x + 1.0f; break;
+      case 1: r = x * 3.0f - 1.0f; s = b + 7.0f; u = b + 2.0f; break;
+      case 2: r = b; s = x; u = x * x; break;
+      case 3: r = x * 5.0f + 0.25f; s = 2.0f - b; u = b * 5.0f; break;
+      default: u = x - b; break;
+    }
+
+    float t = r * s + b;
+    t = t * 0.75f + x * 0.125f;
+    t = t * t + 1.0f;
+    A[i] = (k < 4 ? t : u) * 1000000.0f;
+  }
+}
@@ -61,6 +61,21 @@ def executeOuterLoopTest(scalarLL, options):
 
 
 print("-- RV tester --")
+if len(sys.argv) <= 1:
+  # shape transfer functions against lane-by-lane evaluation
+  print("- shapes")
+  if runShapeCheck("logs/shapes"):
+    print("\tpassed!")
+  else:
+    print("\tfailed!")
+
+  # selects of a divergent switch join
+  print("- blends")
+  if runBlendCheck("logs/blends"):
+    print("\tpassed!")
+  else:
+    print("\tfailed!")
+
 for pattern in patterns:
   for testCase in glob(pattern):
     baseName = path.basename(testCase)
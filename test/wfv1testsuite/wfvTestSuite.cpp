@@ -79,7 +79,13 @@
         const bool useNEON  = false; \
         rvInfo->addCommonMappings(useSSE, useSSE41, useSSE42, useAVX, useNEON); \
         \
-        const DominatorTree domTree(*scalarCopy); \
+        DominatorTree domTree(*scalarCopy); \
+        LoopInfo loopInfo(domTree); \
+        \
+        LoopExitCanonicalizer canonicalizer(loopInfo); \
+        canonicalizer.canonicalize(*scalarCopy); \
+        domTree.recalculate(*scalarCopy); \
+        \
         PostDominatorTree postDomTree; \
         postDomTree.runOnFunction(*scalarCopy); \
         \
@@ -87,11 +93,6 @@
         CDG cdg(*postDomTree.DT); \
         dfg.create(*scalarCopy); \
         cdg.create(*scalarCopy); \
-        \
-        LoopInfo loopInfo(domTree); \
-        \
-        LoopExitCanonicalizer canonicalizer(loopInfo); \
-        canonicalizer.canonicalize(*scalarCopy); \
 
 
 #define RV_RUN_ON_FUNCTION_NEW_INTERFACE_END(scalarName) \
@@ -105,8 +106,7 @@
         assert(genMaskOk); \
         bool linearizeOk = wfv.linearizeCFG(vecInfo, *maskAnalysis, loopInfo, postDomTree, domTree); \
         assert(linearizeOk); \
-	    const DominatorTree domTreeNew(*vecInfo.getMapping().scalarFn); \
-        bool vectorizeOk = wfv.vectorize(vecInfo, domTreeNew); \
+        bool vectorizeOk = wfv.vectorize(vecInfo, domTree); \
         assert(vectorizeOk); \
         wfv.finalize(); \
         delete maskAnalysis; \
@@ -180,7 +180,13 @@
         const bool useNEON  = false; \
         rvInfo->addCommonMappings(useSSE, useSSE41, useSSE42, useAVX, useNEON); \
         \
-        const DominatorTree domTree(*scalarCopy); \
+        DominatorTree domTree(*scalarCopy); \
+        LoopInfo loopInfo(domTree); \
+        \
+        LoopExitCanonicalizer canonicalizer(loopInfo); \
+        canonicalizer.canonicalize(*scalarCopy); \
+        domTree.recalculate(*scalarCopy); \
+        \
         PostDominatorTree postDomTree; \
         postDomTree.runOnFunction(*scalarCopy); \
         \
@@ -189,11 +195,6 @@
         dfg.create(*scalarCopy); \
         cdg.create(*scalarCopy); \
         \
-        LoopInfo loopInfo(domTree); \
-        \
-        LoopExitCanonicalizer canonicalizer(loopInfo); \
-        canonicalizer.canonicalize(*scalarCopy); \
-        \
         rvInfo->addSIMDMapping(*calledFnName, *calledFnName##_SIMD, maskIndex, true); \
         \
         rv::VectorMapping targetMapping = rvInfo->inferTargetMapping(scalarCopy); \
@@ -206,8 +207,7 @@
         assert(genMaskOk); \
         bool linearizeOk = wfv.linearizeCFG(vecInfo, *maskAnalysis, loopInfo, postDomTree, domTree); \
         assert(linearizeOk); \
-        const DominatorTree domTreeNew(*vecInfo.getMapping().scalarFn); \
-        bool vectorizeOk = wfv.vectorize(vecInfo, domTreeNew); \
+        bool vectorizeOk = wfv.vectorize(vecInfo, domTree); \
         assert(vectorizeOk); \
         wfv.finalize(); \
         delete maskAnalysis; \
@@ -0,0 +1,815 @@
+/*
+ * rvBench.cpp
+ *
+ * Micro benchmarks for the data structures of libRV.
+ * Every benchmark builds a synthetic function of configurable size and
+ * compares the libRV implementation against the straightforward baseline
+ * or checks its answers on a function with known structure.
+ * The reach benchmark times the rewiring analysis of the CFG linearizer,
+ * the blends check counts the selects that replace the phis of a switch join.
+ * The shapes check evaluates the VectorShape transfer functions lane by lane
+ * and the shapes the PDA keeps for widened induction variables.
+ */
+
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/Analysis/LoopInfo.h"
+
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/Format.h"
+
+#include "ArgumentReader.h"
+
+#include "rv/vectorizationInfo.h"
+#include "rv/vectorMapping.h"
+#include "rv/vectorShape.h"
+#include "rv/analysis/DisjointPathOracle.h"
+#include "rv/analysis/AnalysisCache.h"
+#include "rv/analysis/maskAnalysis.h"
+#include "rv/analysis/loopLiveValueAnalysis.h"
+#include "rv/pda/ProgramDependenceAnalysis.h"
+#include "rv/pda/SyncDependenceAnalysis.h"
+#include "rv/Region/LoopRegion.h"
+#include "rv/Region/Region.h"
+#include "rv/rvInfo.h"
+#include "rv/rv.h"
+#include "rv/transforms/cfgLinearizer.h"
+#include "rv/transforms/selectGenerator.h"
+#include "utils/rvTools.h"
+
+using namespace llvm;
+
+using Clock = std::chrono::steady_clock;
+
+static double
+msecsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// A chain of @numBlocks blocks with @instsPerBlock additions each
+static Function*
+createSyntheticFunction(Module& mod, unsigned numBlocks, unsigned instsPerBlock)
+{
+    LLVMContext& context = mod.getContext();
+    Type* intTy = Type::getInt32Ty(context);
+    auto* fnTy = FunctionType::get(intTy, { intTy }, false);
+    auto* func = Function::Create(fnTy, GlobalValue::ExternalLinkage, "synthetic", &mod);
+
+    Value* acc = &*func->getArgumentList().begin();
+    BasicBlock* block = BasicBlock::Create(context, "entry", func);
+    IRBuilder<> builder(block);
+
+    for (unsigned b = 0; b < numBlocks; ++b)
+    {
+        for (unsigned i = 0; i < instsPerBlock; ++i)
+        {
+            acc = builder.CreateAdd(acc, ConstantInt::get(intTy, i + 1));
+        }
+
+        BasicBlock* next = BasicBlock::Create(context, "b", func);
+        builder.CreateBr(next);
+        builder.SetInsertPoint(next);
+    }
+    builder.CreateRet(acc);
+
+    return func;
+}
+
+// The storage layout of VectorizationInfo before the values were numbered
+struct MapBasedInfo
+{
+    std::map<const Value*, rv::VectorShape> shapes;
+    std::map<const BasicBlock*, Value*> predicates;
+    std::set<const BasicBlock*> ABABlocks;
+    std::set<const BasicBlock*> MandatoryBlocks;
+};
+
+static bool
+benchVectorizationInfo(unsigned numBlocks, unsigned instsPerBlock, unsigned numRounds)
+{
+    LLVMContext context;
+    Module mod("bench", context);
+    Function* func = createSyntheticFunction(mod, numBlocks, instsPerBlock);
+    Value* pred = ConstantInt::getTrue(context);
+
+    std::vector<const Instruction*> insts;
+    for (auto& block : *func)
+        for (auto& inst : block)
+            insts.push_back(&inst);
+
+    // fill both storages the way the analyses do
+    rv::VectorMapping mapping(func, func, 8, -1, rv::VectorShape::uni(), { rv::VectorShape::uni() });
+    auto start = Clock::now();
+    rv::VectorizationInfo vecInfo(mapping);
+    for (auto* inst : insts)
+    {
+        vecInfo.setVectorShape(*inst, rv::VectorShape::strided(inst->getNumOperands()));
+    }
+    for (auto& block : *func)
+    {
+        vecInfo.setPredicate(block, *pred);
+        if (block.size() % 2) vecInfo.markAlwaysByAll(&block);
+        vecInfo.markMandatory(&block);
+    }
+    double denseFill = msecsSince(start);
+
+    start = Clock::now();
+    MapBasedInfo mapInfo;
+    for (auto* inst : insts)
+    {
+        mapInfo.shapes[inst] = rv::VectorShape::strided(inst->getNumOperands());
+    }
+    for (auto& block : *func)
+    {
+        mapInfo.predicates[&block] = pred;
+        if (block.size() % 2) mapInfo.ABABlocks.insert(&block);
+        mapInfo.MandatoryBlocks.insert(&block);
+    }
+    double mapFill = msecsSince(start);
+
+    // query them the way NatBuilder does: shape of every instruction, properties of every block
+    unsigned long checksum = 0;
+    start = Clock::now();
+    for (unsigned r = 0; r < numRounds; ++r)
+    {
+        for (auto* inst : insts)
+        {
+            if (vecInfo.hasKnownShape(*inst)) checksum += vecInfo.getVectorShape(*inst).getStride();
+        }
+        for (auto& block : *func)
+        {
+            checksum += vecInfo.getPredicate(block) != nullptr;
+            checksum += vecInfo.isAlwaysByAll(&block) + vecInfo.isMandatory(&block);
+        }
+    }
+    double denseQuery = msecsSince(start);
+
+    unsigned long mapChecksum = 0;
+    start = Clock::now();
+    for (unsigned r = 0; r < numRounds; ++r)
+    {
+        for (auto* inst : insts)
+        {
+            auto it = mapInfo.shapes.find(inst);
+            if (it != mapInfo.shapes.end()) mapChecksum += it->second.getStride();
+        }
+        for (auto& block : *func)
+        {
+            auto it = mapInfo.predicates.find(&block);
+            mapChecksum += it != mapInfo.predicates.end() && it->second;
+            mapChecksum += mapInfo.ABABlocks.count(&block) + mapInfo.MandatoryBlocks.count(&block);
+        }
+    }
+    double mapQuery = msecsSince(start);
+
+    outs() << "vecinfo: " << numBlocks << " blocks, " << insts.size() << " instructions, "
+           << numRounds << " query rounds\n";
+    outs() << "  fill   map " << format("%9.3f", mapFill) << " ms, dense " << format("%9.3f", denseFill) << " ms\n";
+    outs() << "  query  map " << format("%9.3f", mapQuery) << " ms, dense " << format("%9.3f", denseQuery)
+           << " ms (" << format("%.2f", mapQuery / denseQuery) << "x)\n";
+    outs() << "  checksum map " << mapChecksum << ", dense " << checksum
+           << (checksum == mapChecksum ? "" : " (storages disagree)") << "\n";
+    return checksum == mapChecksum;
+}
+
+// A chain of @numSwitches switches over the argument, each with @numCases cases that meet in a join block
+static Function*
+createSwitchChainFunction(Module& mod, unsigned numSwitches, unsigned numCases,
+                          std::vector<BasicBlock*>& switchBlocks, std::vector<BasicBlock*>& joinBlocks)
+{
+    LLVMContext& context = mod.getContext();
+    Type* intTy = Type::getInt32Ty(context);
+    auto* fnTy = FunctionType::get(intTy, { intTy }, false);
+    auto* func = Function::Create(fnTy, GlobalValue::ExternalLinkage, "switches", &mod);
+
+    Value* arg = &*func->getArgumentList().begin();
+    BasicBlock* block = BasicBlock::Create(context, "entry", func);
+    IRBuilder<> builder(block);
+
+    for (unsigned s = 0; s < numSwitches; ++s)
+    {
+        BasicBlock* switchBlock = BasicBlock::Create(context, "switch", func);
+        BasicBlock* joinBlock = BasicBlock::Create(context, "join", func);
+        builder.CreateBr(switchBlock);
+
+        builder.SetInsertPoint(switchBlock);
+        BasicBlock* defaultBlock = BasicBlock::Create(context, "case", func);
+        auto* switchInst = builder.CreateSwitch(arg, defaultBlock, numCases - 1);
+        BranchInst::Create(joinBlock, defaultBlock);
+        for (unsigned c = 1; c < numCases; ++c)
+        {
+            BasicBlock* caseBlock = BasicBlock::Create(context, "case", func);
+            switchInst->addCase(ConstantInt::get(cast<IntegerType>(intTy), c), caseBlock);
+            BranchInst::Create(joinBlock, caseBlock);
+        }
+
+        switchBlocks.push_back(switchBlock);
+        joinBlocks.push_back(joinBlock);
+        builder.SetInsertPoint(joinBlock);
+    }
+    builder.CreateRet(arg);
+
+    return func;
+}
+
+static void
+benchDisjointPaths(unsigned numSwitches, unsigned numCases, unsigned numRounds)
+{
+    assert(numCases >= 2 && "a switch needs two cases to diverge");
+
+    LLVMContext context;
+    Module mod("bench", context);
+    std::vector<BasicBlock*> switchBlocks, joinBlocks;
+    Function* func = createSwitchChainFunction(mod, numSwitches, numCases, switchBlocks, joinBlocks);
+
+    DominatorTree domTree(*func);
+    LoopInfo loopInfo(domTree);
+    rv::DisjointPathOracle oracle(domTree, loopInfo);
+
+    // every switch against every join, as the divergence analysis asks for varying switches
+    unsigned numJoins = 0;
+    auto runQueries = [&]()
+    {
+        for (unsigned s = 0; s < switchBlocks.size(); ++s)
+        {
+            for (unsigned j = 0; j < joinBlocks.size(); ++j)
+            {
+                bool joins = oracle.joinsAt(*switchBlocks[s], *joinBlocks[j]);
+                assert(joins == (s == j) && "wrong disjoint path answer");
+                numJoins += joins;
+            }
+        }
+    };
+
+    auto start = Clock::now();
+    runQueries();
+    double coldQuery = msecsSince(start);
+    unsigned coldJoins = numJoins;
+
+    start = Clock::now();
+    for (unsigned r = 0; r < numRounds; ++r) runQueries();
+    double warmQuery = msecsSince(start);
+
+    outs() << "paths: " << numSwitches << " switches with " << numCases << " cases, "
+           << func->size() << " blocks, " << numRounds << " cached rounds\n";
+    outs() << "  queries " << oracle.getNumQueries() << ", cache hits " << oracle.getNumCacheHits()
+           << ", joins " << coldJoins << "\n";
+    outs() << "  cold " << format("%9.3f", coldQuery) << " ms, cached " << format("%9.3f", warmQuery) << " ms\n";
+}
+
+// A chain of @numBranches blocks, each of which continues the chain or leaves it through an exit
+// block for the final join. The join post dominates every branch, so the whole chain is one
+// divergent region. The exit blocks keep the edges to the join from being critical.
+static Function*
+createEarlyExitFunction(Module& mod, unsigned numBranches)
+{
+    LLVMContext& context = mod.getContext();
+    Type* intTy = Type::getInt32Ty(context);
+    auto* fnTy = FunctionType::get(intTy, { intTy }, false);
+    auto* func = Function::Create(fnTy, GlobalValue::ExternalLinkage, "exits", &mod);
+
+    Value* arg = &*func->getArgumentList().begin();
+    BasicBlock* block = BasicBlock::Create(context, "entry", func);
+    BasicBlock* joinBlock = BasicBlock::Create(context, "join", func);
+    IRBuilder<> builder(block);
+
+    for (unsigned b = 0; b < numBranches; ++b)
+    {
+        BasicBlock* branchBlock = BasicBlock::Create(context, "branch", func);
+        builder.CreateBr(branchBlock);
+        builder.SetInsertPoint(branchBlock);
+
+        BasicBlock* exitBlock = BasicBlock::Create(context, "exit", func);
+        BranchInst::Create(joinBlock, exitBlock);
+
+        BasicBlock* next = BasicBlock::Create(context, "b", func);
+        builder.CreateCondBr(builder.CreateICmpEQ(arg, ConstantInt::get(intTy, b)), exitBlock, next);
+        builder.SetInsertPoint(next);
+    }
+    builder.CreateBr(joinBlock);
+
+    builder.SetInsertPoint(joinBlock);
+    builder.CreateRet(arg);
+
+    return func;
+}
+
+// The rewiring analysis of the linearizer (clusters, rewire targets and their order, new edges)
+// on early exit chains, with the bit vectors of BlockReachability and with a walk per query
+static bool
+benchReachability(unsigned maxBranches, unsigned maxWalkBranches)
+{
+    const unsigned vectorWidth = 8;
+    bool consistent = true;
+
+    for (unsigned numBranches = 100; numBranches <= maxBranches; numBranches *= 10)
+    {
+        LLVMContext context;
+        Module mod("bench", context);
+        Function* func = createEarlyExitFunction(mod, numBranches);
+
+        // the branches depend on the varying argument
+        rv::RVInfo rvInfo(&mod, &context, func, func, vectorWidth);
+        rv::VectorMapping mapping(func, func, vectorWidth, -1, rv::VectorShape::varying(),
+                                  { rv::VectorShape::varying() });
+        rv::VectorizationInfo vecInfo(mapping);
+        rv::AnalysisCache analyses(*func);
+
+        rv::VectorizerInterface vectorizer(rvInfo, func);
+        vectorizer.analyze(vecInfo, analyses);
+        std::unique_ptr<MaskAnalysis> maskAnalysis(vectorizer.analyzeMasks(vecInfo, analyses));
+        LoopLiveValueAnalysis loopLiveValueAnalysis(rvInfo, analyses.getLoopInfo());
+
+        auto analyzeRewiring = [&](bool walks, rv::CFGLinearizer::RewiringStatistics& stats)
+        {
+            rv::CFGLinearizer linearizer(rvInfo,
+                                         analyses.getLoopInfo(),
+                                         *maskAnalysis,
+                                         loopLiveValueAnalysis,
+                                         vecInfo,
+                                         analyses.getPostDomTree(),
+                                         analyses.getDomTree());
+            linearizer.setReachabilityWalks(walks);
+
+            auto start = Clock::now();
+            linearizer.analyzeRewiring(*func);
+            double time = msecsSince(start);
+
+            stats = linearizer.getRewiringStatistics();
+            return time;
+        };
+
+        rv::CFGLinearizer::RewiringStatistics stats;
+        double bitsetTime = analyzeRewiring(false, stats);
+
+        outs() << "reach: " << numBranches << " branches, " << func->size() << " blocks, "
+               << stats.numClusters << " clusters, " << stats.numRewireTargets << " rewire targets, "
+               << stats.numRewiredEdges << " rewired edges\n";
+        outs() << "  bitsets " << format("%9.3f", bitsetTime) << " ms";
+
+        if (numBranches > maxWalkBranches)
+        {
+            outs() << ", walks skipped (-c " << maxWalkBranches << ")\n";
+            continue;
+        }
+
+        rv::CFGLinearizer::RewiringStatistics walkStats;
+        double walkTime = analyzeRewiring(true, walkStats);
+
+        outs() << ", walks " << format("%9.3f", walkTime) << " ms ("
+               << format("%.2f", walkTime / bitsetTime) << "x)\n";
+
+        if (walkStats.numClusters != stats.numClusters ||
+            walkStats.numRewireTargets != stats.numRewireTargets ||
+            walkStats.numRewiredEdges != stats.numRewiredEdges)
+        {
+            outs() << "  walks give " << walkStats.numClusters << " clusters, " << walkStats.numRewireTargets
+                   << " rewire targets, " << walkStats.numRewiredEdges << " rewired edges\n";
+            consistent = false;
+        }
+    }
+
+    return consistent;
+}
+
+// Lane values of a 32 bit integer vector
+typedef std::vector<int> LaneValues;
+
+static const unsigned NumCheckedLanes = rv::VectorShape::MaxPeriod;
+
+// Random shapes with known lane offsets and lanes that realize them
+struct ShapeSampler
+{
+    std::mt19937 rng;
+
+    ShapeSampler() : rng(42) {}
+
+    int range(int lo, int hi) { return std::uniform_int_distribution<int>(lo, hi)(rng); }
+
+    rv::VectorShape shape()
+    {
+        static const int alignments[] = { 1, 2, 3, 4, 6, 8, 16 };
+        const int aligned = alignments[range(0, 6)];
+        const int stride = range(-6, 6);
+        if (range(0, 2) > 0) return rv::VectorShape::strided(stride, aligned);
+
+        std::vector<int> laneOffsets(range(0, 1) ? 2 : 4);
+        for (unsigned lane = 1; lane < laneOffsets.size(); ++lane) laneOffsets[lane] = range(-8, 8);
+        return rv::VectorShape::patterned(stride, laneOffsets, aligned);
+    }
+
+    // the first lane is a multiple of the alignment, the lanes often cross zero
+    LaneValues lanes(const rv::VectorShape& shape)
+    {
+        const int first = range(-64, 64) * (int) shape.getAlignment();
+        LaneValues values(NumCheckedLanes);
+        for (unsigned lane = 0; lane < NumCheckedLanes; ++lane) values[lane] = first + shape.getLaneOffset(lane);
+        return values;
+    }
+};
+
+template<typename LaneOp>
+static LaneValues
+mapLanes(const LaneValues& values, LaneOp op)
+{
+    LaneValues res(values.size());
+    for (unsigned lane = 0; lane < values.size(); ++lane) res[lane] = op(values[lane]);
+    return res;
+}
+
+template<typename LaneOp>
+static LaneValues
+zipLanes(const LaneValues& a, const LaneValues& b, LaneOp op)
+{
+    LaneValues res(a.size());
+    for (unsigned lane = 0; lane < a.size(); ++lane) res[lane] = op(a[lane], b[lane]);
+    return res;
+}
+
+static bool
+hasNonNegativeLanes(const LaneValues& values)
+{
+    for (int value : values)
+        if (value < 0) return false;
+    return true;
+}
+
+// @shape describes @values in a @bits wide integer: the first lane is aligned and
+// the lane distances match modulo 2^bits
+static bool
+matchesLanes(const rv::VectorShape& shape, const LaneValues& values, unsigned bits)
+{
+    const unsigned aligned = shape.getAlignment();
+    if (aligned > 1 && values[0] % (int) aligned != 0) return false;
+    if (!shape.hasKnownLaneOffsets()) return true;
+
+    const unsigned mask = bits < 32 ? (1U << bits) - 1 : ~0U;
+    for (unsigned lane = 0; lane < values.size(); ++lane)
+    {
+        const unsigned distance = (unsigned) values[lane] - (unsigned) values[0];
+        if (((distance - (unsigned) shape.getLaneOffset(lane)) & mask) != 0) return false;
+    }
+
+    return true;
+}
+
+static unsigned numShapeMismatches = 0;
+
+static void
+expectLanes(const std::string& op, const rv::VectorShape& a, const LaneValues& values,
+            const rv::VectorShape& res, const LaneValues& resValues, unsigned bits = 32)
+{
+    if (matchesLanes(res, resValues, bits)) return;
+    if (++numShapeMismatches > 10) return;
+
+    outs() << "  " << op << " of " << a << " (lanes " << values[0] << ", " << values[1] << ", ...) gives "
+           << res << " (lanes " << resValues[0] << ", " << resValues[1] << ", ...)\n";
+}
+
+// Every transfer function under the preconditions the PDA establishes for it
+static bool
+checkShapes(unsigned numSamples)
+{
+    ShapeSampler sampler;
+
+    for (unsigned s = 0; s < numSamples; ++s)
+    {
+        const rv::VectorShape a = sampler.shape();
+        const rv::VectorShape b = sampler.shape();
+        const LaneValues x = sampler.lanes(a);
+        const LaneValues y = sampler.lanes(b);
+        const bool nonNegative = hasNonNegativeLanes(x);
+
+        expectLanes("add", a, x, a + b, zipLanes(x, y, [](int u, int v) { return u + v; }));
+        expectLanes("sub", a, x, a - b, zipLanes(x, y, [](int u, int v) { return u - v; }));
+
+        const int c = sampler.range(1, 8);
+        const std::string byC = " by " + std::to_string(c);
+        expectLanes("mul" + byC, a, x, c * a, mapLanes(x, [=](int v) { return c * v; }));
+        expectLanes("srem" + byC, a, x, rv::VectorShape::srem(a, c), mapLanes(x, [=](int v) { return v % c; }));
+
+        // sdiv rounds towards zero, the PDA requires the first lane to be a multiple
+        if (x[0] % c == 0)
+            expectLanes("sdiv" + byC, a, x, a / c, mapLanes(x, [=](int v) { return v / c; }));
+
+        // udiv requires lanes without the sign bit, urem is told whether there are any
+        if (nonNegative)
+            expectLanes("udiv" + byC, a, x, a / c,
+                        mapLanes(x, [=](int v) { return (int) ((unsigned) v / (unsigned) c); }));
+        expectLanes("urem" + byC, a, x, rv::VectorShape::urem(a, c, nonNegative),
+                    mapLanes(x, [=](int v) { return (int) ((unsigned) v % (unsigned) c); }));
+
+        const unsigned amount = sampler.range(0, 4);
+        const std::string byAmount = " by " + std::to_string(amount);
+        expectLanes("ashr" + byAmount, a, x, rv::VectorShape::shiftRight(a, amount),
+                    mapLanes(x, [=](int v) { return v >> amount; }));
+        if (nonNegative)
+            expectLanes("lshr" + byAmount, a, x, rv::VectorShape::shiftRight(a, amount),
+                        mapLanes(x, [=](int v) { return (int) ((unsigned) v >> amount); }));
+
+        const unsigned bits = sampler.range(1, 16);
+        expectLanes("trunc to i" + std::to_string(bits), a, x, rv::VectorShape::truncateToTypeSize(a, bits),
+                    mapLanes(x, [=](int v) { return (int) ((unsigned) v << (32 - bits)) >> (32 - bits); }), bits);
+
+        const int k = sampler.range(0, 15);
+        const std::string withK = " with " + std::to_string(k);
+        expectLanes("or" + withK, a, x, rv::VectorShape::disjointAdd(a, k), mapLanes(x, [=](int v) { return v | k; }));
+        expectLanes("xor" + withK, a, x, rv::VectorShape::disjointAdd(a, k), mapLanes(x, [=](int v) { return v ^ k; }));
+        expectLanes("not", a, x, rv::VectorShape::uni() - a, mapLanes(x, [](int v) { return ~v; }));
+    }
+
+    outs() << "shapes: " << numSamples << " samples of " << NumCheckedLanes << " lanes, "
+           << numShapeMismatches << " mismatches\n";
+    return numShapeMismatches == 0;
+}
+
+// A "++i" loop over i32 from @start that runs while "i.next @pred n" holds for the argument n.
+// The header widens the induction variable with @extOpcode into @wide.
+static Function*
+createInductionFunction(Module& mod, int start, CmpInst::Predicate pred, Instruction::CastOps extOpcode,
+                        PHINode*& phi, Value*& wide)
+{
+    LLVMContext& context = mod.getContext();
+    Type* intTy = Type::getInt32Ty(context);
+    auto* fnTy = FunctionType::get(Type::getVoidTy(context), { intTy }, false);
+    auto* func = Function::Create(fnTy, GlobalValue::ExternalLinkage, "induction", &mod);
+
+    Value* bound = &*func->getArgumentList().begin();
+    BasicBlock* entry = BasicBlock::Create(context, "entry", func);
+    BasicBlock* header = BasicBlock::Create(context, "header", func);
+    BasicBlock* exit = BasicBlock::Create(context, "exit", func);
+    IRBuilder<> builder(entry);
+    builder.CreateBr(header);
+
+    builder.SetInsertPoint(header);
+    phi = builder.CreatePHI(intTy, 2, "i");
+    wide = builder.CreateCast(extOpcode, phi, Type::getInt64Ty(context), "wide");
+    Value* next = builder.CreateAdd(phi, ConstantInt::get(intTy, 1), "i.next");
+    builder.CreateCondBr(builder.CreateICmp(pred, next, bound), header, exit);
+    phi->addIncoming(ConstantInt::getSigned(intTy, start), entry);
+    phi->addIncoming(next, header);
+
+    builder.SetInsertPoint(exit);
+    builder.CreateRetVoid();
+
+    return func;
+}
+
+// Widening a consecutive induction variable keeps its shape only if the lanes of one vector
+// iteration can not wrap around. The PDA computes the shape of the extension in a loop vectorized
+// like rvTool does it, the lanes starting at @firstLane are a vector iteration the scalar loop runs
+// for some n. A shape with known lane offsets must match the widened lanes exactly.
+static bool
+checkInductionWidening()
+{
+    struct WideningCase
+    {
+        const char* desc;
+        int start;
+        CmpInst::Predicate pred;
+        Instruction::CastOps extOpcode;
+        int firstLane;
+        bool provable; // start and bound keep the lanes apart
+    };
+    const WideningCase cases[] =
+    {
+        { "sext of i = 0; i.next < n", 0, CmpInst::ICMP_SLT, Instruction::SExt, INT32_MAX - 3, true },
+        { "zext of i = 0; i.next < n", 0, CmpInst::ICMP_SLT, Instruction::ZExt, INT32_MAX - 3, true },
+        { "zext of i = -8; i.next <u n", -8, CmpInst::ICMP_ULT, Instruction::ZExt, -4, true },
+        { "sext of i = -8; i.next <u n", -8, CmpInst::ICMP_ULT, Instruction::SExt, -4, false },
+        { "sext of i = INT_MAX - 8; i.next != n", INT32_MAX - 8, CmpInst::ICMP_NE, Instruction::SExt, INT32_MAX - 1, false },
+        { "zext of i = -8; i.next != n", -8, CmpInst::ICMP_NE, Instruction::ZExt, -2, false },
+    };
+    const unsigned vectorWidth = 4;
+
+    unsigned numMismatches = 0;
+    for (const WideningCase& c : cases)
+    {
+        LLVMContext context;
+        Module mod("bench", context);
+        PHINode* phi;
+        Value* wide;
+        Function* func = createInductionFunction(mod, c.start, c.pred, c.extOpcode, phi, wide);
+
+        rv::AnalysisCache analyses(*func);
+        Loop* loop = analyses.getLoopInfo().getLoopFor(phi->getParent());
+        rv::LoopRegion loopRegionImpl(*loop);
+        rv::Region loopRegion(loopRegionImpl);
+        rv::VectorizationInfo vecInfo(*func, vectorWidth, loopRegion);
+
+        auto* branch = cast<BranchInst>(phi->getParent()->getTerminator());
+        vecInfo.setVectorShape(*phi, rv::VectorShape::strided(1, vectorWidth));
+        vecInfo.setVectorShape(*branch, rv::VectorShape::uni());
+        vecInfo.setVectorShape(*branch->getCondition(), rv::VectorShape::uni());
+
+        rv::SyncDependenceAnalysis sda(analyses.getDomTree(), analyses.getPostDomTree(), analyses.getLoopInfo());
+        native::VectorMappingMap noMappings;
+        rv::PDA pda(vecInfo, analyses.getCDG(), sda, noMappings, analyses.getLoopInfo());
+        pda.analyze(*func);
+
+        const rv::VectorShape shape = vecInfo.getVectorShape(*wide);
+        bool matches = true;
+        if (shape.hasKnownLaneOffsets())
+        {
+            for (unsigned lane = 0; lane < vectorWidth; ++lane)
+            {
+                const unsigned narrow = (unsigned) c.firstLane + lane;
+                const int64_t value = c.extOpcode == Instruction::SExt ? (int64_t) (int) narrow : (int64_t) narrow;
+                const int64_t first = c.extOpcode == Instruction::SExt ? (int64_t) c.firstLane
+                                                                       : (int64_t) (unsigned) c.firstLane;
+                matches &= value - first == shape.getLaneOffset(lane);
+            }
+        }
+        else
+        {
+            matches = !c.provable;
+        }
+
+        if (!matches)
+        {
+            ++numMismatches;
+            outs() << "  " << c.desc << " gives " << shape << "\n";
+        }
+    }
+
+    outs() << "widening: " << (sizeof(cases) / sizeof(cases[0])) << " induction variables, "
+           << numMismatches << " mismatches\n";
+    return numMismatches == 0;
+}
+
+// A switch over the varying argument with four cases and a default that all lead to one join.
+// The phis of the join are @blended (equal incoming values for cases 0 and 2, undef for the
+// default), @shared (the same edges as @blended) and @allUndef. The result adds all three.
+static Function*
+createSwitchJoinFunction(Module& mod, PHINode*& blended, PHINode*& shared, PHINode*& allUndef)
+{
+    LLVMContext& context = mod.getContext();
+    Type* intTy = Type::getInt32Ty(context);
+    Type* floatTy = Type::getFloatTy(context);
+    auto* fnTy = FunctionType::get(floatTy, { intTy, floatTy }, false);
+    auto* func = Function::Create(fnTy, GlobalValue::ExternalLinkage, "switchjoin", &mod);
+
+    auto argIt = func->getArgumentList().begin();
+    Value* k = &*argIt++;
+    Value* a = &*argIt;
+
+    BasicBlock* entry = BasicBlock::Create(context, "entry", func);
+    BasicBlock* joinBlock = BasicBlock::Create(context, "join", func);
+    BasicBlock* defaultBlock = BasicBlock::Create(context, "default", func);
+    BranchInst::Create(joinBlock, defaultBlock);
+
+    IRBuilder<> builder(entry);
+    Value* half = builder.CreateFMul(a, ConstantFP::get(floatTy, 0.5));
+    Value* third = builder.CreateFMul(a, ConstantFP::get(floatTy, 0.25));
+    SwitchInst* switchInst = builder.CreateSwitch(k, defaultBlock, 4);
+
+    builder.SetInsertPoint(joinBlock);
+    blended = builder.CreatePHI(floatTy, 5, "blended");
+    shared = builder.CreatePHI(floatTy, 5, "shared");
+    allUndef = builder.CreatePHI(floatTy, 5, "undef");
+    builder.CreateRet(builder.CreateFAdd(builder.CreateFAdd(blended, shared), allUndef));
+
+    Value* undef = UndefValue::get(floatTy);
+    for (unsigned c = 0; c < 4; ++c)
+    {
+        BasicBlock* caseBlock = BasicBlock::Create(context, "case", func, joinBlock);
+        switchInst->addCase(ConstantInt::get(cast<IntegerType>(intTy), c), caseBlock);
+        builder.SetInsertPoint(caseBlock);
+
+        Value* blendedValue = half;
+        Value* sharedValue = third;
+        if (c % 2)
+        {
+            blendedValue = builder.CreateFAdd(a, ConstantFP::get(floatTy, c));
+            sharedValue = builder.CreateFSub(a, ConstantFP::get(floatTy, c));
+        }
+        builder.CreateBr(joinBlock);
+
+        blended->addIncoming(blendedValue, caseBlock);
+        shared->addIncoming(sharedValue, caseBlock);
+        allUndef->addIncoming(undef, caseBlock);
+    }
+    blended->addIncoming(undef, defaultBlock);
+    shared->addIncoming(undef, defaultBlock);
+    allUndef->addIncoming(undef, defaultBlock);
+
+    return func;
+}
+
+// The selects that replace the phis of a divergent switch join. Each phi has three distinct
+// values that need two selects (one for each of @blended and @shared), the all-undef phi
+// needs none. The only disjunction of exit masks (cases 1 and 3) is shared by both trees.
+static bool
+checkBlends()
+{
+    const unsigned vectorWidth = 8;
+
+    LLVMContext context;
+    Module mod("bench", context);
+    PHINode* blended;
+    PHINode* shared;
+    PHINode* allUndef;
+    Function* func = createSwitchJoinFunction(mod, blended, shared, allUndef);
+    BasicBlock* joinBlock = blended->getParent();
+    Instruction* sum = cast<Instruction>(*allUndef->user_begin());
+
+    rv::RVInfo rvInfo(&mod, &context, func, func, vectorWidth);
+    rv::VectorMapping mapping(func, func, vectorWidth, -1, rv::VectorShape::varying(),
+                              { rv::VectorShape::varying(), rv::VectorShape::varying() });
+    rv::VectorizationInfo vecInfo(mapping);
+    rv::AnalysisCache analyses(*func);
+
+    rv::VectorizerInterface vectorizer(rvInfo, func);
+    vectorizer.analyze(vecInfo, analyses);
+    std::unique_ptr<MaskAnalysis> maskAnalysis(vectorizer.analyzeMasks(vecInfo, analyses));
+    vectorizer.generateMasks(vecInfo, *maskAnalysis, analyses);
+
+    LoopLiveValueAnalysis loopLiveValueAnalysis(rvInfo, analyses.getLoopInfo());
+    loopLiveValueAnalysis.run(*func);
+    SelectGenerator selectGenerator(rvInfo, analyses.getLoopInfo(), *maskAnalysis, loopLiveValueAnalysis, vecInfo);
+    selectGenerator.generate(*func);
+
+    unsigned numPhis = 0;
+    unsigned numSelects = 0;
+    unsigned numBlendMasks = 0;
+    for (Instruction& inst : *joinBlock)
+    {
+        if (!inst.getType()->isFloatTy() && !inst.getName().startswith("blend.mask")) continue;
+        numPhis += isa<PHINode>(inst);
+        numSelects += isa<SelectInst>(inst);
+        numBlendMasks += inst.getName().startswith("blend.mask");
+    }
+    const bool undefBlended = isa<UndefValue>(sum->getOperand(1));
+
+    outs() << "blends: " << numPhis << " float phis left, " << numSelects << " selects, "
+           << numBlendMasks << " blend masks, all-undef phi " << (undefBlended ? "" : "not ") << "folded\n";
+    return numPhis == 0 && numSelects == 4 && numBlendMasks == 1 && undefBlended;
+}
+
+int main(int argc, char** argv)
+{
+    ArgumentReader reader(argc, argv);
+
+    std::string benchName;
+    if (!reader.readOption<std::string>("-b", benchName))
+    {
+        std::cerr << "rvBench -b vecinfo [-n BLOCKS] [-m INSTS_PER_BLOCK] [-r ROUNDS]\n";
+        std::cerr << "rvBench -b paths [-n SWITCHES] [-m CASES] [-r ROUNDS]\n";
+        std::cerr << "rvBench -b reach [-n MAX_BRANCHES] [-c MAX_WALK_BRANCHES]\n";
+        std::cerr << "rvBench -b blends\n";
+        std::cerr << "rvBench -b shapes [-n SAMPLES]\n";
+        return -1;
+    }
+
+    uint numBlocks = reader.getOption<uint>("-n", benchName == "paths" ? 64 : 10000);
+    uint instsPerBlock = reader.getOption<uint>("-m", 16);
+    uint numRounds = reader.getOption<uint>("-r", 20);
+    uint maxWalkBranches = reader.getOption<uint>("-c", 1000);
+
+    if (benchName == "vecinfo")
+    {
+        if (!benchVectorizationInfo(numBlocks, instsPerBlock, numRounds)) return 1;
+    }
+    else if (benchName == "paths")
+    {
+        benchDisjointPaths(numBlocks, instsPerBlock, numRounds);
+    }
+    else if (benchName == "reach")
+    {
+        if (!benchReachability(numBlocks, maxWalkBranches)) return 1;
+    }
+    else if (benchName == "blends")
+    {
+        if (!checkBlends()) return 1;
+    }
+    else if (benchName == "shapes")
+    {
+        bool shapesOk = checkShapes(numBlocks);
+        bool wideningOk = checkInductionWidening();
+        if (!shapesOk || !wideningOk) return 1;
+    }
+    else
+    {
+        std::cerr << "Unknown benchmark " << benchName << "\n";
+        return -1;
+    }
+
+    return 0;
+}
@@ -10,6 +10,10 @@
 #include <iostream>
 #include <cassert>
 #include <sstream>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
 
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
@@ -33,10 +37,18 @@
 #include "ArgumentReader.h"
 
 #include "rv/rv.h"
+#include "rv/loopSelection.h"
+#include "rv/analysis/AnalysisCache.h"
 #include "rv/vectorMapping.h"
 #include "rv/rvInfo.h"
+#include "rv/transforms/dynamicVariantGenerator.h"
 #include "rv/transforms/loopExitCanonicalizer.h"
+#include "rv/transforms/laneRefiller.h"
+#include "rv/transforms/loopInterleaver.h"
+#include "rv/transforms/uniformHoister.h"
 #include "rv/Region/LoopRegion.h"
+#include "utils/metadata.h"
+#include "utils/rvTools.h"
 
 using namespace llvm;
 
@@ -72,55 +84,230 @@ normalizeFunction(Function& F)
     FPM.run(F);
 }
 
-static Value*
-GetInitValue(Loop& loop, PHINode& phi)
+// The vector loop advances by @vectorWidth iterations. The phi and the latch compare continue with
+// a bumped copy of the "++i" increment, which is uniform: its first lane is the increment of the
+// last lane. Other users keep the scalar increment, i + 1 on every lane.
+// Returns the bumped increment.
+static Instruction*
+AdjustStride(Loop& loop, PHINode& phi, uint vectorWidth)
 {
-    for (uint i = 0; i < phi.getNumIncomingValues(); ++i)
+    auto* latch = loop.getLoopLatch();
+    auto* increment = dyn_cast<BinaryOperator>(phi.getIncomingValueForBlock(latch));
+    assert(increment && increment->getOpcode() == Instruction::Add);
+
+    uint constPos = isa<Constant>(increment->getOperand(1)) ? 1 : 0;
+    auto* incStep = cast<ConstantInt>(increment->getOperand(constPos));
+    assert(incStep->getLimitedValue() == 1);
+    auto* vectorIncStep = ConstantInt::getSigned(incStep->getType(), vectorWidth);
+
+    auto* vectorIncrement = BinaryOperator::CreateAdd(&phi, vectorIncStep, "iv.vec.next");
+    vectorIncrement->insertAfter(increment);
+    phi.setIncomingValue(phi.getBasicBlockIndex(latch), vectorIncrement);
+
+    auto* cmp = dyn_cast<ICmpInst>(cast<BranchInst>(latch->getTerminator())->getCondition());
+    if (cmp)
     {
-        if (!loop.contains(phi.getIncomingBlock(i)))
+        for (uint i = 0; i < cmp->getNumOperands(); ++i)
         {
-            return phi.getIncomingValue(i);
+            if (cmp->getOperand(i) == increment) cmp->setOperand(i, vectorIncrement);
         }
     }
-    return nullptr;
+
+    return vectorIncrement;
 }
 
-static bool
-AdjustStride(Loop& loop, PHINode& phi, uint vectorWidth)
+static Function&
+RequestAnyFunction(Module& mod)
 {
-    Instruction* increment = nullptr;
-    for (uint i = 0; i < phi.getNumIncomingValues(); ++i)
+    auto* func = mod.getFunction("rv_any");
+    if (func) return *func;
+
+    auto* boolTy = Type::getInt1Ty(mod.getContext());
+    auto* funcTy = FunctionType::get(boolTy, boolTy, false);
+    func = Function::Create(funcTy, GlobalValue::ExternalLinkage, "rv_any", &mod);
+    func->setDoesNotAccessMemory();
+    func->setDoesNotThrow();
+    func->setConvergent();
+    return *func;
+}
+
+// Ask the linearizer for BOSCC checks on all conditional branches of @func (see
+// CFGLinearizer::collectBOSCCRegions). Uniform branches ignore the request.
+static void
+MarkBOSCCBranches(Function& func)
+{
+    rv::setUpMetadata(func.getParent());
+    for (auto& block : func)
     {
-        auto* inVal = phi.getIncomingValue(i);
-        auto* inInst = dyn_cast<Instruction>(inVal);
-        if (!inInst || !loop.contains(inInst->getParent()))
-        {
-            continue;
-        }
-        if (!inInst || (inInst->getOpcode() != Instruction::Add))
-        { continue; }
-        increment = inInst;
-        break;
+        auto* branch = dyn_cast<BranchInst>(block.getTerminator());
+        if (branch && branch->isConditional()) rv::setMetadata(branch, rv::RV_METADATA_VARIANT_BOSCC);
     }
+}
 
-    // bump up loop increment to vector width
-    assert(increment);
-    uint constPos = isa<Constant>(increment->getOperand(1)) ? 1 : 0;
-    auto* incStep = cast<ConstantInt>(increment->getOperand(constPos));
-    assert(incStep->getLimitedValue() == 1);
-    auto* vectorIncStep = ConstantInt::getSigned(incStep->getType(), vectorWidth);
-    increment->setOperand(constPos, vectorIncStep);
+// Ask for a uniform and a varying version of the regions of all conditional branches
+// of @func (see DynamicVariantGenerator). Uniform branches ignore the request.
+static void
+MarkVariantBranches(Function& func)
+{
+    rv::setUpMetadata(func.getParent());
+    for (auto& block : func)
+    {
+        auto* branch = dyn_cast<BranchInst>(block.getTerminator());
+        if (branch && branch->isConditional()) rv::setMetadata(branch, rv::RV_METADATA_VARIANT_START);
+    }
+}
 
-    return true;
+// Clone the regions of varying branches with variant_start metadata into a uniform
+// and a varying version, before masks are computed for them.
+static void
+GenerateDynamicVariants(Function& func, VectorizationInfo& vecInfo, rv::AnalysisCache& analyses)
+{
+    DynamicVariantGenerator variantGenerator(vecInfo,
+                                             analyses.getDomTree(),
+                                             analyses.getPostDomTree(),
+                                             analyses.getLoopInfo());
+    if (!variantGenerator.run(func)) return;
+
+    errs() << "Created dynamic variants of " << variantGenerator.getNumVariants() << " regions\n";
+    analyses.invalidate(rv::AnalysisCache::PreservedAnalyses::none().preserve(rv::AnalysisCache::Loops));
+}
+
+// Live values and masks times the instructions they are live across, for the structural
+// order of the branch sides and the order the linearizer chose
+static void
+PrintScheduleStatistics(const rv::ScheduleStatistics& stats)
+{
+    if (!stats.numBranches) return;
+
+    errs() << "Ordered the sides of " << stats.numBranches << " branches (" << stats.numReordered
+           << " reordered): live values x insts " << stats.structuralValueCost << " -> "
+           << stats.scheduledValueCost << ", live masks x insts " << stats.structuralMaskCost
+           << " -> " << stats.scheduledMaskCost << "\n";
+}
+
+// Work of the PDA fixpoint iteration
+static void
+PrintAnalysisStatistics(const rv::PDA::Statistics& stats)
+{
+    errs() << "PDA: " << stats.numIterations << " iterations, " << stats.numEvaluations
+           << " evaluations (" << stats.numReevaluations << " repeated), "
+           << stats.numPrivatizedAllocas << " privatized allocas\n";
+}
+
+// And, or and not operations of the mask graph before and after its simplification
+static void
+PrintMaskStatistics(const MaskAnalysis::Statistics& stats)
+{
+    errs() << "Simplified " << stats.numOperationsBefore << " mask operations to "
+           << stats.numOperationsAfter << "\n";
+}
+
+// Turn a data-dependent loop exit into a uniform branch that leaves the loop
+// as soon as any lane takes it. The exit target becomes the "true" successor,
+// the vector backend then recovers the exiting lane from the ballot of the
+// rv_any argument. Exit tests nested in divergent control only count for the
+// lanes that reach them: the backend ANDs the rv_any argument and the ballot
+// with the mask of the exiting block.
+static void
+LowerEarlyExit(Loop& loop, BasicBlock& exitingBlock, Function& anyFn, VectorizationInfo& vecInfo)
+{
+    auto* branch = cast<BranchInst>(exitingBlock.getTerminator());
+    assert(branch->isConditional());
+
+    Value* exitCond = branch->getCondition();
+    if (loop.contains(branch->getSuccessor(0)))
+    {
+        exitCond = BinaryOperator::CreateNot(exitCond, "exit.cond", branch);
+        branch->swapSuccessors();
+    }
+
+    auto* anyExit = CallInst::Create(&anyFn, exitCond, "any.exit", branch);
+    branch->setCondition(anyExit);
+
+    vecInfo.setVectorShape(*anyExit, rv::VectorShape::uni());
+    vecInfo.setVectorShape(*branch, rv::VectorShape::uni());
+}
+
+// Every lane accumulates its own iterations of a reduction, starting at the identity of the
+// update operation. The vector backend combines the lanes of the live-out (see
+// NatBuilder::repairOutsideUses), the initial value is folded in again in the exit block.
+static void
+PrepareReductions(Loop& loop, PHINode& xPhi)
+{
+    auto* preheader = loop.getLoopPreheader();
+    auto* latch = loop.getLoopLatch();
+    auto* exitBlock = loop.getExitBlock();
+    assert(exitBlock && "reductions in loops with early exits are not supported");
+
+    for (auto& inst : *loop.getHeader())
+    {
+        auto* phi = dyn_cast<PHINode>(&inst);
+        if (!phi) break;
+        if (phi == &xPhi) continue;
+
+        unsigned opcode = rv::getReductionOpcode(loop, *phi);
+        if (!opcode) continue;
+
+        Value* init = phi->getIncomingValueForBlock(preheader);
+        Constant* identity = rv::getReductionIdentity(opcode, phi->getType());
+        if (init == identity) continue;
+
+        phi->setIncomingValue(phi->getBasicBlockIndex(preheader), identity);
+
+        auto* update = cast<Instruction>(phi->getIncomingValueForBlock(latch));
+        for (auto& exitInst : *exitBlock)
+        {
+            auto* lcssaPhi = dyn_cast<PHINode>(&exitInst);
+            if (!lcssaPhi) break;
+            if (lcssaPhi->getIncomingValueForBlock(latch) != update) continue;
+
+            SmallVector<User*, 4> users(lcssaPhi->user_begin(), lcssaPhi->user_end());
+            auto* result = BinaryOperator::Create((Instruction::BinaryOps) opcode, lcssaPhi, init,
+                                                  update->getName() + ".init",
+                                                  &*exitBlock->getFirstInsertionPt());
+            result->copyIRFlags(update);
+            for (auto* user : users)
+            {
+                user->replaceUsesOfWith(lcssaPhi, result);
+            }
+        }
+    }
 }
 
 void
-vectorizeLoop(Function& parentFn, Loop& loop, uint vectorWidth, LoopInfo& loopInfo, DFG& dfg,
-              CDG& cdg, DominatorTree& domTree, PostDominatorTree& postDomTree)
+vectorizeLoop(Function& parentFn, Loop& loop, uint vectorWidth, rv::AnalysisCache& analyses,
+              bool refilled, bool preserveSSA)
 {
     // assert: function is already normalized
 
     Module& mod = *parentFn.getParent();
+
+    // the latch holds the exit of the "++i" loop, all other exits are data-dependent
+    auto* latch = loop.getLoopLatch();
+    assert(latch && loop.isLoopExiting(latch) && "latch does not exit the loop!");
+
+    SmallVector<BasicBlock*, 4> exitingBlocks;
+    loop.getExitingBlocks(exitingBlocks);
+    SmallVector<BasicBlock*, 4> earlyExits;
+    for (auto* exiting : exitingBlocks)
+    {
+        if (exiting == latch) continue;
+        auto* branch = dyn_cast<BranchInst>(exiting->getTerminator());
+        if (!branch || !branch->isConditional())
+        {
+            errs() << "Unsupported loop exit in " << exiting->getName() << "\n";
+            return;
+        }
+        earlyExits.push_back(exiting);
+    }
+
+    std::string reason;
+    if (!rv::canVectorizeEarlyExits(loop, earlyExits, reason))
+    {
+        errs() << "Can not vectorize early exit " << earlyExits[0]->getName() << " because of " << reason << "\n";
+        return;
+    }
+
     auto* rvInfo = new rv::RVInfo(&mod,
                                   &mod.getContext(),
                                   &parentFn,
@@ -143,43 +330,71 @@ vectorizeLoop(Function& parentFn, Loop& loop, uint vectorWidth, LoopInfo& loopIn
     // configure initial shape for induction variable
     auto* header = loop.getHeader();
     PHINode* xPhi = cast<PHINode>(&*header->begin());
-    auto* xPhiInit = GetInitValue(loop, *xPhi);
     errs() << "Vectorizing loop with induction variable " << *xPhi << "\n";
-    vecInfo.setVectorShape(*xPhi, rv::VectorShape::strided(1, vectorWidth));
-    vecInfo.setVectorShape(*xPhiInit, rv::VectorShape::strided(1, vectorWidth));
+
+    // refilled lanes fetch their iterations themselves (see LaneRefiller)
+    if (!refilled)
+    {
+        auto* xPhiInit = rv::getLoopInitValue(loop, *xPhi);
+        vecInfo.setVectorShape(*xPhi, rv::VectorShape::strided(1, vectorWidth));
+        vecInfo.setVectorShape(*xPhiInit, rv::VectorShape::strided(1, vectorWidth));
+    }
 
     // configure exit condition to be non-divergent in any case
-    auto* exitBlock = loop.getExitingBlock();
-    assert(exitBlock && "does not have a unique exit block!");
-    vecInfo.setVectorShape(*exitBlock->getTerminator(), rv::VectorShape::uni());
-    vecInfo.setVectorShape(*cast<BranchInst>(exitBlock->getTerminator())->getOperand(0),
+    vecInfo.setVectorShape(*latch->getTerminator(), rv::VectorShape::uni());
+    vecInfo.setVectorShape(*cast<BranchInst>(latch->getTerminator())->getOperand(0),
                            rv::VectorShape::uni());
 
-    bool matched = AdjustStride(loop, *xPhi, vectorWidth);
-    assert(matched && "could not match ++i loop pattern");
+    // leave the loop on data-dependent exits once any lane takes them
+    for (auto* exiting : earlyExits)
+    {
+        LowerEarlyExit(loop, *exiting, RequestAnyFunction(mod), vecInfo);
+    }
+
+    if (earlyExits.empty())
+    {
+        PrepareReductions(loop, *xPhi);
+    }
+
+    if (!refilled)
+    {
+        auto* vectorIncrement = AdjustStride(loop, *xPhi, vectorWidth);
+        vecInfo.setVectorShape(*vectorIncrement, rv::VectorShape::uni());
+    }
 
     rv::VectorizerInterface vectorizer(*rvInfo, &parentFn);
 
     // vectorizationAnalysis
-    vectorizer.analyze(vecInfo, cdg, dfg, loopInfo, postDomTree, domTree);
+    vectorizer.analyze(vecInfo, analyses);
+    PrintAnalysisStatistics(vectorizer.getAnalysisStatistics());
+
+    // move invariant uniform values to the preheader and uniform live-outs to the exit block
+    UniformHoister hoister(vecInfo);
+    if (hoister.run(loop))
+    {
+        errs() << "Hoisted " << hoister.getNumHoisted() << " and sunk " << hoister.getNumSunk()
+               << " uniform instructions\n";
+    }
+
+    GenerateDynamicVariants(parentFn, vecInfo, analyses);
 
     // mask analysis
-    MaskAnalysis* maskAnalysis = vectorizer.analyzeMasks(vecInfo, loopInfo);
+    MaskAnalysis* maskAnalysis = vectorizer.analyzeMasks(vecInfo, analyses);
     assert(maskAnalysis);
     maskAnalysis->print(errs(), &mod);
+    PrintMaskStatistics(maskAnalysis->getStatistics());
 
     // mask generator
-    bool genMaskOk = vectorizer.generateMasks(vecInfo, *maskAnalysis, loopInfo);
+    bool genMaskOk = vectorizer.generateMasks(vecInfo, *maskAnalysis, analyses);
     assert(genMaskOk);
 
     // control conversion
-    bool linearizeOk = vectorizer.linearizeCFG(vecInfo, *maskAnalysis, loopInfo, postDomTree,
-                                               domTree);
+    bool linearizeOk = vectorizer.linearizeCFG(vecInfo, *maskAnalysis, analyses, preserveSSA);
     assert(linearizeOk);
+    PrintScheduleStatistics(vectorizer.getScheduleStatistics());
 
-    const DominatorTree domTreeNew(*vecInfo.getMapping()
-                                           .scalarFn); // Control conversion does not preserve the domTree so we have to rebuild it for now
-    bool vectorizeOk = vectorizer.vectorize(vecInfo, domTreeNew);
+    // control conversion keeps the dominator tree up to date
+    bool vectorizeOk = vectorizer.vectorize(vecInfo, analyses);
     assert(vectorizeOk);
 
     // cleanup
@@ -189,49 +404,123 @@ vectorizeLoop(Function& parentFn, Loop& loop, uint vectorWidth, LoopInfo& loopIn
     delete rvInfo;
 }
 
+// Replicate the vector body of the loop at @header @interleaveFactor times (0 = choose automatically)
+static void
+interleaveLoop(Function& parentFn, BasicBlock& header, uint vectorWidth, uint interleaveFactor,
+               rv::AnalysisCache& analyses)
+{
+    auto& loop = *analyses.getLoopInfo().getLoopFor(&header);
+    PHINode* xPhi = cast<PHINode>(&*header.begin());
+
+    LoopInterleaver interleaver(vectorWidth);
+    uint64_t tripCount = rv::getConstantTripCount(loop, *xPhi);
+    // an unknown trip count is only assumed to be a multiple of the vector width,
+    // the interleaved loop has no remainder for the last vector iterations
+    if (!tripCount)
+    {
+        if (interleaveFactor > 1)
+        {
+            errs() << "Can not interleave loop " << header.getName() << " " << interleaveFactor
+                   << " times: unknown trip count\n";
+        }
+        return;
+    }
+
+    if (interleaveFactor == 0)
+    {
+        interleaveFactor = interleaver.computeInterleaveFactor(loop, *xPhi);
+    }
+
+    // keep the trip count a multiple of the interleaved vector width
+    while (interleaveFactor > 1 && tripCount % (interleaveFactor * vectorWidth))
+    {
+        interleaveFactor /= 2;
+    }
+
+    if (interleaveFactor <= 1)
+    {
+        return;
+    }
+
+    if (interleaver.interleave(loop, *xPhi, interleaveFactor))
+    {
+        errs() << "Interleaving " << interleaveFactor << " vector iterations per loop trip\n";
+        analyses.invalidateAll();
+    }
+    else
+    {
+        errs() << "Could not interleave loop " << header.getName() << "\n";
+    }
+}
+
+// Run the loop at @header in lane-refill mode if it has an inner loop.
+// Returns true if the loop was transformed.
+static bool
+refillLoop(Function& parentFn, BasicBlock& header, rv::AnalysisCache& analyses)
+{
+    auto& loop = *analyses.getLoopInfo().getLoopFor(&header);
+    if (loop.getSubLoops().empty())
+    {
+        return false;
+    }
+
+    PHINode* xPhi = cast<PHINode>(&*header.begin());
+    LaneRefiller refiller;
+    std::string reason;
+    if (!refiller.canRefill(loop, *xPhi, reason))
+    {
+        errs() << "Can not refill lanes of loop " << header.getName() << ": " << reason << "\n";
+        return false;
+    }
+
+    refiller.refill(loop, *xPhi);
+    analyses.invalidateAll();
+    errs() << "Refilling lanes of loop " << header.getName() << " from its outer iterations\n";
+    return true;
+}
+
 // Use case: Outer-loop Vectorizer
 void
-vectorizeFirstLoop(Function& parentFn, uint vectorWidth)
+vectorizeLoops(Function& parentFn, uint vectorWidth, uint interleaveFactor, int nestIdx, bool laneRefill,
+               bool preserveSSA)
 {
     // normalize
     normalizeFunction(parentFn);
 
-    // build Analysis
-    DominatorTree domTree(parentFn);
-    PostDominatorTree postDomTree;
-    postDomTree.runOnFunction(parentFn);
-    LoopInfo loopInfo(domTree);
-
-    // Dominance Frontier Graph
-    DFG dfg(domTree);
-    dfg.create(parentFn);
-
-    // Control Dependence Graph
-    CDG cdg(*postDomTree.DT);
-    cdg.create(parentFn);
+    rv::AnalysisCache analyses(parentFn);
 
-    // normalize loop exits
-    LoopExitCanonicalizer canonicalizer(loopInfo);
-    canonicalizer.canonicalize(parentFn);
+    // The selected loops are disjoint, vectorizing one of them leaves the headers of the others intact.
+    rv::LoopSelection selection(parentFn, vectorWidth, analyses);
+    std::vector<BasicBlock*> selectedHeaders = selection.selectLoops(nestIdx);
+    selection.print(errs());
 
-    if (loopInfo.begin() == loopInfo.end())
+    for (auto* header : selectedHeaders)
     {
-        return;
-    }
+        // lane refill or vector unroll (both invalidate all analyses)
+        bool refilled = laneRefill && refillLoop(parentFn, *header, analyses);
+        if (!refilled)
+        {
+            interleaveLoop(parentFn, *header, vectorWidth, interleaveFactor, analyses);
+        }
 
-    auto* firstLoop = *loopInfo.begin();
+        // normalize loop exits, this updates the loop info but not the trees
+        LoopExitCanonicalizer canonicalizer(analyses.getLoopInfo());
+        canonicalizer.canonicalize(parentFn);
+        analyses.invalidate(rv::AnalysisCache::PreservedAnalyses::none().preserve(rv::AnalysisCache::Loops));
 
-    vectorizeLoop(parentFn, *firstLoop, vectorWidth, loopInfo, dfg, cdg, domTree, postDomTree);
+        auto* loop = analyses.getLoopInfo().getLoopFor(header);
+        assert(loop && loop->getHeader() == header);
 
-    // mark region
-    // run RV
-    // replace stride
+        vectorizeLoop(parentFn, *loop, vectorWidth, analyses, refilled, preserveSSA);
+    }
+
+    analyses.print(errs());
 }
 
 
 // Use case: Whole-Function Vectorizer
 void
-vectorizeFunction(rv::VectorMapping& vectorizerJob)
+vectorizeFunction(rv::VectorMapping& vectorizerJob, bool preserveSSA)
 {
     Function* scalarFn = vectorizerJob.scalarFn;
     Function* vectorFn = vectorizerJob.vectorFn;
@@ -281,49 +570,43 @@ vectorizeFunction(rv::VectorMapping& vectorizerJob)
     rvInfo->addCommonMappings(useSSE, useSSE41, useSSE42, useAVX, useNEON);
 #endif
 
-    // build Analysis
-    const DominatorTree domTree(*scalarCopy);
-    PostDominatorTree postDomTree;
-    postDomTree.runOnFunction(*scalarCopy);
-    LoopInfo loopInfo(domTree);
-
-    // Dominance Frontier Graph
-    DFG dfg(domTree);
-    dfg.create(*scalarCopy);
-
-    // Control Dependence Graph
-    CDG cdg(*postDomTree.DT);
-    cdg.create(*scalarCopy);
+    // analyses are built on demand
+    rv::AnalysisCache analyses(*scalarCopy);
 
-    // normalize loop exits
-    LoopExitCanonicalizer canonicalizer(loopInfo);
+    // normalize loop exits, this updates the loop info but not the trees
+    LoopExitCanonicalizer canonicalizer(analyses.getLoopInfo());
     canonicalizer.canonicalize(*scalarCopy);
+    analyses.invalidate(rv::AnalysisCache::PreservedAnalyses::none().preserve(rv::AnalysisCache::Loops));
 
     // vectorizationAnalysis
-    vectorizer.analyze(vecInfo, cdg, dfg, loopInfo, postDomTree, domTree);
+    vectorizer.analyze(vecInfo, analyses);
+    PrintAnalysisStatistics(vectorizer.getAnalysisStatistics());
+
+    GenerateDynamicVariants(*scalarCopy, vecInfo, analyses);
 
     // mask analysis
-    MaskAnalysis* maskAnalysis = vectorizer.analyzeMasks(vecInfo, loopInfo);
+    MaskAnalysis* maskAnalysis = vectorizer.analyzeMasks(vecInfo, analyses);
     assert(maskAnalysis);
+    PrintMaskStatistics(maskAnalysis->getStatistics());
 
     // mask generator
-    bool genMaskOk = vectorizer.generateMasks(vecInfo, *maskAnalysis, loopInfo);
+    bool genMaskOk = vectorizer.generateMasks(vecInfo, *maskAnalysis, analyses);
     assert(genMaskOk);
 
     // control conversion
-    bool linearizeOk = vectorizer.linearizeCFG(vecInfo, *maskAnalysis, loopInfo, postDomTree,
-                                               domTree);
+    bool linearizeOk = vectorizer.linearizeCFG(vecInfo, *maskAnalysis, analyses, preserveSSA);
     assert(linearizeOk);
+    PrintScheduleStatistics(vectorizer.getScheduleStatistics());
 
-    const DominatorTree domTreeNew(*vecInfo.getMapping()
-                                           .scalarFn); // Control conversion does not preserve the domTree so we have to rebuild it for now
-    bool vectorizeOk = vectorizer.vectorize(vecInfo, domTreeNew);
+    bool vectorizeOk = vectorizer.vectorize(vecInfo, analyses);
     assert(vectorizeOk);
 
     // cleanup
     vectorizer.finalize();
+    analyses.print(errs());
 
     delete maskAnalysis;
+    analyses.invalidateAll();
     scalarCopy->eraseFromParent();
 }
 
@@ -432,11 +715,12 @@ int main(int argc, char** argv)
 
     bool onlyAnalyze = reader.hasOption("--analyze");
 
-    if (!(hasFile && hasKernelName))
+    // loop vectorization without a kernel name handles all functions of the module
+    if (!(hasFile && (hasKernelName || loopVecMode)))
     {
         std::cerr << "Not all arguments specified -wfv/-loopvec) "
                   << "-i MODULE -k KERNELNAME [-target TARGET_DECL]"
-                  << "[-o OUTPUT_LL] [-w 8] [--vectorize] [--analyze\n";
+                  << "[-o OUTPUT_LL] [-w 8] [-l LOOPNEST] [-interleave 0] [--refill] [--ssa] [--boscc] [--variants] [--vectorize] [--analyze\n";
         return -1;
     }
 
@@ -448,8 +732,8 @@ int main(int argc, char** argv)
         errs() << "Could not load module " << inFile << ". Aborting!\n";
         return 1;
     }
-    llvm::Function* scalarFn = mod->getFunction(kernelName);
-    if (!scalarFn)
+    llvm::Function* scalarFn = hasKernelName ? mod->getFunction(kernelName) : nullptr;
+    if (hasKernelName && !scalarFn)
     {
         return 2;
     }
@@ -461,7 +745,7 @@ int main(int argc, char** argv)
     rv::VectorShape resShape;
     rv::VectorShapeVec argShapes;
     std::string shapeText;
-    if (reader.readOption<std::string>("-s", shapeText))
+    if (scalarFn && reader.readOption<std::string>("-s", shapeText))
     {
         uint i = 0;
         for (auto& it : scalarFn->getArgumentList())
@@ -481,7 +765,7 @@ int main(int argc, char** argv)
         }
 
     }
-    else
+    else if (scalarFn)
     {
         for (auto& it : scalarFn->getArgumentList())
         {
@@ -491,6 +775,33 @@ int main(int argc, char** argv)
 
     uint vectorWidth = reader.getOption<uint>("-w", 8);
 
+    // 0 lets the loop interleaver decide, 1 disables interleaving
+    uint interleaveFactor = reader.getOption<uint>("-interleave", 0);
+
+    // outer loops with inner loops keep their lanes busy by fetching new iterations
+    bool laneRefill = reader.hasOption("--refill");
+
+    // linearize without the reg2mem/mem2reg round trip
+    bool preserveSSA = reader.hasOption("--ssa");
+
+    // skip the sides of all varying branches if no lane takes them
+    if (reader.hasOption("--boscc"))
+    {
+        for (auto& func : *mod)
+        {
+            if (!func.isDeclaration() && (!scalarFn || &func == scalarFn)) MarkBOSCCBranches(func);
+        }
+    }
+
+    // run coherent vectors through an unmasked copy of the regions of varying branches
+    if (reader.hasOption("--variants"))
+    {
+        for (auto& func : *mod)
+        {
+            if (!func.isDeclaration() && (!scalarFn || &func == scalarFn)) MarkVariantBranches(func);
+        }
+    }
+
     if (wfvMode)
     {
 
@@ -523,12 +834,31 @@ int main(int argc, char** argv)
         errs() << "\nVectorizing kernel \"" << vectorizerJob.scalarFn->getName()
                << "\" into declaration \"" << vectorizerJob.vectorFn->getName()
                << "\" with vector size " << vectorizerJob.vectorWidth << "... \n";
-        vectorizeFunction(vectorizerJob);
+        vectorizeFunction(vectorizerJob, preserveSSA);
 
     }
     else if (loopVecMode)
     {
-        vectorizeFirstLoop(*scalarFn, vectorWidth);
+        // restrict the selection to a single loop nest (in program order)
+        int nestIdx = reader.getOption<int>("-l", -1);
+
+        if (scalarFn)
+        {
+            vectorizeLoops(*scalarFn, vectorWidth, interleaveFactor, nestIdx, laneRefill, preserveSSA);
+        }
+        else
+        {
+            // vectorization adds helper functions to the module
+            std::vector<Function*> kernels;
+            for (auto& func : *mod)
+            {
+                if (!func.isDeclaration()) kernels.push_back(&func);
+            }
+            for (auto* kernel : kernels)
+            {
+                vectorizeLoops(*kernel, vectorWidth, interleaveFactor, nestIdx, laneRefill, preserveSSA);
+            }
+        }
     }
 
     //output